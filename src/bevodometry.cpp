@@ -0,0 +1,208 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "bevodometry.h"
+
+#include <math.h>
+#include <float.h>
+
+namespace voxel_odometry {
+
+BevOdometry::BevOdometry(const double & resolution, const uint32_t & angleBins, const double & minResponse) :
+                            m_resolution(resolution), m_angleBins(angleBins), m_minResponse(minResponse)
+{
+    m_minX = m_maxX = m_minY = m_maxY = 0.0f;
+    m_rotationResponse = m_translationResponse = 0.0;
+}
+
+void BevOdometry::setGridGeometry(const float & minX, const float & maxX, const float & minY, const float & maxY)
+{
+    if ((minX == m_minX) && (maxX == m_maxX) && (minY == m_minY) && (maxY == m_maxY))
+        return;
+
+    m_minX = minX;
+    m_maxX = maxX;
+    m_minY = minY;
+    m_maxY = maxY;
+
+    m_size = cv::Size(cv::getOptimalDFTSize(ceil((m_maxX - m_minX) / m_resolution)),
+                      cv::getOptimalDFTSize(ceil((m_maxY - m_minY) / m_resolution)));
+
+    cv::createHanningWindow(m_window, m_size, CV_32F);
+
+    // Log-polar sampling of the (not shifted) spectrum. Just angles in [0, pi) are needed,
+    // since the magnitude spectrum of a real image is symmetric.
+    const uint32_t radiusBins = std::min(m_size.width, m_size.height) / 2;
+    const float maxRadius = radiusBins;
+    const float logBase = log(maxRadius) / radiusBins;
+    m_logPolarMapX.create(m_angleBins, radiusBins, CV_32F);
+    m_logPolarMapY.create(m_angleBins, radiusBins, CV_32F);
+    for (uint32_t a = 0; a < m_angleBins; a++) {
+        const float angle = a * CV_PI / m_angleBins;
+        float * mapX = m_logPolarMapX.ptr<float>(a);
+        float * mapY = m_logPolarMapY.ptr<float>(a);
+        for (uint32_t r = 0; r < radiusBins; r++) {
+            const float radius = exp(r * logBase);
+            // Negative frequencies are wrapped by the remap border
+            mapX[r] = radius * cos(angle);
+            mapY[r] = radius * sin(angle);
+        }
+    }
+
+    // The previous frame is not valid anymore
+    m_lastDft.release();
+    m_lastLogPolarDft.release();
+}
+
+void BevOdometry::project(const CentroidList & centroids, const double & yaw, cv::Mat & image) const
+{
+    image = cv::Mat::zeros(m_size, CV_32F);
+
+    const float cosYaw = cos(yaw);
+    const float sinYaw = sin(yaw);
+    for (uint32_t i = 0; i < centroids.size(); i++) {
+        const Eigen::Vector3f & point = centroids[i];
+        const float x = cosYaw * point[0] - sinYaw * point[1];
+        const float y = sinYaw * point[0] + cosYaw * point[1];
+
+        const int32_t col = floor((x - m_minX) / m_resolution);
+        const int32_t row = floor((y - m_minY) / m_resolution);
+
+        if ((col >= 0) && (col < m_size.width) && (row >= 0) && (row < m_size.height))
+            image.at<float>(row, col) += 1.0f;
+    }
+}
+
+void BevOdometry::spectrum(const cv::Mat & image, cv::Mat & dft) const
+{
+    cv::Mat windowed;
+    cv::multiply(image, m_window, windowed);
+    cv::dft(windowed, dft, cv::DFT_COMPLEX_OUTPUT);
+}
+
+void BevOdometry::logPolarMagnitude(const cv::Mat & dft, cv::Mat & logPolar) const
+{
+    cv::Mat planes[2];
+    cv::split(dft, planes);
+
+    cv::Mat magnitude;
+    cv::magnitude(planes[0], planes[1], magnitude);
+    magnitude += cv::Scalar::all(1.0);
+    cv::log(magnitude, magnitude);
+
+    cv::Mat resampled;
+    cv::remap(magnitude, resampled, m_logPolarMapX, m_logPolarMapY, cv::INTER_LINEAR, cv::BORDER_WRAP);
+
+    cv::dft(resampled, logPolar, cv::DFT_COMPLEX_OUTPUT);
+}
+
+/**
+ * Normalized cross power spectrum between two images.
+ * @return The response of the peak, and the shift d for which image2(x) = image1(x - d).
+ */
+double BevOdometry::phaseCorrelation(const cv::Mat & dft1, const cv::Mat & dft2, cv::Point2d & shift) const
+{
+    cv::Mat cross;
+    cv::mulSpectrums(dft2, dft1, cross, 0, true);
+
+    cv::Mat planes[2];
+    cv::split(cross, planes);
+    cv::Mat magnitude;
+    cv::magnitude(planes[0], planes[1], magnitude);
+    magnitude += cv::Scalar::all(FLT_EPSILON);
+    cv::divide(planes[0], magnitude, planes[0]);
+    cv::divide(planes[1], magnitude, planes[1]);
+    cv::merge(planes, 2, cross);
+
+    cv::Mat correlation;
+    cv::idft(cross, correlation, cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+
+    cv::Point peak;
+    double response;
+    cv::minMaxLoc(correlation, NULL, &response, NULL, &peak);
+
+    // Subpixel position, as the weighted centroid of the 3x3 neighbourhood (the correlation is circular)
+    double sumX = 0.0, sumY = 0.0, sumWeights = 0.0;
+    for (int32_t dy = -1; dy <= 1; dy++) {
+        for (int32_t dx = -1; dx <= 1; dx++) {
+            const int32_t row = (peak.y + dy + correlation.rows) % correlation.rows;
+            const int32_t col = (peak.x + dx + correlation.cols) % correlation.cols;
+            const float & weight = correlation.at<float>(row, col);
+            if (weight <= 0.0f)
+                continue;
+            sumX += dx * weight;
+            sumY += dy * weight;
+            sumWeights += weight;
+        }
+    }
+
+    shift.x = peak.x + sumX / sumWeights;
+    shift.y = peak.y + sumY / sumWeights;
+    if (shift.x > correlation.cols / 2.0)
+        shift.x -= correlation.cols;
+    if (shift.y > correlation.rows / 2.0)
+        shift.y -= correlation.rows;
+
+    return response;
+}
+
+/**
+ * Estimates the motion of the vehicle between the previous and the current frame.
+ * @param centroids: Centroids of the occupied voxels in the current frame.
+ * @param deltaTime: Time elapsed since the previous frame.
+ * @param motion: Motion of the vehicle frame, expressed in the previous frame.
+ * @return true if both correlation peaks are above the min response.
+ */
+bool BevOdometry::estimate(const CentroidList & centroids, const double & deltaTime, t_ego_motion & motion)
+{
+    motion.deltaX = motion.deltaY = motion.deltaYaw = 0.0;
+    motion.deltaTime = deltaTime;
+    motion.valid = false;
+
+    m_rotationResponse = m_translationResponse = 0.0;
+
+    cv::Mat image, dft, logPolarDft;
+    project(centroids, 0.0, image);
+    spectrum(image, dft);
+    logPolarMagnitude(dft, logPolarDft);
+
+    if (! m_lastDft.empty()) {
+        // |F_curr|(phi) = |F_prev|(phi + yaw), so the angular shift is -yaw
+        cv::Point2d rotationShift;
+        m_rotationResponse = phaseCorrelation(m_lastLogPolarDft, logPolarDft, rotationShift);
+        const double yaw = -rotationShift.y * CV_PI / m_angleBins;
+
+        // Once derotated, the current image is the previous one shifted by -translation
+        cv::Mat derotated, derotatedDft;
+        project(centroids, yaw, derotated);
+        spectrum(derotated, derotatedDft);
+
+        cv::Point2d translationShift;
+        m_translationResponse = phaseCorrelation(m_lastDft, derotatedDft, translationShift);
+
+        motion.deltaX = -translationShift.x * m_resolution;
+        motion.deltaY = -translationShift.y * m_resolution;
+        motion.deltaYaw = yaw;
+        motion.valid = (m_rotationResponse > m_minResponse) && (m_translationResponse > m_minResponse);
+    }
+
+    m_lastDft = dft;
+    m_lastLogPolarDft = logPolarDft;
+
+    return motion.valid;
+}
+
+}
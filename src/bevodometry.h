@@ -0,0 +1,73 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef BEVODOMETRY_H
+#define BEVODOMETRY_H
+
+#include "params_structs.h"
+#include "voxelregistration.h"
+
+#include <opencv2/opencv.hpp>
+
+namespace voxel_odometry {
+
+/**
+ * Ego-motion in SE(2) from the bird's eye view occupancy of two consecutive frames.
+ * The rotation is obtained by phase correlation of the log-polar resampled magnitude spectra
+ * (which are invariant to translation), and the translation by phase correlation between the
+ * previous image and the current one, once derotated. Except for the projection of the
+ * centroids, the cost just depends on the resolution of the BEV image.
+ */
+class BevOdometry
+{
+public:
+    BevOdometry(const double & resolution, const uint32_t & angleBins, const double & minResponse);
+
+    void setGridGeometry(const float & minX, const float & maxX, const float & minY, const float & maxY);
+
+    bool estimate(const CentroidList & centroids, const double & deltaTime, t_ego_motion & motion);
+
+    double rotationResponse() const { return m_rotationResponse; }
+    double translationResponse() const { return m_translationResponse; }
+
+protected:
+    void project(const CentroidList & centroids, const double & yaw, cv::Mat & image) const;
+    void spectrum(const cv::Mat & image, cv::Mat & dft) const;
+    void logPolarMagnitude(const cv::Mat & dft, cv::Mat & logPolar) const;
+    double phaseCorrelation(const cv::Mat & dft1, const cv::Mat & dft2, cv::Point2d & shift) const;
+
+    double m_resolution;
+    uint32_t m_angleBins;
+    double m_minResponse;
+
+    float m_minX, m_maxX, m_minY, m_maxY;
+    cv::Size m_size;
+
+    // Precomputed, just depending on the size of the image
+    cv::Mat m_window;
+    cv::Mat m_logPolarMapX, m_logPolarMapY;
+
+    // Previous frame
+    cv::Mat m_lastDft;
+    cv::Mat m_lastLogPolarDft;
+
+    double m_rotationResponse, m_translationResponse;
+};
+
+}
+
+#endif // BEVODOMETRY_H
@@ -0,0 +1,161 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef ENGINEPARAMS_H
+#define ENGINEPARAMS_H
+
+#include "voxelodometryengine.h"
+#include "logging.h"
+
+#include <math.h>
+#include <string>
+
+namespace voxel_odometry {
+
+/**
+ * Reads the params of the engine from anything with the param method of ros::NodeHandle 
+ * (the node, or a ParamFile offline), so all of them use the same names and defaults.
+ * @return false if a param is not valid. The reason is left in error.
+ */
+template <typename ParamSource>
+bool readEngineParams(const ParamSource & source, t_engine_params & params, std::string & error)
+{
+    double dummyDouble;
+    int dummyInteger;
+    
+    source.template param<bool>("use_oflow", params.useOFlow, false);
+    
+    source.template param<double>("cell_size_x", dummyDouble, 0.5);
+    params.cellSizeX = dummyDouble;
+    source.template param<double>("cell_size_y", dummyDouble, 0.5);
+    params.cellSizeY = dummyDouble;
+    source.template param<double>("cell_size_z", dummyDouble, 0.5);
+    params.cellSizeZ = dummyDouble;
+    
+    source.template param<int>("max_particles_number_per_voxel", dummyInteger, 30);
+    params.maxNumberOfParticles = dummyInteger;
+    source.template param<int>("num_threads", dummyInteger, 8);
+    params.threads = dummyInteger;
+    
+    source.template param<double>("max_vel_x", params.maxVelX, 2.0);
+    source.template param<double>("max_vel_y", params.maxVelY, 2.0);
+    source.template param<double>("max_vel_z", params.maxVelZ, 0.0);
+    source.template param<double>("min_vel_x", params.minVelX, 0.3);
+    source.template param<double>("min_vel_y", params.minVelY, 0.3);
+    source.template param<double>("min_vel_z", params.minVelZ, 0.0);
+    
+    source.template param<double>("yaw_interval", params.yawInterval, 1.0);
+    source.template param<double>("pitch_interval", params.pitchInterval, 1.0);
+    source.template param<double>("speed_factor", params.factorSpeed, 0.1);
+    
+    source.template param<double>("occupancy_prob_tresh", params.threshOccupancyProb, 0.5);
+    
+    std::string obstacleSpeedMethodStr;
+    source.template param<std::string>("obstacle_speed_method", obstacleSpeedMethodStr, SPEED_METHOD_CIRC_HIST_STR);
+    if (obstacleSpeedMethodStr == SPEED_METHOD_CIRC_HIST_STR) {
+        params.obstacleSpeedMethod = SPEED_METHOD_CIRC_HIST;
+    } else if (obstacleSpeedMethodStr == SPEED_METHOD_MEAN_STR) {
+        params.obstacleSpeedMethod = SPEED_METHOD_MEAN;
+    } else {
+        error = "\"" + obstacleSpeedMethodStr + "\" is not a valid obstacle speed computation method";
+        return false;
+    }
+    
+    source.template param<double>("random_particles_per_voxel", params.particlesPerVoxel, 100.0);
+    
+    // BEGIN: Just with flood_fill_segment
+    source.template param<double>("yaw_thresh_to_join_voxels", params.threshYaw, 90.0 * M_PI / 180.0);
+    source.template param<double>("pitch_thresh_to_join_voxels", params.threshPitch, 9999999.0);
+    source.template param<double>("magnitude_thresh_to_join_voxels", params.threshMagnitude, 9999999.0);
+    source.template param<double>("min_voxel_density", params.minVoxelDensity, 10.0);
+    // END: Just with use_flood_fill_segment
+    
+    // BEGIN: Just with original segmentation method
+    std::string voxelSpeedMethodStr;
+    source.template param<std::string>("voxel_speed_method", voxelSpeedMethodStr, SPEED_METHOD_CIRC_HIST_STR);
+    if (voxelSpeedMethodStr == SPEED_METHOD_CIRC_HIST_STR) {
+        params.speedMethod = SPEED_METHOD_CIRC_HIST;
+    } else if (voxelSpeedMethodStr == SPEED_METHOD_MEAN_STR) {
+        params.speedMethod = SPEED_METHOD_MEAN;
+    } else {
+        error = "\"" + voxelSpeedMethodStr + "\" is not a valid obstacle speed computation method";
+        return false;
+    }
+    // END: Just with original segmentation method
+    
+    std::string odometryMethodStr;
+    source.template param<std::string>("odometry_method", odometryMethodStr, ODOMETRY_METHOD_PARTICLES_STR);
+    if (odometryMethodStr == ODOMETRY_METHOD_PARTICLES_STR) {
+        params.odometryMethod = ODOMETRY_METHOD_PARTICLES;
+    } else if (odometryMethodStr == ODOMETRY_METHOD_REGISTRATION_STR) {
+        params.odometryMethod = ODOMETRY_METHOD_REGISTRATION;
+    } else if (odometryMethodStr == ODOMETRY_METHOD_BEV_STR) {
+        params.odometryMethod = ODOMETRY_METHOD_BEV;
+    } else {
+        error = "\"" + odometryMethodStr + "\" is not a valid odometry method";
+        return false;
+    }
+    
+    // BEGIN: Just with odometry_method_registration
+    std::string registrationMetricStr;
+    source.template param<std::string>("registration_metric", registrationMetricStr, REGISTRATION_POINT_TO_PLANE_STR);
+    if (registrationMetricStr == REGISTRATION_POINT_TO_POINT_STR) {
+        params.registrationMetric = REGISTRATION_POINT_TO_POINT;
+    } else if (registrationMetricStr == REGISTRATION_POINT_TO_PLANE_STR) {
+        params.registrationMetric = REGISTRATION_POINT_TO_PLANE;
+    } else {
+        error = "\"" + registrationMetricStr + "\" is not a valid registration metric";
+        return false;
+    }
+    
+    source.template param<int>("registration_max_iterations", dummyInteger, 10);
+    params.registrationMaxIterations = dummyInteger;
+    source.template param<int>("registration_min_correspondences", dummyInteger, 20);
+    params.registrationMinCorrespondences = dummyInteger;
+    source.template param<double>("registration_max_correspondence_distance", params.registrationMaxDistance, 1.0);
+    source.template param<double>("registration_translation_epsilon", params.registrationTranslationEps, 1e-3);
+    source.template param<double>("registration_rotation_epsilon", params.registrationRotationEps, 1e-4);
+    
+    source.template param<bool>("registration_bev_fallback", params.registrationBevFallback, false);
+    // END: Just with odometry_method_registration
+    
+    // BEGIN: Just with odometry_method_bev (or registration_bev_fallback)
+    source.template param<double>("bev_resolution", params.bevResolution, 0.25);
+    source.template param<int>("bev_angle_bins", dummyInteger, 360);
+    params.bevAngleBins = dummyInteger;
+    source.template param<double>("bev_min_response", params.bevMinResponse, 0.05);
+    // END: Just with odometry_method_bev
+    
+    source.template param<bool>("compensate_ego_motion", params.compensateEgoMotion, false);
+    if (params.compensateEgoMotion && (params.odometryMethod == ODOMETRY_METHOD_PARTICLES)) {
+        VO_LOG_WARN("compensate_ego_motion needs an ego-motion estimation, it is ignored with %s", 
+                    ODOMETRY_METHOD_PARTICLES_STR.c_str());
+        params.compensateEgoMotion = false;
+    }
+    
+    source.template param<bool>("input_from_cameras", params.inputFromCameras, true);
+    
+    // Wall time is always measured, CPU time just if asked for (it is more expensive)
+    source.template param<bool>("stage_cpu_time", params.stageCpuTime, false);
+    
+    return true;
+}
+
+}
+
+#endif // ENGINEPARAMS_H
@@ -0,0 +1,132 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef FRAMESNAPSHOT_H
+#define FRAMESNAPSHOT_H
+
+#include "timeutils.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace voxel_odometry {
+
+typedef struct {
+    float x, y, z;
+    float vx, vy, vz;
+    uint32_t age;
+    int32_t id;
+    uint32_t voxelIdx;                          // Position in FrameSnapshot::voxels
+} t_particle_record;
+
+typedef struct {
+    float centroidX, centroidY, centroidZ;
+    float vx, vy, vz, magnitude;
+    uint32_t x, y, z;                           // Position in the grid
+    uint32_t firstParticle, numParticles;       // Range in FrameSnapshot::particles
+    uint32_t firstOFlowParticle, numOFlowParticles;
+} t_voxel_record;
+
+typedef struct {
+    float x, y, z;
+} t_point_record;
+
+typedef struct {
+    float centerX, centerY, centerZ;
+    float minX, maxX, minY, maxY, minZ, maxZ;
+    float vx, vy, vz, magnitude;                // Direction (unit vector) and speed
+    float confidence;
+    uint32_t idx;
+    uint32_t firstVoxel, numVoxels;             // Range in FrameSnapshot::obstacleVoxels
+} t_obstacle_record;
+
+typedef struct {
+    double x, y, theta;
+    double vx, vy, vz, yawRate;
+    bool valid;
+} t_odometry_state;
+
+// Stages timed in each frame. STAGE_NAMES has to follow the same order.
+enum Stage { STAGE_GET_VOXEL_GRID_FROM_POINT_CLOUD = 0, STAGE_REGISTRATION, STAGE_UPDATE_FROM_OFLOW,
+             STAGE_GET_MEASUREMENT_MODEL, STAGE_EGO_MOTION_COMPENSATION, STAGE_PREDICTION, 
+             STAGE_MEASUREMENT_BASED_UPDATE, STAGE_SEGMENT, STAGE_UPDATE_SPEED_FROM_OBSTACLES, 
+             STAGE_INITIALIZATION, STAGE_TOTAL_COMPUTE, STAGE_TOTAL_VISUALIZATION, NUM_STAGES };
+const char * const STAGE_NAMES[NUM_STAGES] = { "getVoxelGridFromPointCloud", "registration", "updateFromOFlow",
+                                               "getMeasurementModel", "egoMotionCompensation", "prediction",
+                                               "measurementBasedUpdate", "segment", "updateSpeedFromObstacles",
+                                               "initialization", "totalCompute", "totalVisualization" };
+
+// Same fields as voxel_odometry/stats.msg (seconds, unless noted)
+typedef struct {
+    t_stage_time stages[NUM_STAGES];
+    
+    // Workload of the frame
+    uint32_t inputPoints;
+    uint32_t occupiedVoxels;
+    uint32_t liveParticles;                     // After the filter
+    uint32_t particlesBorn;
+    uint32_t particlesEvicted;                  // Predicted out of the occupied voxels
+    uint32_t obstacles;
+    
+    uint32_t ingestQueueSize;
+    double ingestQueueAge;
+    uint64_t ingestDropped;
+    uint64_t upstreamDropped;
+    double ingestRate;                          // Hz
+    
+    uint64_t posesExtrapolated;                 // So far
+    uint64_t posesStale;                        // So far (including unavailable ones)
+} t_frame_stats;
+
+/**
+ * Plain copy of the result of a frame, with everything the publishers need. Once filled
+ * it is not modified, so it can be published while the next frame is being computed.
+ * The vectors keep their capacity between frames.
+ */
+struct FrameSnapshot
+{
+    uint32_t id;
+    double stamp;                               // Seconds
+    double deltaTime;
+    uint32_t dimX, dimY, dimZ;
+
+    // Just filled if publish_intermediate_info
+    std::vector<t_voxel_record> voxels;
+    std::vector<t_particle_record> particles;
+    std::vector<t_particle_record> oFlowParticles;
+
+    std::vector<t_obstacle_record> obstacles;
+    std::vector<t_point_record> obstacleVoxels;
+
+    t_odometry_state odometry;
+
+    t_frame_stats timeStats;
+
+    void clear() {
+        voxels.clear();
+        particles.clear();
+        oFlowParticles.clear();
+        obstacles.clear();
+        obstacleVoxels.clear();
+        odometry.valid = false;
+        timeStats = t_frame_stats();
+    }
+};
+
+}
+
+#endif // FRAMESNAPSHOT_H
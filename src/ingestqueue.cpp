@@ -0,0 +1,122 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "ingestqueue.h"
+
+// Weight of the last interval in the processing rate
+#define RATE_SMOOTHING 0.1
+
+namespace voxel_odometry {
+
+IngestQueue::IngestQueue(const IngestPolicy & policy, const uint32_t & capacity, const double & maxAge) :
+                            m_policy(policy), m_maxAge(maxAge)
+{
+    m_capacity = (m_policy == INGEST_POLICY_LATEST_ONLY)? 1 : std::max(capacity, 1u);
+    
+    m_dropped = m_upstreamDropped = 0;
+    m_lastSeq = 0;
+    m_firstMsg = true;
+    m_rate = 0.0;
+    m_closed = false;
+}
+
+void IngestQueue::push(const sensor_msgs::PointCloud2::ConstPtr & msg)
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        
+        if ((! m_firstMsg) && (msg->header.seq > m_lastSeq + 1))
+            m_upstreamDropped += msg->header.seq - m_lastSeq - 1;
+        m_lastSeq = msg->header.seq;
+        m_firstMsg = false;
+        
+        t_queue_item item;
+        item.msg = msg;
+        item.arrival = ros::WallTime::now();
+        m_queue.push_back(item);
+        
+        while (m_queue.size() > m_capacity) {
+            m_queue.pop_front();
+            m_dropped++;
+        }
+    }
+    m_condition.notify_one();
+}
+
+/**
+ * Blocks until a cloud is available.
+ * @return false once the queue is closed
+ */
+bool IngestQueue::pop(sensor_msgs::PointCloud2::ConstPtr & msg, t_ingest_info & info)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_queue.empty() && (! m_closed))
+        m_condition.wait(lock);
+    
+    if (m_closed)
+        return false;
+    
+    const ros::WallTime now = ros::WallTime::now();
+    const ros::Time stampNow = ros::Time::now();
+    if (m_policy == INGEST_POLICY_SKIP_OLDER) {
+        while ((m_queue.size() > 1) && (age(m_queue.front(), stampNow, now) > m_maxAge)) {
+            m_queue.pop_front();
+            m_dropped++;
+        }
+    }
+    
+    msg = m_queue.front().msg;
+    info.queueAge = age(m_queue.front(), stampNow, now);
+    m_queue.pop_front();
+    
+    if (! m_lastPop.isZero()) {
+        const double interval = (now - m_lastPop).toSec();
+        if (interval > 0.0)
+            m_rate = (m_rate == 0.0)? 1.0 / interval : 
+                        RATE_SMOOTHING / interval + (1.0 - RATE_SMOOTHING) * m_rate;
+    }
+    m_lastPop = now;
+    
+    info.queueSize = m_queue.size();
+    info.dropped = m_dropped;
+    info.upstreamDropped = m_upstreamDropped;
+    info.rate = m_rate;
+    
+    return true;
+}
+
+/**
+ * Seconds since the cloud was captured, so the delays before the callback also count
+ */
+double IngestQueue::age(const t_queue_item & item, const ros::Time & now, const ros::WallTime & wallNow)
+{
+    if (item.msg->header.stamp.isZero())
+        return (wallNow - item.arrival).toSec();
+    
+    return (now - item.msg->header.stamp).toSec();
+}
+
+void IngestQueue::close()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_closed = true;
+    }
+    m_condition.notify_all();
+}
+
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef INGESTQUEUE_H
+#define INGESTQUEUE_H
+
+#include "params_structs.h"
+
+#include <deque>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace voxel_odometry {
+
+// State of the ingestion queue when a cloud is taken from it
+typedef struct {
+    uint32_t queueSize;             // Clouds still waiting
+    double queueAge;                // Seconds since header.stamp (since it arrived, if it has no stamp)
+    uint64_t dropped;               // Clouds dropped by the policy so far
+    uint64_t upstreamDropped;       // Gaps in header.seq: clouds lost before reaching the callback
+    double rate;                    // Effective processing rate (Hz)
+} t_ingest_info;
+
+/**
+ * Queue between the ROS callback and the thread that computes the frames. The callback
+ * never blocks; when clouds arrive faster than they are computed, the policy decides
+ * which ones are dropped:
+ * - process_all: all of them are computed, up to capacity waiting clouds (the oldest is dropped).
+ * - latest_only: just the last received cloud is kept.
+ * - skip_older: clouds older than maxAge (since their header.stamp) are dropped when taken, except the 
+ *   newest one. So the clouds that arrive late from upstream are dropped too.
+ */
+class IngestQueue
+{
+public:
+    IngestQueue(const IngestPolicy & policy, const uint32_t & capacity, const double & maxAge);
+
+    void push(const sensor_msgs::PointCloud2::ConstPtr & msg);
+    bool pop(sensor_msgs::PointCloud2::ConstPtr & msg, t_ingest_info & info);
+    void close();
+
+protected:
+    typedef struct {
+        sensor_msgs::PointCloud2::ConstPtr msg;
+        ros::WallTime arrival;      // Just used for the clouds without stamp
+    } t_queue_item;
+
+    static double age(const t_queue_item & item, const ros::Time & now, const ros::WallTime & wallNow);
+
+    IngestPolicy m_policy;
+    uint32_t m_capacity;
+    double m_maxAge;
+
+    std::deque<t_queue_item> m_queue;
+
+    uint64_t m_dropped, m_upstreamDropped;
+    uint32_t m_lastSeq;
+    bool m_firstMsg;
+    ros::WallTime m_lastPop;
+    double m_rate;
+
+    bool m_closed;
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+};
+
+}
+
+#endif // INGESTQUEUE_H
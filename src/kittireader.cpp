@@ -0,0 +1,236 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "kittireader.h"
+#include "logging.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+namespace voxel_odometry {
+
+KittiReader::KittiReader() : m_velodyne2Camera(Eigen::Affine3d::Identity())
+{
+    m_current.idx = m_next.idx = -1;
+}
+
+KittiReader::~KittiReader()
+{
+    unmap(m_current);
+    unmap(m_next);
+}
+
+bool KittiReader::isSequence(const std::string & path)
+{
+    return boost::filesystem::is_directory(boost::filesystem::path(path) / "velodyne");
+}
+
+bool KittiReader::open(const std::string & sequence, const std::string & posesFile, std::string & error)
+{
+    const boost::filesystem::path sequencePath(sequence);
+    const boost::filesystem::path velodynePath = sequencePath / "velodyne";
+    if (! boost::filesystem::is_directory(velodynePath)) {
+        error = velodynePath.string() + " is not a directory";
+        return false;
+    }
+    
+    boost::filesystem::directory_iterator end;
+    for (boost::filesystem::directory_iterator it(velodynePath); it != end; ++it) {
+        if (it->path().extension() == ".bin")
+            m_files.push_back(it->path().string());
+    }
+    // Names are the frame numbers, with leading zeros
+    std::sort(m_files.begin(), m_files.end());
+    if (m_files.empty()) {
+        error = "No .bin files in " + velodynePath.string();
+        return false;
+    }
+    
+    if (! loadTimes((sequencePath / "times.txt").string()))
+        VO_LOG_WARN("%s not found, 10 Hz assumed", (sequencePath / "times.txt").string().c_str());
+    
+    const boost::filesystem::path calibPath = sequencePath / "calib.txt";
+    if (boost::filesystem::exists(calibPath)) {
+        if (! loadCalibration(calibPath.string(), error))
+            return false;
+    } else {
+        VO_LOG_WARN("%s not found, the poses are used as the ones of the velodyne", calibPath.string().c_str());
+    }
+    
+    std::string posesPath = posesFile;
+    if (posesPath.empty() && boost::filesystem::exists(sequencePath / "poses.txt"))
+        posesPath = (sequencePath / "poses.txt").string();
+    if ((! posesPath.empty()) && (! loadPoses(posesPath, error)))
+        return false;
+    
+    return true;
+}
+
+bool KittiReader::frame(const uint32_t & idx, t_kitti_frame & frame)
+{
+    if (idx >= m_files.size())
+        return false;
+    
+    // Frames are usually read in order, so the prefetched one is the one requested
+    if (m_next.idx == (int32_t)idx) {
+        unmap(m_current);
+        m_current = m_next;
+        m_next.idx = -1;
+    } else if (m_current.idx != (int32_t)idx) {
+        unmap(m_current);
+        if (! map(idx, m_current))
+            return false;
+    }
+    madvise(m_current.data, m_current.size, MADV_SEQUENTIAL);
+    
+    // The pages of the next scan are read by the kernel while this one is processed
+    if ((idx + 1 < m_files.size()) && (m_next.idx != (int32_t)(idx + 1))) {
+        unmap(m_next);
+        if (map(idx + 1, m_next))
+            madvise(m_next.data, m_next.size, MADV_WILLNEED);
+    }
+    
+    frame.points = (const float *)m_current.data;
+    frame.numPoints = m_current.size / (KITTI_POINT_STRIDE * sizeof(float));
+    frame.stamp = (idx < m_stamps.size())? m_stamps[idx] : idx * 0.1;
+    frame.hasPose = (idx < m_poses.size());
+    frame.pose2Map = frame.hasPose? m_poses[idx] : Eigen::Affine3d::Identity();
+    
+    return true;
+}
+
+bool KittiReader::map(const uint32_t & idx, t_mapping & mapping)
+{
+    mapping.idx = -1;
+    
+    const int fd = ::open(m_files[idx].c_str(), O_RDONLY);
+    if (fd < 0) {
+        VO_LOG_ERROR("%s could not be opened", m_files[idx].c_str());
+        return false;
+    }
+    
+    struct stat fileStat;
+    if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size == 0)) {
+        VO_LOG_ERROR("%s is empty", m_files[idx].c_str());
+        close(fd);
+        return false;
+    }
+    
+    // The mapping keeps the file referenced after closing it
+    mapping.size = fileStat.st_size;
+    mapping.data = mmap(NULL, mapping.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping.data == MAP_FAILED) {
+        VO_LOG_ERROR("%s could not be mapped", m_files[idx].c_str());
+        return false;
+    }
+    mapping.idx = idx;
+    
+    return true;
+}
+
+void KittiReader::unmap(t_mapping & mapping)
+{
+    if (mapping.idx < 0)
+        return;
+    
+    munmap(mapping.data, mapping.size);
+    mapping.idx = -1;
+}
+
+bool KittiReader::loadTimes(const std::string & fileName)
+{
+    std::ifstream file(fileName.c_str());
+    if (! file.is_open())
+        return false;
+    
+    double stamp;
+    while (file >> stamp)
+        m_stamps.push_back(stamp);
+    
+    return true;
+}
+
+// Rows of a 3x4 matrix, as in the files of the KITTI devkit
+static bool parseMatrix(std::istream & stream, Eigen::Affine3d & transform)
+{
+    Eigen::Matrix<double, 3, 4> matrix;
+    for (uint32_t i = 0; i < 12; i++) {
+        if (! (stream >> matrix(i / 4, i % 4)))
+            return false;
+    }
+    
+    transform.matrix().topRows<3>() = matrix;
+    transform.matrix().row(3) << 0.0, 0.0, 0.0, 1.0;
+    
+    return true;
+}
+
+bool KittiReader::loadCalibration(const std::string & fileName, std::string & error)
+{
+    std::ifstream file(fileName.c_str());
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        std::string key;
+        stream >> key;
+        if ((key == "Tr:") && parseMatrix(stream, m_velodyne2Camera))
+            return true;
+    }
+    
+    error = "No Tr in " + fileName;
+    return false;
+}
+
+bool KittiReader::loadPoses(const std::string & fileName, std::string & error)
+{
+    std::ifstream file(fileName.c_str());
+    if (! file.is_open()) {
+        error = fileName + " could not be read";
+        return false;
+    }
+    
+    // KITTI poses are of the left camera in the frame of its first pose
+    const Eigen::Affine3d camera2Velodyne = m_velodyne2Camera.inverse();
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty())
+            continue;
+        
+        std::istringstream stream(line);
+        Eigen::Affine3d cameraPose;
+        if (! parseMatrix(stream, cameraPose)) {
+            error = "Wrong pose in " + fileName + ": " + line;
+            return false;
+        }
+        m_poses.push_back(camera2Velodyne * cameraPose * m_velodyne2Camera);
+    }
+    
+    return true;
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef KITTIREADER_H
+#define KITTIREADER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+namespace voxel_odometry {
+
+// x, y, z, reflectance of each point of a KITTI velodyne/*.bin file
+const uint32_t KITTI_POINT_STRIDE = 4;
+
+typedef struct {
+    const float * points;                       // Mapped file: valid until the next call of KittiReader::frame
+    uint32_t numPoints;
+    double stamp;                               // Seconds (from times.txt, or 0.1 s per frame)
+    bool hasPose;
+    Eigen::Affine3d pose2Map;                   // Of the velodyne, with the one of the first frame as map
+} t_kitti_frame;
+
+/**
+ * Reads a KITTI odometry sequence (the .bin files of velodyne/, times.txt, calib.txt and the 
+ * poses) without copies: each scan is memory mapped, and the next one is prefetched (madvise) 
+ * while the current one is processed. The poses of KITTI are of the left camera; they are moved to
+ * the velodyne with Tr of calib.txt.
+ */
+class KittiReader
+{
+public:
+    KittiReader();
+    ~KittiReader();
+    
+    /**
+     * @param sequence: Directory with velodyne/ (and times.txt and calib.txt).
+     * @param posesFile: One 3x4 matrix per line (poses/XX.txt in the devkit). If empty,
+     *                   sequence/poses.txt is used if it exists.
+     */
+    bool open(const std::string & sequence, const std::string & posesFile, std::string & error);
+    
+    uint32_t numFrames() const { return m_files.size(); }
+    bool frame(const uint32_t & idx, t_kitti_frame & frame);
+    
+    static bool isSequence(const std::string & path);
+    
+protected:
+    typedef struct {
+        int32_t idx;                            // -1 if nothing is mapped
+        void * data;
+        size_t size;
+    } t_mapping;
+    
+    bool map(const uint32_t & idx, t_mapping & mapping);
+    void unmap(t_mapping & mapping);
+    
+    bool loadTimes(const std::string & fileName);
+    bool loadCalibration(const std::string & fileName, std::string & error);
+    bool loadPoses(const std::string & fileName, std::string & error);
+    
+    std::vector<std::string> m_files;
+    std::vector<double> m_stamps;
+    std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > m_poses;
+    Eigen::Affine3d m_velodyne2Camera;          // Tr
+    
+    t_mapping m_current, m_next;
+};
+
+}
+
+#endif // KITTIREADER_H
@@ -0,0 +1,159 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "logging.h"
+#include "timeutils.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <boost/bind.hpp>
+
+namespace voxel_odometry {
+
+Logger::Logger() : m_sink(new Sink(&Logger::stderrSink))
+{
+    m_async = false;
+    m_dropped = 0;
+    m_asyncUsers = 0;
+}
+
+Logger::~Logger()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_asyncUsers != 0)
+        stopWriter();
+}
+
+Logger & Logger::instance()
+{
+    static Logger logger;
+    
+    return logger;
+}
+
+void Logger::log(const int32_t & level, const char * format, ...)
+{
+    t_log_record record;
+    record.level = level;
+    
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record.text, LOG_RECORD_SIZE, format, args);
+    va_end(args);
+    
+    if (! m_async.load(boost::memory_order_acquire)) {
+        const boost::shared_ptr<const Sink> sink = boost::atomic_load(&m_sink);
+        (*sink)(record.level, record.text);
+        return;
+    }
+    
+    if (! m_queue->bounded_push(record)) {
+        m_dropped.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+    
+    // The async mode was stopped meanwhile, and its last write could have missed this message
+    if (! m_async.load(boost::memory_order_seq_cst))
+        writeQueued();
+}
+
+void Logger::setSink(const Sink & sink)
+{
+    boost::atomic_store(&m_sink, boost::shared_ptr<const Sink>(new Sink(sink)));
+}
+
+void Logger::startAsync(const uint32_t & queueSize)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_asyncUsers++ != 0)
+        return;
+    
+    // Never replaced, since late loggers may still be pushing to it
+    if (! m_queue)
+        m_queue.reset(new boost::lockfree::queue<t_log_record>(std::max(queueSize, (uint32_t)1)));
+    m_thread = boost::thread(boost::bind(&Logger::writeLoop, this));
+    m_async.store(true, boost::memory_order_seq_cst);
+}
+
+void Logger::stopAsync()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if ((m_asyncUsers == 0) || (--m_asyncUsers != 0))
+        return;
+    
+    stopWriter();
+}
+
+// With m_mutex taken
+void Logger::stopWriter()
+{
+    m_async.store(false, boost::memory_order_seq_cst);
+    
+    m_thread.interrupt();
+    m_thread.join();
+    
+    // Messages pushed by threads that saw m_async just before it was cleared
+    writeQueued();
+}
+
+/**
+ * Main loop of the writer thread
+ */
+void Logger::writeLoop()
+{
+    const boost::posix_time::milliseconds period(5);
+    
+    try {
+        while (true) {
+            writeQueued();
+            boost::this_thread::sleep(period);
+        }
+    } catch (boost::thread_interrupted &) {
+    }
+}
+
+void Logger::writeQueued()
+{
+    const boost::shared_ptr<const Sink> sink = boost::atomic_load(&m_sink);
+    
+    t_log_record record;
+    while (m_queue->pop(record))
+        (*sink)(record.level, record.text);
+}
+
+bool Logger::throttle(uint64_t & last, const double & period)
+{
+    const uint64_t now = monotonicTime() * 1e9;
+    const uint64_t previous = __atomic_load_n(&last, __ATOMIC_RELAXED);
+    
+    // The first call always passes
+    if ((previous != 0) && (now - previous < period * 1e9))
+        return false;
+    
+    // If two threads get here, just one of them logs
+    return __sync_bool_compare_and_swap(&last, previous, now);
+}
+
+void Logger::stderrSink(const int32_t & level, const char * text)
+{
+    const char * const LEVEL_NAMES[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+    
+    fprintf(stderr, "[%s] %s\n", LEVEL_NAMES[std::min(std::max(level, 0), VO_LOG_LEVEL_ERROR)], text);
+}
+
+}
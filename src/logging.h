@@ -0,0 +1,144 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#define VO_LOG_LEVEL_DEBUG 0
+#define VO_LOG_LEVEL_INFO 1
+#define VO_LOG_LEVEL_WARN 2
+#define VO_LOG_LEVEL_ERROR 3
+#define VO_LOG_LEVEL_NONE 4
+
+// Messages below this level are not compiled at all (nor are their arguments evaluated)
+#ifndef VO_LOG_MIN_LEVEL
+#define VO_LOG_MIN_LEVEL VO_LOG_LEVEL_INFO
+#endif
+
+#define VO_LOG(level, ...) voxel_odometry::Logger::instance().log(level, __VA_ARGS__)
+// At most one message every period seconds from each call site
+#define VO_LOG_THROTTLE(level, period, ...) \
+    do { \
+        static uint64_t voLogLast = 0; \
+        if (voxel_odometry::Logger::throttle(voLogLast, period)) \
+            VO_LOG(level, __VA_ARGS__); \
+    } while (0)
+
+#if VO_LOG_MIN_LEVEL <= VO_LOG_LEVEL_DEBUG
+#define VO_LOG_DEBUG(...) VO_LOG(VO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define VO_LOG_DEBUG_THROTTLE(period, ...) VO_LOG_THROTTLE(VO_LOG_LEVEL_DEBUG, period, __VA_ARGS__)
+#else
+#define VO_LOG_DEBUG(...) do {} while (0)
+#define VO_LOG_DEBUG_THROTTLE(period, ...) do {} while (0)
+#endif
+
+#if VO_LOG_MIN_LEVEL <= VO_LOG_LEVEL_INFO
+#define VO_LOG_INFO(...) VO_LOG(VO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define VO_LOG_INFO_THROTTLE(period, ...) VO_LOG_THROTTLE(VO_LOG_LEVEL_INFO, period, __VA_ARGS__)
+#else
+#define VO_LOG_INFO(...) do {} while (0)
+#define VO_LOG_INFO_THROTTLE(period, ...) do {} while (0)
+#endif
+
+#if VO_LOG_MIN_LEVEL <= VO_LOG_LEVEL_WARN
+#define VO_LOG_WARN(...) VO_LOG(VO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define VO_LOG_WARN_THROTTLE(period, ...) VO_LOG_THROTTLE(VO_LOG_LEVEL_WARN, period, __VA_ARGS__)
+#else
+#define VO_LOG_WARN(...) do {} while (0)
+#define VO_LOG_WARN_THROTTLE(period, ...) do {} while (0)
+#endif
+
+#if VO_LOG_MIN_LEVEL <= VO_LOG_LEVEL_ERROR
+#define VO_LOG_ERROR(...) VO_LOG(VO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define VO_LOG_ERROR_THROTTLE(period, ...) VO_LOG_THROTTLE(VO_LOG_LEVEL_ERROR, period, __VA_ARGS__)
+#else
+#define VO_LOG_ERROR(...) do {} while (0)
+#define VO_LOG_ERROR_THROTTLE(period, ...) do {} while (0)
+#endif
+
+namespace voxel_odometry {
+
+#define LOG_RECORD_SIZE 256
+
+/**
+ * Destination of the VO_LOG_* macros, shared by the whole process. Messages are formatted
+ * in the calling thread and passed to the sink (stderr unless changed). With startAsync they 
+ * are queued instead, through a lock-free queue, and a background thread calls the sink, so
+ * the calling thread never waits for the output. If the queue is full the message is dropped.
+ * Several users (e.g. nodelets in the same manager) can start and stop the async mode: it
+ * lasts until the last of them stops it.
+ */
+class Logger
+{
+public:
+    // Called with one message at a time, without the trailing new line
+    typedef boost::function<void (const int32_t & level, const char * text)> Sink;
+    
+    static Logger & instance();
+    
+    void log(const int32_t & level, const char * format, ...) __attribute__((format(printf, 3, 4)));
+    
+    // Can be replaced at any time: a message being written keeps the previous one
+    void setSink(const Sink & sink);
+    // The queue is created by the first call, and kept (with its size) until the process ends
+    void startAsync(const uint32_t & queueSize);
+    // Each startAsync needs a stopAsync. The last one writes whatever is still queued before returning.
+    void stopAsync();
+    
+    uint64_t dropped() const { return m_dropped.load(boost::memory_order_relaxed); }
+    
+    // True if the last message of the call site was at least period seconds ago
+    static bool throttle(uint64_t & last, const double & period);
+    
+protected:
+    typedef struct {
+        int32_t level;
+        char text[LOG_RECORD_SIZE];
+    } t_log_record;
+    
+    Logger();
+    ~Logger();
+    void stopWriter();
+    void writeLoop();
+    void writeQueued();
+    
+    static void stderrSink(const int32_t & level, const char * text);
+    
+    // Read and replaced with boost::atomic_load / atomic_store
+    boost::shared_ptr<const Sink> m_sink;
+    boost::shared_ptr< boost::lockfree::queue<t_log_record> > m_queue;
+    boost::atomic<bool> m_async;
+    boost::atomic<uint64_t> m_dropped;
+    boost::thread m_thread;
+    
+    uint32_t m_asyncUsers;                      // Protected by m_mutex
+    boost::mutex m_mutex;
+};
+
+}
+
+#endif // LOGGING_H
@@ -0,0 +1,1137 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+/**
+ * Runs the engine over a recorded drive as fast as possible, without a ROS master, and 
+ * prints the statistics of each stage and the throughput.
+ * 
+ * voxel_odometry_bench <directory of .pcd files | .bag file | KITTI sequence | synthetic> [options]
+ *   --params FILE          Params of the engine (e.g. params/voxel_odometry_verdino_params.yaml)
+ *   --poses FILE           One line per frame: stamp x y z qx qy qz qw (pose of the vehicle in the map).
+ *                          With a KITTI sequence, its poses/XX.txt (sequence/poses.txt by default)
+ *   --rate HZ              Rate of the frames if there are no stamps (10)
+ *   --cloud-topic TOPIC    Topic of the clouds in the bag (/velodyne_points)
+ *   --map-frame FRAME      With a bag and no --poses, the poses are taken from its /tf (/map)
+ *   --pose-frame FRAME     (/base_footprint)
+ *   --frames N             Stop after N frames
+ *   --warmup N             Frames left out of the statistics (5)
+ *   --sensor-height H      Height of the sensor over the vehicle frame, in which the grid is (1.73 with 
+ *                          KITTI, 0 otherwise). The points are moved down by it, and the poses of KITTI 
+ *                          (the ones of the velodyne) are moved to the vehicle
+ * 
+ * Performance gate (not with a sweep): the p50 and p99 of each stage and counter are written 
+ * to --json, and compared with the ones of --baseline (a --json of a previous run of the same 
+ * input). The exit code is 2 if any of them got worse than its tolerance.
+ *   --json FILE
+ *   --baseline FILE
+ *   --tolerance T          Relative increase allowed in the time of a stage (0.1)
+ *   --counter-tolerance T  Relative increase allowed in a counter (0.05)
+ *   --slack-ms MS          Increase always allowed in the time of a stage (0.5)
+ *   --tolerance-of M=T     Tolerance of a single metric, e.g. stages.segment.p99=0.3 (repeatable)
+ * 
+ * Evaluation: when the poses of the frames are known (always with synthetic), the odometry of 
+ * the engine is compared with them (relative pose error and drift per 100 m), and --eval writes
+ * PREFIX.csv (errors and runtime of each frame) and PREFIX_summary.txt.
+ *   --eval PREFIX
+ * 
+ * Lists of values run every combination of them (a sweep). The sweep ends with a table of
+ * accuracy vs. latency, in which the configurations of the Pareto front are marked with *. 
+ * With --eval, each one writes PREFIX_<n>.csv, and the table is written to PREFIX_sweep.csv.
+ *   --cell-size C[,C...]   Overrides cell_size_x/y/z
+ *   --particles N[,N...]   Overrides max_particles_number_per_voxel
+ *   --speed-factor F[,F...] Overrides speed_factor
+ * 
+ * With synthetic, the scans come from a SceneGenerator, and the speed of the obstacles found is
+ * also compared with the ground truth:
+ *   --movers N[,N...]      Moving objects (10)
+ *   --static N             Static objects (40)
+ *   --ego-speed V          Speed of the vehicle, m/s (0)
+ *   --seed S               (1)
+ *   --check-metric         Just checks that the comparison with the ground truth passes with a fake 
+ *                          engine giving the exact answer, and fails with wrong ones (exit code 1)
+ */
+
+#include "voxelodometryengine.h"
+#include "engineparams.h"
+#include "kittireader.h"
+#include "odometryeval.h"
+#include "paramfile.h"
+#include "perfreport.h"
+#include "rollingstats.h"
+#include "scenegenerator.h"
+#include "timeutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <new>
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <tf/transform_datatypes.h>
+#include <tf/tf.h>
+#include <tf2_msgs/TFMessage.h>
+#include <tf_conversions/tf_eigen.h>
+
+using namespace voxel_odometry;
+using namespace std;
+
+typedef pcl::PointCloud<pcl::PointXYZ> InputCloud;
+
+typedef struct {
+    string input;
+    string paramsFile;
+    string posesFile;
+    double rate;
+    string cloudTopic;
+    string mapFrame, poseFrame;
+    uint32_t maxFrames;
+    uint32_t warmup;
+    double sensorHeight;                        // Negative for the default of the input
+    
+    string jsonFile;
+    string baselineFile;
+    t_perf_tolerances tolerances;
+    
+    string evalPrefix;
+    
+    // Sweep (negative values are the ones of --params)
+    vector<double> cellSizes;
+    vector<int32_t> maxParticles;
+    vector<double> speedFactors;
+    
+    // Just with synthetic
+    bool synthetic;
+    vector<uint32_t> movers;
+    uint32_t numStatic;
+    double egoSpeed;
+    uint32_t seed;
+    bool checkMetric;
+} t_bench_options;
+
+typedef struct {
+    double stamp;
+    Eigen::Affine3d pose;
+} t_stamped_pose;
+
+// One combination of the values of a sweep
+typedef struct {
+    uint32_t numMovers;
+    double cellSize;
+    int32_t maxParticles;
+    double speedFactor;
+} t_bench_config;
+
+// Allocations of the whole process, counted by the operator new below
+static uint64_t g_allocations = 0;
+
+// Dynamic exception specifications are not allowed since C++17
+#if __cplusplus >= 201103L
+#define BENCH_THROW_BAD_ALLOC
+#define BENCH_NO_THROW noexcept
+#else
+#define BENCH_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define BENCH_NO_THROW throw()
+#endif
+
+void * operator new(size_t size) BENCH_THROW_BAD_ALLOC
+{
+    __sync_fetch_and_add(&g_allocations, 1);
+    
+    void * ptr = malloc((size != 0)? size : 1);
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void * ptr) BENCH_NO_THROW
+{
+    free(ptr);
+}
+
+#if __cplusplus >= 201402L
+// Used instead of the one above when the size is known
+void operator delete(void * ptr, size_t) noexcept
+{
+    free(ptr);
+}
+#endif
+
+// The workers of the engine allocate while it is read
+static uint64_t allocations()
+{
+    return __atomic_load_n(&g_allocations, __ATOMIC_RELAXED);
+}
+
+/**
+ * Source of the frames: the files of a directory, the clouds of a bag or a KITTI sequence
+ */
+class FrameReader
+{
+public:
+    FrameReader(const t_bench_options & options) : m_options(options), m_next(0), m_kitti(false) {}
+    
+    bool open() {
+        if (KittiReader::isSequence(m_options.input)) {
+            m_kitti = true;
+            string error;
+            if (! m_kittiReader.open(m_options.input, m_options.posesFile, error)) {
+                fprintf(stderr, "%s\n", error.c_str());
+                return false;
+            }
+            return m_kittiReader.numFrames() != 0;
+        }
+        
+        if (boost::filesystem::is_directory(m_options.input)) {
+            boost::filesystem::directory_iterator end;
+            for (boost::filesystem::directory_iterator it(m_options.input); it != end; ++it) {
+                if (it->path().extension() == ".pcd")
+                    m_files.push_back(it->path().string());
+            }
+            sort(m_files.begin(), m_files.end());
+            return ! m_files.empty();
+        }
+        
+        try {
+            m_bag.open(m_options.input, rosbag::bagmode::Read);
+        } catch (rosbag::BagException & ex) {
+            fprintf(stderr, "%s\n", ex.what());
+            return false;
+        }
+        m_view.reset(new rosbag::View(m_bag, rosbag::TopicQuery(m_options.cloudTopic)));
+        m_viewIt = m_view->begin();
+        
+        if (m_options.posesFile.empty())
+            loadTf();
+        
+        return true;
+    }
+    
+    /**
+     * points is valid until the next call. With KITTI it is the mapped file, not a copy.
+     * stamp is negative if the frame has none.
+     */
+    bool next(const float * & points, uint32_t & numPoints, uint32_t & stride, double & stamp, 
+              bool & hasPose, Eigen::Affine3d & pose) {
+        hasPose = false;
+        
+        if (m_kitti) {
+            t_kitti_frame frame;
+            if (! m_kittiReader.frame(m_next++, frame))
+                return false;
+            
+            points = frame.points;
+            numPoints = frame.numPoints;
+            stride = KITTI_POINT_STRIDE;
+            stamp = frame.stamp;
+            hasPose = frame.hasPose;
+            pose = frame.pose2Map;
+            return true;
+        }
+        
+        if (! nextCloud(m_cloud, stamp))
+            return false;
+        
+        points = m_cloud.empty()? NULL : &m_cloud.points[0].x;
+        numPoints = m_cloud.size();
+        stride = sizeof(pcl::PointXYZ) / sizeof(float);
+        return true;
+    }
+    
+    bool isKitti() const { return m_kitti; }
+    
+    // Pose of the vehicle in the map from the /tf of the bag
+    bool tfPose(const double & stamp, Eigen::Affine3d & pose) {
+        if (! m_transformer)
+            return false;
+        
+        // Static transforms are valid at any time
+        BOOST_FOREACH(tf::StampedTransform transform, m_staticTransforms) {
+            transform.stamp_ = ros::Time(stamp);
+            m_transformer->setTransform(transform, "bag");
+        }
+        
+        try {
+            tf::StampedTransform transform;
+            m_transformer->lookupTransform(m_options.mapFrame, m_options.poseFrame, ros::Time(stamp), transform);
+            tf::transformTFToEigen(transform, pose);
+        } catch (tf::TransformException & ex) {
+            return false;
+        }
+        return true;
+    }
+    
+protected:
+    bool nextCloud(InputCloud & cloud, double & stamp) {
+        if (m_view) {
+            while (m_viewIt != m_view->end()) {
+                sensor_msgs::PointCloud2::ConstPtr msg = m_viewIt->instantiate<sensor_msgs::PointCloud2>();
+                ++m_viewIt;
+                if (! msg)
+                    continue;
+                
+                pcl::fromROSMsg(*msg, cloud);
+                stamp = msg->header.stamp.toSec();
+                return true;
+            }
+            return false;
+        }
+        
+        while (m_next < m_files.size()) {
+            const string & fileName = m_files[m_next++];
+            if (pcl::io::loadPCDFile(fileName, cloud) != 0) {
+                fprintf(stderr, "%s could not be read, skipped\n", fileName.c_str());
+                continue;
+            }
+            stamp = -1.0;
+            return true;
+        }
+        return false;
+    }
+    
+    void loadTf() {
+        rosbag::View tfView(m_bag, rosbag::TopicQuery(vector<string>(1, "/tf")));
+        rosbag::View staticView(m_bag, rosbag::TopicQuery(vector<string>(1, "/tf_static")));
+        
+        // The whole bag is kept, so any frame can be looked up
+        const ros::Duration duration = tfView.getEndTime() - tfView.getBeginTime() + ros::Duration(1.0);
+        m_transformer.reset(new tf::Transformer(true, duration));
+        
+        BOOST_FOREACH(const rosbag::MessageInstance & instance, tfView) {
+            tf2_msgs::TFMessage::ConstPtr msg = instance.instantiate<tf2_msgs::TFMessage>();
+            if (! msg)
+                continue;
+            BOOST_FOREACH(const geometry_msgs::TransformStamped & transformMsg, msg->transforms) {
+                tf::StampedTransform transform;
+                tf::transformStampedMsgToTF(transformMsg, transform);
+                m_transformer->setTransform(transform, "bag");
+            }
+        }
+        BOOST_FOREACH(const rosbag::MessageInstance & instance, staticView) {
+            tf2_msgs::TFMessage::ConstPtr msg = instance.instantiate<tf2_msgs::TFMessage>();
+            if (! msg)
+                continue;
+            BOOST_FOREACH(const geometry_msgs::TransformStamped & transformMsg, msg->transforms) {
+                tf::StampedTransform transform;
+                tf::transformStampedMsgToTF(transformMsg, transform);
+                m_staticTransforms.push_back(transform);
+            }
+        }
+    }
+    
+    const t_bench_options & m_options;
+    
+    vector<string> m_files;
+    uint32_t m_next;
+    InputCloud m_cloud;
+    
+    bool m_kitti;
+    KittiReader m_kittiReader;
+    
+    rosbag::Bag m_bag;
+    boost::shared_ptr<rosbag::View> m_view;
+    rosbag::View::iterator m_viewIt;
+    boost::shared_ptr<tf::Transformer> m_transformer;
+    vector<tf::StampedTransform> m_staticTransforms;
+};
+
+static bool loadPoses(const string & fileName, vector<t_stamped_pose> & poses)
+{
+    ifstream file(fileName.c_str());
+    if (! file.is_open())
+        return false;
+    
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || (line[0] == '#'))
+            continue;
+        
+        double stamp, x, y, z, qx, qy, qz, qw;
+        if (sscanf(line.c_str(), "%lf %lf %lf %lf %lf %lf %lf %lf", &stamp, &x, &y, &z, &qx, &qy, &qz, &qw) != 8)
+            return false;
+        
+        t_stamped_pose pose;
+        pose.stamp = stamp;
+        pose.pose = Eigen::Translation3d(x, y, z) * Eigen::Quaterniond(qw, qx, qy, qz).normalized();
+        poses.push_back(pose);
+    }
+    
+    return true;
+}
+
+// Statistics of a run, over the frames after the warm up
+struct BenchRun
+{
+    BenchRun(const uint32_t & windowSize) : stats(windowSize), frames(0), points(0), compute(0.0), 
+                                            visibleMovers(0), detectedMovers(0), speedError(0.0) {
+        for (uint32_t i = 0; i < NUM_STAGES; i++)
+            stats.addSeries(STAGE_NAMES[i]);
+        occupiedVoxelsSeries = stats.addSeries("occupiedVoxels");
+        liveParticlesSeries = stats.addSeries("liveParticles");
+        particlesBornSeries = stats.addSeries("particlesBorn");
+        particlesEvictedSeries = stats.addSeries("particlesEvicted");
+        obstaclesSeries = stats.addSeries("obstacles");
+        allocationsSeries = stats.addSeries("allocations");
+    }
+    
+    // Every frame with a known pose, the ones of the warm up included (the odometry starts with them)
+    void addPose(const t_frame_input & input, const FrameSnapshot & result, const double & elapsed) {
+        odometry.add(input.stamp, result.odometry, input.pose2MapTransform, elapsed);
+    }
+    
+    void add(const FrameSnapshot & result, const uint32_t & numPoints, const double & elapsed, 
+             const uint64_t & allocations) {
+        const t_frame_stats & frameStats = result.timeStats;
+        for (uint32_t i = 0; i < NUM_STAGES; i++)
+            stats.add(i, frameStats.stages[i].wall);
+        stats.add(occupiedVoxelsSeries, frameStats.occupiedVoxels);
+        stats.add(liveParticlesSeries, frameStats.liveParticles);
+        stats.add(particlesBornSeries, frameStats.particlesBorn);
+        stats.add(particlesEvictedSeries, frameStats.particlesEvicted);
+        stats.add(obstaclesSeries, frameStats.obstacles);
+        stats.add(allocationsSeries, allocations);
+        
+        frames++;
+        points += numPoints;
+        compute += elapsed;
+    }
+    
+    RollingStats stats;
+    uint32_t occupiedVoxelsSeries, liveParticlesSeries, particlesBornSeries, particlesEvictedSeries;
+    uint32_t obstaclesSeries, allocationsSeries;
+    uint32_t frames;
+    uint64_t points;
+    double compute;
+    
+    OdometryEvaluator odometry;
+    
+    // Just with synthetic
+    uint32_t visibleMovers, detectedMovers;
+    double speedError;                          // Sum, m/s
+};
+
+// Minimum number of points for a mover to count as seen
+#define MIN_MOVER_HITS 10
+
+/**
+ * Matches each mover seen in the scan with the obstacle owning most of the voxels inside its 
+ * true box (grown by a cell), and adds the error of the speed of that obstacle. Obstacles do 
+ * not have to match a single object, so several movers can get the same one.
+ */
+static void compareWithGroundTruth(const SceneGenerator & generator, const FrameSnapshot & result, 
+                                   const double & cellSize, BenchRun & run)
+{
+    BOOST_FOREACH(const t_scene_object & object, generator.objects()) {
+        if (object.isStatic || (object.hits < MIN_MOVER_HITS))
+            continue;
+        
+        const Eigen::Vector3d center = object.center - generator.egoPosition();
+        // Out of the grid of the engine
+        if ((fabs(center.x()) > 20.0) || (fabs(center.y()) > 20.0))
+            continue;
+        
+        run.visibleMovers++;
+        
+        const double minX = center.x() - object.size.x() / 2.0 - cellSize;
+        const double maxX = center.x() + object.size.x() / 2.0 + cellSize;
+        const double minY = center.y() - object.size.y() / 2.0 - cellSize;
+        const double maxY = center.y() + object.size.y() / 2.0 + cellSize;
+        
+        const t_obstacle_record * match = NULL;
+        uint32_t matchVoxels = 0;
+        BOOST_FOREACH(const t_obstacle_record & obstacle, result.obstacles) {
+            uint32_t inside = 0;
+            for (uint32_t i = obstacle.firstVoxel; i < obstacle.firstVoxel + obstacle.numVoxels; i++) {
+                const t_point_record & voxel = result.obstacleVoxels[i];
+                if ((voxel.x >= minX) && (voxel.x <= maxX) && (voxel.y >= minY) && (voxel.y <= maxY))
+                    inside++;
+            }
+            if (inside > matchVoxels) {
+                match = &obstacle;
+                matchVoxels = inside;
+            }
+        }
+        if (match == NULL)
+            continue;
+        
+        // Direction (unit vector) times speed
+        const double vx = match->vx * match->magnitude;
+        const double vy = match->vy * match->magnitude;
+        
+        run.detectedMovers++;
+        run.speedError += hypot(vx - object.velocity.x(), vy - object.velocity.y());
+    }
+}
+
+// Answers of the fake engines of checkGroundTruthMetric
+enum FakeEngine { FAKE_ENGINE_EXACT, FAKE_ENGINE_REVERSED, FAKE_ENGINE_SINGLE_STATIC, FAKE_ENGINE_NOTHING };
+
+/**
+ * Result the fake engine gives for the last scan of the generator: an obstacle per mover, with
+ * a voxel at each cell of its box (exact, or with the speed reversed), a single static obstacle 
+ * with all of them, or nothing at all.
+ */
+static void fakeResult(const SceneGenerator & generator, const FakeEngine & engine, const double & cellSize, 
+                       FrameSnapshot & result)
+{
+    result.clear();
+    if (engine == FAKE_ENGINE_NOTHING)
+        return;
+    
+    BOOST_FOREACH(const t_scene_object & object, generator.objects()) {
+        if (object.isStatic || (object.hits < MIN_MOVER_HITS))
+            continue;
+        
+        const Eigen::Vector3d center = object.center - generator.egoPosition();
+        
+        if ((engine != FAKE_ENGINE_SINGLE_STATIC) || result.obstacles.empty()) {
+            t_obstacle_record obstacle = t_obstacle_record();
+            const double speed = object.velocity.head<2>().norm();
+            if ((engine != FAKE_ENGINE_SINGLE_STATIC) && (speed > 0.0)) {
+                const double sign = (engine == FAKE_ENGINE_REVERSED)? -1.0 : 1.0;
+                obstacle.vx = sign * object.velocity.x() / speed;
+                obstacle.vy = sign * object.velocity.y() / speed;
+                obstacle.magnitude = speed;
+            }
+            obstacle.idx = result.obstacles.size();
+            obstacle.firstVoxel = result.obstacleVoxels.size();
+            result.obstacles.push_back(obstacle);
+        }
+        
+        for (double x = -object.size.x() / 2.0; x <= object.size.x() / 2.0; x += cellSize) {
+            for (double y = -object.size.y() / 2.0; y <= object.size.y() / 2.0; y += cellSize) {
+                const t_point_record voxel = { (float)(center.x() + x), (float)(center.y() + y), 
+                                               (float)(center.z() + object.size.z() / 2.0) };
+                result.obstacleVoxels.push_back(voxel);
+            }
+        }
+        result.obstacles.back().numVoxels = result.obstacleVoxels.size() - result.obstacles.back().firstVoxel;
+    }
+}
+
+/**
+ * Runs compareWithGroundTruth over the scans of a scene with fake engines, and checks that just 
+ * the exact one passes. False if the metric cannot tell them apart.
+ */
+static bool checkGroundTruthMetric(const t_bench_options & options, const double & cellSize)
+{
+    const FakeEngine engines[] = { FAKE_ENGINE_EXACT, FAKE_ENGINE_REVERSED, FAKE_ENGINE_SINGLE_STATIC, 
+                                   FAKE_ENGINE_NOTHING };
+    const char * names[] = { "exact", "reversed", "single static", "nothing" };
+    
+    t_scene_params sceneParams = SceneGenerator::defaultParams();
+    sceneParams.seed = options.seed;
+    sceneParams.numMovers = 10;
+    sceneParams.numStatic = options.numStatic;
+    sceneParams.egoSpeed = options.egoSpeed;
+    sceneParams.rate = options.rate;
+    // Below it, the speed error of the wrong engines could be as small as the one of the exact one
+    const double maxError = sceneParams.minSpeed / 2.0;
+    
+    bool ok = true;
+    for (uint32_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        SceneGenerator generator(sceneParams);
+        BenchRun run(1);
+        
+        vector<float> points;
+        Eigen::Affine3d pose;
+        double stamp;
+        FrameSnapshot result;
+        for (uint32_t frame = 0; frame < 10; frame++) {
+            generator.nextScan(points, pose, stamp);
+            fakeResult(generator, engines[i], cellSize, result);
+            compareWithGroundTruth(generator, result, cellSize, run);
+        }
+        
+        const double speedError = (run.detectedMovers != 0)? run.speedError / run.detectedMovers : 0.0;
+        const bool passes = (run.visibleMovers != 0) && (run.detectedMovers == run.visibleMovers) && 
+                            (speedError < maxError);
+        const bool expected = (engines[i] == FAKE_ENGINE_EXACT);
+        printf("Fake engine %-14s %u/%u movers found, mean speed error %.3f m/s: %s\n", names[i], 
+               run.detectedMovers, run.visibleMovers, speedError, 
+               (passes == expected)? "ok" : "WRONG");
+        ok = ok && (passes == expected);
+    }
+    
+    return ok;
+}
+
+static void printRun(const BenchRun & run, const uint32_t & numFrames, const uint32_t & threads)
+{
+    printf("%u frames (%u timed), %u threads\n", numFrames, run.frames, threads);
+    
+    printf("\n%-28s %12s %12s %12s %12s\n", "", "p50", "p90", "p99", "max");
+    for (uint32_t i = 0; i < run.stats.numSeries(); i++) {
+        // Visualization is not run here
+        if (i == STAGE_TOTAL_VISUALIZATION)
+            continue;
+        
+        const t_percentiles percentiles = run.stats.percentiles(i);
+        const double scale = (i < NUM_STAGES)? 1000.0 : 1.0;
+        printf("%-28s %12.3f %12.3f %12.3f %12.3f%s\n", run.stats.name(i).c_str(), 
+               percentiles.p50 * scale, percentiles.p90 * scale, percentiles.p99 * scale, percentiles.max * scale,
+               (i < NUM_STAGES)? " ms" : "");
+    }
+    
+    printf("\nThroughput: %.2f frames/s, %.0f points/s\n", run.frames / run.compute, run.points / run.compute);
+    const t_odometry_errors errors = run.odometry.errors();
+    if (errors.frames > 1) {
+        printf("Odometry (%u frames, %.1f m): RPE %.3f m / %.3f deg, ", errors.frames, errors.distance, 
+               errors.rpeTranslation, errors.rpeRotation * 180.0 / M_PI);
+        if (errors.segments != 0)
+            printf("drift %.2f%% / %.3f deg per 100 m\n", errors.drift, errors.rotationDrift);
+        else
+            printf("no drift (less than 100 m)\n");
+    }
+    if (run.visibleMovers != 0) {
+        printf("Movers: %.1f%% found, mean speed error %.3f m/s\n", 100.0 * run.detectedMovers / run.visibleMovers,
+               (run.detectedMovers != 0)? run.speedError / run.detectedMovers : 0.0);
+    }
+}
+
+static void applyConfig(const t_bench_config & config, t_engine_params & params)
+{
+    if (config.cellSize > 0.0)
+        params.cellSizeX = params.cellSizeY = params.cellSizeZ = config.cellSize;
+    if (config.maxParticles > 0)
+        params.maxNumberOfParticles = config.maxParticles;
+    if (config.speedFactor > 0.0)
+        params.factorSpeed = config.speedFactor;
+}
+
+static bool writeSummary(const string & fileName, const BenchRun & run, const t_engine_params & params)
+{
+    FILE * file = fopen(fileName.c_str(), "w");
+    if (file == NULL)
+        return false;
+    
+    const t_odometry_errors errors = run.odometry.errors();
+    const t_percentiles total = run.stats.percentiles(STAGE_TOTAL_COMPUTE);
+    fprintf(file, "cell_size: %g\nmax_particles_number_per_voxel: %u\nspeed_factor: %g\n", 
+            params.cellSizeX, params.maxNumberOfParticles, params.factorSpeed);
+    fprintf(file, "frames: %u\ndistance: %.3f\n", errors.frames, errors.distance);
+    fprintf(file, "rpe_translation: %.6f\nrpe_rotation: %.6f\n", errors.rpeTranslation, errors.rpeRotation);
+    fprintf(file, "drift_segments: %u\ndrift: %.4f\nrotation_drift: %.4f\n", errors.segments, errors.drift, 
+            errors.rotationDrift);
+    fprintf(file, "total_compute_p50: %.6f\ntotal_compute_p99: %.6f\nframes_per_second: %.3f\n", 
+            total.p50, total.p99, run.frames / run.compute);
+    fclose(file);
+    
+    return true;
+}
+
+/**
+ * Writes the report of the run to --json and compares it with --baseline.
+ * @return The exit code: 0, 1 on errors or 2 if there are regressions
+ */
+static int checkRun(const t_bench_options & options, const BenchRun & run, const uint32_t & numFrames)
+{
+    PerfReport report;
+    report.setInfo("input", options.input);
+    report.setInfo("params", options.paramsFile);
+    report.setInfo("frames", boost::lexical_cast<string>(numFrames));
+    report.setInfo("warmup", boost::lexical_cast<string>(options.warmup));
+    for (uint32_t i = 0; i < run.stats.numSeries(); i++) {
+        if (i == STAGE_TOTAL_VISUALIZATION)
+            continue;
+        if (i < NUM_STAGES)
+            report.addStage(run.stats.name(i), run.stats.percentiles(i));
+        else
+            report.addCounter(run.stats.name(i), run.stats.percentiles(i));
+    }
+    
+    string error;
+    if ((! options.jsonFile.empty()) && (! report.save(options.jsonFile, error))) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    if (options.baselineFile.empty())
+        return 0;
+    
+    PerfReport baseline;
+    if (! baseline.load(options.baselineFile, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    // Different inputs or frames give different numbers, not regressions
+    if ((baseline.info("input") != report.info("input")) || (baseline.info("frames") != report.info("frames")) || 
+        (baseline.info("warmup") != report.info("warmup"))) {
+        fprintf(stderr, "The baseline is of %s (%s frames, %s of warm up), not comparable with this run\n", 
+                baseline.info("input").c_str(), baseline.info("frames").c_str(), baseline.info("warmup").c_str());
+        return 1;
+    }
+    
+    const vector<t_perf_regression> regressions = report.compare(baseline, options.tolerances);
+    if (regressions.empty()) {
+        printf("\nNo regressions with respect to %s\n", options.baselineFile.c_str());
+        return 0;
+    }
+    
+    printf("\n%-40s %14s %14s %14s\n", "Regressions", "baseline", "current", "limit");
+    BOOST_FOREACH(const t_perf_regression & regression, regressions) {
+        if (regression.current < 0.0) {
+            printf("%-40s %14g %14s %14g\n", regression.metric.c_str(), regression.baseline, "missing", 
+                   regression.limit);
+        } else {
+            printf("%-40s %14g %14g %14g\n", regression.metric.c_str(), regression.baseline, regression.current, 
+                   regression.limit);
+        }
+    }
+    
+    return 2;
+}
+
+static bool runSynthetic(const t_bench_options & options, const t_engine_params & params, 
+                         const uint32_t & numMovers, BenchRun & run)
+{
+    t_scene_params sceneParams = SceneGenerator::defaultParams();
+    sceneParams.seed = options.seed;
+    sceneParams.numMovers = numMovers;
+    sceneParams.numStatic = options.numStatic;
+    sceneParams.egoSpeed = options.egoSpeed;
+    sceneParams.rate = options.rate;
+    SceneGenerator generator(sceneParams);
+    
+    VoxelOdometryEngine engine(params);
+    
+    vector<float> points;
+    FrameSnapshot result;
+    const uint32_t numFrames = (options.maxFrames != 0)? options.maxFrames : 50;
+    for (uint32_t i = 0; i < numFrames; i++) {
+        t_frame_input input;
+        input.id = i;
+        // The scans are already in the vehicle frame
+        input.sensor2PoseTransform = input.map2CamTransform = Eigen::Affine3d::Identity();
+        generator.nextScan(points, input.pose2MapTransform, input.stamp);
+        input.deltaTime = 1.0 / sceneParams.rate;
+        
+        const uint64_t startAllocations = allocations();
+        const double start = monotonicTime();
+        engine.compute(&points[0], points.size() / 3, 3, input, result);
+        const double elapsed = monotonicTime() - start;
+        
+        run.addPose(input, result, elapsed);
+        if (i >= options.warmup) {
+            run.add(result, points.size() / 3, elapsed, allocations() - startAllocations);
+            compareWithGroundTruth(generator, result, params.cellSizeX, run);
+        }
+    }
+    
+    return run.frames != 0;
+}
+
+static bool runRecorded(const t_bench_options & options, const t_engine_params & params, 
+                        const vector<t_stamped_pose> & poses, BenchRun & run, uint32_t & numFrames)
+{
+    numFrames = 0;
+    
+    FrameReader reader(options);
+    if (! reader.open()) {
+        fprintf(stderr, "No frames in %s\n", options.input.c_str());
+        return false;
+    }
+    
+    VoxelOdometryEngine engine(params);
+    
+    FrameSnapshot result;
+    double lastStamp = -1.0;
+    uint32_t missingPoses = 0;
+    
+    // Height of the velodyne of KITTI over the ground
+    const double sensorHeight = (options.sensorHeight >= 0.0)? options.sensorHeight : (reader.isKitti()? 1.73 : 0.0);
+    const Eigen::Affine3d sensor2Pose(Eigen::Translation3d(0.0, 0.0, sensorHeight));
+    
+    const float * points;
+    uint32_t numPoints, stride;
+    double stamp;
+    bool hasPose;
+    Eigen::Affine3d pose;
+    while (reader.next(points, numPoints, stride, stamp, hasPose, pose)) {
+        if ((options.maxFrames != 0) && (numFrames >= options.maxFrames))
+            break;
+        if (numPoints == 0)
+            continue;
+        
+        t_frame_input input;
+        input.id = numFrames;
+        input.pose2MapTransform = input.map2CamTransform = Eigen::Affine3d::Identity();
+        input.sensor2PoseTransform = sensor2Pose;
+        if (hasPose) {
+            // Of the sensor
+            input.pose2MapTransform = pose * sensor2Pose.inverse();
+        } else if (numFrames < poses.size()) {
+            input.pose2MapTransform = poses[numFrames].pose;
+            stamp = poses[numFrames].stamp;
+            hasPose = true;
+        } else if ((! reader.isKitti()) && poses.empty() && (stamp >= 0.0)) {
+            hasPose = reader.tfPose(stamp, input.pose2MapTransform);
+        }
+        if (! hasPose)
+            missingPoses++;
+        if (stamp < 0.0)
+            stamp = numFrames / options.rate;
+        input.stamp = stamp;
+        input.deltaTime = (lastStamp < 0.0)? 1.0 / options.rate : stamp - lastStamp;
+        lastStamp = stamp;
+        
+        const uint64_t startAllocations = allocations();
+        const double start = monotonicTime();
+        engine.compute(points, numPoints, stride, input, result);
+        const double elapsed = monotonicTime() - start;
+        
+        if (hasPose)
+            run.addPose(input, result, elapsed);
+        if (numFrames >= options.warmup)
+            run.add(result, numPoints, elapsed, allocations() - startAllocations);
+        numFrames++;
+    }
+    
+    if (missingPoses != 0)
+        printf("%u frames without pose (identity used)\n", missingPoses);
+    
+    return run.frames != 0;
+}
+
+// Result of a configuration of a sweep
+typedef struct {
+    t_bench_config config;
+    double cellSize;
+    uint32_t maxParticles;
+    double speedFactor;
+    double voxels;                              // p50
+    t_percentiles total;
+    double framesPerSecond;
+    t_odometry_errors errors;
+    double error;                               // Drift, or the RPE if there are no segments of 100 m
+    double found, speedError;                   // Just with synthetic
+    bool pareto;
+} t_sweep_row;
+
+static t_sweep_row sweepRow(const BenchRun & run, const t_bench_config & config, const t_engine_params & params)
+{
+    t_sweep_row row;
+    row.config = config;
+    row.cellSize = params.cellSizeX;
+    row.maxParticles = params.maxNumberOfParticles;
+    row.speedFactor = params.factorSpeed;
+    row.voxels = run.stats.percentiles(run.occupiedVoxelsSeries).p50;
+    row.total = run.stats.percentiles(STAGE_TOTAL_COMPUTE);
+    row.framesPerSecond = run.frames / run.compute;
+    row.errors = run.odometry.errors();
+    row.error = (row.errors.segments != 0)? row.errors.drift : row.errors.rpeTranslation;
+    row.found = (run.visibleMovers != 0)? 100.0 * run.detectedMovers / run.visibleMovers : 0.0;
+    row.speedError = (run.detectedMovers != 0)? run.speedError / run.detectedMovers : 0.0;
+    row.pareto = false;
+    
+    return row;
+}
+
+/**
+ * A configuration is in the Pareto front of error vs. latency (total p50) if no other one is 
+ * at least as good in both and better in one of them
+ */
+static void markParetoFront(vector<t_sweep_row> & rows)
+{
+    for (uint32_t i = 0; i < rows.size(); i++) {
+        // Without ground truth there is no accuracy to trade
+        if (rows[i].errors.frames < 2)
+            continue;
+        
+        rows[i].pareto = true;
+        for (uint32_t j = 0; (j < rows.size()) && rows[i].pareto; j++) {
+            if ((i == j) || (rows[j].errors.frames < 2))
+                continue;
+            if ((rows[j].error <= rows[i].error) && (rows[j].total.p50 <= rows[i].total.p50) &&
+                ((rows[j].error < rows[i].error) || (rows[j].total.p50 < rows[i].total.p50)))
+                rows[i].pareto = false;
+        }
+    }
+}
+
+static void printSweep(const vector<t_sweep_row> & rows, const bool & synthetic)
+{
+    // Drift needs 100 m of ground truth; shorter sequences are compared by their RPE
+    bool drift = true;
+    BOOST_FOREACH(const t_sweep_row & row, rows)
+        drift = drift && (row.errors.segments != 0);
+    
+    printf("%s%10s %10s %12s %12s %12s %12s %10s %10s", synthetic? "  movers " : "", "cell size", "particles", 
+           "speed factor", "voxels p50", "total p50", "total p99", "frames/s", drift? "drift %" : "RPE m");
+    printf(synthetic? " %10s %12s\n" : "\n", "found", "speed error");
+    
+    BOOST_FOREACH(const t_sweep_row & row, rows) {
+        if (synthetic)
+            printf("%8u ", row.config.numMovers);
+        printf("%10.3f %10u %12.3f %12.0f %12.3f %12.3f %10.2f %9.3f%s", row.cellSize, row.maxParticles, 
+               row.speedFactor, row.voxels, row.total.p50 * 1000.0, row.total.p99 * 1000.0, row.framesPerSecond, 
+               drift? row.errors.drift : row.errors.rpeTranslation, row.pareto? "*" : " ");
+        if (synthetic)
+            printf(" %9.1f%% %12.3f", row.found, row.speedError);
+        printf("\n");
+    }
+}
+
+static bool writeSweep(const string & fileName, const vector<t_sweep_row> & rows)
+{
+    FILE * file = fopen(fileName.c_str(), "w");
+    if (file == NULL)
+        return false;
+    
+    fprintf(file, "config,movers,cell_size,max_particles_number_per_voxel,speed_factor,voxels_p50,total_compute_p50,"
+                  "total_compute_p99,frames_per_second,distance,rpe_translation,rpe_rotation,drift,rotation_drift,"
+                  "found,speed_error,pareto\n");
+    for (uint32_t i = 0; i < rows.size(); i++) {
+        const t_sweep_row & row = rows[i];
+        fprintf(file, "%u,%u,%g,%u,%g,%g,%.6f,%.6f,%.3f,%.3f,%.6f,%.6f,%.4f,%.4f,%.2f,%.4f,%d\n", i, 
+                row.config.numMovers, row.cellSize, row.maxParticles, row.speedFactor, row.voxels, 
+                row.total.p50, row.total.p99, row.framesPerSecond, row.errors.distance, row.errors.rpeTranslation, 
+                row.errors.rpeRotation, row.errors.drift, row.errors.rotationDrift, row.found, row.speedError, 
+                row.pareto? 1 : 0);
+    }
+    fclose(file);
+    
+    return true;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "Usage: %s <directory of .pcd files | .bag file | KITTI sequence | synthetic> [--params FILE] [--poses FILE] [--rate HZ]\n"
+                    "       [--cloud-topic TOPIC] [--map-frame FRAME] [--pose-frame FRAME] [--frames N] [--warmup N] [--sensor-height H]\n"
+                    "       [--eval PREFIX] [--cell-size C[,C...]] [--particles N[,N...]] [--speed-factor F[,F...]]\n"
+                    "       [--movers N[,N...]] [--static N] [--ego-speed V] [--seed S] [--check-metric]\n"
+                    "       [--json FILE] [--baseline FILE] [--tolerance T] [--counter-tolerance T] [--slack-ms MS]\n"
+                    "       [--tolerance-of METRIC=T]...\n", name);
+}
+
+static bool isSweep(const t_bench_options & options)
+{
+    return (options.cellSizes.size() > 1) || (options.maxParticles.size() > 1) || (options.speedFactors.size() > 1) ||
+           (options.synthetic && (options.movers.size() > 1));
+}
+
+static bool parseOptions(int argC, char ** argV, t_bench_options & options)
+{
+    options.rate = 10.0;
+    options.cloudTopic = "/velodyne_points";
+    options.mapFrame = "/map";
+    options.poseFrame = "/base_footprint";
+    options.maxFrames = 0;
+    options.warmup = 5;
+    options.sensorHeight = -1.0;
+    options.movers = vector<uint32_t>(1, 10);
+    options.cellSizes = vector<double>(1, -1.0);
+    options.maxParticles = vector<int32_t>(1, -1);
+    options.speedFactors = vector<double>(1, -1.0);
+    options.numStatic = 40;
+    options.egoSpeed = 0.0;
+    options.seed = 1;
+    options.checkMetric = false;
+    options.tolerances.stages = 0.1;
+    options.tolerances.counters = 0.05;
+    options.tolerances.stageSlack = 0.0005;
+    
+    for (int i = 1; i < argC; i++) {
+        const string arg = argV[i];
+        const bool hasValue = (i + 1 < argC);
+        
+        if ((arg == "--params") && hasValue) {
+            options.paramsFile = argV[++i];
+        } else if ((arg == "--poses") && hasValue) {
+            options.posesFile = argV[++i];
+        } else if ((arg == "--rate") && hasValue) {
+            options.rate = atof(argV[++i]);
+        } else if ((arg == "--cloud-topic") && hasValue) {
+            options.cloudTopic = argV[++i];
+        } else if ((arg == "--map-frame") && hasValue) {
+            options.mapFrame = argV[++i];
+        } else if ((arg == "--pose-frame") && hasValue) {
+            options.poseFrame = argV[++i];
+        } else if ((arg == "--frames") && hasValue) {
+            options.maxFrames = atoi(argV[++i]);
+        } else if ((arg == "--warmup") && hasValue) {
+            options.warmup = atoi(argV[++i]);
+        } else if ((arg == "--sensor-height") && hasValue) {
+            options.sensorHeight = atof(argV[++i]);
+        } else if ((arg == "--movers") && hasValue) {
+            if (! parseList(argV[++i], options.movers))
+                return false;
+        } else if ((arg == "--cell-size") && hasValue) {
+            if (! parseList(argV[++i], options.cellSizes))
+                return false;
+        } else if ((arg == "--particles") && hasValue) {
+            if (! parseList(argV[++i], options.maxParticles))
+                return false;
+        } else if ((arg == "--speed-factor") && hasValue) {
+            if (! parseList(argV[++i], options.speedFactors))
+                return false;
+        } else if ((arg == "--eval") && hasValue) {
+            options.evalPrefix = argV[++i];
+        } else if ((arg == "--static") && hasValue) {
+            options.numStatic = atoi(argV[++i]);
+        } else if ((arg == "--ego-speed") && hasValue) {
+            options.egoSpeed = atof(argV[++i]);
+        } else if ((arg == "--seed") && hasValue) {
+            options.seed = atoi(argV[++i]);
+        } else if (arg == "--check-metric") {
+            options.checkMetric = true;
+        } else if ((arg == "--json") && hasValue) {
+            options.jsonFile = argV[++i];
+        } else if ((arg == "--baseline") && hasValue) {
+            options.baselineFile = argV[++i];
+        } else if ((arg == "--tolerance") && hasValue) {
+            options.tolerances.stages = atof(argV[++i]);
+        } else if ((arg == "--counter-tolerance") && hasValue) {
+            options.tolerances.counters = atof(argV[++i]);
+        } else if ((arg == "--slack-ms") && hasValue) {
+            options.tolerances.stageSlack = atof(argV[++i]) / 1000.0;
+        } else if ((arg == "--tolerance-of") && hasValue) {
+            const string metric = argV[++i];
+            const size_t equal = metric.find('=');
+            if (equal == string::npos)
+                return false;
+            options.tolerances.metrics[metric.substr(0, equal)] = atof(metric.substr(equal + 1).c_str());
+        } else if ((arg[0] != '-') && options.input.empty()) {
+            options.input = arg;
+        } else {
+            return false;
+        }
+    }
+    options.synthetic = (options.input == "synthetic");
+    
+    // A sweep has several runs, and the gate is for a single one
+    const bool gate = (! options.jsonFile.empty()) || (! options.baselineFile.empty());
+    if (gate && isSweep(options))
+        return false;
+    
+    return (! options.input.empty()) && (options.rate > 0.0);
+}
+
+int main(int argC, char ** argV)
+{
+    t_bench_options options;
+    if (! parseOptions(argC, argV, options)) {
+        usage(argV[0]);
+        return 1;
+    }
+    
+    // Needed by the tf lookups, not a master
+    ros::Time::init();
+    
+    ParamFile paramFile;
+    if ((! options.paramsFile.empty()) && (! paramFile.load(options.paramsFile))) {
+        fprintf(stderr, "%s could not be read\n", options.paramsFile.c_str());
+        return 1;
+    }
+    t_engine_params params;
+    string error;
+    if (! readEngineParams(paramFile, params, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    // The bench just has point clouds
+    params.inputFromCameras = false;
+    params.useOFlow = false;
+    
+    if (options.checkMetric) {
+        if (! options.synthetic) {
+            usage(argV[0]);
+            return 1;
+        }
+        return checkGroundTruthMetric(options, params.cellSizeX)? 0 : 1;
+    }
+    
+    const uint32_t windowSize = std::max(options.maxFrames, (uint32_t)100000);
+    
+    // The poses of a KITTI sequence are read by its reader
+    vector<t_stamped_pose> poses;
+    if ((! options.synthetic) && (! options.posesFile.empty()) && (! KittiReader::isSequence(options.input)) && 
+        (! loadPoses(options.posesFile, poses))) {
+        fprintf(stderr, "%s could not be read\n", options.posesFile.c_str());
+        return 1;
+    }
+    
+    vector<t_bench_config> configs;
+    const vector<uint32_t> movers = options.synthetic? options.movers : vector<uint32_t>(1, 0);
+    BOOST_FOREACH(const uint32_t & numMovers, movers) {
+        BOOST_FOREACH(const double & cellSize, options.cellSizes) {
+            BOOST_FOREACH(const int32_t & maxParticles, options.maxParticles) {
+                BOOST_FOREACH(const double & speedFactor, options.speedFactors) {
+                    const t_bench_config config = { numMovers, cellSize, maxParticles, speedFactor };
+                    configs.push_back(config);
+                }
+            }
+        }
+    }
+    
+    const bool sweep = isSweep(options);
+    vector<t_sweep_row> rows;
+    for (uint32_t i = 0; i < configs.size(); i++) {
+        t_engine_params configParams = params;
+        applyConfig(configs[i], configParams);
+        
+        BenchRun run(windowSize);
+        uint32_t numFrames;
+        if (options.synthetic) {
+            numFrames = (options.maxFrames != 0)? options.maxFrames : 50;
+            if (! runSynthetic(options, configParams, configs[i].numMovers, run)) {
+                fprintf(stderr, "No frames after the %u of warm up\n", options.warmup);
+                return 1;
+            }
+        } else if (! runRecorded(options, configParams, poses, run, numFrames)) {
+            if (numFrames != 0)
+                fprintf(stderr, "%u frames read, none after the %u of warm up\n", numFrames, options.warmup);
+            return 1;
+        }
+        
+        if (! options.evalPrefix.empty()) {
+            const string prefix = sweep? options.evalPrefix + "_" + boost::lexical_cast<string>(i) : options.evalPrefix;
+            if ((! run.odometry.writeCsv(prefix + ".csv")) || (! writeSummary(prefix + "_summary.txt", run, configParams))) {
+                fprintf(stderr, "%s could not be written\n", prefix.c_str());
+                return 1;
+            }
+        }
+        
+        if (! sweep) {
+            printRun(run, numFrames, configParams.threads);
+            return checkRun(options, run, numFrames);
+        }
+        
+        rows.push_back(sweepRow(run, configs[i], configParams));
+    }
+    
+    markParetoFront(rows);
+    printSweep(rows, options.synthetic);
+    if ((! options.evalPrefix.empty()) && (! writeSweep(options.evalPrefix + "_sweep.csv", rows))) {
+        fprintf(stderr, "%s_sweep.csv could not be written\n", options.evalPrefix.c_str());
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+/**
+ * Microbenchmarks of the per-particle and per-voxel kernels, with populations of particles 
+ * similar to the ones of a real frame (ages between 1 and 10, speeds up to max_vel_x/y).
+ * Times are per particle; bytes per particle are the size of a particle and its pointer.
+ * 
+ * voxel_odometry_microbench [--filter TEXT] [--min-time SECONDS] [--particles N[,N...]]
+ *                           [--speed-factor F[,F...]] [--yaw-interval Y[,Y...]]
+ */
+
+#include "microbench.h"
+#include "voxelodometryengine.h"
+#include "engineparams.h"
+#include "paramfile.h"
+#include "voxel.h"
+#include "voxelobstacle.h"
+#include "particle3d.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+using namespace voxel_odometry;
+using namespace std;
+
+// Voxels used by the obstacle benchmarks (the particles are spread among them)
+#define OBSTACLE_VOXELS 8
+
+// Keeps the compiler from removing the kernels whose result is not used
+static volatile double g_sink;
+
+static t_engine_params engineParams(const t_microbench_args & args)
+{
+    ParamFile noParams;
+    t_engine_params params;
+    string error;
+    readEngineParams(noParams, params, error);
+    
+    params.factorSpeed = args.speedFactor;
+    params.yawInterval = args.yawInterval;
+    params.threads = 1;
+    params.inputFromCameras = false;
+    
+    return params;
+}
+
+/**
+ * Voxels at 10 m of the vehicle, with the particles the filter would have put in them
+ */
+class ParticleFixture
+{
+public:
+    ParticleFixture(const t_microbench_args & args, const uint32_t & numVoxels = 1) : 
+                        m_params(engineParams(args)), m_random(1) {
+        boost::random::uniform_real_distribution<double> unit(0.0, 1.0);
+        boost::random::uniform_int_distribution<uint32_t> age(1, 10);
+        
+        for (uint32_t v = 0; v < numVoxels; v++) {
+            const uint32_t x = 60 + v % 2, y = 40 + (v / 2) % 2, z = 2 + v / 4;
+            VoxelPtr voxel = newVoxel(x, y, z);
+            
+            ParticleList particles;
+            const uint32_t numParticles = args.particles / numVoxels + ((v < args.particles % numVoxels)? 1 : 0);
+            for (uint32_t i = 0; i < numParticles; i++) {
+                ParticlePtr particle(new Particle3d(
+                    voxel->centroidX() + (unit(m_random) - 0.5) * m_params.cellSizeX, 
+                    voxel->centroidY() + (unit(m_random) - 0.5) * m_params.cellSizeY, 
+                    voxel->centroidZ() + (unit(m_random) - 0.5) * m_params.cellSizeZ,
+                    (2.0 * unit(m_random) - 1.0) * m_params.maxVelX, 
+                    (2.0 * unit(m_random) - 1.0) * m_params.maxVelY, 
+                    (2.0 * unit(m_random) - 1.0) * m_params.maxVelZ));
+                particle->setAge(age(m_random));
+                particles.push_back(particle);
+                m_particles.push_back(particle);
+            }
+            voxel->setParticles(particles);
+            m_voxels.push_back(voxel);
+        }
+    }
+    
+    // Grid of the engine: 40 x 40 m around the vehicle
+    VoxelPtr newVoxel(const uint32_t & x, const uint32_t & y, const uint32_t & z) const {
+        return VoxelPtr(new Voxel(x, y, z, 
+                                  -20.0 + (x + 0.5) * m_params.cellSizeX, -20.0 + (y + 0.5) * m_params.cellSizeY, 
+                                  0.5 + (z + 0.5) * m_params.cellSizeZ,
+                                  m_params.cellSizeX, m_params.cellSizeY, m_params.cellSizeZ, 
+                                  m_params.maxVelX, m_params.maxVelY, m_params.maxVelZ, NULL, 
+                                  m_params.speedMethod, m_params.yawInterval, m_params.pitchInterval, 
+                                  m_params.factorSpeed));
+    }
+    
+    VoxelObstacle newObstacle() {
+        VoxelObstacle obstacle(0, m_params.threshYaw, m_params.threshPitch, m_params.threshMagnitude, 
+                               m_params.minVoxelDensity, m_params.obstacleSpeedMethod, 
+                               m_params.yawInterval, m_params.pitchInterval);
+        BOOST_FOREACH(VoxelPtr & voxel, m_voxels)
+            obstacle.addVoxelToObstacle(voxel);
+        
+        return obstacle;
+    }
+    
+    t_engine_params m_params;
+    boost::random::mt19937 m_random;
+    VoxelList m_voxels;
+    ParticleList m_particles;
+};
+
+static uint64_t bytesPerParticle()
+{
+    return sizeof(Particle3d) + sizeof(ParticlePtr);
+}
+
+static void BM_particleTransform(MicroBenchState & state)
+{
+    ParticleFixture fixture(state.args());
+    
+    while (state.running()) {
+        BOOST_FOREACH(ParticlePtr & particle, fixture.m_particles)
+            particle->transform(0.1);
+    }
+    
+    state.setItemsPerIteration(fixture.m_particles.size());
+    state.setBytesPerItem(bytesPerParticle());
+}
+MICROBENCH(BM_particleTransform, MICROBENCH_ARG_PARTICLES)
+
+// Gives access to the per-particle helper of the engine
+class EngineProbe : public VoxelOdometryEngine
+{
+public:
+    EngineProbe(const t_engine_params & params) : VoxelOdometryEngine(params) {}
+    using VoxelOdometryEngine::particleToVoxel;
+};
+
+static void BM_particleToVoxel(MicroBenchState & state)
+{
+    ParticleFixture fixture(state.args());
+    EngineProbe engine(fixture.m_params);
+    
+    VoxelFrame frame;
+    frame.minX = frame.minY = -20.0;
+    frame.minZ = 0.5;
+    
+    while (state.running()) {
+        int32_t sum = 0;
+        BOOST_FOREACH(const ParticlePtr & particle, fixture.m_particles) {
+            int32_t x, y, z;
+            engine.particleToVoxel(frame, particle, x, y, z);
+            sum += x + y + z;
+        }
+        g_sink = sum;
+    }
+    
+    state.setItemsPerIteration(fixture.m_particles.size());
+    state.setBytesPerItem(bytesPerParticle());
+}
+MICROBENCH(BM_particleToVoxel, MICROBENCH_ARG_PARTICLES)
+
+// The number of particles depends on yaw_interval (and pitch_interval), not on --particles
+static void BM_createParticlesStatic(MicroBenchState & state)
+{
+    t_microbench_args args = state.args();
+    args.particles = 0;
+    ParticleFixture fixture(args);
+    
+    uint64_t numParticles = 0;
+    unsigned int seed = 1;
+    while (state.running()) {
+        const ParticleList particles = fixture.m_voxels[0]->createParticlesStatic(seed);
+        numParticles = particles.size();
+    }
+    
+    state.setItemsPerIteration(numParticles);
+    state.setBytesPerItem(bytesPerParticle());
+}
+MICROBENCH(BM_createParticlesStatic, MICROBENCH_ARG_YAW_INTERVAL)
+
+static void BM_voxelUpdateHistogram(MicroBenchState & state)
+{
+    ParticleFixture fixture(state.args());
+    
+    while (state.running()) {
+        // The histogram accumulates, so each iteration starts with a new voxel
+        state.pause();
+        VoxelPtr voxel = fixture.newVoxel(60, 40, 2);
+        voxel->setParticles(fixture.m_particles);
+        state.resume();
+        
+        voxel->updateHistogram();
+        g_sink = voxel->vx();
+    }
+    
+    state.setItemsPerIteration(fixture.m_particles.size());
+    state.setBytesPerItem(bytesPerParticle());
+}
+MICROBENCH(BM_voxelUpdateHistogram, MICROBENCH_ARG_PARTICLES | MICROBENCH_ARG_SPEED_FACTOR)
+
+static void BM_obstacleUpdateHistogram(MicroBenchState & state)
+{
+    ParticleFixture fixture(state.args(), OBSTACLE_VOXELS);
+    VoxelObstacle obstacle = fixture.newObstacle();
+    const t_engine_params & params = fixture.m_params;
+    const float minVel = sqrt(params.minVelX * params.minVelX + params.minVelY * params.minVelY + 
+                              params.minVelZ * params.minVelZ);
+    
+    while (state.running()) {
+        obstacle.updateHistogram(params.maxVelX, params.maxVelY, params.maxVelZ, params.factorSpeed, minVel);
+        g_sink = obstacle.vx();
+    }
+    
+    state.setItemsPerIteration(fixture.m_particles.size());
+    state.setBytesPerItem(bytesPerParticle());
+}
+MICROBENCH(BM_obstacleUpdateHistogram, MICROBENCH_ARG_PARTICLES | MICROBENCH_ARG_SPEED_FACTOR)
+
+static void BM_obstacleUpdateSpeedFromParticles(MicroBenchState & state)
+{
+    ParticleFixture fixture(state.args(), OBSTACLE_VOXELS);
+    VoxelObstacle obstacle = fixture.newObstacle();
+    
+    while (state.running()) {
+        obstacle.updateSpeedFromParticles();
+        g_sink = obstacle.vx();
+    }
+    
+    state.setItemsPerIteration(fixture.m_particles.size());
+    state.setBytesPerItem(bytesPerParticle());
+}
+MICROBENCH(BM_obstacleUpdateSpeedFromParticles, MICROBENCH_ARG_PARTICLES | MICROBENCH_ARG_YAW_INTERVAL)
+
+int main(int argC, char ** argV)
+{
+    string filter;
+    double minTime = 0.5;
+    vector<uint32_t> particles;
+    vector<double> speedFactors, yawIntervals;
+    parseList("100,1000,10000", particles);
+    parseList("0.1,0.05", speedFactors);
+    parseList("1.0,0.5", yawIntervals);
+    
+    for (int i = 1; i < argC; i++) {
+        const string arg = argV[i];
+        const bool hasValue = (i + 1 < argC);
+        
+        bool valid = hasValue;
+        if ((arg == "--filter") && hasValue) {
+            filter = argV[++i];
+        } else if ((arg == "--min-time") && hasValue) {
+            minTime = atof(argV[++i]);
+        } else if ((arg == "--particles") && hasValue) {
+            valid = parseList(argV[++i], particles);
+        } else if ((arg == "--speed-factor") && hasValue) {
+            valid = parseList(argV[++i], speedFactors);
+        } else if ((arg == "--yaw-interval") && hasValue) {
+            valid = parseList(argV[++i], yawIntervals);
+        } else {
+            valid = false;
+        }
+        
+        if (! valid) {
+            fprintf(stderr, "Usage: %s [--filter TEXT] [--min-time SECONDS] [--particles N[,N...]]\n"
+                            "       [--speed-factor F[,F...]] [--yaw-interval Y[,Y...]]\n", argV[0]);
+            return 1;
+        }
+    }
+    
+    printf("%-58s %12s %14s %14s %12s\n", "", "iterations", "us/iteration", "ns/particle", "B/particle");
+    BOOST_FOREACH(const t_microbench & benchmark, microBenchmarks()) {
+        if ((! filter.empty()) && (benchmark.name.find(filter) == string::npos))
+            continue;
+        
+        const uint32_t numParticles = (benchmark.argsUsed & MICROBENCH_ARG_PARTICLES)? particles.size() : 1;
+        const uint32_t numSpeedFactors = (benchmark.argsUsed & MICROBENCH_ARG_SPEED_FACTOR)? speedFactors.size() : 1;
+        const uint32_t numYawIntervals = (benchmark.argsUsed & MICROBENCH_ARG_YAW_INTERVAL)? yawIntervals.size() : 1;
+        
+        for (uint32_t p = 0; p < numParticles; p++) {
+            for (uint32_t s = 0; s < numSpeedFactors; s++) {
+                for (uint32_t y = 0; y < numYawIntervals; y++) {
+                    t_microbench_args args;
+                    args.particles = particles[p];
+                    args.speedFactor = speedFactors[s];
+                    args.yawInterval = yawIntervals[y];
+                    
+                    string name = benchmark.name;
+                    if (benchmark.argsUsed & MICROBENCH_ARG_PARTICLES)
+                        name += "/particles:" + boost::lexical_cast<string>(args.particles);
+                    if (benchmark.argsUsed & MICROBENCH_ARG_SPEED_FACTOR)
+                        name += "/speed_factor:" + boost::lexical_cast<string>(args.speedFactor);
+                    if (benchmark.argsUsed & MICROBENCH_ARG_YAW_INTERVAL)
+                        name += "/yaw_interval:" + boost::lexical_cast<string>(args.yawInterval);
+                    
+                    MicroBenchState state(args, minTime);
+                    benchmark.function(state);
+                    
+                    const double items = std::max(state.itemsPerIteration(), (uint64_t)1);
+                    printf("%-58s %12lu %14.3f %14.3f %12lu\n", name.c_str(), (unsigned long)state.iterations(), 
+                           state.secondsPerIteration() * 1e6, state.secondsPerIteration() * 1e9 / items, 
+                           (unsigned long)state.bytesPerItem());
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
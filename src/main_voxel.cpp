@@ -17,6 +17,7 @@
 #include "voxel_odometry.h"
 
 #include <iostream>
+#include <stdexcept>
 
 #include <ros/ros.h>
 
@@ -26,9 +27,14 @@ using namespace std;
 int main(int argC, char **argV) {
     ros::init(argC, argV, "voxel_odometry");
     
-    VoxelOdometry vo;
-    
-    ros::spin();
+    try {
+        VoxelOdometry vo;
+        
+        ros::spin();
+    } catch (const std::invalid_argument & e) {
+        // Already reported
+        return 1;
+    }
     
     return 0;
 }
\ No newline at end of file
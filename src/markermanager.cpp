@@ -0,0 +1,80 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "markermanager.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace voxel_odometry {
+
+/**
+ * Adds to markers the deletions of the markers published last time and not present now.
+ * @param markers: Markers of this frame (ADD/MODIFY). Ids have to be unique in each namespace.
+ */
+void MarkerManager::finish(visualization_msgs::MarkerArray & markers)
+{
+    m_current.clear();
+    for (uint32_t i = 0; i < markers.markers.size(); i++)
+        m_current.push_back(key(markers.markers[i]));
+    std::sort(m_current.begin(), m_current.end());
+    
+    m_gone.clear();
+    std::set_difference(m_published.begin(), m_published.end(), m_current.begin(), m_current.end(), 
+                        std::back_inserter(m_gone));
+    
+    if (! markers.markers.empty())
+        m_header = markers.markers[0].header;
+    
+    // Every marker of the frame is sent anyway, so a DELETEALL is cheaper than deleting most of them.
+    // It needs a frame, so it waits until a marker has been seen.
+    if ((m_reset || (m_gone.size() > m_current.size())) && (! m_header.frame_id.empty())) {
+        visualization_msgs::Marker deleteAll;
+        deleteAll.header = m_header;
+        deleteAll.action = visualization_msgs::Marker::DELETEALL;
+        
+        markers.markers.insert(markers.markers.begin(), deleteAll);
+        m_reset = false;
+    } else if (! m_gone.empty()) {
+        const uint32_t first = markers.markers.size();
+        markers.markers.resize(first + m_gone.size());
+        for (uint32_t i = 0; i < m_gone.size(); i++) {
+            visualization_msgs::Marker & marker = markers.markers[first + i];
+            marker.header = m_header;
+            marker.ns = m_namespaces[m_gone[i] >> 32];
+            marker.id = static_cast<int32_t>(m_gone[i] & 0xFFFFFFFF);
+            marker.action = visualization_msgs::Marker::DELETE;
+        }
+    }
+    
+    m_published.swap(m_current);
+}
+
+// Namespace and id of the marker in a single integer
+uint64_t MarkerManager::key(const visualization_msgs::Marker & marker)
+{
+    // Just a few namespaces per topic
+    uint32_t ns = 0;
+    while ((ns < m_namespaces.size()) && (m_namespaces[ns] != marker.ns))
+        ns++;
+    if (ns == m_namespaces.size())
+        m_namespaces.push_back(marker.ns);
+    
+    return (static_cast<uint64_t>(ns) << 32) | static_cast<uint32_t>(marker.id);
+}
+
+}
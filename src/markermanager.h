@@ -0,0 +1,60 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef MARKERMANAGER_H
+#define MARKERMANAGER_H
+
+#include <visualization_msgs/MarkerArray.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace voxel_odometry {
+
+/**
+ * Keeps the markers published last time in a topic, so just the changes are sent instead of
+ * cleaning every possible id before each frame. The markers of the frame are added as usual
+ * and finish() completes the array with a DELETE for each marker that is gone. If most of them
+ * are gone (or nothing was published before), a single DELETEALL goes first instead.
+ * Not thread safe: all the publications of a topic are expected from the same thread.
+ */
+class MarkerManager
+{
+public:
+    MarkerManager() : m_reset(true) {}
+
+    void finish(visualization_msgs::MarkerArray & markers);
+    
+    // The next finish() starts with a DELETEALL
+    void reset() { m_reset = true; }
+
+protected:
+    uint64_t key(const visualization_msgs::Marker & marker);
+
+    bool m_reset;
+    std_msgs::Header m_header;                  // Of the last markers
+    std::vector<std::string> m_namespaces;      // Position in the key
+    std::vector<uint64_t> m_published;          // Sorted
+    std::vector<uint64_t> m_current;
+    std::vector<uint64_t> m_gone;
+};
+
+}
+
+#endif // MARKERMANAGER_H
@@ -0,0 +1,156 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include "timeutils.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace voxel_odometry {
+
+// Values of the params a kernel depends on, for one run
+typedef struct {
+    uint32_t particles;
+    double speedFactor;
+    double yawInterval;
+} t_microbench_args;
+
+// Params each benchmark is run over (the rest are left at the first value of their list)
+#define MICROBENCH_ARG_PARTICLES 1
+#define MICROBENCH_ARG_SPEED_FACTOR 2
+#define MICROBENCH_ARG_YAW_INTERVAL 4
+
+/**
+ * Loop of a single benchmark, in the style of Google Benchmark:
+ * 
+ *     static void BM_kernel(MicroBenchState & state) {
+ *         Fixture fixture(state.args());
+ *         while (state.running()) { kernel(fixture); }
+ *         state.setItemsPerIteration(state.args().particles);
+ *     }
+ * 
+ * The body is repeated in batches of increasing size until a batch takes minTime.
+ * Whatever is run between pause and resume is not timed.
+ */
+class MicroBenchState
+{
+public:
+    MicroBenchState(const t_microbench_args & args, const double & minTime) : 
+                m_args(args), m_minTime(minTime), m_batchSize(1), m_remaining(0), m_iterations(0), 
+                m_elapsed(0.0), m_paused(0.0), m_pauseStart(0.0), m_itemsPerIteration(0), 
+                m_bytesPerItem(0), m_started(false) {}
+    
+    const t_microbench_args & args() const { return m_args; }
+    
+    bool running() {
+        if (m_remaining != 0) {
+            m_remaining--;
+            return true;
+        }
+        return nextBatch();
+    }
+    
+    void pause() { m_pauseStart = monotonicTime(); }
+    void resume() { m_paused += monotonicTime() - m_pauseStart; }
+    
+    // An item is whatever the ns and bytes are reported per (a particle, usually)
+    void setItemsPerIteration(const uint64_t & items) { m_itemsPerIteration = items; }
+    // Memory used (or touched) by each item
+    void setBytesPerItem(const uint64_t & bytes) { m_bytesPerItem = bytes; }
+    
+    uint64_t iterations() const { return m_iterations; }
+    double secondsPerIteration() const { return (m_iterations != 0)? m_elapsed / m_iterations : 0.0; }
+    uint64_t itemsPerIteration() const { return m_itemsPerIteration; }
+    uint64_t bytesPerItem() const { return m_bytesPerItem; }
+    
+protected:
+    bool nextBatch() {
+        const double now = monotonicTime();
+        if (m_started) {
+            const double batchTime = now - m_batchStart - m_paused;
+            if (batchTime >= m_minTime) {
+                m_iterations = m_batchSize;
+                m_elapsed = batchTime;
+                return false;
+            }
+            
+            // Aims a bit over minTime, so most benchmarks need one more batch at most
+            const double scale = (batchTime > 0.0)? 1.4 * m_minTime / batchTime : 10.0;
+            m_batchSize = std::max(m_batchSize + 1, (uint64_t)(m_batchSize * std::min(scale, 10.0)));
+        }
+        
+        m_started = true;
+        m_remaining = m_batchSize - 1;
+        m_paused = 0.0;
+        m_batchStart = monotonicTime();
+        return true;
+    }
+    
+    t_microbench_args m_args;
+    double m_minTime;
+    
+    uint64_t m_batchSize;
+    uint64_t m_remaining;
+    uint64_t m_iterations;
+    double m_batchStart;
+    double m_elapsed;
+    double m_paused, m_pauseStart;
+    
+    uint64_t m_itemsPerIteration;
+    uint64_t m_bytesPerItem;
+    bool m_started;
+};
+
+typedef void (*MicroBenchFunction)(MicroBenchState & state);
+
+typedef struct {
+    std::string name;
+    MicroBenchFunction function;
+    uint32_t argsUsed;                          // MICROBENCH_ARG_*
+} t_microbench;
+
+// Benchmarks registered with MICROBENCH
+inline std::vector<t_microbench> & microBenchmarks()
+{
+    static std::vector<t_microbench> benchmarks;
+    
+    return benchmarks;
+}
+
+struct MicroBenchRegistration
+{
+    MicroBenchRegistration(const char * name, MicroBenchFunction function, const uint32_t & argsUsed) {
+        t_microbench benchmark;
+        benchmark.name = name;
+        benchmark.function = function;
+        benchmark.argsUsed = argsUsed;
+        microBenchmarks().push_back(benchmark);
+    }
+};
+
+#define MICROBENCH(function, argsUsed) \
+    static voxel_odometry::MicroBenchRegistration function##Registration(#function, function, argsUsed);
+
+}
+
+#endif // MICROBENCH_H
@@ -0,0 +1,159 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "odometryeval.h"
+
+#include <math.h>
+#include <fstream>
+#include <algorithm>
+
+namespace voxel_odometry {
+
+// Frames between the starts of two segments, as in the KITTI devkit
+static const uint32_t SEGMENT_STEP = 10;
+
+OdometryEvaluator::OdometryEvaluator(const double & segmentLength) : m_segmentLength(segmentLength), 
+                                        m_firstGroundTruth(Eigen::Affine3d::Identity()), 
+                                        m_lastEstimate(Eigen::Affine2d::Identity())
+{
+}
+
+// Projection on the ground plane (x, y, yaw)
+static Eigen::Affine2d toPose2d(const Eigen::Affine3d & pose)
+{
+    const Eigen::Vector3d xAxis = pose.linear().col(0);
+    
+    Eigen::Affine2d pose2d = Eigen::Affine2d::Identity();
+    pose2d.translate(pose.translation().head<2>());
+    pose2d.rotate(atan2(xAxis.y(), xAxis.x()));
+    
+    return pose2d;
+}
+
+void OdometryEvaluator::add(const double & stamp, const t_odometry_state & estimate, 
+                            const Eigen::Affine3d & groundTruth, const double & runtime)
+{
+    if (m_frames.empty())
+        m_firstGroundTruth = groundTruth;
+    
+    t_eval_frame frame;
+    frame.stamp = stamp;
+    frame.runtime = runtime;
+    frame.valid = estimate.valid;
+    frame.groundTruth = toPose2d(m_firstGroundTruth.inverse() * groundTruth);
+    frame.distance = m_frames.empty()? 0.0 : m_frames.back().distance + 
+                        (frame.groundTruth.translation() - m_frames.back().groundTruth.translation()).norm();
+    
+    // The engine starts at the origin of its own frame
+    if (estimate.valid) {
+        m_lastEstimate = Eigen::Affine2d::Identity();
+        m_lastEstimate.translate(Eigen::Vector2d(estimate.x, estimate.y));
+        m_lastEstimate.rotate(estimate.theta);
+    }
+    frame.estimate = m_lastEstimate;
+    
+    m_frames.push_back(frame);
+}
+
+void OdometryEvaluator::relativeError(const Eigen::Affine2d & estimate1, const Eigen::Affine2d & estimate2, 
+                                      const Eigen::Affine2d & groundTruth1, const Eigen::Affine2d & groundTruth2, 
+                                      double & translation, double & rotation)
+{
+    const Eigen::Affine2d error = (groundTruth1.inverse() * groundTruth2).inverse() * (estimate1.inverse() * estimate2);
+    
+    translation = error.translation().norm();
+    rotation = fabs(atan2(error.linear()(1, 0), error.linear()(0, 0)));
+}
+
+t_odometry_errors OdometryEvaluator::errors() const
+{
+    t_odometry_errors errors;
+    errors.frames = m_frames.size();
+    errors.distance = m_frames.empty()? 0.0 : m_frames.back().distance;
+    errors.rpeTranslation = errors.rpeRotation = 0.0;
+    errors.segments = 0;
+    errors.drift = errors.rotationDrift = 0.0;
+    
+    if (m_frames.size() < 2)
+        return errors;
+    
+    for (uint32_t i = 1; i < m_frames.size(); i++) {
+        double translation, rotation;
+        relativeError(m_frames[i - 1].estimate, m_frames[i].estimate, 
+                      m_frames[i - 1].groundTruth, m_frames[i].groundTruth, translation, rotation);
+        errors.rpeTranslation += translation * translation;
+        errors.rpeRotation += rotation * rotation;
+    }
+    errors.rpeTranslation = sqrt(errors.rpeTranslation / (m_frames.size() - 1));
+    errors.rpeRotation = sqrt(errors.rpeRotation / (m_frames.size() - 1));
+    
+    // Each segment ends at the first frame segmentLength meters after its start
+    uint32_t last = 0;
+    for (uint32_t first = 0; first < m_frames.size(); first += SEGMENT_STEP) {
+        last = std::max(last, first);
+        while ((last < m_frames.size()) && (m_frames[last].distance - m_frames[first].distance < m_segmentLength))
+            last++;
+        if (last == m_frames.size())
+            break;
+        
+        double translation, rotation;
+        relativeError(m_frames[first].estimate, m_frames[last].estimate, 
+                      m_frames[first].groundTruth, m_frames[last].groundTruth, translation, rotation);
+        const double length = m_frames[last].distance - m_frames[first].distance;
+        errors.drift += 100.0 * translation / length;
+        errors.rotationDrift += (rotation * 180.0 / M_PI) * 100.0 / length;
+        errors.segments++;
+    }
+    if (errors.segments != 0) {
+        errors.drift /= errors.segments;
+        errors.rotationDrift /= errors.segments;
+    }
+    
+    return errors;
+}
+
+bool OdometryEvaluator::writeCsv(const std::string & fileName) const
+{
+    std::ofstream file(fileName.c_str());
+    if (! file.is_open())
+        return false;
+    
+    file << "stamp,valid,x,y,theta,gt_x,gt_y,gt_theta,distance,rpe_translation,rpe_rotation,runtime\n";
+    for (uint32_t i = 0; i < m_frames.size(); i++) {
+        const t_eval_frame & frame = m_frames[i];
+        
+        double translation = 0.0, rotation = 0.0;
+        if (i != 0) {
+            relativeError(m_frames[i - 1].estimate, frame.estimate, m_frames[i - 1].groundTruth, frame.groundTruth, 
+                          translation, rotation);
+        }
+        
+        const Eigen::Matrix2d & estimateRotation = frame.estimate.linear();
+        const Eigen::Matrix2d & groundTruthRotation = frame.groundTruth.linear();
+        file.precision(9);
+        file << frame.stamp << "," << (frame.valid? 1 : 0) << ","
+             << frame.estimate.translation().x() << "," << frame.estimate.translation().y() << "," 
+             << atan2(estimateRotation(1, 0), estimateRotation(0, 0)) << ","
+             << frame.groundTruth.translation().x() << "," << frame.groundTruth.translation().y() << "," 
+             << atan2(groundTruthRotation(1, 0), groundTruthRotation(0, 0)) << ","
+             << frame.distance << "," << translation << "," << rotation << "," << frame.runtime << "\n";
+    }
+    
+    return file.good();
+}
+
+}
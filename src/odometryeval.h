@@ -0,0 +1,87 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef ODOMETRYEVAL_H
+#define ODOMETRYEVAL_H
+
+#include "framesnapshot.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+namespace voxel_odometry {
+
+typedef struct {
+    uint32_t frames;                            // With ground truth
+    double distance;                            // Travelled (ground truth), meters
+    double rpeTranslation;                      // RMSE of the error between consecutive frames, meters
+    double rpeRotation;                         // Radians
+    uint32_t segments;                          // Of segmentLength, used for the drift
+    double drift;                               // Mean translation error at the end of a segment, %
+    double rotationDrift;                       // Degrees per 100 m
+} t_odometry_errors;
+
+/**
+ * Compares the odometry integrated by the engine (x, y, theta of FrameSnapshot::odometry) with 
+ * ground truth poses, both taken relative to their first frame and projected on the ground plane. 
+ * Errors are the relative pose error between consecutive frames and the drift over segments of 
+ * segmentLength meters (as the KITTI odometry benchmark). The runtime of each frame is kept 
+ * with its errors, for the CSV.
+ */
+class OdometryEvaluator
+{
+public:
+    OdometryEvaluator(const double & segmentLength = 100.0);
+    
+    void add(const double & stamp, const t_odometry_state & estimate, const Eigen::Affine3d & groundTruth, 
+             const double & runtime);
+    
+    t_odometry_errors errors() const;
+    
+    // One line per frame: stamp, poses, relative pose error and runtime
+    bool writeCsv(const std::string & fileName) const;
+    
+protected:
+    typedef struct {
+        double stamp;
+        double runtime;
+        bool valid;                             // The estimate of this frame
+        Eigen::Affine2d estimate;
+        Eigen::Affine2d groundTruth;
+        double distance;                        // Travelled since the first frame
+    } t_eval_frame;
+    
+    static void relativeError(const Eigen::Affine2d & estimate1, const Eigen::Affine2d & estimate2, 
+                              const Eigen::Affine2d & groundTruth1, const Eigen::Affine2d & groundTruth2, 
+                              double & translation, double & rotation);
+    
+    double m_segmentLength;
+    
+    std::vector<t_eval_frame, Eigen::aligned_allocator<t_eval_frame> > m_frames;
+    Eigen::Affine3d m_firstGroundTruth;
+    Eigen::Affine2d m_lastEstimate;             // Estimates are kept while the engine has none
+};
+
+}
+
+#endif // ODOMETRYEVAL_H
@@ -0,0 +1,72 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "paramfile.h"
+
+#include <fstream>
+
+namespace voxel_odometry {
+
+static std::string trim(const std::string & text)
+{
+    const size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return std::string();
+    const size_t end = text.find_last_not_of(" \t\r");
+    
+    return text.substr(begin, end - begin + 1);
+}
+
+bool ParamFile::load(const std::string & fileName)
+{
+    std::ifstream file(fileName.c_str());
+    if (! file.is_open())
+        return false;
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        
+        const std::string name = trim(line.substr(0, colon));
+        std::string value = trim(line.substr(colon + 1));
+        if ((value.size() >= 2) && ((value[0] == '"') || (value[0] == '\'')) && (value[value.size() - 1] == value[0]))
+            value = value.substr(1, value.size() - 2);
+        
+        if (! name.empty())
+            m_values[name] = value;
+    }
+    
+    return true;
+}
+
+bool ParamFile::convert(const std::string & text, bool & value)
+{
+    if ((text == "true") || (text == "True") || (text == "1")) {
+        value = true;
+    } else if ((text == "false") || (text == "False") || (text == "0")) {
+        value = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef PARAMFILE_H
+#define PARAMFILE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+
+namespace voxel_odometry {
+
+/**
+ * Params read from a flat YAML file ("name: value" lines, as the ones in params/), for the
+ * tools that run without a ROS master. param has the same behaviour as ros::NodeHandle::param.
+ */
+class ParamFile
+{
+public:
+    ParamFile() {}
+    
+    // Returns false if the file could not be read
+    bool load(const std::string & fileName);
+    
+    template <typename T>
+    bool param(const std::string & name, T & value, const T & defaultValue) const {
+        std::map<std::string, std::string>::const_iterator it = m_values.find(name);
+        if ((it == m_values.end()) || (! convert(it->second, value))) {
+            value = defaultValue;
+            return false;
+        }
+        return true;
+    }
+    
+    bool hasParam(const std::string & name) const { return m_values.find(name) != m_values.end(); }
+    
+protected:
+    template <typename T>
+    static bool convert(const std::string & text, T & value) {
+        try {
+            value = boost::lexical_cast<T>(text);
+        } catch (boost::bad_lexical_cast &) {
+            return false;
+        }
+        return true;
+    }
+    static bool convert(const std::string & text, bool & value);
+    static bool convert(const std::string & text, std::string & value) { value = text; return true; }
+    
+    std::map<std::string, std::string> m_values;
+};
+
+/**
+ * Values of a comma separated list (e.g. "0.1,0.05"), for the options of the tools. Returns 
+ * false if any of them is not valid, or if there are none.
+ */
+template <typename T>
+bool parseList(const std::string & text, std::vector<T> & values)
+{
+    values.clear();
+    
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        const size_t end = std::min(text.find(',', begin), text.size());
+        try {
+            values.push_back(boost::lexical_cast<T>(text.substr(begin, end - begin)));
+        } catch (boost::bad_lexical_cast &) {
+            return false;
+        }
+        begin = end + 1;
+    }
+    
+    return ! values.empty();
+}
+
+}
+
+#endif // PARAMFILE_H
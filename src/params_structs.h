@@ -35,6 +35,23 @@ namespace voxel_odometry {
     const string SPEED_METHOD_CIRC_HIST_STR = "speed_method_circ_hist";
     
     enum SpeedMethod { SPEED_METHOD_MEAN = 0, SPEED_METHOD_CIRC_HIST = 1 };
+    
+    const string ODOMETRY_METHOD_PARTICLES_STR = "odometry_method_particles";
+    const string ODOMETRY_METHOD_REGISTRATION_STR = "odometry_method_registration";
+    const string ODOMETRY_METHOD_BEV_STR = "odometry_method_bev";
+    
+    enum OdometryMethod { ODOMETRY_METHOD_PARTICLES = 0, ODOMETRY_METHOD_REGISTRATION = 1, ODOMETRY_METHOD_BEV = 2 };
+    
+    const string REGISTRATION_POINT_TO_POINT_STR = "registration_point_to_point";
+    const string REGISTRATION_POINT_TO_PLANE_STR = "registration_point_to_plane";
+    
+    enum RegistrationMetric { REGISTRATION_POINT_TO_POINT = 0, REGISTRATION_POINT_TO_PLANE = 1 };
+    
+    const string INGEST_POLICY_PROCESS_ALL_STR = "ingest_policy_process_all";
+    const string INGEST_POLICY_LATEST_ONLY_STR = "ingest_policy_latest_only";
+    const string INGEST_POLICY_SKIP_OLDER_STR = "ingest_policy_skip_older";
+    
+    enum IngestPolicy { INGEST_POLICY_PROCESS_ALL = 0, INGEST_POLICY_LATEST_ONLY = 1, INGEST_POLICY_SKIP_OLDER = 2 };
 // }
 
 // namespace voxel_odometry {
@@ -50,6 +67,13 @@ typedef struct {
     Eigen::Matrix< double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> t;
 } t_Camera_params;
 
+// Left camera of a stereo pair, as used for the occupancy of the voxels
+typedef struct {
+    double fx, fy;
+    double cx, cy;
+    double baseline;
+} t_stereo_camera;
+
 typedef struct {        
     int minDisparity;
     int numDisparities;
@@ -75,6 +99,15 @@ typedef struct {
     string time;
 } t_ego_value;
 
+// Motion of the vehicle frame between two consecutive frames, expressed in the previous one
+typedef struct {
+    double deltaX;
+    double deltaY;
+    double deltaYaw;
+    double deltaTime;
+    bool valid;
+} t_ego_motion;
+
 typedef struct {
     uint32_t numPoints;
     double magnitudeSum;
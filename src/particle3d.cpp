@@ -20,9 +20,6 @@
 #include <stdlib.h>
 #include <math.h>
 #include <boost/graph/graph_concepts.hpp>
-#include <eigen3/Eigen/Eigen>
-#include <eigen3/Eigen/Dense>
-#include <tf_conversions/tf_eigen.h>
 
 using namespace std;
 
@@ -30,21 +27,13 @@ namespace voxel_odometry {
 
 Particle3d::Particle3d(const double & centroidX, const double & centroidY, const double & centroidZ, 
                         const double & voxelSizeX, const double & voxelSizeY, const double & voxelSizeZ, 
-                       const double & maxVelX, const double & maxVelY, const double & maxVelZ, 
-                       const tf::StampedTransform & pose2mapTransform)
-                            : m_maxVelX(maxVelX), m_maxVelY(maxVelY), m_maxVelZ(maxVelZ), 
-                              m_pose2mapTransform(pose2mapTransform)
+                       const double & maxVelX, const double & maxVelY, const double & maxVelZ)
+                            : m_maxVelX(maxVelX), m_maxVelY(maxVelY), m_maxVelZ(maxVelZ)
 {
     m_x = centroidX;// + (((double)rand() / RAND_MAX) - 0.5) * voxelSizeX;
     m_y = centroidY;// + (((double)rand() / RAND_MAX) - 0.5) * voxelSizeY;
     m_z = centroidZ;// + (((double)rand() / RAND_MAX) - 0.5) * voxelSizeZ;
     
-    tf::Vector3 point = /*m_pose2mapTransform * */tf::Vector3(m_x, m_y, m_z);
-    
-    m_x = point[0];
-    m_y = point[1];
-    m_z = point[2];
-    
 //     const double theta = 0.0; //((double)rand() / RAND_MAX) * 2.0 * M_PI;
 //     const double gamma = 0.0; //((double)rand() / RAND_MAX) * 2.0 * M_PI;
     m_vx = m_maxVelX - 2.0 * m_maxVelX * ((double)rand() / RAND_MAX);
@@ -61,51 +50,30 @@ Particle3d::Particle3d(const double & centroidX, const double & centroidY, const
 }
 
 Particle3d::Particle3d(const double& x, const double& y, const double& z, 
-                       const double& vx, const double& vy, const double& vz, 
-                       const tf::StampedTransform & pose2mapTransform, const bool & transform)
-                    : m_x(x), m_y(y), m_z(z), m_vx(vx), m_vy(vy), m_vz(vz), 
-                      m_pose2mapTransform(pose2mapTransform)
+                       const double& vx, const double& vy, const double& vz)
+                    : m_x(x), m_y(y), m_z(z), m_vx(vx), m_vy(vy), m_vz(vz)
 {
-    if (transform) {
-        tf::Vector3 point = /*m_pose2mapTransform * */tf::Vector3(m_x, m_y, m_z);
-        
-        m_x = point[0];
-        m_y = point[1];
-        m_z = point[2];
-    }
-    
     m_age = 0;
     
     m_id = (int32_t)(255 * (double)rand() / RAND_MAX);
     
 }
 
+Particle3d::Particle3d(const double& x, const double& y, const double& z, 
+                       const double& vx, const double& vy, const double& vz, const int32_t & id)
+                    : m_x(x), m_y(y), m_z(z), m_vx(vx), m_vy(vy), m_vz(vz), m_id(id)
+{
+    m_age = 0;
+}
+
 Particle3d::Particle3d(const Particle3d& particle)
                             : m_x(particle.x()), m_y(particle.y()), m_z(particle.z()), 
                                 m_vx(particle.vx()), m_vy(particle.vy()), m_vz(particle.vz()),
-                                m_pose2mapTransform(particle.pose2mapTransform()), m_age(particle.age()),
+                                m_age(particle.age()),
                                 m_id(particle.id())
 {
 }
 
-tf::Quaternion Particle3d::getQuaternion() const
-{
-    if (m_vx == m_vy == m_vz == 0.0) {
-        return tf::Quaternion(0.0, 0.0, 0.0, 0.0);
-    }
-    
-    Eigen::Vector3d zeroVector, currVector;
-    zeroVector << 1.0, 0.0, 0.0;
-    currVector << m_vx, m_vy, m_vz;
-    currVector.normalize();
-    Eigen::Quaterniond eigenQuat;
-    eigenQuat.setFromTwoVectors(zeroVector, currVector);
-    
-    tf::Quaternion quat(eigenQuat.x(), eigenQuat.y(), eigenQuat.z(), eigenQuat.w());
-
-    return quat;
-}
-
 void Particle3d::getYawPitch(double & yaw, double & pitch) const
 {
     yaw = atan2(m_vy, m_vx);
@@ -136,6 +104,22 @@ void Particle3d::transform(const float & t)
     m_age++;
 }
 
+/**
+ * Moves the particle to the current vehicle frame, given the motion of the vehicle
+ * expressed in the previous one (p_prev = R * p_curr + t). The velocity is rotated.
+ */
+void Particle3d::egoTransform(const double & cosYaw, const double & sinYaw, const double & deltaX, const double & deltaY)
+{
+    const double x = m_x - deltaX;
+    const double y = m_y - deltaY;
+    m_x =  cosYaw * x + sinYaw * y;
+    m_y = -sinYaw * x + cosYaw * y;
+    
+    const double vx = m_vx;
+    m_vx =  cosYaw * vx + sinYaw * m_vy;
+    m_vy = -sinYaw * vx + cosYaw * m_vy;
+}
+
 void Particle3d::updatePosition(const float& x, const float& y, const float& z)
 {
     m_x = x;
@@ -22,8 +22,6 @@
 #include <iostream>
 #include <tiff.h>
 #include <Eigen/Core>
-#include <tf/transform_datatypes.h>
-#include <tf/transform_listener.h>
 #include <opencv2/opencv.hpp>
 
 using namespace std;
@@ -36,15 +34,16 @@ public:
     
     Particle3d(const double & centroidX, const double & centroidY, const double & centroidZ, 
                const double & voxelSizeX, const double & voxelSizeY, const double & voxelSizeZ, 
-               const double & maxVelX, const double & maxVelY, const double & maxVelZ,
-               const tf::StampedTransform & pose2mapTransform);
+               const double & maxVelX, const double & maxVelY, const double & maxVelZ);
     Particle3d(const double & x, const double & y, const double & z, 
-               const double & vx, const double & vy, const double & vz, 
-               const tf::StampedTransform & pose2mapTransform, const bool & transform = false);
+               const double & vx, const double & vy, const double & vz);
+    Particle3d(const double & x, const double & y, const double & z, 
+               const double & vx, const double & vy, const double & vz, const int32_t & id);
     
     Particle3d(const Particle3d & particle);
     
     void transform(const float & t);
+    void egoTransform(const double & cosYaw, const double & sinYaw, const double & deltaX, const double & deltaY);
     
     void updatePosition(const float & x, const float & y, const float & z);
     
@@ -65,11 +64,8 @@ public:
     void setId(const int32_t & id) { m_id = id; }
     
     
-    tf::Quaternion getQuaternion() const;
     void getYawPitch(double & yaw, double & pitch) const;
     
-    tf::StampedTransform pose2mapTransform() const { return m_pose2mapTransform; }
-    
     bool operator < (const Particle3d & particle) const;
     
     friend ostream& operator<<(ostream & stream, const Particle3d & in);
@@ -83,8 +79,6 @@ private:
     int32_t m_id;
     
     double m_maxVelX, m_maxVelY, m_maxVelZ;
-    
-    tf::StampedTransform m_pose2mapTransform;
 };
     
 }
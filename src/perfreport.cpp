@@ -0,0 +1,126 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "perfreport.h"
+
+#include <boost/foreach.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace voxel_odometry {
+
+static const char * const GROUP_INFO = "info";
+static const char * const GROUP_STAGES = "stages";
+static const char * const GROUP_COUNTERS = "counters";
+
+void PerfReport::setInfo(const std::string & name, const std::string & value)
+{
+    m_tree.put(boost::property_tree::ptree::path_type(std::string(GROUP_INFO) + "/" + name, '/'), value);
+}
+
+void PerfReport::addStage(const std::string & name, const t_percentiles & percentiles)
+{
+    add(GROUP_STAGES, name, percentiles);
+}
+
+void PerfReport::addCounter(const std::string & name, const t_percentiles & percentiles)
+{
+    add(GROUP_COUNTERS, name, percentiles);
+}
+
+void PerfReport::add(const std::string & group, const std::string & name, const t_percentiles & percentiles)
+{
+    boost::property_tree::ptree metric;
+    metric.put("p50", percentiles.p50);
+    metric.put("p99", percentiles.p99);
+    
+    boost::optional<boost::property_tree::ptree &> groupTree = m_tree.get_child_optional(group);
+    if (! groupTree)
+        groupTree = m_tree.put_child(group, boost::property_tree::ptree());
+    // Names are used as single keys, even if they had dots
+    groupTree->push_back(std::make_pair(name, metric));
+}
+
+bool PerfReport::save(const std::string & fileName, std::string & error) const
+{
+    try {
+        boost::property_tree::write_json(fileName, m_tree);
+    } catch (boost::property_tree::json_parser_error & ex) {
+        error = ex.what();
+        return false;
+    }
+    return true;
+}
+
+bool PerfReport::load(const std::string & fileName, std::string & error)
+{
+    m_tree.clear();
+    try {
+        boost::property_tree::read_json(fileName, m_tree);
+    } catch (boost::property_tree::json_parser_error & ex) {
+        error = ex.what();
+        return false;
+    }
+    return true;
+}
+
+std::string PerfReport::info(const std::string & name) const
+{
+    return m_tree.get(boost::property_tree::ptree::path_type(std::string(GROUP_INFO) + "/" + name, '/'), 
+                      std::string());
+}
+
+std::vector<t_perf_regression> PerfReport::compare(const PerfReport & baseline, 
+                                                   const t_perf_tolerances & tolerances) const
+{
+    std::vector<t_perf_regression> regressions;
+    
+    const char * const groups[] = { GROUP_STAGES, GROUP_COUNTERS };
+    for (uint32_t g = 0; g < 2; g++) {
+        const bool isStage = (g == 0);
+        const boost::property_tree::ptree emptyTree;
+        const boost::property_tree::ptree & baselineGroup = baseline.m_tree.get_child(groups[g], emptyTree);
+        const boost::property_tree::ptree & currentGroup = m_tree.get_child(groups[g], emptyTree);
+        
+        BOOST_FOREACH(const boost::property_tree::ptree::value_type & baselineMetric, baselineGroup) {
+            boost::property_tree::ptree::const_assoc_iterator currentIt = currentGroup.find(baselineMetric.first);
+            
+            BOOST_FOREACH(const boost::property_tree::ptree::value_type & value, baselineMetric.second) {
+                t_perf_regression regression;
+                regression.metric = std::string(groups[g]) + "." + baselineMetric.first + "." + value.first;
+                regression.baseline = value.second.get_value<double>(0.0);
+                regression.current = -1.0;
+                
+                std::map<std::string, double>::const_iterator toleranceIt = tolerances.metrics.find(regression.metric);
+                const double tolerance = (toleranceIt != tolerances.metrics.end())? toleranceIt->second :
+                                                        (isStage? tolerances.stages : tolerances.counters);
+                regression.limit = regression.baseline * (1.0 + tolerance) + (isStage? tolerances.stageSlack : 0.0);
+                
+                if (currentIt == currentGroup.not_found()) {
+                    regressions.push_back(regression);
+                    continue;
+                }
+                regression.current = currentIt->second.get(value.first, -1.0);
+                if ((regression.current < 0.0) || (regression.current > regression.limit))
+                    regressions.push_back(regression);
+            }
+        }
+    }
+    
+    return regressions;
+}
+
+}
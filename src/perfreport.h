@@ -0,0 +1,74 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef PERFREPORT_H
+#define PERFREPORT_H
+
+#include "rollingstats.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace voxel_odometry {
+
+typedef struct {
+    double stages;                              // Relative increase allowed in the time of a stage
+    double counters;                            // Relative increase allowed in a counter
+    double stageSlack;                          // Seconds always allowed, for the stages that take ~0
+    std::map<std::string, double> metrics;      // Overrides, by metric name (e.g. "stages.segment.p99")
+} t_perf_tolerances;
+
+typedef struct {
+    std::string metric;
+    double baseline, current, limit;
+} t_perf_regression;
+
+/**
+ * p50 and p99 of the stages (seconds, with the names of voxel_odometry/stats.msg) and of the 
+ * counters of a benchmark run, saved as JSON so a run can be compared with a baseline.
+ */
+class PerfReport
+{
+public:
+    PerfReport() {}
+    
+    void setInfo(const std::string & name, const std::string & value);
+    void addStage(const std::string & name, const t_percentiles & percentiles);
+    void addCounter(const std::string & name, const t_percentiles & percentiles);
+    
+    bool save(const std::string & fileName, std::string & error) const;
+    bool load(const std::string & fileName, std::string & error);
+    
+    std::string info(const std::string & name) const;
+    
+    // Metrics of this report above the ones of baseline plus their tolerance. Metrics not 
+    // in the baseline are not checked; the ones missing here are returned with current < 0.
+    std::vector<t_perf_regression> compare(const PerfReport & baseline, const t_perf_tolerances & tolerances) const;
+    
+protected:
+    void add(const std::string & group, const std::string & name, const t_percentiles & percentiles);
+    
+    boost::property_tree::ptree m_tree;
+};
+
+}
+
+#endif // PERFREPORT_H
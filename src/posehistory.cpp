@@ -0,0 +1,149 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "posehistory.h"
+
+#include <algorithm>
+
+namespace voxel_odometry {
+
+void PoseHistory::push(const double & stamp, const Eigen::Affine3d & pose)
+{
+    const uint64_t head = m_head.load(boost::memory_order_relaxed);
+    
+    const Eigen::Quaterniond rotation(pose.rotation());
+    t_pose_sample & sample = m_samples[head % POSE_HISTORY_SIZE];
+    sample.stamp = stamp;
+    sample.tx = pose.translation().x();
+    sample.ty = pose.translation().y();
+    sample.tz = pose.translation().z();
+    sample.qx = rotation.x();
+    sample.qy = rotation.y();
+    sample.qz = rotation.z();
+    sample.qw = rotation.w();
+    
+    m_head.store(head + 1, boost::memory_order_release);
+}
+
+/**
+ * Copies the most recent samples, oldest first.
+ * @return The number of samples copied.
+ */
+uint32_t PoseHistory::copyRecent(t_pose_sample * samples, const uint32_t & maxSamples) const
+{
+    while (true) {
+        const uint64_t head = m_head.load(boost::memory_order_acquire);
+        const uint64_t numSamples = std::min(head, (uint64_t)maxSamples);
+        
+        for (uint64_t i = 0; i < numSamples; i++)
+            samples[i] = m_samples[(head - numSamples + i) % POSE_HISTORY_SIZE];
+        
+        // The copy is valid if the writer did not overwrite the oldest sample meanwhile
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        const uint64_t newHead = m_head.load(boost::memory_order_relaxed);
+        if (newHead - (head - numSamples) < POSE_HISTORY_SIZE)
+            return numSamples;
+    }
+}
+
+PoseStatus PoseHistory::lookup(const double & stamp, const double & maxExtrapolation, Eigen::Affine3d & pose) const
+{
+    t_pose_sample samples[POSE_HISTORY_SIZE / 2];
+    const uint32_t numSamples = copyRecent(samples, POSE_HISTORY_SIZE / 2);
+    
+    if (numSamples == 0)
+        return POSE_UNAVAILABLE;
+    
+    const t_pose_sample & newest = samples[numSamples - 1];
+    
+    // A chain of static transforms has a single sample, at stamp 0, which is valid at any time
+    if ((numSamples == 1) && (newest.stamp == 0.0)) {
+        toPose(newest, pose);
+        return POSE_INTERPOLATED;
+    }
+    
+    if (stamp > newest.stamp) {
+        if ((numSamples > 1) && (stamp - newest.stamp <= maxExtrapolation)) {
+            interpolate(samples[numSamples - 2], newest, stamp, pose);
+            return POSE_EXTRAPOLATED;
+        }
+        toPose(newest, pose);
+        return POSE_STALE;
+    }
+    
+    if (stamp < samples[0].stamp) {
+        toPose(samples[0], pose);
+        return POSE_STALE;
+    }
+    
+    for (uint32_t i = numSamples - 1; i > 0; i--) {
+        if (samples[i - 1].stamp <= stamp) {
+            interpolate(samples[i - 1], samples[i], stamp, pose);
+            return POSE_INTERPOLATED;
+        }
+    }
+    
+    // Just one sample, at this very stamp
+    toPose(newest, pose);
+    return POSE_INTERPOLATED;
+}
+
+PoseStatus PoseHistory::latest(Eigen::Affine3d & pose) const
+{
+    t_pose_sample sample;
+    if (copyRecent(&sample, 1) == 0)
+        return POSE_UNAVAILABLE;
+    
+    toPose(sample, pose);
+    return POSE_INTERPOLATED;
+}
+
+double PoseHistory::newestStamp() const
+{
+    t_pose_sample sample;
+    if (copyRecent(&sample, 1) == 0)
+        return 0.0;
+    
+    return sample.stamp;
+}
+
+void PoseHistory::toPose(const t_pose_sample & sample, Eigen::Affine3d & pose)
+{
+    pose = Eigen::Translation3d(sample.tx, sample.ty, sample.tz) * 
+           Eigen::Quaterniond(sample.qw, sample.qx, sample.qy, sample.qz);
+}
+
+/**
+ * Linear interpolation of the translation and slerp of the rotation. With stamp after 
+ * sample2, the motion between both samples is extrapolated.
+ */
+void PoseHistory::interpolate(const t_pose_sample & sample1, const t_pose_sample & sample2, 
+                              const double & stamp, Eigen::Affine3d & pose)
+{
+    const double deltaStamp = sample2.stamp - sample1.stamp;
+    const double t = (deltaStamp > 0.0)? (stamp - sample1.stamp) / deltaStamp : 1.0;
+    
+    const Eigen::Vector3d translation1(sample1.tx, sample1.ty, sample1.tz);
+    const Eigen::Vector3d translation2(sample2.tx, sample2.ty, sample2.tz);
+    const Eigen::Quaterniond rotation1(sample1.qw, sample1.qx, sample1.qy, sample1.qz);
+    const Eigen::Quaterniond rotation2(sample2.qw, sample2.qx, sample2.qy, sample2.qz);
+    
+    pose = Eigen::Translation3d(translation1 + t * (translation2 - translation1)) * 
+           rotation1.slerp(t, rotation2);
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef POSEHISTORY_H
+#define POSEHISTORY_H
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+
+#include <Eigen/Geometry>
+
+#define POSE_HISTORY_SIZE 128
+
+namespace voxel_odometry {
+
+enum PoseStatus { POSE_INTERPOLATED = 0, POSE_EXTRAPOLATED = 1, POSE_STALE = 2, POSE_UNAVAILABLE = 3 };
+
+/**
+ * Last poses received for a pair of frames, in a ring buffer written by a single thread. 
+ * Readers never lock: they copy the most recent half of the ring and check afterwards that 
+ * the writer did not reach it meanwhile (which would take POSE_HISTORY_SIZE / 2 new poses 
+ * during the copy), retrying in that case.
+ */
+class PoseHistory
+{
+public:
+    PoseHistory() : m_head(0) {}
+    
+    // Just from the writer thread. Poses have to be pushed in order.
+    void push(const double & stamp, const Eigen::Affine3d & pose);
+    
+    /**
+     * Pose at a certain time, interpolated between the closest samples. After the newest sample
+     * it is extrapolated up to maxExtrapolation seconds; out of the history, the closest sample
+     * is returned as stale. A single sample at stamp 0 (static transforms) is valid at any time. 
+     * If there are no samples, pose is not modified.
+     */
+    PoseStatus lookup(const double & stamp, const double & maxExtrapolation, Eigen::Affine3d & pose) const;
+    PoseStatus latest(Eigen::Affine3d & pose) const;
+    
+    double newestStamp() const;
+    bool empty() const { return m_head.load(boost::memory_order_acquire) == 0; }
+    
+protected:
+    typedef struct {
+        double stamp;
+        double tx, ty, tz;
+        double qx, qy, qz, qw;
+    } t_pose_sample;
+    
+    uint32_t copyRecent(t_pose_sample * samples, const uint32_t & maxSamples) const;
+    static void toPose(const t_pose_sample & sample, Eigen::Affine3d & pose);
+    static void interpolate(const t_pose_sample & sample1, const t_pose_sample & sample2, 
+                            const double & stamp, Eigen::Affine3d & pose);
+    
+    t_pose_sample m_samples[POSE_HISTORY_SIZE];
+    boost::atomic<uint64_t> m_head;                 // Number of samples pushed so far
+};
+
+}
+
+#endif // POSEHISTORY_H
@@ -0,0 +1,124 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "poseprovider.h"
+
+#include <tf_conversions/tf_eigen.h>
+
+#include <boost/bind.hpp>
+
+namespace voxel_odometry {
+
+PoseProvider::PoseProvider(tf::TransformListener & listener, const double & pollRate, 
+                           const double & maxExtrapolation) : 
+                                m_listener(listener), m_pollRate(pollRate), m_maxExtrapolation(maxExtrapolation),
+                                m_numPairs(0)
+{
+    m_pollThread = boost::thread(boost::bind(&PoseProvider::pollLoop, this));
+}
+
+PoseProvider::~PoseProvider()
+{
+    m_pollThread.interrupt();
+    m_pollThread.join();
+}
+
+bool PoseProvider::addPair(const std::string & targetFrame, const std::string & sourceFrame, 
+                           const bool & isStatic, uint32_t & pairIdx)
+{
+    boost::mutex::scoped_lock lock(m_addMutex);
+    
+    const uint32_t numPairs = m_numPairs.load(boost::memory_order_acquire);
+    for (uint32_t i = 0; i < numPairs; i++) {
+        if ((m_pairs[i].targetFrame == targetFrame) && (m_pairs[i].sourceFrame == sourceFrame)) {
+            pairIdx = i;
+            return true;
+        }
+    }
+    
+    if (numPairs == MAX_POSE_PAIRS) {
+        ROS_ERROR_NAMED(__FILE__, "Too many pairs of frames, %s -> %s is not followed", 
+                        sourceFrame.c_str(), targetFrame.c_str());
+        return false;
+    }
+    
+    t_frame_pair & pair = m_pairs[numPairs];
+    pair.targetFrame = targetFrame;
+    pair.sourceFrame = sourceFrame;
+    pair.isStatic = isStatic;
+    
+    // First pose, so the pair can be used right away. The poller does not see it yet.
+    poll(pair);
+    
+    m_numPairs.store(numPairs + 1, boost::memory_order_release);
+    
+    pairIdx = numPairs;
+    return true;
+}
+
+PoseStatus PoseProvider::lookup(const uint32_t & pairIdx, const double & stamp, Eigen::Affine3d & pose) const
+{
+    const t_frame_pair & pair = m_pairs[pairIdx];
+    
+    if (pair.isStatic)
+        return pair.history.latest(pose);
+    
+    return pair.history.lookup(stamp, m_maxExtrapolation, pose);
+}
+
+void PoseProvider::poll(t_frame_pair & pair)
+{
+    if (pair.isStatic && (! pair.history.empty()))
+        return;
+    
+    tf::StampedTransform transform;
+    try {
+        m_listener.lookupTransform(pair.targetFrame, pair.sourceFrame, ros::Time(0), transform);
+    } catch (tf::TransformException ex) {
+        ROS_DEBUG("[%s] %s", __FUNCTION__, ex.what());
+        return;
+    }
+    
+    const double stamp = transform.stamp_.toSec();
+    if ((! pair.history.empty()) && (stamp <= pair.history.newestStamp()))
+        return;
+    
+    Eigen::Affine3d pose;
+    tf::transformTFToEigen(transform, pose);
+    pair.history.push(stamp, pose);
+}
+
+/**
+ * Main loop of the poll thread. It is the only writer of the histories.
+ */
+void PoseProvider::pollLoop()
+{
+    const boost::posix_time::microseconds period(1e6 / m_pollRate);
+    
+    try {
+        while (true) {
+            const uint32_t numPairs = m_numPairs.load(boost::memory_order_acquire);
+            for (uint32_t i = 0; i < numPairs; i++)
+                poll(m_pairs[i]);
+            
+            boost::this_thread::sleep(period);
+        }
+    } catch (boost::thread_interrupted &) {
+    }
+}
+
+}
@@ -0,0 +1,79 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef POSEPROVIDER_H
+#define POSEPROVIDER_H
+
+#include "posehistory.h"
+
+#include <string>
+
+#include <tf/transform_listener.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#define MAX_POSE_PAIRS 8
+
+namespace voxel_odometry {
+
+/**
+ * Keeps the recent transforms between some pairs of frames, so the frames can get their poses 
+ * without waiting for tf. A thread polls the listener at pollRate and fills a PoseHistory 
+ * per pair; lookup just reads from it, without locking. Static pairs are looked up until 
+ * the first transform is received, and then kept forever.
+ */
+class PoseProvider
+{
+public:
+    PoseProvider(tf::TransformListener & listener, const double & pollRate, const double & maxExtrapolation);
+    ~PoseProvider();
+    
+    // Transform from sourceFrame to targetFrame. If the pair already exists, its index is returned.
+    // Returns false if there are already MAX_POSE_PAIRS pairs.
+    bool addPair(const std::string & targetFrame, const std::string & sourceFrame, const bool & isStatic, 
+                 uint32_t & pairIdx);
+    
+    // If the result is POSE_UNAVAILABLE, pose is not modified
+    PoseStatus lookup(const uint32_t & pairIdx, const double & stamp, Eigen::Affine3d & pose) const;
+    
+protected:
+    typedef struct {
+        std::string targetFrame, sourceFrame;
+        bool isStatic;
+        PoseHistory history;
+    } t_frame_pair;
+    
+    void pollLoop();
+    void poll(t_frame_pair & pair);
+    
+    tf::TransformListener & m_listener;
+    double m_pollRate;
+    double m_maxExtrapolation;
+    
+    // Pairs are never removed, so the poller and lookup can go through them without locking
+    t_frame_pair m_pairs[MAX_POSE_PAIRS];
+    boost::atomic<uint32_t> m_numPairs;
+    boost::mutex m_addMutex;
+    
+    boost::thread m_pollThread;
+};
+
+}
+
+#endif // POSEPROVIDER_H
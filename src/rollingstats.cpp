@@ -0,0 +1,77 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "rollingstats.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace voxel_odometry {
+
+RollingStats::RollingStats(const uint32_t & windowSize) : m_windowSize(std::max(windowSize, (uint32_t)1))
+{
+}
+
+uint32_t RollingStats::addSeries(const std::string & name)
+{
+    t_series series;
+    series.name = name;
+    series.values.reserve(m_windowSize);
+    series.next = 0;
+    
+    m_series.push_back(series);
+    
+    return m_series.size() - 1;
+}
+
+void RollingStats::add(const uint32_t & series, const double & value)
+{
+    t_series & currSeries = m_series[series];
+    
+    if (currSeries.values.size() < m_windowSize) {
+        currSeries.values.push_back(value);
+    } else {
+        currSeries.values[currSeries.next] = value;
+        currSeries.next = (currSeries.next + 1) % m_windowSize;
+    }
+}
+
+/**
+ * Nearest-rank percentiles. All of them are 0 if the series has no values yet.
+ */
+t_percentiles RollingStats::percentiles(const uint32_t & series) const
+{
+    t_percentiles result;
+    result.p50 = result.p90 = result.p99 = result.max = 0.0;
+    
+    const std::vector<double> & values = m_series[series].values;
+    if (values.empty())
+        return result;
+    
+    m_sorted = values;
+    std::sort(m_sorted.begin(), m_sorted.end());
+    
+    const uint32_t numValues = m_sorted.size();
+    result.p50 = m_sorted[std::max((int32_t)ceil(0.50 * numValues) - 1, 0)];
+    result.p90 = m_sorted[std::max((int32_t)ceil(0.90 * numValues) - 1, 0)];
+    result.p99 = m_sorted[std::max((int32_t)ceil(0.99 * numValues) - 1, 0)];
+    result.max = m_sorted[numValues - 1];
+    
+    return result;
+}
+
+}
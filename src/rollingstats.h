@@ -0,0 +1,68 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef ROLLINGSTATS_H
+#define ROLLINGSTATS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace voxel_odometry {
+
+typedef struct {
+    double p50, p90, p99, max;
+} t_percentiles;
+
+/**
+ * Percentiles of several series over the last windowSize values of each one.
+ * Adding a value is O(1); percentiles are computed on request, so they are meant to be
+ * read at a low rate. Not thread safe.
+ */
+class RollingStats
+{
+public:
+    RollingStats(const uint32_t & windowSize);
+    
+    // Returns the index of the new series
+    uint32_t addSeries(const std::string & name);
+    void add(const uint32_t & series, const double & value);
+    
+    t_percentiles percentiles(const uint32_t & series) const;
+    
+    uint32_t numSeries() const { return m_series.size(); }
+    const std::string & name(const uint32_t & series) const { return m_series[series].name; }
+    uint32_t numValues(const uint32_t & series) const { return m_series[series].values.size(); }
+    uint32_t windowSize() const { return m_windowSize; }
+    
+protected:
+    typedef struct {
+        std::string name;
+        std::vector<double> values;
+        uint32_t next;                          // Position of the next value, once the window is full
+    } t_series;
+    
+    uint32_t m_windowSize;
+    std::vector<t_series> m_series;
+    
+    mutable std::vector<double> m_sorted;
+};
+
+}
+
+#endif // ROLLINGSTATS_H
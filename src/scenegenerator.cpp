@@ -0,0 +1,222 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "scenegenerator.h"
+
+#include <math.h>
+#include <limits>
+#include <algorithm>
+
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/random/normal_distribution.hpp>
+
+namespace voxel_odometry {
+
+SceneGenerator::SceneGenerator(const t_scene_params & params) : m_params(params), m_random(params.seed)
+{
+    m_egoPosition = Eigen::Vector3d::Zero();
+    m_numScans = 0;
+    
+    createObjects();
+}
+
+t_scene_params SceneGenerator::defaultParams()
+{
+    t_scene_params params;
+    
+    params.seed = 1;
+    params.rate = 10.0;
+    
+    // Similar to a HDL-32E
+    params.numRings = 32;
+    params.pointsPerRing = 1800;
+    params.minElevation = -30.67 * M_PI / 180.0;
+    params.maxElevation = 10.67 * M_PI / 180.0;
+    params.sensorHeight = 1.8;
+    params.maxRange = 70.0;
+    params.rangeNoise = 0.02;
+    params.ground = true;
+    
+    // Covers the grid of the engine (40 x 40 m around the vehicle)
+    params.sceneSize = 40.0;
+    params.clearRadius = 7.0;
+    params.numStatic = 40;
+    params.numMovers = 10;
+    params.pedestrianRatio = 0.5;
+    params.minSpeed = 0.5;
+    params.maxSpeed = 2.0;
+    params.egoSpeed = 0.0;
+    
+    return params;
+}
+
+void SceneGenerator::createObjects()
+{
+    boost::random::uniform_real_distribution<double> position(-m_params.sceneSize / 2.0, m_params.sceneSize / 2.0);
+    boost::random::uniform_real_distribution<double> unit(0.0, 1.0);
+    boost::random::uniform_real_distribution<double> angle(-M_PI, M_PI);
+    
+    const uint32_t numObjects = m_params.numStatic + m_params.numMovers;
+    for (uint32_t i = 0; i < numObjects; i++) {
+        t_scene_object object;
+        object.id = i;
+        object.isStatic = (i < m_params.numStatic);
+        object.pedestrian = (! object.isStatic) && (unit(m_random) < m_params.pedestrianRatio);
+        object.velocity = Eigen::Vector3d::Zero();
+        object.hits = 0;
+        
+        if (object.isStatic) {
+            object.size = Eigen::Vector3d(0.3 + 4.0 * unit(m_random), 0.3 + 4.0 * unit(m_random), 0.5 + 3.0 * unit(m_random));
+        } else if (object.pedestrian) {
+            object.size = Eigen::Vector3d(0.5, 0.5, 1.7);
+        } else {
+            object.size = Eigen::Vector3d(4.2, 1.8, 1.5);
+        }
+        
+        do {
+            object.center = Eigen::Vector3d(position(m_random), position(m_random), 0.0);
+        } while (object.center.head<2>().norm() < m_params.clearRadius);
+        
+        if (! object.isStatic) {
+            const double speed = m_params.minSpeed + (m_params.maxSpeed - m_params.minSpeed) * unit(m_random);
+            const double direction = angle(m_random);
+            object.velocity = Eigen::Vector3d(speed * cos(direction), speed * sin(direction), 0.0);
+            
+            // Cars are aligned with their motion (as far as an axis aligned box can be)
+            if ((! object.pedestrian) && (fabs(object.velocity.y()) > fabs(object.velocity.x())))
+                std::swap(object.size.x(), object.size.y());
+        }
+        
+        m_objects.push_back(object);
+    }
+}
+
+/**
+ * Movers bounce at the border of the scene (which moves with the vehicle), so they never leave it
+ */
+void SceneGenerator::moveObjects(const double & deltaTime)
+{
+    m_egoPosition.x() += m_params.egoSpeed * deltaTime;
+    
+    const double halfSize = m_params.sceneSize / 2.0;
+    for (uint32_t i = 0; i < m_objects.size(); i++) {
+        t_scene_object & object = m_objects[i];
+        if (object.isStatic)
+            continue;
+        
+        object.center += object.velocity * deltaTime;
+        for (uint32_t axis = 0; axis < 2; axis++) {
+            const double relative = object.center[axis] - m_egoPosition[axis];
+            if (((relative > halfSize) && (object.velocity[axis] > 0.0)) || 
+                ((relative < -halfSize) && (object.velocity[axis] < 0.0)))
+                object.velocity[axis] = -object.velocity[axis];
+        }
+    }
+}
+
+double SceneGenerator::castRay(const Eigen::Vector3d & origin, const Eigen::Vector3d & direction, 
+                               int32_t & hitObject) const
+{
+    double nearest = std::numeric_limits<double>::max();
+    hitObject = -1;
+    
+    if (m_params.ground && (direction.z() < 0.0))
+        nearest = -origin.z() / direction.z();
+    
+    // Slab method
+    for (uint32_t i = 0; i < m_objects.size(); i++) {
+        const t_scene_object & object = m_objects[i];
+        
+        const Eigen::Vector3d minCorner(object.center.x() - object.size.x() / 2.0, 
+                                        object.center.y() - object.size.y() / 2.0, object.center.z());
+        const Eigen::Vector3d maxCorner = minCorner + object.size;
+        
+        double tMin = 0.0, tMax = nearest;
+        bool hit = true;
+        for (uint32_t axis = 0; (axis < 3) && hit; axis++) {
+            if (fabs(direction[axis]) < 1e-12) {
+                hit = (origin[axis] >= minCorner[axis]) && (origin[axis] <= maxCorner[axis]);
+                continue;
+            }
+            double t0 = (minCorner[axis] - origin[axis]) / direction[axis];
+            double t1 = (maxCorner[axis] - origin[axis]) / direction[axis];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+            hit = (tMin <= tMax);
+        }
+        
+        if (hit && (tMin < nearest)) {
+            nearest = tMin;
+            hitObject = i;
+        }
+    }
+    
+    return (nearest <= m_params.maxRange)? nearest : -1.0;
+}
+
+void SceneGenerator::nextScan(std::vector<float> & points, Eigen::Affine3d & pose2Map, double & stamp)
+{
+    const double deltaTime = 1.0 / m_params.rate;
+    if (m_numScans != 0)
+        moveObjects(deltaTime);
+    
+    stamp = m_numScans * deltaTime;
+    pose2Map = Eigen::Translation3d(m_egoPosition) * Eigen::Quaterniond::Identity();
+    
+    for (uint32_t i = 0; i < m_objects.size(); i++)
+        m_objects[i].hits = 0;
+    
+    boost::random::normal_distribution<double> noise(0.0, m_params.rangeNoise);
+    
+    points.clear();
+    points.reserve(m_params.numRings * m_params.pointsPerRing * 3);
+    
+    const Eigen::Vector3d origin = m_egoPosition + Eigen::Vector3d(0.0, 0.0, m_params.sensorHeight);
+    for (uint32_t ring = 0; ring < m_params.numRings; ring++) {
+        const double elevation = m_params.minElevation + 
+                                 (m_params.maxElevation - m_params.minElevation) * ring / std::max(m_params.numRings - 1, (uint32_t)1);
+        const double cosElevation = cos(elevation);
+        const double sinElevation = sin(elevation);
+        
+        for (uint32_t step = 0; step < m_params.pointsPerRing; step++) {
+            const double azimuth = 2.0 * M_PI * step / m_params.pointsPerRing;
+            const Eigen::Vector3d direction(cosElevation * cos(azimuth), cosElevation * sin(azimuth), sinElevation);
+            
+            int32_t hitObject;
+            double range = castRay(origin, direction, hitObject);
+            if (range < 0.0)
+                continue;
+            
+            if (hitObject >= 0)
+                m_objects[hitObject].hits++;
+            if (m_params.rangeNoise > 0.0)
+                range += noise(m_random);
+            
+            // In the vehicle frame (which is not rotated)
+            const Eigen::Vector3d point = origin + range * direction - m_egoPosition;
+            points.push_back(point.x());
+            points.push_back(point.y());
+            points.push_back(point.z());
+        }
+    }
+    
+    m_numScans++;
+}
+
+}
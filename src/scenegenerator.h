@@ -0,0 +1,106 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef SCENEGENERATOR_H
+#define SCENEGENERATOR_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace voxel_odometry {
+
+typedef struct {
+    uint32_t seed;
+    double rate;                                // Hz
+    
+    // Sensor (a Velodyne-like spinning lidar), at the origin of the vehicle
+    uint32_t numRings;
+    uint32_t pointsPerRing;
+    double minElevation, maxElevation;          // Radians
+    double sensorHeight;
+    double maxRange;
+    double rangeNoise;                          // Standard deviation, meters
+    bool ground;                                // Also the points hitting the ground
+    
+    // Scene, in a square of side sceneSize around the start of the vehicle
+    double sceneSize;
+    double clearRadius;                         // No object starts closer to the vehicle
+    uint32_t numStatic;                         // Boxes of random sizes (buildings, parked cars, poles...)
+    uint32_t numMovers;
+    double pedestrianRatio;                     // The rest of the movers are cars
+    double minSpeed, maxSpeed;                  // Of the movers, m/s
+    double egoSpeed;                            // Of the vehicle, along x, m/s
+} t_scene_params;
+
+// Axis aligned box, in the map frame
+typedef struct {
+    uint32_t id;
+    bool isStatic;
+    bool pedestrian;
+    Eigen::Vector3d center;                     // Of the base of the box
+    Eigen::Vector3d size;
+    Eigen::Vector3d velocity;                   // m/s, map frame
+    uint32_t hits;                              // Points of the last scan on it
+} t_scene_object;
+
+/**
+ * Synthetic scans of a scene with static clutter and boxes moving at constant speed, with the
+ * ground truth of every object. Everything depends just on the params (seed included), so the
+ * same params always give the same sequence.
+ */
+class SceneGenerator
+{
+public:
+    SceneGenerator(const t_scene_params & params);
+    
+    static t_scene_params defaultParams();
+    
+    /**
+     * Scan of the current time, after which the scene moves to the next one.
+     * @param points: x, y, z of each point, in the vehicle frame (packed).
+     * @param pose2Map: Pose of the vehicle.
+     * @param stamp: Seconds since the first scan.
+     */
+    void nextScan(std::vector<float> & points, Eigen::Affine3d & pose2Map, double & stamp);
+    
+    // State of the objects at the time of the last scan (hits included)
+    const std::vector<t_scene_object> & objects() const { return m_objects; }
+    const Eigen::Vector3d & egoPosition() const { return m_egoPosition; }
+    
+protected:
+    void createObjects();
+    void moveObjects(const double & deltaTime);
+    // Distance to the first object (or the ground) along the ray. Negative if nothing is hit.
+    double castRay(const Eigen::Vector3d & origin, const Eigen::Vector3d & direction, int32_t & hitObject) const;
+    
+    t_scene_params m_params;
+    boost::random::mt19937 m_random;
+    
+    std::vector<t_scene_object> m_objects;
+    Eigen::Vector3d m_egoPosition;
+    uint32_t m_numScans;
+};
+
+}
+
+#endif // SCENEGENERATOR_H
@@ -0,0 +1,109 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "snapshotpublisher.h"
+
+#include <boost/bind.hpp>
+
+namespace voxel_odometry {
+
+SnapshotPublisher::SnapshotPublisher(const Callback & callback, const bool & async) :
+                                        m_callback(callback), m_async(async)
+{
+    m_writing = m_pending = m_publishing = -1;
+    m_dropped = 0;
+    m_stop = false;
+
+    if (m_async)
+        m_thread = boost::thread(boost::bind(&SnapshotPublisher::run, this));
+}
+
+SnapshotPublisher::~SnapshotPublisher()
+{
+    if (m_async) {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_stop = true;
+        }
+        m_condition.notify_one();
+        m_thread.join();
+    }
+}
+
+/**
+ * @return The buffer in which the next snapshot has to be written. It is never the one
+ * being published; if it was pending, that snapshot is dropped.
+ */
+FrameSnapshot & SnapshotPublisher::acquire()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    m_writing = (m_publishing == 0)? 1 : 0;
+    if ((m_publishing == -1) && (m_pending == 0))
+        m_writing = 1;
+
+    if (m_pending == m_writing) {
+        m_pending = -1;
+        m_dropped++;
+    }
+
+    m_buffers[m_writing].clear();
+
+    return m_buffers[m_writing];
+}
+
+void SnapshotPublisher::submit()
+{
+    if (! m_async) {
+        m_callback(m_buffers[m_writing]);
+        return;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if (m_pending != -1)
+            m_dropped++;
+        m_pending = m_writing;
+        m_writing = -1;
+    }
+    m_condition.notify_one();
+}
+
+void SnapshotPublisher::run()
+{
+    while (true) {
+        int32_t publishing;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while ((m_pending == -1) && (! m_stop))
+                m_condition.wait(lock);
+
+            // Pending snapshots are published before stopping
+            if (m_pending == -1)
+                return;
+
+            m_publishing = publishing = m_pending;
+            m_pending = -1;
+        }
+
+        m_callback(m_buffers[publishing]);
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_publishing = -1;
+    }
+}
+
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef SNAPSHOTPUBLISHER_H
+#define SNAPSHOTPUBLISHER_H
+
+#include "framesnapshot.h"
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace voxel_odometry {
+
+/**
+ * Double buffer of frame snapshots between the compute thread and a publisher thread.
+ * The compute thread never waits: if the previous snapshot has not been taken yet by the
+ * publisher thread, it is replaced by the new one (and counted as dropped).
+ * In synchronous mode, the callback is just called from submit().
+ */
+class SnapshotPublisher
+{
+public:
+    typedef boost::function<void (const FrameSnapshot &)> Callback;
+
+    SnapshotPublisher(const Callback & callback, const bool & async);
+    ~SnapshotPublisher();
+
+    FrameSnapshot & acquire();
+    void submit();
+
+    uint64_t dropped() const { return m_dropped; }
+
+protected:
+    void run();
+
+    Callback m_callback;
+    bool m_async;
+
+    FrameSnapshot m_buffers[2];
+    int32_t m_writing, m_pending, m_publishing;
+    uint64_t m_dropped;
+
+    bool m_stop;
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+    boost::thread m_thread;
+};
+
+}
+
+#endif // SNAPSHOTPUBLISHER_H
@@ -0,0 +1,88 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef STAGEQUEUE_H
+#define STAGEQUEUE_H
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace voxel_odometry {
+
+/**
+ * Bounded single producer / single consumer queue between two pipeline stages.
+ * Items go through a lock-free ring; the mutex is just used to sleep when the
+ * queue is full (producer) or empty (consumer).
+ */
+template <typename T>
+class StageQueue
+{
+public:
+    StageQueue(const uint32_t & capacity) : m_queue(capacity), m_closed(false) {}
+
+    // Blocks while the queue is full. Returns false if the queue was closed.
+    bool push(const T & item) {
+        while (! m_queue.push(item)) {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while ((m_queue.write_available() == 0) && (! m_closed))
+                m_condition.wait(lock);
+            if (m_closed)
+                return false;
+        }
+        notify();
+        return true;
+    }
+
+    // Blocks while the queue is empty. Returns false once the queue is closed and empty.
+    bool pop(T & item) {
+        while (! m_queue.pop(item)) {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while ((m_queue.read_available() == 0) && (! m_closed))
+                m_condition.wait(lock);
+            if ((m_queue.read_available() == 0) && m_closed)
+                return false;
+        }
+        notify();
+        return true;
+    }
+
+    void close() {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_closed = true;
+        }
+        m_condition.notify_all();
+    }
+
+protected:
+    void notify() {
+        // Taking the mutex avoids losing the wake up of a thread about to wait
+        { boost::mutex::scoped_lock lock(m_mutex); }
+        m_condition.notify_all();
+    }
+
+    boost::lockfree::spsc_queue<T> m_queue;
+
+    bool m_closed;
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+};
+
+}
+
+#endif // STAGEQUEUE_H
@@ -0,0 +1,118 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "sweepdeskew.h"
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+namespace voxel_odometry {
+
+/**
+ * Polynomial approximation of atan2 (error below 1e-5 rad). Unlike atan2f, it is
+ * branch free once compiled, so the ingestion loop can be vectorised.
+ */
+static inline float fastAtan2(const float & y, const float & x)
+{
+    const float absX = fabsf(x);
+    const float absY = fabsf(y);
+    const float ratio = std::min(absX, absY) / (std::max(absX, absY) + FLT_MIN);
+    const float ratio2 = ratio * ratio;
+
+    float angle = ((-0.0464964749f * ratio2 + 0.15931422f) * ratio2 - 0.327622764f) * ratio2 * ratio + ratio;
+    angle = (absY > absX)? 1.57079637f - angle : angle;
+    angle = (x < 0.0f)? 3.14159274f - angle : angle;
+    return (y < 0.0f)? -angle : angle;
+}
+
+SweepDeskew::SweepDeskew(const t_deskew_params & params) : m_params(params)
+{
+    m_vx = m_vy = m_yawRate = 0.0f;
+    m_moving = false;
+}
+
+/**
+ * Sets the velocity assumed during the next sweep.
+ * @param egoMotion: Last motion estimation. If not valid, the points are just copied.
+ */
+void SweepDeskew::setMotion(const t_ego_motion & egoMotion)
+{
+    m_moving = egoMotion.valid && (egoMotion.deltaTime > 0.0);
+    if (! m_moving) {
+        m_vx = m_vy = m_yawRate = 0.0f;
+        return;
+    }
+
+    m_vx = egoMotion.deltaX / egoMotion.deltaTime;
+    m_vy = egoMotion.deltaY / egoMotion.deltaTime;
+    m_yawRate = egoMotion.deltaYaw / egoMotion.deltaTime;
+}
+
+void SweepDeskew::copy(const uint8_t * data, const uint32_t & numPoints, const uint32_t & pointStep,
+                       const uint32_t & offsetX, const uint32_t & offsetY, const uint32_t & offsetZ,
+                       pcl::PointXYZRGB * points) const
+{
+    for (uint32_t i = 0; i < numPoints; i++) {
+        const uint8_t * raw = data + i * pointStep;
+        points[i].x = *reinterpret_cast<const float *>(raw + offsetX);
+        points[i].y = *reinterpret_cast<const float *>(raw + offsetY);
+        points[i].z = *reinterpret_cast<const float *>(raw + offsetZ);
+    }
+}
+
+/**
+ * Ingestion for clouds without a time field. The capture time of each point is derived
+ * from its azimuth around the sensor, relative to the azimuth at which the sweep ends.
+ */
+void SweepDeskew::ingest(const uint8_t * data, const uint32_t & numPoints, const uint32_t & pointStep,
+                         const uint32_t & offsetX, const uint32_t & offsetY, const uint32_t & offsetZ,
+                         pcl::PointCloud<pcl::PointXYZRGB> & cloud) const
+{
+    cloud.points.resize(numPoints);
+    cloud.width = numPoints;
+    cloud.height = 1;
+    if (numPoints == 0)
+        return;
+    pcl::PointXYZRGB * points = &cloud.points[0];
+
+    if (! enabled()) {
+        copy(data, numPoints, pointStep, offsetX, offsetY, offsetZ, points);
+        return;
+    }
+
+    const float inv2Pi = 0.5 / M_PI;
+    const float cutFraction = m_params.cutAzimuth * inv2Pi;
+    const float direction = m_params.clockwise? 1.0f : -1.0f;
+    const float sweepDuration = m_params.sweepDuration;
+    const float sensorX = m_params.sensorX;
+    const float sensorY = m_params.sensorY;
+
+    for (uint32_t i = 0; i < numPoints; i++) {
+        const uint8_t * raw = data + i * pointStep;
+        const float & x = *reinterpret_cast<const float *>(raw + offsetX);
+        const float & y = *reinterpret_cast<const float *>(raw + offsetY);
+        const float & z = *reinterpret_cast<const float *>(raw + offsetZ);
+
+        // Fraction of the sweep between the point and the end of the sweep, in [0, 1)
+        float fraction = direction * (fastAtan2(y - sensorY, x - sensorX) * inv2Pi - cutFraction);
+        fraction -= floorf(fraction);
+
+        correct(x, y, z, -fraction * sweepDuration, points[i]);
+    }
+}
+
+}
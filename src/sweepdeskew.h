@@ -0,0 +1,116 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef SWEEPDESKEW_H
+#define SWEEPDESKEW_H
+
+#include "params_structs.h"
+
+namespace voxel_odometry {
+
+typedef struct {
+    bool enabled;
+    double sweepDuration;           // Seconds
+    double cutAzimuth;              // Azimuth of the last point of the sweep, in the frame of the cloud
+    bool clockwise;                 // Velodyne sensors rotate clockwise seen from above
+    float sensorX, sensorY;         // Position of the sensor in the frame of the cloud
+} t_deskew_params;
+
+/**
+ * Copies the points of a raw cloud buffer into a PCL cloud, moving each point to the
+ * vehicle frame at the stamp of the cloud (the end of the sweep). The capture time of each
+ * point is taken from its time field (seconds relative to the stamp) or, if not available,
+ * from its azimuth. A constant velocity, taken from the last ego-motion estimation, is assumed.
+ */
+class SweepDeskew
+{
+public:
+    SweepDeskew(const t_deskew_params & params);
+
+    void setMotion(const t_ego_motion & egoMotion);
+
+    void ingest(const uint8_t * data, const uint32_t & numPoints, const uint32_t & pointStep,
+                const uint32_t & offsetX, const uint32_t & offsetY, const uint32_t & offsetZ,
+                pcl::PointCloud<pcl::PointXYZRGB> & cloud) const;
+
+    template <typename TimeType>
+    void ingest(const uint8_t * data, const uint32_t & numPoints, const uint32_t & pointStep,
+                const uint32_t & offsetX, const uint32_t & offsetY, const uint32_t & offsetZ,
+                const uint32_t & offsetTime, pcl::PointCloud<pcl::PointXYZRGB> & cloud) const;
+
+    bool enabled() const { return m_params.enabled && m_moving; }
+
+protected:
+    void copy(const uint8_t * data, const uint32_t & numPoints, const uint32_t & pointStep,
+              const uint32_t & offsetX, const uint32_t & offsetY, const uint32_t & offsetZ,
+              pcl::PointXYZRGB * points) const;
+
+    inline void correct(const float & x, const float & y, const float & z, const float & t,
+                        pcl::PointXYZRGB & point) const;
+
+    t_deskew_params m_params;
+
+    // Velocity of the vehicle frame
+    float m_vx, m_vy, m_yawRate;
+    bool m_moving;
+};
+
+inline void SweepDeskew::correct(const float & x, const float & y, const float & z, const float & t,
+                                 pcl::PointXYZRGB & point) const
+{
+    // Pose of the vehicle at stamp + t, relative to the one at stamp. Second order
+    // approximation of the rotation, the angles are small during a sweep.
+    const float angle = m_yawRate * t;
+    const float cosAngle = 1.0f - 0.5f * angle * angle;
+    const float sinAngle = angle;
+
+    point.x = cosAngle * x - sinAngle * y + m_vx * t;
+    point.y = sinAngle * x + cosAngle * y + m_vy * t;
+    point.z = z;
+}
+
+template <typename TimeType>
+void SweepDeskew::ingest(const uint8_t * data, const uint32_t & numPoints, const uint32_t & pointStep,
+                         const uint32_t & offsetX, const uint32_t & offsetY, const uint32_t & offsetZ,
+                         const uint32_t & offsetTime, pcl::PointCloud<pcl::PointXYZRGB> & cloud) const
+{
+    cloud.points.resize(numPoints);
+    cloud.width = numPoints;
+    cloud.height = 1;
+    if (numPoints == 0)
+        return;
+    pcl::PointXYZRGB * points = &cloud.points[0];
+
+    if (! enabled()) {
+        copy(data, numPoints, pointStep, offsetX, offsetY, offsetZ, points);
+        return;
+    }
+
+    for (uint32_t i = 0; i < numPoints; i++) {
+        const uint8_t * raw = data + i * pointStep;
+        const float & x = *reinterpret_cast<const float *>(raw + offsetX);
+        const float & y = *reinterpret_cast<const float *>(raw + offsetY);
+        const float & z = *reinterpret_cast<const float *>(raw + offsetZ);
+        const float t = *reinterpret_cast<const TimeType *>(raw + offsetTime);
+
+        correct(x, y, z, t, points[i]);
+    }
+}
+
+}
+
+#endif // SWEEPDESKEW_H
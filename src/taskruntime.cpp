@@ -0,0 +1,208 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "taskruntime.h"
+
+#include <boost/bind.hpp>
+
+namespace voxel_odometry {
+
+TaskRuntime::TaskRuntime(const uint32_t & numThreads)
+{
+    m_queuedChunks = 0;
+    m_nextQueue = 0;
+    m_stop = false;
+    
+    const uint32_t numWorkers = (numThreads > 1)? numThreads - 1 : 0;
+    for (uint32_t i = 0; i <= numWorkers; i++)
+        m_queues.push_back(boost::shared_ptr<t_worker_queue>(new t_worker_queue));
+    
+    for (uint32_t i = 0; i < numWorkers; i++)
+        m_workers.push_back(boost::shared_ptr<boost::thread>(
+                                new boost::thread(boost::bind(&TaskRuntime::workerLoop, this, i))));
+}
+
+TaskRuntime::~TaskRuntime()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    
+    for (uint32_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->join();
+}
+
+void TaskRuntime::parallelFor(const uint32_t & begin, const uint32_t & end, const uint32_t & grain, 
+                              const RangeTask & task)
+{
+    if (end <= begin)
+        return;
+    
+    const uint32_t safeGrain = std::max(grain, (uint32_t)1);
+    
+    // Nothing to share
+    if (m_workers.empty() || (end - begin <= safeGrain)) {
+        TraceSpan span(m_tracer.get(), "task");
+        task(begin, end);
+        return;
+    }
+    
+    t_job job;
+    job.task = &task;
+    job.remaining = (end - begin + safeGrain - 1) / safeGrain;
+    
+    // Chunks are dealt round robin, starting at a different queue for each loop
+    uint32_t queueIdx;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        queueIdx = m_nextQueue;
+        m_nextQueue = (m_nextQueue + 1) % m_queues.size();
+        m_queuedChunks += job.remaining;
+    }
+    for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += safeGrain) {
+        t_chunk chunk;
+        chunk.job = &job;
+        chunk.begin = chunkBegin;
+        chunk.end = std::min(chunkBegin + safeGrain, end);
+        
+        t_worker_queue & queue = *m_queues[queueIdx];
+        {
+            boost::mutex::scoped_lock lock(queue.mutex);
+            queue.chunks.push_back(chunk);
+        }
+        queueIdx = (queueIdx + 1) % m_queues.size();
+    }
+    m_condition.notify_all();
+    
+    // The caller helps until its loop is finished
+    while (true) {
+        {
+            boost::mutex::scoped_lock lock(job.mutex);
+            if (job.remaining == 0)
+                return;
+        }
+        
+        t_chunk chunk;
+        if (popJobChunk(job, chunk)) {
+            runChunk(chunk);
+        } else {
+            // The remaining chunks are being run by the workers
+            boost::mutex::scoped_lock lock(job.mutex);
+            while (job.remaining != 0)
+                job.condition.wait(lock);
+            return;
+        }
+    }
+}
+
+/**
+ * Takes the first chunk of its own queue or, if it is empty, the last one of another queue.
+ */
+bool TaskRuntime::popChunk(const uint32_t & queueIdx, t_chunk & chunk)
+{
+    bool found = false;
+    {
+        t_worker_queue & queue = *m_queues[queueIdx];
+        boost::mutex::scoped_lock lock(queue.mutex);
+        if (! queue.chunks.empty()) {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+            found = true;
+        }
+    }
+    
+    for (uint32_t i = 1; (i < m_queues.size()) && (! found); i++) {
+        t_worker_queue & victim = *m_queues[(queueIdx + i) % m_queues.size()];
+        boost::mutex::scoped_lock lock(victim.mutex);
+        if (! victim.chunks.empty()) {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            found = true;
+        }
+    }
+    
+    if (found) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_queuedChunks--;
+    }
+    
+    return found;
+}
+
+/**
+ * Takes a chunk of the given job from any queue, so a caller never runs the loops of others.
+ */
+bool TaskRuntime::popJobChunk(const t_job & job, t_chunk & chunk)
+{
+    bool found = false;
+    for (uint32_t i = 0; (i < m_queues.size()) && (! found); i++) {
+        t_worker_queue & queue = *m_queues[m_queues.size() - 1 - i];
+        boost::mutex::scoped_lock lock(queue.mutex);
+        // From the back, as when stealing, since the workers take the front of their queues
+        for (std::deque<t_chunk>::reverse_iterator it = queue.chunks.rbegin(); it != queue.chunks.rend(); ++it) {
+            if (it->job == &job) {
+                chunk = *it;
+                queue.chunks.erase(--it.base());
+                found = true;
+                break;
+            }
+        }
+    }
+    
+    if (found) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_queuedChunks--;
+    }
+    
+    return found;
+}
+
+void TaskRuntime::runChunk(const t_chunk & chunk)
+{
+    {
+        TraceSpan span(m_tracer.get(), "task");
+        (*chunk.job->task)(chunk.begin, chunk.end);
+    }
+    
+    t_job & job = *chunk.job;
+    boost::mutex::scoped_lock lock(job.mutex);
+    job.remaining--;
+    // Notified while locked: the job lives in the stack of the caller, which can return as soon as it sees 0
+    if (job.remaining == 0)
+        job.condition.notify_all();
+}
+
+void TaskRuntime::workerLoop(const uint32_t & queueIdx)
+{
+    while (true) {
+        t_chunk chunk;
+        if (popChunk(queueIdx, chunk)) {
+            runChunk(chunk);
+            continue;
+        }
+        
+        boost::mutex::scoped_lock lock(m_mutex);
+        while ((m_queuedChunks == 0) && (! m_stop))
+            m_condition.wait(lock);
+        if (m_stop)
+            return;
+    }
+}
+
+}
@@ -0,0 +1,101 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef TASKRUNTIME_H
+#define TASKRUNTIME_H
+
+#include "tracer.h"
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace voxel_odometry {
+
+/**
+ * Pool of threads shared by all the per-voxel and per-obstacle loops. A loop is split into
+ * chunks of a fixed size which are dealt to the workers; a worker that runs out of chunks 
+ * steals from the others, so loops with very uneven work per item are still balanced.
+ * The thread calling parallelFor also runs chunks until its loop is done, but just the ones of
+ * its own loop. It can be called from several threads at the same time (e.g. the filter and the 
+ * publisher), and none of them ends up running the loops of the others.
+ */
+class TaskRuntime
+{
+public:
+    // Called with a subrange [begin, end) of the loop
+    typedef boost::function<void (const uint32_t & begin, const uint32_t & end)> RangeTask;
+    
+    // numThreads includes the calling thread, so with 0 or 1 everything is run by the caller
+    TaskRuntime(const uint32_t & numThreads);
+    ~TaskRuntime();
+    
+    void parallelFor(const uint32_t & begin, const uint32_t & end, const uint32_t & grain, 
+                     const RangeTask & task);
+    
+    uint32_t numThreads() const { return m_workers.size() + 1; }
+    
+    // Each chunk is recorded as a "task" span. Has to be set before any loop is run.
+    void setTracer(const boost::shared_ptr<Tracer> & tracer) { m_tracer = tracer; }
+    
+protected:
+    typedef struct {
+        const RangeTask * task;
+        uint32_t remaining;                     // Chunks not finished yet
+        boost::mutex mutex;
+        boost::condition_variable condition;
+    } t_job;
+    
+    typedef struct {
+        t_job * job;
+        uint32_t begin, end;
+    } t_chunk;
+    
+    typedef struct {
+        boost::mutex mutex;
+        std::deque<t_chunk> chunks;
+    } t_worker_queue;
+    
+    bool popChunk(const uint32_t & queueIdx, t_chunk & chunk);
+    bool popJobChunk(const t_job & job, t_chunk & chunk);
+    void runChunk(const t_chunk & chunk);
+    void workerLoop(const uint32_t & queueIdx);
+    
+    // One queue per worker, plus the last one for the calling threads
+    std::vector< boost::shared_ptr<t_worker_queue> > m_queues;
+    std::vector< boost::shared_ptr<boost::thread> > m_workers;
+    
+    boost::shared_ptr<Tracer> m_tracer;
+    
+    uint32_t m_queuedChunks;
+    uint32_t m_nextQueue;
+    bool m_stop;
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+};
+
+}
+
+#endif // TASKRUNTIME_H
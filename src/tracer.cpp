@@ -0,0 +1,149 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <signal.h>
+#include <sstream>
+
+namespace voxel_odometry {
+
+static volatile sig_atomic_t g_flushRequested = 0;
+
+static void requestFlush(int /*signal*/)
+{
+    g_flushRequested = 1;
+}
+
+Tracer::Tracer(const uint32_t & eventsPerThread, const std::string & path) : 
+                    m_eventsPerThread(std::max(eventsPerThread, (uint32_t)1)), m_path(path), m_numFlushes(0),
+                    m_threadBuffer(&Tracer::keepBuffer)
+{
+}
+
+Tracer::t_thread_buffer * Tracer::threadBuffer()
+{
+    t_thread_buffer * buffer = m_threadBuffer.get();
+    if (buffer != NULL)
+        return buffer;
+    
+    boost::shared_ptr<t_thread_buffer> newBuffer(new t_thread_buffer);
+    newBuffer->events.resize(m_eventsPerThread);
+    newBuffer->head = 0;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        newBuffer->tid = m_buffers.size();
+        m_buffers.push_back(newBuffer);
+    }
+    m_threadBuffer.reset(newBuffer.get());
+    
+    return newBuffer.get();
+}
+
+void Tracer::record(const char * name, const double & begin, const double & end)
+{
+    t_thread_buffer * buffer = threadBuffer();
+    
+    const uint64_t head = buffer->head.load(boost::memory_order_relaxed);
+    t_trace_event & event = buffer->events[head % m_eventsPerThread];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    
+    buffer->head.store(head + 1, boost::memory_order_release);
+}
+
+void Tracer::setThreadName(const std::string & name)
+{
+    t_thread_buffer * buffer = threadBuffer();
+    
+    boost::mutex::scoped_lock lock(m_mutex);
+    buffer->name = name;
+}
+
+/**
+ * Writes the events in the buffers, while the threads keep recording. Events overwritten 
+ * during the copy are left out.
+ */
+std::string Tracer::flush()
+{
+    std::vector< boost::shared_ptr<t_thread_buffer> > buffers;
+    std::vector<std::string> names;
+    uint32_t numFlush;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        buffers = m_buffers;
+        for (uint32_t i = 0; i < buffers.size(); i++)
+            names.push_back(buffers[i]->name);
+        numFlush = m_numFlushes++;
+    }
+    
+    std::stringstream fileName;
+    fileName << m_path << "_" << numFlush << ".json";
+    FILE * file = fopen(fileName.str().c_str(), "w");
+    if (file == NULL)
+        return std::string();
+    
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    std::vector<t_trace_event> events;
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+        t_thread_buffer & buffer = *buffers[i];
+        
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first? "" : ",\n", buffer.tid, names[i].empty()? "thread" : names[i].c_str());
+        first = false;
+        
+        const uint64_t head = buffer.head.load(boost::memory_order_acquire);
+        const uint64_t firstEvent = (head > m_eventsPerThread)? head - m_eventsPerThread : 0;
+        events.resize(head - firstEvent);
+        for (uint64_t e = firstEvent; e < head; e++)
+            events[e - firstEvent] = buffer.events[e % m_eventsPerThread];
+        
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        const uint64_t newHead = buffer.head.load(boost::memory_order_relaxed);
+        // The slot of event newHead (the one of newHead - m_eventsPerThread) may be being written
+        const uint64_t firstValid = (newHead + 1 > m_eventsPerThread)? newHead + 1 - m_eventsPerThread : 0;
+        
+        for (uint64_t e = std::max(firstEvent, firstValid); e < head; e++) {
+            const t_trace_event & event = events[e - firstEvent];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, buffer.tid, event.begin * 1e6, (event.end - event.begin) * 1e6);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    
+    return fileName.str();
+}
+
+void Tracer::installSignalHandler()
+{
+    signal(SIGUSR1, requestFlush);
+}
+
+bool Tracer::flushRequested()
+{
+    if (g_flushRequested == 0)
+        return false;
+    
+    g_flushRequested = 0;
+    return true;
+}
+
+}
@@ -0,0 +1,107 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "timeutils.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace voxel_odometry {
+
+/**
+ * Records spans (name, begin, end) of every thread into a ring buffer of that thread, and writes
+ * the ones still in the buffers as a Chrome trace (chrome://tracing, Perfetto) when flushed.
+ * Recording does not lock: each buffer has a single writer. A thread takes the mutex just the
+ * first time it records something, to register its buffer.
+ * A flush copies the buffers while their threads keep writing (as PoseHistory::lookup), and leaves
+ * out whatever was overwritten meanwhile. Once a buffer is full, the last eventsPerThread - 1 events
+ * are written, since the slot of the next one may be being overwritten.
+ */
+class Tracer
+{
+public:
+    // Files are written to <path>_<n>.json
+    Tracer(const uint32_t & eventsPerThread, const std::string & path);
+    
+    // Names must be literals (or live as long as the tracer), since just the pointer is kept
+    void record(const char * name, const double & begin, const double & end);
+    void setThreadName(const std::string & name);
+    
+    // Returns the name of the file written, or an empty string on failure
+    std::string flush();
+    
+    // SIGUSR1 just raises a flag, which has to be polled with flushRequested (it is cleared then)
+    static void installSignalHandler();
+    static bool flushRequested();
+    
+protected:
+    typedef struct {
+        const char * name;
+        double begin, end;                      // Seconds, monotonic clock
+    } t_trace_event;
+    
+    typedef struct {
+        uint32_t tid;
+        std::string name;                       // Protected by m_mutex
+        std::vector<t_trace_event> events;
+        boost::atomic<uint64_t> head;           // Number of events recorded so far
+    } t_thread_buffer;
+    
+    t_thread_buffer * threadBuffer();
+    static void keepBuffer(t_thread_buffer *) {}
+    
+    uint32_t m_eventsPerThread;
+    std::string m_path;
+    uint32_t m_numFlushes;
+    
+    boost::thread_specific_ptr<t_thread_buffer> m_threadBuffer;
+    std::vector< boost::shared_ptr<t_thread_buffer> > m_buffers;      // Owners of the buffers
+    boost::mutex m_mutex;
+};
+
+// Records its own lifetime. Does nothing if tracer is NULL.
+class TraceSpan
+{
+public:
+    TraceSpan(Tracer * tracer, const char * name) : m_tracer(tracer), m_name(name) {
+        if (m_tracer)
+            m_begin = monotonicTime();
+    }
+    ~TraceSpan() {
+        if (m_tracer)
+            m_tracer->record(m_name, m_begin, monotonicTime());
+    }
+    
+protected:
+    Tracer * m_tracer;
+    const char * m_name;
+    double m_begin;
+};
+
+}
+
+#endif // TRACER_H
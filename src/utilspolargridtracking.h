@@ -35,6 +35,7 @@
 #include <voxel_grid_tracking/point_2d.h>
 
 #include "params_structs.h"
+#include "timeutils.h"
 
 using namespace std;
 
@@ -46,15 +47,6 @@ using namespace std;
     
 #define LOG_BASE(base, x) log10(x) / log10(base)
 
-#define INIT_CLOCK(start) clock_t start = clock();
-#define RESET_CLOCK(start) start = clock();
-#define END_CLOCK(time, start) float time = (clock() - start) / (float)(CLOCKS_PER_SEC);
-#define END_CLOCK_2(time, start) time = (clock() - start) / (float)(CLOCKS_PER_SEC);
-
-// #define INIT_CLOCK(start) auto start = std::chrono::high_resolution_clock::now();
-// #define RESET_CLOCK(start) start = std::chrono::high_resolution_clock::now();
-// #define END_CLOCK(time, start) float time = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now()-start).count();
-// #define END_CLOCK_2(time, start) time = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now()-start).count();
 // typedef Eigen::Matrix<bool, Eigen::Dynamic, Eigen::Dynamic> BinaryMap;
 
 // cv::Mat getCvMatFromEigenBinary(const voxel_odometry::BinaryMap & map);
@@ -15,13 +15,13 @@
  */
 
 #include "voxel.h"
+#include "logging.h"
 
 #include <iostream>
+#include <stdlib.h>
 #include <boost/foreach.hpp>
 #include <boost/graph/graph_concepts.hpp>
 #include <pcl/common/impl/centroid.hpp>
-#include <visualization_msgs/Marker.h>
-#include <visualization_msgs/MarkerArray.h>
 
 
 using namespace std;
@@ -41,7 +41,7 @@ Voxel::Voxel(const double & x, const double & y, const double & z,
              const double & centroidX, const double & centroidY, const double & centroidZ,
              const double & sizeX, const double & sizeY, const double & sizeZ, 
              const double & maxVelX, const double & maxVelY, const double & maxVelZ,
-             const image_geometry::StereoCameraModel * stereoCameraModel, const SpeedMethod & speedMethod,
+             const t_stereo_camera * stereoCamera, const SpeedMethod & speedMethod,
              const double & yawInterval, const double & pitchInterval, const float & factorSpeed) : 
                     m_x(x), m_y(y), m_z(z), 
                     m_centroidX(centroidX), m_centroidY(centroidY), m_centroidZ(centroidZ), 
@@ -63,10 +63,10 @@ Voxel::Voxel(const double & x, const double & y, const double & z,
         double yReal = m_y * m_sizeY;
         double zReal = m_z * m_sizeZ;
 
-        if (stereoCameraModel != NULL) {
+        if (stereoCamera != NULL) {
 
             const double sigmaY = (m_centroidY * yReal * DISPARITY_COMPUTATION_ERROR) / 
-                                        (stereoCameraModel->baseline() * stereoCameraModel->left().fx());
+                                        (stereoCamera->baseline * stereoCamera->fx);
 
             const double sigmaX = (m_centroidX * sigmaY) / m_centroidY;
             const double sigmaZ = (m_centroidZ * sigmaY) / m_centroidY;
@@ -79,6 +79,10 @@ Voxel::Voxel(const double & x, const double & y, const double & z,
 
     }
 
+    m_meanX = m_centroidX;
+    m_meanY = m_centroidY;
+    m_meanZ = m_centroidZ;
+    
     m_magnitude = 0.0;
     m_neighborOcc = 0;
     m_oldestParticle = 0;
@@ -91,17 +95,20 @@ Voxel::Voxel(const double & x, const double & y, const double & z,
 
 }
 
-void Voxel::createParticles(const uint32_t & numParticles, const tf::StampedTransform & pose2mapTransform)
+void Voxel::createParticles(const uint32_t & numParticles)
 {
     for (uint32_t i = m_particles.size(); i < numParticles; i++) {
         ParticlePtr particle(new Particle3d(m_centroidX, m_centroidY, m_centroidZ, 
-                   m_sizeX, m_sizeY, m_sizeZ, m_maxVelX, m_maxVelY, m_maxVelZ, 
-                   pose2mapTransform));
+                   m_sizeX, m_sizeY, m_sizeZ, m_maxVelX, m_maxVelY, m_maxVelZ));
         m_particles.push_back(particle);
     }
 }
 
-ParticleList Voxel::createParticlesStatic(const tf::StampedTransform& pose2mapTransform)
+/**
+ * @param seed: State of the generator of the ids of the particles (rand_r), so several voxels can be
+ * initialized at the same time.
+ */
+ParticleList Voxel::createParticlesStatic(unsigned int & seed)
 {
     ParticleList particleList;
     for (double vx = -1; vx <= 1; vx += m_yawInterval) {
@@ -115,8 +122,8 @@ ParticleList Voxel::createParticlesStatic(const tf::StampedTransform& pose2mapTr
                     ParticlePtr particle(new Particle3d(m_centroidX, m_centroidY, m_centroidZ, 
                                             vx * m_maxVelX * factorSpeed, 
                                             vy * m_maxVelY * factorSpeed, 
-                                            vz * m_maxVelZ * factorSpeed,
-                                            pose2mapTransform, false));
+                                            vz * m_maxVelZ * factorSpeed, 
+                                            (int32_t)(255 * (double)rand_r(&seed) / RAND_MAX)));
                     
                     particleList.push_back(particle);
                 }
@@ -278,24 +285,22 @@ void Voxel::setMainVectors(const double & deltaEgoX, const double & deltaEgoY, c
                         uint32_t idY = round(speedVector[1] + 1.0f);
                         uint32_t idZ = round(speedVector[2] + 1.0f);
                         uint32_t idSpeed = round(speed / maxSpeed / m_factorSpeed);
-                        cout << "v: " << speedVector << ", speed: " << speed << ", maxSpeed " << maxSpeed <<
-                                " => " << cv::Vec3f(idX, idY, idZ) << ", idSpeed: " << idSpeed << endl;
+                        VO_LOG_DEBUG("v: [%f, %f, %f], speed: %f, maxSpeed %f => [%u, %u, %u], idSpeed: %u", 
+                                     speedVector[0], speedVector[1], speedVector[2], speed, maxSpeed, 
+                                     idX, idY, idZ, idSpeed);
                         
                         histogram[idX][idY][idZ][idSpeed].numPoints += particle->age();
                         totalPoints += particle->age();
                     }
                 }
                 
-                cout << "-------------------" << endl;
-
                 for (int32_t x = 0; x < 3; x++) {
                     for (int32_t y = 0; y < 3; y++) {
                         for (int32_t z = 0; z < 3; z++) {
                             for (int32_t s = 0; s < ceil(1.0 / m_factorSpeed) + 1; s++) {
                                 if (histogram[x][y][z][s].numPoints != 0) {
-                                    cout << "(" << x - 1 << ", " << y - 1 << ", " 
-                                            << s * m_factorSpeed * maxSpeed << ") => " 
-                                            << histogram[x][y][z][s].numPoints / (float)totalPoints << endl;
+                                    VO_LOG_DEBUG("(%d, %d, %f) => %f", x - 1, y - 1, s * m_factorSpeed * maxSpeed, 
+                                                 histogram[x][y][z][s].numPoints / (float)totalPoints);
                                 }
                             }
                         }
@@ -362,7 +367,7 @@ void Voxel::setMainVectors(const double & deltaEgoX, const double & deltaEgoY, c
             break;
         }
         default: {
-            ROS_ERROR("Speed method not known: %d", m_speedMethod);
+            cerr << "Speed method not known: " << m_speedMethod << endl;
             exit(-1);
         }
     }
@@ -23,12 +23,10 @@
 
 #include <boost/multi_array.hpp>
 
-#include <pcl_ros/point_cloud.h>
+#include <pcl/point_cloud.h>
 
 #include <opencv2/opencv.hpp>
 
-#include <image_geometry/stereo_camera_model.h>
-
 #include <vector>
 #include <tiff.h>
 
@@ -55,11 +53,11 @@ public:
           const double & centroidX, const double & centroidY, const double & centroidZ, 
           const double & sizeX, const double & sizeY, const double & sizeZ, 
           const double & maxVelX, const double & maxVelY, const double & maxVelZ,
-          const image_geometry::StereoCameraModel * stereoCameraModel, const SpeedMethod & speedMethod,
+          const t_stereo_camera * stereoCamera, const SpeedMethod & speedMethod,
           const double & yawInterval, const double & pitchInterval, const float & factorSpeed);
     
-    void createParticles(const uint32_t & numParticles, const tf::StampedTransform & pose2mapTransform);
-    ParticleList createParticlesStatic(const tf::StampedTransform & pose2mapTransform);
+    void createParticles(const uint32_t & numParticles);
+    ParticleList createParticlesStatic(unsigned int & seed);
     ParticleList createParticlesFromOFlow(const uint32_t & numParticles);
     
     void setOccupiedProb(const double & occupiedProb) { m_occupiedProb = occupiedProb; }
@@ -78,9 +76,11 @@ public:
     uint32_t numParticles() const { return m_particles.size(); }
     ParticlePtr getParticle(const uint32_t & idx) const { return m_particles.at(idx); }
     ParticleList getParticles() const { return m_particles; }
+    const ParticleList & particles() const { return m_particles; }
     
     uint32_t numOFlowParticles() const { return m_oFlowParticles.size(); }
     ParticleList getOFlowParticles() { return m_oFlowParticles; }
+    const ParticleList & oFlowParticles() const { return m_oFlowParticles; }
     
     bool empty() const { return m_particles.size() == 0; }
     void makeCopy(const ParticlePtr & particle);
@@ -110,6 +110,14 @@ public:
     double centroidY() const { return m_centroidY; }
     double centroidZ() const { return m_centroidZ; }
     
+    // Mean of the points that fell into the voxel (the centroid is just the center of the cell)
+    void setPointsMean(const double & meanX, const double & meanY, const double & meanZ) { 
+        m_meanX = meanX; m_meanY = meanY; m_meanZ = meanZ; 
+    }
+    double meanX() const { return m_meanX; }
+    double meanY() const { return m_meanY; }
+    double meanZ() const { return m_meanZ; }
+    
     double magnitude() const { return m_magnitude; }
     double yaw() const { return m_yaw; }
     double pitch() const { return m_pitch; }
@@ -130,7 +138,8 @@ public:
     
     uint32_t neighborOcc() const { return m_neighborOcc; };
     
-    void incNeighborOcc() { m_neighborOcc++; };
+    // Atomic, since neighbours are counted from several threads
+    void incNeighborOcc() { __sync_fetch_and_add(&m_neighborOcc, 1); };
     
     int32_t obstIdx() const { return m_obstIdx; }
     
@@ -155,6 +164,7 @@ protected:
     
     double m_vx, m_vy, m_vz;
     double m_centroidX, m_centroidY, m_centroidZ;
+    double m_meanX, m_meanY, m_meanZ;
     double m_magnitude;
     double m_yaw, m_pitch;
     
@@ -43,6 +43,7 @@
 #include <cv_bridge/cv_bridge.h>
 
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 #include <boost/graph/graph_concepts.hpp>
 
 #include <opencv2/opencv.hpp>
@@ -71,19 +72,110 @@
 
 #include <iostream>
 #include <queue>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
 #include <pcl-1.7/pcl/impl/point_types.hpp>
 
 #include "voxel_odometry/stats.h"
+#include "voxel_odometry/stats_summary.h"
+#include "voxel_odometry/obstacle_array.h"
 #include "utilspolargridtracking.h"
 
 using namespace std;
 
 namespace voxel_odometry {
-    
-VoxelOdometry::VoxelOdometry()
+
+// Destination of the VO_LOG_* messages
+static void rosconsoleSink(const int32_t & level, const char * text)
 {
-    m_initialized = false;
+    switch (level) {
+        case VO_LOG_LEVEL_DEBUG: ROS_DEBUG("%s", text); break;
+        case VO_LOG_LEVEL_INFO: ROS_INFO("%s", text); break;
+        case VO_LOG_LEVEL_WARN: ROS_WARN("%s", text); break;
+        default: ROS_ERROR("%s", text); break;
+    }
+}
+
+/**
+ * Wrong params stop the node, or just the nodelet (see VoxelOdometryNodelet::onInit), instead of
+ * the whole nodelet manager.
+ * @return The exception to be thrown.
+ */
+static std::invalid_argument paramError(const std::string & error)
+{
+    ROS_FATAL_NAMED(__FILE__, "%s", error.c_str());
+    return std::invalid_argument(error);
+}
+
+// A field of the records in the snapshot, as a field of a PointCloud2
+typedef struct {
+    const char * name;
+    uint32_t offset;
+    uint8_t datatype;
+} t_record_field;
+
+static const t_record_field PARTICLE_FIELDS[] = {
+    { "x", offsetof(t_particle_record, x), sensor_msgs::PointField::FLOAT32 },
+    { "y", offsetof(t_particle_record, y), sensor_msgs::PointField::FLOAT32 },
+    { "z", offsetof(t_particle_record, z), sensor_msgs::PointField::FLOAT32 },
+    { "vx", offsetof(t_particle_record, vx), sensor_msgs::PointField::FLOAT32 },
+    { "vy", offsetof(t_particle_record, vy), sensor_msgs::PointField::FLOAT32 },
+    { "vz", offsetof(t_particle_record, vz), sensor_msgs::PointField::FLOAT32 },
+    { "age", offsetof(t_particle_record, age), sensor_msgs::PointField::UINT32 },
+    { "id", offsetof(t_particle_record, id), sensor_msgs::PointField::INT32 },
+    { "voxel_idx", offsetof(t_particle_record, voxelIdx), sensor_msgs::PointField::UINT32 }
+};
+
+static const t_record_field VOXEL_FIELDS[] = {
+    { "x", offsetof(t_voxel_record, centroidX), sensor_msgs::PointField::FLOAT32 },
+    { "y", offsetof(t_voxel_record, centroidY), sensor_msgs::PointField::FLOAT32 },
+    { "z", offsetof(t_voxel_record, centroidZ), sensor_msgs::PointField::FLOAT32 },
+    { "vx", offsetof(t_voxel_record, vx), sensor_msgs::PointField::FLOAT32 },
+    { "vy", offsetof(t_voxel_record, vy), sensor_msgs::PointField::FLOAT32 },
+    { "vz", offsetof(t_voxel_record, vz), sensor_msgs::PointField::FLOAT32 },
+    { "magnitude", offsetof(t_voxel_record, magnitude), sensor_msgs::PointField::FLOAT32 },
+    { "grid_x", offsetof(t_voxel_record, x), sensor_msgs::PointField::UINT32 },
+    { "grid_y", offsetof(t_voxel_record, y), sensor_msgs::PointField::UINT32 },
+    { "grid_z", offsetof(t_voxel_record, z), sensor_msgs::PointField::UINT32 },
+    { "first_particle", offsetof(t_voxel_record, firstParticle), sensor_msgs::PointField::UINT32 },
+    { "num_particles", offsetof(t_voxel_record, numParticles), sensor_msgs::PointField::UINT32 }
+};
+
+/**
+ * Fills cloud with the records, one point each. The layout of the points is the one of the records,
+ * so the whole vector is copied at once, with no conversion.
+ */
+template <typename RecordType>
+static void recordsToCloud(const std::vector<RecordType> & records, const t_record_field * fields, 
+                           const uint32_t & numFields, sensor_msgs::PointCloud2 & cloud)
+{
+    cloud.fields.resize(numFields);
+    for (uint32_t i = 0; i < numFields; i++) {
+        cloud.fields[i].name = fields[i].name;
+        cloud.fields[i].offset = fields[i].offset;
+        cloud.fields[i].datatype = fields[i].datatype;
+        cloud.fields[i].count = 1;
+    }
+    
+    cloud.height = 1;
+    cloud.width = records.size();
+    cloud.is_bigendian = false;
+    cloud.is_dense = true;
+    cloud.point_step = sizeof(RecordType);
+    cloud.row_step = cloud.point_step * cloud.width;
+    
+    cloud.data.resize(cloud.row_step);
+    if (! records.empty())
+        memcpy(&cloud.data[0], &records[0], cloud.row_step);
+}
     
+/**
+ * @param nh: Private node handle, from which params are read and topics are advertised. 
+ * Within a nodelet, the one of the nodelet.
+ */
+VoxelOdometry::VoxelOdometry(ros::NodeHandle nh)
+{
     m_obstacleColors.resize(boost::extents[MAX_OBSTACLES_VISUALIZATION][3]);
     for (uint32_t i = 0; i < MAX_OBSTACLES_VISUALIZATION; i++) {
         for (uint32_t c = 0; c < 3; c++) {
@@ -102,54 +194,75 @@ VoxelOdometry::VoxelOdometry()
     m_particleColors[7] = cv::Scalar(255, 255, 255);    // White
     
     m_lastMapOdomTransform.stamp_ = ros::Time(-1);
-    ros::NodeHandle nh("~");
     
     // Reading params
     nh.param<string>("map_frame", m_mapFrame, "/map");
     nh.param<string>("pose_frame", m_poseFrame, "/base_footprint");
     nh.param<string>("camera_frame", m_cameraFrame, "/base_left_cam");
     
-    nh.param("use_oflow", m_useOFlow, false);
-    
-    nh.param("publish_intermediate_info", m_publishIntermediateInfo, false);
+    // Parameters of the method. Every param that can be wrong is checked before any thread is started
+    t_engine_params engineParams;
+    string paramsError;
+    if (! readEngineParams(nh, engineParams, paramsError))
+        throw paramError(paramsError);
+    
+    double tfPollRate, tfMaxExtrapolation;
+    nh.param<double>("tf_poll_rate", tfPollRate, 100.0);
+    nh.param<double>("tf_max_extrapolation_ms", tfMaxExtrapolation, 100.0);
+    nh.param("static_map_to_camera", m_staticMap2Cam, false);
+    if (tfPollRate <= 0.0)
+        throw paramError("tf_poll_rate must be positive");
+    
+    // Clouds received while a frame is being computed
+    string ingestPolicyStr;
+    nh.param<string>("ingest_policy", ingestPolicyStr, INGEST_POLICY_LATEST_ONLY_STR);
+    IngestPolicy ingestPolicy;
+    if (ingestPolicyStr == INGEST_POLICY_PROCESS_ALL_STR) {
+        ingestPolicy = INGEST_POLICY_PROCESS_ALL;
+    } else if (ingestPolicyStr == INGEST_POLICY_LATEST_ONLY_STR) {
+        ingestPolicy = INGEST_POLICY_LATEST_ONLY;
+    } else if (ingestPolicyStr == INGEST_POLICY_SKIP_OLDER_STR) {
+        ingestPolicy = INGEST_POLICY_SKIP_OLDER;
+    } else {
+        throw paramError("\"" + ingestPolicyStr + "\" is not a valid ingest policy");
+    }
     
-    double dummyDouble;
-    nh.param<double>("cell_size_x", dummyDouble, 0.5);
-    m_cellSizeX = dummyDouble;
-    nh.param<double>("cell_size_y", dummyDouble, 0.5);
-    m_cellSizeY = dummyDouble;
-    nh.param<double>("cell_size_z", dummyDouble, 0.5);
-    m_cellSizeZ = dummyDouble;
+    // Messages of the computation are written from a separate thread
+    int logQueueSize;
+    nh.param("log_async", m_logAsync, true);
+    nh.param("log_queue_size", logQueueSize, 1024);
+    Logger::instance().setSink(rosconsoleSink);
+    if (m_logAsync)
+        Logger::instance().startAsync(std::max(logQueueSize, 1));
+    
+    // Poses are taken from a history of transforms, filled in the background
+    m_poseProvider.reset(new PoseProvider(m_tfListener, tfPollRate, tfMaxExtrapolation / 1000.0));
+    m_poseProvider->addPair(m_mapFrame, m_poseFrame, false, m_pose2MapPair);
+    m_poseProvider->addPair(m_cameraFrame, m_mapFrame, m_staticMap2Cam, m_map2CamPair);
+    m_map2CamFrame = m_cameraFrame;
+    m_pose2MapTransform = m_map2CamTransform = Eigen::Affine3d::Identity();
+    m_posesExtrapolated = m_posesStale = 0;
+    
+    m_useOFlow = engineParams.useOFlow;
+    m_cellSizeX = engineParams.cellSizeX;
+    m_cellSizeY = engineParams.cellSizeY;
+    m_cellSizeZ = engineParams.cellSizeZ;
+    m_maxVelX = engineParams.maxVelX;
+    m_maxVelY = engineParams.maxVelY;
+    m_maxVelZ = engineParams.maxVelZ;
+    m_odometryMethod = engineParams.odometryMethod;
+    m_inputFromCameras = engineParams.inputFromCameras;
+    m_stageCpuTime = engineParams.stageCpuTime;
     
-    m_voxelSize = max(max(m_cellSizeX, m_cellSizeY), m_cellSizeZ);
+    nh.param("publish_intermediate_info", m_publishIntermediateInfo, false);
     
-    int dummyInteger;
-    nh.param<int>("max_particles_number_per_voxel", dummyInteger, 30);
-    m_maxNumberOfParticles = dummyInteger;
-    nh.param<int>("num_threads", dummyInteger, 8);
-    m_threads = dummyInteger;
-
-    nh.param<double>("max_vel_x", m_maxVelX, 2.0);
-    nh.param<double>("max_vel_y", m_maxVelY, 2.0);
-    nh.param<double>("max_vel_z", m_maxVelZ, 0.0);
-
     if (m_maxVelZ != 0.0) {
         ROS_WARN("The max speed expected for the z axis is %f. Are you sure you expect this behaviour?", m_maxVelZ);
     }
     
-    nh.param<double>("min_vel_x", m_minVelX, 0.3);
-    nh.param<double>("min_vel_y", m_minVelY, 0.3);
-    nh.param<double>("min_vel_z", m_minVelZ, 0.0);
-    
     m_maxMagnitude = cv::norm(cv::Vec3f(m_maxVelX, m_maxVelY, m_maxVelZ));
-    m_minMagnitude = cv::norm(cv::Vec3f(m_minVelX, m_minVelY, m_minVelZ));
-    
-    nh.param<double>("yaw_interval", m_yawInterval, 1.0);
-    nh.param<double>("pitch_interval", m_pitchInterval, 1.0);
-    nh.param<double>("speed_factor", m_factorSpeed, 0.1);
     
-    nh.param<double>("occupancy_prob_tresh", m_threshOccupancyProb, 0.5);
-
+    int dummyInteger;
     nh.param<int>("l1_distance_for_neighbor_thresh_x", dummyInteger, 1);
     m_neighBorX = dummyInteger;
     nh.param<int>("l1_distance_for_neighbor_thresh_y", dummyInteger, 1);
@@ -157,50 +270,34 @@ VoxelOdometry::VoxelOdometry()
     nh.param<int>("l1_distance_for_neighbor_thresh_z", dummyInteger, 1);
     m_neighBorZ = dummyInteger;
     
-    string obstacleSpeedMethodStr;
-    nh.param<string>("obstacle_speed_method", obstacleSpeedMethodStr, SPEED_METHOD_CIRC_HIST_STR);
-    if (obstacleSpeedMethodStr == SPEED_METHOD_CIRC_HIST_STR) {
-        m_obstacleSpeedMethod = SPEED_METHOD_CIRC_HIST;
-    } else if (obstacleSpeedMethodStr == SPEED_METHOD_MEAN_STR) {
-        m_obstacleSpeedMethod = SPEED_METHOD_MEAN;
-    } else {
-        ROS_ERROR_NAMED(__FILE__, 
-                        "\"%s\" is not a valid obstacle speed computation method", obstacleSpeedMethodStr.c_str());
-        exit(0);
-    }
-    
-    nh.param<double>("random_particles_per_voxel", m_particlesPerVoxel, 100.0);
-    
     // BEGIN: Just with flood_fill_segment
-    nh.param<double>("yaw_thresh_to_join_voxels", m_threshYaw, 90.0 * M_PI / 180.0);
-    nh.param<double>("pitch_thresh_to_join_voxels", m_threshPitch, 9999999.0);
-    nh.param<double>("magnitude_thresh_to_join_voxels", m_threshMagnitude, 9999999.0);
-    
     nh.param<int>("min_voxels_per_obstacle", dummyInteger, 2 * 2 * 2);
     m_minVoxelsPerObstacle = dummyInteger;
     
-    nh.param<double>("min_voxel_density", m_minVoxelDensity, 10.0);
     nh.param<double>("max_common_value_to_join", m_maxCommonVolume, 0.8);
     nh.param<double>("min_obstacle_height", m_minObstacleHeight, 1.25);
     // END: Just with use_flood_fill_segment
     
-    // BEGIN: Just with original segmentation method
-    string voxelSpeedMethodStr;
-    nh.param<string>("voxel_speed_method", voxelSpeedMethodStr, SPEED_METHOD_CIRC_HIST_STR);
-    if (voxelSpeedMethodStr == SPEED_METHOD_CIRC_HIST_STR) {
-        m_speedMethod = SPEED_METHOD_CIRC_HIST;
-    } else if (voxelSpeedMethodStr == SPEED_METHOD_MEAN_STR) {
-        m_speedMethod = SPEED_METHOD_MEAN;
-    } else {
-        ROS_ERROR_NAMED(__FILE__, 
-                        "\"%s\" is not a valid obstacle speed computation method", voxelSpeedMethodStr.c_str());
-        exit(0);
+    // BEGIN: Just with odometry_method_registration or odometry_method_bev
+    double dummyDouble;
+    t_deskew_params deskewParams;
+    nh.param("deskew_enabled", deskewParams.enabled, false);
+    nh.param<double>("deskew_sweep_duration", deskewParams.sweepDuration, 0.1);
+    nh.param<double>("deskew_cut_azimuth", deskewParams.cutAzimuth, M_PI);
+    nh.param("deskew_clockwise", deskewParams.clockwise, true);
+    nh.param<double>("deskew_sensor_x", dummyDouble, 0.0);
+    deskewParams.sensorX = dummyDouble;
+    nh.param<double>("deskew_sensor_y", dummyDouble, 0.0);
+    deskewParams.sensorY = dummyDouble;
+    nh.param<string>("deskew_time_field", m_deskewTimeField, "time");
+    
+    if (deskewParams.enabled && (m_odometryMethod == ODOMETRY_METHOD_PARTICLES)) {
+        ROS_WARN_NAMED("VoxelOdometry", "deskew_enabled needs an ego-motion estimation, "
+                       "it is ignored with %s", ODOMETRY_METHOD_PARTICLES_STR.c_str());
+        deskewParams.enabled = false;
     }
-    // END: Just with original segmentation method
-    
-    m_currX = m_currY = 0.0;
-    
-    m_currTheta = std::numeric_limits<double>::infinity();
+    m_sweepDeskew.reset(new SweepDeskew(deskewParams));
+    // END: Just with odometry_method_registration or odometry_method_bev
     
     // Topics
     std::string left_info_topic = "left/camera_info";
@@ -211,7 +308,46 @@ VoxelOdometry::VoxelOdometry()
     int queue_size;
     nh.param("approximate_sync", approx, false);
     nh.param("queue_size", queue_size, 10);
-    nh.param("input_from_cameras", m_inputFromCameras, true);
+    
+    // Percentiles of the stage times, latency and workload over the last frames
+    nh.param<int>("stats_window", dummyInteger, 100);
+    m_rollingStats.reset(new RollingStats(std::max(dummyInteger, 1)));
+    for (uint32_t i = 0; i < NUM_STAGES; i++)
+        m_rollingStats->addSeries(STAGE_NAMES[i]);
+    m_latencySeries = m_rollingStats->addSeries("latency");
+    m_inputPointsSeries = m_rollingStats->addSeries("inputPoints");
+    m_occupiedVoxelsSeries = m_rollingStats->addSeries("occupiedVoxels");
+    m_liveParticlesSeries = m_rollingStats->addSeries("liveParticles");
+    m_obstaclesSeries = m_rollingStats->addSeries("obstacles");
+    m_publishedBytesSeries = m_rollingStats->addSeries("publishedBytes");
+    double statsSummaryRate;
+    nh.param<double>("stats_summary_rate", statsSummaryRate, 1.0);
+    m_statsSummaryPeriod = (statsSummaryRate > 0.0)? 1.0 / statsSummaryRate : -1.0;
+    m_lastStatsSummary = ros::WallTime::now();
+    
+    for (uint32_t i = 0; i < NUM_OUTPUTS; i++) {
+        double publishRate;
+        nh.param<double>(std::string("publish_rate_") + OUTPUT_NAMES[i], publishRate, 0.0);
+        m_outputPeriods[i] = (publishRate > 0.0)? 1.0 / publishRate : 0.0;
+    }
+    
+    m_engine.reset(new VoxelOdometryEngine(engineParams));
+    
+    // Timeline of the stages, parallel tasks and publications (see chrome://tracing or Perfetto)
+    bool traceEnabled;
+    nh.param("trace_enabled", traceEnabled, false);
+    if (traceEnabled) {
+        string traceFile;
+        nh.param<string>("trace_file", traceFile, "/tmp/voxel_odometry_trace");
+        nh.param<int>("trace_events_per_thread", dummyInteger, 100000);
+        m_tracer.reset(new Tracer(std::max(dummyInteger, 1), traceFile));
+        m_engine->setTracer(m_tracer);
+        Tracer::installSignalHandler();
+    }
+    double traceDeadline;
+    nh.param<double>("trace_deadline_ms", traceDeadline, 0.0);
+    m_traceDeadline = traceDeadline / 1000.0;
+    m_lastTraceFlush = ros::WallTime(0.0);
     
 //     if (m_inputFromCameras) {
 //         m_leftCameraInfoSub.subscribe(nh, left_info_topic, 1);
@@ -263,7 +399,7 @@ VoxelOdometry::VoxelOdometry()
 //             }
 //         }
 //     } else {
-        m_pointCloudJustPointCloudSub = nh.subscribe<sensor_msgs::PointCloud2>("pointCloud", 1, boost::bind(&VoxelOdometry::pointCloudCallback, this, _1));
+//         The cloud subscription is made at the end of the constructor
 //     }
     
     m_pointCloud.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
@@ -277,6 +413,8 @@ VoxelOdometry::VoxelOdometry()
     m_particles3Pub = nh.advertise<geometry_msgs::PoseArray> ("particles3", 1);
     m_particlesDPub = nh.advertise<geometry_msgs::PoseArray> ("particlesD", 1);
     m_particlesSimplePub = nh.advertise<geometry_msgs::PoseArray> ("particlesSimple", 1);
+    m_particlesCloudPub = nh.advertise<sensor_msgs::PointCloud2> ("particlesCloud", 1);
+    m_voxelsCloudPub = nh.advertise<sensor_msgs::PointCloud2> ("voxelsCloud", 1);
     m_oFlowPub = nh.advertise<geometry_msgs::PoseArray> ("oflow_visualization", 1);
     m_pointsPerVoxelPub = nh.advertise<sensor_msgs::PointCloud2> ("pointPerVoxel", 1);
     m_mainVectorsPub = nh.advertise<visualization_msgs::MarkerArray>("mainVectors", 1);
@@ -285,6 +423,7 @@ VoxelOdometry::VoxelOdometry()
     m_obstacleSpeedPub = nh.advertise<visualization_msgs::MarkerArray>("obstacleSpeed", 1);
     m_obstacleSpeedTextPub = nh.advertise<visualization_msgs::MarkerArray>("obstacleSpeedText", 1);
     m_timeStatsPub = nh.advertise<voxel_odometry::stats>("time_stats", 1);
+    m_statsSummaryPub = nh.advertise<voxel_odometry::stats_summary>("time_stats_summary", 1);
     m_dynObjectsPub = nh.advertise<sensor_msgs::PointCloud2> ("dynamic_objects", 1);
     m_fakePointCloudPub = nh.advertise<sensor_msgs::PointCloud2> ("fakePointCloud", 1);
     m_fakeParticlesPub = nh.advertise<geometry_msgs::PoseArray> ("fakeParticles", 1);
@@ -294,26 +433,97 @@ VoxelOdometry::VoxelOdometry()
     m_debugProbPub = nh.advertise<sensor_msgs::PointCloud2> ("debugProbPub", 1);
     
     m_odomPub = nh.advertise<nav_msgs::Odometry>("odom", 50);
+    m_obstacleArrayPub = nh.advertise<voxel_odometry::obstacle_array>("obstacleArray", 1);
+    
+    bool publishAsync;
+    nh.param("publish_async", publishAsync, true);
+    m_snapshotPublisher.reset(new SnapshotPublisher(boost::bind(&VoxelOdometry::publishSnapshot, this, _1), 
+                                                    publishAsync));
+    
+    // Frames being processed at the same time (ingestion + filter)
+    nh.param("pipeline_enabled", m_pipelineEnabled, true);
+    nh.param<int>("pipeline_depth", dummyInteger, 2);
+    const uint32_t pipelineDepth = m_pipelineEnabled? std::max(dummyInteger, 1) : 1;
+    
+    m_freeFrames.reset(new StageQueue<VoxelFrame *>(pipelineDepth));
+    m_readyFrames.reset(new StageQueue<VoxelFrame *>(pipelineDepth));
+    m_frames.resize(pipelineDepth);
+    for (uint32_t i = 0; i < pipelineDepth; i++) {
+        m_frames[i].reset(new VoxelFrame);
+        m_freeFrames->push(m_frames[i].get());
+    }
+    if (m_pipelineEnabled)
+        m_filterThread = boost::thread(boost::bind(&VoxelOdometry::filterLoop, this));
+    
+    nh.param<int>("ingest_queue_size", dummyInteger, 10);
+    const uint32_t ingestQueueSize = std::max(dummyInteger, 1);
+    double ingestMaxAge;
+    nh.param<double>("ingest_max_age_ms", ingestMaxAge, 200.0);
+    
+    m_ingestInfo = t_ingest_info();
+    m_ingestQueue.reset(new IngestQueue(ingestPolicy, ingestQueueSize, ingestMaxAge / 1000.0));
+    m_ingestThread = boost::thread(boost::bind(&VoxelOdometry::ingestLoop, this));
+    
+    // Last, since in a nodelet the callback can run before the constructor returns
+    m_pointCloudJustPointCloudSub = nh.subscribe<sensor_msgs::PointCloud2>("pointCloud", 1, boost::bind(&VoxelOdometry::pointCloudCallback, this, _1));
 //     ros::spin();
 }
 
+VoxelOdometry::~VoxelOdometry()
+{
+    // No more callbacks, since the members they use are destroyed before the subscriber
+    m_pointCloudJustPointCloudSub.shutdown();
+    
+    // Clouds still waiting are discarded
+    m_ingestQueue->close();
+    m_ingestThread.join();
+    
+    // Pending frames are filtered before stopping
+    m_readyFrames->close();
+    if (m_pipelineEnabled)
+        m_filterThread.join();
+    m_freeFrames->close();
+    
+    // The publisher thread uses the publishers, so it is stopped first
+    m_snapshotPublisher.reset();
+    
+    m_poseProvider.reset();
+    
+    if (m_tracer)
+        flushTrace("shutdown");
+    
+    if (m_logAsync)
+        Logger::instance().stopAsync();
+}
+
 void VoxelOdometry::pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& msgPointCloud) 
 {
-    cout << __FUNCTION__ << ":" << __LINE__ << endl;
-    m_cameraFrame = msgPointCloud->header.frame_id;
-    try {
-        m_tfListener.lookupTransform(m_mapFrame, m_poseFrame, msgPointCloud->header.stamp, m_pose2MapTransform);
-        m_tfListener.lookupTransform(m_cameraFrame, m_mapFrame, msgPointCloud->header.stamp, m_map2CamTransform);
-//         m_tfListener.lookupTransform(m_mapFrame, m_poseFrame, ros::Time(0), m_pose2MapTransform);
-//         m_tfListener.lookupTransform(m_cameraFrame, m_mapFrame, ros::Time(0), m_map2CamTransform);
-    } catch (tf::TransformException ex){
-        ROS_ERROR("%s",ex.what());
+    // The cloud is computed in the ingestion thread, so the callback never waits
+    m_ingestQueue->push(msgPointCloud);
+}
+
+/**
+ * Main loop of the ingestion thread
+ */
+void VoxelOdometry::ingestLoop()
+{
+    if (m_tracer)
+        m_tracer->setThreadName("ingest");
+    
+    sensor_msgs::PointCloud2::ConstPtr msgPointCloud;
+    while (m_ingestQueue->pop(msgPointCloud, m_ingestInfo)) {
+        VO_LOG_DEBUG("[%s] Cloud %d is %f seconds old, %lu dropped so far", __FUNCTION__, 
+                  msgPointCloud->header.seq, m_ingestInfo.queueAge, 
+                  (unsigned long)(m_ingestInfo.dropped + m_ingestInfo.upstreamDropped));
+        processPointCloud(msgPointCloud);
     }
+}
 
-    pcl::PointCloud<pcl::PointXYZ>::Ptr tmpCloud (new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::fromROSMsg<pcl::PointXYZ>(*msgPointCloud, *tmpCloud);
-    
-    pcl::copyPointCloud(*tmpCloud, *m_pointCloud);
+void VoxelOdometry::processPointCloud(const sensor_msgs::PointCloud2::ConstPtr& msgPointCloud) 
+{
+    updatePoses(msgPointCloud->header);
+
+    ingestPointCloud(*msgPointCloud);
     
     if (m_pointCloud->size() != 0) {
     
@@ -331,13 +541,7 @@ void VoxelOdometry::pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr&
                                            const sensor_msgs::CameraInfoConstPtr& leftCameraInfo, 
                                            const sensor_msgs::CameraInfoConstPtr& rightCameraInfo) 
 {
-    m_cameraFrame = msgPointCloud->header.frame_id;
-    try {
-        m_tfListener.lookupTransform(m_mapFrame, m_poseFrame, ros::Time(0), m_pose2MapTransform);
-        m_tfListener.lookupTransform(m_cameraFrame, m_mapFrame, ros::Time(0), m_map2CamTransform);
-    } catch (tf::TransformException ex){
-        ROS_ERROR("%s",ex.what());
-    }
+    updatePoses(msgPointCloud->header);
     
     pcl::fromROSMsg<pcl::PointXYZRGB>(*msgPointCloud, *m_pointCloud);
     
@@ -360,12 +564,7 @@ void VoxelOdometry::pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr&
                                            const sensor_msgs::CameraInfoConstPtr& leftCameraInfo, 
                                            const sensor_msgs::CameraInfoConstPtr& rightCameraInfo) 
 {
-    m_cameraFrame = msgPointCloud->header.frame_id;
-    try {
-        m_tfListener.lookupTransform(m_mapFrame, m_poseFrame, ros::Time(0), m_pose2MapTransform);
-    } catch (tf::TransformException ex){
-        ROS_ERROR("%s",ex.what());
-    }
+    updatePoses(msgPointCloud->header);
     
     pcl::fromROSMsg<pcl::PointXYZRGB>(*msgPointCloud, *m_pointCloud);
     
@@ -386,669 +585,432 @@ void VoxelOdometry::pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr&
 }
 
 /**
- * Given a certain pointCloud, the frame is computed
- * @param pointCloud: The input point cloud.
+ * Poses of the cloud, taken from the transform history. The provider is never waited for:
+ * if a pose is not available the previous one is kept, as stale.
+ * @param header: Header of the cloud.
  */
-void VoxelOdometry::compute(const PointCloudPtr& pointCloud)
+void VoxelOdometry::updatePoses(const std_msgs::Header & header)
 {
-    cout << __FILE__ << endl;
-    voxel_odometry::stats timeStatsMsg;
-    timeStatsMsg.header.seq = m_currentId;
-    timeStatsMsg.header.stamp = ros::Time::now();
-    
-    INIT_CLOCK(startCompute)
-    
-    // Grid is reset
-    INIT_CLOCK(startCompute1)
-//     reset();
-    END_CLOCK(totalCompute1, startCompute1)
-    ROS_INFO("[%s] %d, reset: %f seconds", __FUNCTION__, __LINE__, totalCompute1);
-    
-//     INIT_CLOCK(startExtractDynamicObjects)
-//     extractDynamicObjects(pointCloud);
-//     END_CLOCK(totalExtractDynamicObjects, startExtractDynamicObjects)
-//     ROS_INFO("[%s] %d, extractDynamicObjects: %f seconds", __FUNCTION__, __LINE__, totalExtractDynamicObjects);
-    
-// START OF COMMENT
-    // Having a point cloud, the voxel grid is computed
-    INIT_CLOCK(startCompute2)
-    getVoxelGridFromPointCloud(pointCloud);
-    END_CLOCK(totalCompute2, startCompute2)
-    ROS_INFO("[%s] %d, getVoxelGridFromPointCloud: %f seconds", __FUNCTION__, __LINE__, totalCompute2);
-    timeStatsMsg.getVoxelGridFromPointCloud = totalCompute2;
-    
-    if(m_useOFlow) {
-        INIT_CLOCK(startCompute3)
-        updateFromOFlow();
-        END_CLOCK(totalCompute3, startCompute3)
-        ROS_INFO("[%s] %d, updateFromOFlow: %f seconds", __FUNCTION__, __LINE__, totalCompute3);
-        timeStatsMsg.updateFromOFlow = totalCompute3;
+    m_cameraFrame = header.frame_id;
+    if (m_cameraFrame != m_map2CamFrame) {
+        // Just when the frame of the clouds changes (e.g. the first one). If it cannot be followed 
+        // (already reported), the previous pair is kept.
+        m_poseProvider->addPair(m_cameraFrame, m_mapFrame, m_staticMap2Cam, m_map2CamPair);
+        m_map2CamFrame = m_cameraFrame;
     }
-    INIT_CLOCK(startCompute4)
-    getMeasurementModel();
-    END_CLOCK(totalCompute4, startCompute4)
-    ROS_INFO("[%s] %d, getMeasurementModel: %f seconds", __FUNCTION__, __LINE__, totalCompute4);
-    timeStatsMsg.getMeasurementModel = totalCompute4;
-    
-    // TODO:
-    // Improve the way in which flow vectors are computed
-    
-    if (m_initialized) {
-        INIT_CLOCK(startCompute5)
-        prediction();
-        END_CLOCK(totalCompute5, startCompute5)
-        ROS_INFO("[%s] %d, prediction: %f seconds", __FUNCTION__, __LINE__, totalCompute5);
-        timeStatsMsg.prediction = totalCompute5;
-        
-        INIT_CLOCK(startCompute6)
-        measurementBasedUpdate();
-        END_CLOCK(totalCompute6, startCompute6)
-        ROS_INFO("[%s] %d, measurementBasedUpdate: %f seconds", __FUNCTION__, __LINE__, totalCompute6);
-        timeStatsMsg.measurementBasedUpdate = totalCompute6;
-
-//         publishParticles();
-        
-        INIT_CLOCK(startCompute7)
-        joinVoxels();
-        END_CLOCK(totalCompute7, startCompute7)
-        ROS_INFO("[%s] %d, joinVoxels: %f seconds", __FUNCTION__, __LINE__, totalCompute7);
-        timeStatsMsg.segment = totalCompute7;
-
-        INIT_CLOCK(startCompute8)
-        updateSpeedFromObstacles();
-        END_CLOCK(totalCompute8, startCompute8)
-        ROS_INFO("[%s] %d, updateSpeedFromObstacles: %f seconds", __FUNCTION__, __LINE__, totalCompute8);
-        timeStatsMsg.updateSpeedFromObstacles = totalCompute8;
-        INIT_CLOCK(startCompute2)
-    }
-    INIT_CLOCK(startCompute9)
-    initialization();
-    END_CLOCK(totalCompute9, startCompute9)
-    ROS_INFO("[%s] %d, initialization: %f seconds", __FUNCTION__, __LINE__, totalCompute9);
-    timeStatsMsg.initialization = totalCompute9;
-// END OF COMMENT
-    
-    
-    
-//     publishParticles(m_oldParticlesPub, 2.0);
-    
-//     initialization();
-    
     
+    const double stamp = header.stamp.toSec();
+    countPoseStatus(m_poseProvider->lookup(m_pose2MapPair, stamp, m_pose2MapTransform));
+    countPoseStatus(m_poseProvider->lookup(m_map2CamPair, stamp, m_map2CamTransform));
+}
 
-    END_CLOCK(totalCompute, startCompute)
-    
-    ROS_INFO("[%s] Total time: %f seconds", __FUNCTION__, totalCompute);
-    timeStatsMsg.totalCompute = totalCompute;
-    
-    INIT_CLOCK(startVis)
-    if (m_publishIntermediateInfo) {
-//         cout << __FILE__ << ":" << __LINE__ << endl;
-        publishVoxels();
-//         cout << __FILE__ << ":" << __LINE__ << endl;
-        publishOFlow();
-//         cout << __FILE__ << ":" << __LINE__ << endl;
-        publishParticles();
-        publishMainVectors();
-//         cout << __FILE__ << ":" << __LINE__ << endl;
-        publishObstacles();
-//         cout << __FILE__ << ":" << __LINE__ << endl;
-        publishObstacleCubes();
-//         cout << __FILE__ << ":" << __LINE__ << endl;
+void VoxelOdometry::countPoseStatus(const PoseStatus & status)
+{
+    switch (status) {
+        case POSE_EXTRAPOLATED:
+            m_posesExtrapolated++;
+            break;
+        case POSE_STALE:
+        case POSE_UNAVAILABLE:
+            m_posesStale++;
+            break;
+        default:
+            break;
     }
-    END_CLOCK(totalVis, startVis)
-    
-    publishFakePointCloud();
-    publishOdom();
-//     cout << __FILE__ << ":" << __LINE__ << endl;
-    
-    ROS_INFO("[%s] Total visualization time: %f seconds", __FUNCTION__, totalVis);
-    timeStatsMsg.totalVisualization = totalVis;
-    
-    m_timeStatsPub.publish(timeStatsMsg);
 }
 
-
 /**
- * The grid is emptied
+ * Fills m_pointCloud directly from the buffer of the message, deskewing the sweep with the
+ * last ego-motion estimation in the same pass.
+ * @param msgPointCloud: The input point cloud.
  */
-void VoxelOdometry::reset()
+void VoxelOdometry::ingestPointCloud(const sensor_msgs::PointCloud2 & msgPointCloud)
 {
-    for (uint32_t x = 0; x < m_dimX; x++) {
-        for (uint32_t y = 0; y < m_dimY; y++) {
-            for (uint32_t z = 0; z < m_dimZ; z++) {
-                m_grid[x][y][z]->reset();
-            }
-        }
+    const sensor_msgs::PointField * fieldX = NULL, * fieldY = NULL, * fieldZ = NULL, * fieldTime = NULL;
+    BOOST_FOREACH(const sensor_msgs::PointField & field, msgPointCloud.fields) {
+        if (field.name == "x") fieldX = &field;
+        else if (field.name == "y") fieldY = &field;
+        else if (field.name == "z") fieldZ = &field;
+        else if (field.name == m_deskewTimeField) fieldTime = &field;
     }
-}
 
-void VoxelOdometry::getVoxelGridFromPointCloud(const PointCloudPtr& pointCloud)
-{
-    INIT_CLOCK(startCompute)
-    
-    PointType minPoint, maxPoint;
-    
-//     if (m_threads >= 3) {
-//         // This way is twice faster than pcl::getMinMax3D implementation
-//         minPoint = pointCloud->at(0);
-//         maxPoint = pointCloud->at(0);
-//         
-//         #pragma omp parallel num_threads(3) 
-//         {
-//             #pragma omp sections nowait 
-//             {
-//                 #pragma omp section 
-//                 {
-//                     // X
-//                     for (uint32_t i = 0; i < pointCloud->size(); i++) {
-//                         if (minPoint.x > pointCloud->at(i).x) minPoint.x = pointCloud->at(i).x;
-//                         if (maxPoint.x < pointCloud->at(i).x) maxPoint.x = pointCloud->at(i).x;
-//                     }
-//                 }
-//                 #pragma omp section 
-//                 {
-//                     // Y
-//                     for (uint32_t i = 0; i < pointCloud->size(); i++) {
-//                         if (minPoint.y > pointCloud->at(i).y) minPoint.y = pointCloud->at(i).y;
-//                         if (maxPoint.y < pointCloud->at(i).y) maxPoint.y = pointCloud->at(i).y;
-//                     }
-//                 }
-//                 #pragma omp section 
-//                 {
-//                     // Z
-//                     for (uint32_t i = 0; i < pointCloud->size(); i++) {
-//                         if (minPoint.z > pointCloud->at(i).z) minPoint.z = pointCloud->at(i).z;
-//                         if (maxPoint.z < pointCloud->at(i).z) maxPoint.z = pointCloud->at(i).z;
-//                     }
-//                 }
-//             }
-//         }
-//     } else {
-//         pcl::getMinMax3D(*pointCloud, minPoint, maxPoint);
-//     }
-    
-
-    const float halfSizeX = m_cellSizeX / 2.0f;
-    const float halfSizeY = m_cellSizeY / 2.0f;
-    const float halfSizeZ = m_cellSizeZ / 2.0f;
-    
-    m_minX = floor(minPoint.x / m_cellSizeX) * m_cellSizeX;
-    m_minY = floor(minPoint.y / m_cellSizeY) * m_cellSizeY;
-    m_minZ = floor(minPoint.z / m_cellSizeZ) * m_cellSizeZ;
-    
-    m_maxX = ceil(maxPoint.x / m_cellSizeX) * m_cellSizeX;
-    m_maxY = ceil(maxPoint.y / m_cellSizeY) * m_cellSizeY;
-    m_maxZ = ceil(maxPoint.z / m_cellSizeZ) * m_cellSizeZ;
-    
-    m_minX = -20.0;
-    m_maxX = 20.0;
-    m_minY = -20.0;
-    m_maxY = 20.0;
-    m_minZ = 0.5;
-    m_maxZ = 3.5;
-    
-    m_dimX = (m_maxX - m_minX) / m_cellSizeX;
-    m_dimY = (m_maxY - m_minY) / m_cellSizeY; 
-    m_dimZ = (m_maxZ - m_minZ) / m_cellSizeZ;
-    
-    m_grid.resize(boost::extents[0][0][0]);
-    m_grid.resize(boost::extents[m_dimX][m_dimY][m_dimZ]);
-    
-    m_voxelList.clear();
-    m_voxelList.reserve(m_dimX * m_dimY * m_dimZ);
-    
-    END_CLOCK(totalCompute, startCompute)
-    ROS_INFO("[%s] %d: %f seconds", __FUNCTION__, __LINE__, totalCompute);
-    
-    RESET_CLOCK(startCompute)
-    
-    // Create the Kd-Tree
-    pcl::search::KdTree<PointType> kdtree;
-    kdtree.setSortedResults(false);
-    kdtree.setEpsilon(std::min(halfSizeX, std::min(halfSizeY, halfSizeZ)));
-    kdtree.setInputCloud (pointCloud);
-    END_CLOCK_2(totalCompute, startCompute)
-    ROS_INFO("[%s] %d: %f seconds", __FUNCTION__, __LINE__, totalCompute);
+    if ((fieldX == NULL) || (fieldY == NULL) || (fieldZ == NULL) ||
+        (fieldX->datatype != sensor_msgs::PointField::FLOAT32) ||
+        (fieldY->datatype != sensor_msgs::PointField::FLOAT32) ||
+        (fieldZ->datatype != sensor_msgs::PointField::FLOAT32) ||
+        (msgPointCloud.row_step != msgPointCloud.width * msgPointCloud.point_step) ||
+        msgPointCloud.is_bigendian) {
 
-    RESET_CLOCK(startCompute)
+        // Unusual layout, the generic conversion is used instead (without deskewing)
+        pcl::PointCloud<pcl::PointXYZ>::Ptr tmpCloud (new pcl::PointCloud<pcl::PointXYZ>);
+        pcl::fromROSMsg<pcl::PointXYZ>(msgPointCloud, *tmpCloud);
 
-    std::vector<int> pointIdxRadiusSearch;
-    std::vector<float> pointRadiusSquaredDistance;
+        pcl::copyPointCloud(*tmpCloud, *m_pointCloud);
 
-    double focalX = 0.0, focalY = 0.0;
-    if (m_inputFromCameras) {
-        focalX = m_stereoCameraModel.left().fx();
-        focalY = m_stereoCameraModel.left().fy();
+        return;
     }
 
-    PointCloudPtr currPointCloud(new PointCloud);
-
-    cout << "m_minX " << m_minX << endl;
-    cout << "m_maxX " << m_maxX << endl;
-    cout << "m_minY " << m_minY << endl;
-    cout << "m_maxY " << m_maxY << endl;
-    cout << "m_minZ " << m_minZ << endl;
-    cout << "m_maxZ " << m_maxZ << endl;
-    
-    PointType searchPoint;
-    for (searchPoint.x = m_minX + halfSizeX; searchPoint.x < m_maxX; searchPoint.x += m_cellSizeX) {
-        for (searchPoint.y = m_minY + halfSizeY; searchPoint.y < m_maxY; searchPoint.y += m_cellSizeY) {
-            for (searchPoint.z = m_minZ + halfSizeZ; searchPoint.z < m_maxZ; searchPoint.z += m_cellSizeZ) {
-
-                if ((fabs(searchPoint.x) < 6.0) || (fabs(searchPoint.x) < 6.0) || (fabs(searchPoint.x) < 6.0))
-                    continue;
-                
-                float prob = 1.0;
-                const uint32_t neighbours = kdtree.radiusSearch(searchPoint, m_voxelSize / 2.0, 
-                                                                pointIdxRadiusSearch, pointRadiusSquaredDistance);
-
-                if (neighbours == 0)
-                    continue;
-
-                currPointCloud->push_back(searchPoint);
-
-                // Avoids using static obstacles
-//                 if (!m_inputFromCameras && m_lastPointCloud) {
-
-//                     const uint32_t & prevNeighbours = m_kdtreeLastPointCloud.radiusSearch(searchPoint, m_voxelSize / 2.0, 
-//                                                                                     pointIdxRadiusSearch, pointRadiusSquaredDistance);
-
-//                     if (prevNeighbours != 0)
-//                         continue;
-
-//                 }
-
-                if (m_inputFromCameras) {
-
-                    tf::Vector3 point = m_map2CamTransform * tf::Vector3(searchPoint.x, searchPoint.y, searchPoint.z);
-                    const float & X = point[0];
-                    const float & Y = point[1];
-                    const float & Z = point[2];
-                    
-                    const float & fX_Z = focalX / Z;
-                    const float & u = X * fX_Z;
-                    const float & u0 = (X - m_cellSizeX) * fX_Z;
-                    const float & u1 = (X + m_cellSizeX) * fX_Z;
-                    const float & sigmaX = (u1 - u0) + 1;//2 * (u1 - u0) + 1;
-                    
-                    const float & fY_Z = focalY / Z;
-                    const float & v = Y * fY_Z;
-                    const float & v0 = (Y - m_cellSizeY) * fY_Z;
-                    const float & v1 = (Y + m_cellSizeY) * fY_Z;
-                    const float & sigmaY = (u1 - u0) + 1; //2 * (v1 - v0) + 1;
-                    
-                    prob = neighbours / sqrt(sigmaX * sigmaY);
-
-                }
-
-                // Just voxels with enough probability are added to the list
-                if (prob > m_threshOccupancyProb) {
-
-                    const float & x = floor((searchPoint.x - m_minX) / m_cellSizeX);
-                    const float & y = floor((searchPoint.y - m_minY)  / m_cellSizeY);
-                    const float & z = floor((searchPoint.z - m_minZ)  / m_cellSizeZ);
+    m_sweepDeskew->setMotion(m_engine->egoMotion());
+
+    const uint8_t * data = msgPointCloud.data.empty()? NULL : &msgPointCloud.data[0];
+    const uint32_t numPoints = msgPointCloud.width * msgPointCloud.height;
+    if ((fieldTime != NULL) && (fieldTime->datatype == sensor_msgs::PointField::FLOAT32)) {
+        m_sweepDeskew->ingest<float>(data, numPoints, msgPointCloud.point_step,
+                                     fieldX->offset, fieldY->offset, fieldZ->offset, fieldTime->offset,
+                                     *m_pointCloud);
+    } else if ((fieldTime != NULL) && (fieldTime->datatype == sensor_msgs::PointField::FLOAT64)) {
+        m_sweepDeskew->ingest<double>(data, numPoints, msgPointCloud.point_step,
+                                      fieldX->offset, fieldY->offset, fieldZ->offset, fieldTime->offset,
+                                      *m_pointCloud);
+    } else {
+        m_sweepDeskew->ingest(data, numPoints, msgPointCloud.point_step,
+                              fieldX->offset, fieldY->offset, fieldZ->offset, *m_pointCloud);
+    }
 
-                    // FIXME: This is just for debugging
-//                     if (z == 1.0) {
+    m_pointCloud->header = pcl_conversions::toPCL(msgPointCloud.header);
+    m_pointCloud->is_dense = msgPointCloud.is_dense;
+}
 
-                        image_geometry::StereoCameraModel * stereoCameraModel = NULL;
-                        if (m_inputFromCameras)
-                            stereoCameraModel = &m_stereoCameraModel;
+/**
+ * Given a certain pointCloud, the frame is computed. The voxel grid is obtained in the calling
+ * thread; the rest of the filter runs in the filter thread if pipeline_enabled, so the next cloud
+ * can be binned meanwhile.
+ * @param pointCloud: The input point cloud.
+ */
+void VoxelOdometry::compute(const PointCloudPtr& pointCloud)
+{
+    // Blocks if all the frames are still in the pipeline
+    VoxelFrame * frame;
+    if (! m_freeFrames->pop(frame))
+        return;
     
-                        VoxelPtr voxelPtr( new Voxel(x, y, z, 
-                                            searchPoint.x, searchPoint.y, searchPoint.z, 
-                                            m_cellSizeX, m_cellSizeY, m_cellSizeZ, 
-                                            m_maxVelX, m_maxVelY, m_maxVelZ, 
-                                            stereoCameraModel, m_speedMethod,
-                                            m_yawInterval, m_pitchInterval, m_factorSpeed));
-
-                        if (! m_inputFromCameras)
-                            voxelPtr->setOccupiedProb(1.0);
-
-                        m_voxelList.push_back(voxelPtr);
-                        m_grid[x][y][z] = voxelPtr;
-
-//                     }
-                }
-
-            }
-        }
+    frame->id = m_currentId;
+    frame->stamp = m_lastPointCloudTime.toSec();
+    frame->deltaTime = m_deltaTime;
+    frame->pose2MapTransform = m_pose2MapTransform;
+    if (m_inputFromCameras) {
+        frame->map2CamTransform = m_map2CamTransform;
+        frame->stereoCamera.fx = m_stereoCameraModel.left().fx();
+        frame->stereoCamera.fy = m_stereoCameraModel.left().fy();
+        frame->stereoCamera.cx = m_stereoCameraModel.left().cx();
+        frame->stereoCamera.cy = m_stereoCameraModel.left().cy();
+        frame->stereoCamera.baseline = m_stereoCameraModel.baseline();
     }
-    
-    cout << "m_voxelList.size() " << m_voxelList.size() << endl;
+    if (m_useOFlow)
+        *frame->oFlowCloud = *m_oFlowCloud;
+    
+    frame->timeStats = t_frame_stats();
+    frame->timeStats.ingestQueueSize = m_ingestInfo.queueSize;
+    frame->timeStats.ingestQueueAge = m_ingestInfo.queueAge;
+    frame->timeStats.ingestDropped = m_ingestInfo.dropped;
+    frame->timeStats.upstreamDropped = m_ingestInfo.upstreamDropped;
+    frame->timeStats.ingestRate = m_ingestInfo.rate;
+    frame->timeStats.posesExtrapolated = m_posesExtrapolated;
+    frame->timeStats.posesStale = m_posesStale;
+    
+    m_engine->computeVoxelFrame(pointCloud, *frame);
+    
+    if (m_pipelineEnabled) {
+        m_readyFrames->push(frame);
+    } else {
+        filterFrame(*frame);
+        m_freeFrames->push(frame);
+    }
+}
 
-//     m_lastPointCloud.reset(new PointCloud);
-//     pcl::copyPointCloud(*currPointCloud, *m_lastPointCloud);
-//     BOOST_FOREACH (VoxelPtr & voxel, m_voxelList) {
-//         m_lastPointCloud->push_back(PointType(voxel->centroidX(), voxel->centroidY(), voxel->centroidZ()));
-//     }
-//     m_kdtreeLastPointCloud.setSortedResults(false);
-//     m_kdtreeLastPointCloud.setEpsilon(std::min(halfSizeX, std::min(halfSizeY, halfSizeZ)));
-//     m_kdtreeLastPointCloud.setInputCloud (m_lastPointCloud);
+/**
+ * Second stage of a frame: runs the filter of the engine and hands the result to the publisher.
+ * @param frame: The frame, as left by computeVoxelFrame.
+ */
+void VoxelOdometry::filterFrame(VoxelFrame & frame)
+{
+    m_engine->filterFrame(frame);
     
-    END_CLOCK_2(totalCompute, startCompute)
-    ROS_INFO("[%s] %d: %f seconds", __FUNCTION__, __LINE__, totalCompute);
+    // Voxels and particles are not copied if nobody is going to see them
+    FrameSnapshot & snapshot = m_snapshotPublisher->acquire();
+    m_engine->fillSnapshot(frame, snapshot, m_publishIntermediateInfo && hasIntermediateSubscribers());
+    snapshot.timeStats = frame.timeStats;
+    m_snapshotPublisher->submit();
 }
 
-
-void VoxelOdometry::updateFromOFlow()
+/**
+ * Main loop of the filter thread
+ */
+void VoxelOdometry::filterLoop()
 {
-    BOOST_FOREACH(pcl::PointXYZRGBNormal & flowVector, *m_oFlowCloud) {
-
-        
-        if (cv::norm(cv::Vec3f(flowVector.normal_x, flowVector.normal_y, flowVector.normal_z)) > 
-            cv::norm(cv::Vec3f(m_maxVelX, m_maxVelY, m_maxVelZ))) {
-            
-            continue;
-        }
-            
-        ParticlePtr particle(new Particle3d(flowVector.x, flowVector.y, flowVector.z, 
-                                    flowVector.normal_x, flowVector.normal_y, flowVector.normal_z, 
-                                    m_pose2MapTransform));
-        
-        int32_t xPos, yPos, zPos;
-        particleToVoxel(particle, xPos, yPos, zPos);
-        
-        if ((xPos >= 0) && (xPos < m_dimX) &&
-            (yPos >= 0) && (yPos < m_dimY) &&
-            (zPos >= 0) && (zPos < m_dimZ)) {                    
-            
-            if (m_grid[xPos][yPos][zPos]->occupied()) {
-                particle->setAge(m_grid[xPos][yPos][zPos]->oldestParticle() + 2);
-                
-                m_grid[xPos][yPos][zPos]->addFlowParticle(particle);
-            }
-        }
+    if (m_tracer)
+        m_tracer->setThreadName("filter");
+    
+    VoxelFrame * frame;
+    while (m_readyFrames->pop(frame)) {
+        filterFrame(*frame);
+        m_freeFrames->push(frame);
     }
 }
 
-// TODO: This part is not meant to be used in the future. I leave it for compatibility, but 
-// it will dissappear.
-void VoxelOdometry::getMeasurementModel()
+/**
+ * Publication of a frame. Called from the publisher thread if publish_async.
+ * @param snapshot: The result of the frame.
+ */
+void VoxelOdometry::publishSnapshot(const FrameSnapshot & snapshot)
 {
-    if (m_inputFromCameras) {
-        for (uint32_t x = 0; x < m_dimX; x++) {
-            for (uint32_t y = 0; y < m_dimY; y++) {
-                for (uint32_t z = 0; z < m_dimZ; z++) {
-                    VoxelPtr & voxel = m_grid[x][y][z];
-                    
-                    if (voxel) {
-                        const int & sigmaX = voxel->sigmaX();
-                        const int & sigmaY = voxel->sigmaY();
-                        const int & sigmaZ = voxel->sigmaZ();
-                        
-                        for (uint32_t x1 = max(0, (int)(x - sigmaX)); x1 <= min((int)(m_dimX - 1), (int)(x + sigmaX)); x1++) {
-                            for (uint32_t y1 = max(0, (int)(y - sigmaY)); y1 <= min((int)(m_dimY - 1), (int)(y + sigmaY)); y1++) {
-                                for (uint32_t z1 = max(0, (int)(z - sigmaZ)); z1 <= min((int)(m_dimZ - 1), (int)(z + sigmaZ)); z1++) {
-                                    if (m_grid[x1][y1][z1])
-                                        m_grid[x1][y1][z1]->incNeighborOcc();
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    const t_frame_stats & timeStats = snapshot.timeStats;
+    const t_stage_time * stages = timeStats.stages;
+    
+    // Checked here, since nothing can be written from the signal handler
+    if (m_tracer) {
+        if (Tracer::flushRequested())
+            flushTrace("SIGUSR1");
+        else if ((m_traceDeadline > 0.0) && (stages[STAGE_TOTAL_COMPUTE].wall > m_traceDeadline) &&
+                 ((ros::WallTime::now() - m_lastTraceFlush).toSec() >= 1.0))
+            flushTrace("deadline");
+    }
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
+    
+    m_publishedMarkers = 0;
+    m_publishedBytes = 0;
+    
+    // Every frame is in time_stats, so just a sample goes to the log
+    for (uint32_t i = 0; i < STAGE_TOTAL_COMPUTE; i++)
+        VO_LOG_DEBUG("[%s] Time for %s: %f seconds (%f CPU)", __FUNCTION__, STAGE_NAMES[i], stages[i].wall, stages[i].cpu);
+    VO_LOG_INFO_THROTTLE(5.0, "[%s] Total time: %f seconds (%f CPU)", __FUNCTION__, 
+                         stages[STAGE_TOTAL_COMPUTE].wall, stages[STAGE_TOTAL_COMPUTE].cpu);
+    
+    voxel_odometry::stats timeStatsMsg;
+    timeStatsMsg.header.seq = snapshot.id;
+    timeStatsMsg.header.stamp = ros::Time::now();
+    timeStatsMsg.getVoxelGridFromPointCloud = stages[STAGE_GET_VOXEL_GRID_FROM_POINT_CLOUD].wall;
+    timeStatsMsg.registration = stages[STAGE_REGISTRATION].wall;
+    timeStatsMsg.updateFromOFlow = stages[STAGE_UPDATE_FROM_OFLOW].wall;
+    timeStatsMsg.getMeasurementModel = stages[STAGE_GET_MEASUREMENT_MODEL].wall;
+    timeStatsMsg.egoMotionCompensation = stages[STAGE_EGO_MOTION_COMPENSATION].wall;
+    timeStatsMsg.prediction = stages[STAGE_PREDICTION].wall;
+    timeStatsMsg.measurementBasedUpdate = stages[STAGE_MEASUREMENT_BASED_UPDATE].wall;
+    timeStatsMsg.segment = stages[STAGE_SEGMENT].wall;
+    timeStatsMsg.updateSpeedFromObstacles = stages[STAGE_UPDATE_SPEED_FROM_OBSTACLES].wall;
+    timeStatsMsg.initialization = stages[STAGE_INITIALIZATION].wall;
+    timeStatsMsg.totalCompute = stages[STAGE_TOTAL_COMPUTE].wall;
+    timeStatsMsg.ingestQueueSize = timeStats.ingestQueueSize;
+    timeStatsMsg.ingestQueueAge = timeStats.ingestQueueAge;
+    timeStatsMsg.ingestDropped = timeStats.ingestDropped;
+    timeStatsMsg.upstreamDropped = timeStats.upstreamDropped;
+    timeStatsMsg.ingestRate = timeStats.ingestRate;
+    timeStatsMsg.posesExtrapolated = timeStats.posesExtrapolated;
+    timeStatsMsg.posesStale = timeStats.posesStale;
+    
+    t_stage_time visualization = stages[STAGE_TOTAL_VISUALIZATION];
+    if (m_publishIntermediateInfo) {
+        StageTimer timer(visualization, m_stageCpuTime);
+        if (outputDue(OUTPUT_VOXELS, hasSubscribers(m_voxelsPub) || hasSubscribers(m_voxelsIdxPub) || 
+                                     hasSubscribers(m_voxelsCloudPub)))
+            publishVoxels(snapshot);
+        if (outputDue(OUTPUT_OFLOW, hasSubscribers(m_oFlowPub)))
+            publishOFlow(snapshot);
+        if (outputDue(OUTPUT_PARTICLES, hasSubscribers(m_particlesPub) || hasSubscribers(m_particlesSimplePub) || 
+                                        hasSubscribers(m_particlesCloudPub) || 
+                                        hasSubscribers(m_particles0Pub) || hasSubscribers(m_particles1Pub) || 
+                                        hasSubscribers(m_particles2Pub) || hasSubscribers(m_particles3Pub) || 
+                                        hasSubscribers(m_particlesDPub)))
+            publishParticles(snapshot);
+        if (outputDue(OUTPUT_MAIN_VECTORS, hasSubscribers(m_mainVectorsPub)))
+            publishMainVectors(snapshot);
+        if (outputDue(OUTPUT_OBSTACLES, hasSubscribers(m_obstaclesPub)))
+            publishObstacles(snapshot);
+        if (outputDue(OUTPUT_OBSTACLE_CUBES, hasSubscribers(m_obstacleCubesPub) || hasSubscribers(m_obstacleSpeedPub) || 
+                                             hasSubscribers(m_obstacleSpeedTextPub)))
+            publishObstacleCubes(snapshot);
+    }
+    
+    if (outputDue(OUTPUT_FAKE_POINT_CLOUD, hasSubscribers(m_fakePointCloudPub) || hasSubscribers(m_fakeParticlesPub)))
+        publishFakePointCloud(snapshot);
+    if (outputDue(OUTPUT_ODOM, hasSubscribers(m_odomPub)))
+        publishOdom(snapshot);
+    if (outputDue(OUTPUT_OBSTACLE_ARRAY, hasSubscribers(m_obstacleArrayPub)))
+        publishObstacleArray(snapshot);
+    
+    VO_LOG_DEBUG("[%s] Total visualization time: %f seconds (%f CPU)", __FUNCTION__, visualization.wall, visualization.cpu);
+    timeStatsMsg.totalVisualization = visualization.wall;
+    
+    timeStatsMsg.stageNames.resize(NUM_STAGES);
+    timeStatsMsg.stageWallTime.resize(NUM_STAGES);
+    timeStatsMsg.stageCpuTime.resize(NUM_STAGES);
+    for (uint32_t i = 0; i < NUM_STAGES; i++) {
+        const t_stage_time & stage = (i == STAGE_TOTAL_VISUALIZATION)? visualization : stages[i];
+        timeStatsMsg.stageNames[i] = STAGE_NAMES[i];
+        timeStatsMsg.stageWallTime[i] = stage.wall;
+        timeStatsMsg.stageCpuTime[i] = stage.cpu;
+        m_rollingStats->add(i, stage.wall);
+    }
+    
+    timeStatsMsg.inputPoints = timeStats.inputPoints;
+    timeStatsMsg.occupiedVoxels = timeStats.occupiedVoxels;
+    timeStatsMsg.liveParticles = timeStats.liveParticles;
+    timeStatsMsg.particlesBorn = timeStats.particlesBorn;
+    timeStatsMsg.particlesEvicted = timeStats.particlesEvicted;
+    timeStatsMsg.obstacles = timeStats.obstacles;
+    timeStatsMsg.publishedMarkers = m_publishedMarkers;
+    timeStatsMsg.publishedBytes = m_publishedBytes;
+    timeStatsMsg.latency = (ros::Time::now() - ros::Time(snapshot.stamp)).toSec();
+    
+    m_rollingStats->add(m_latencySeries, timeStatsMsg.latency);
+    m_rollingStats->add(m_inputPointsSeries, timeStats.inputPoints);
+    m_rollingStats->add(m_occupiedVoxelsSeries, timeStats.occupiedVoxels);
+    m_rollingStats->add(m_liveParticlesSeries, timeStats.liveParticles);
+    m_rollingStats->add(m_obstaclesSeries, timeStats.obstacles);
+    m_rollingStats->add(m_publishedBytesSeries, m_publishedBytes);
+    
+    m_timeStatsPub.publish(timeStatsMsg);
+    
+    if ((m_statsSummaryPeriod > 0.0) && 
+        ((ros::WallTime::now() - m_lastStatsSummary).toSec() >= m_statsSummaryPeriod)) {
         
-        for (uint32_t x = 0; x < m_dimX; x++) {
-            for (uint32_t y = 0; y < m_dimY; y++) {
-                for (uint32_t z = 0; z < m_dimZ; z++) {
-                    VoxelPtr & voxel = m_grid[x][y][z];
-
-                    if (voxel) {
-                        const int & sigmaX = voxel->sigmaX();
-                        const int & sigmaY = voxel->sigmaY();
-                        const int & sigmaZ = voxel->sigmaZ();
-                    
-                        // p(m(x,z) | occupied)
-                        const double occupiedProb = (double)voxel->neighborOcc() / 
-                                    ((2.0 * (double)sigmaX + 1.0) + (2.0 * (double)sigmaY + 1.0) + (2.0 * (double)sigmaZ + 1.0));
-                        voxel->setOccupiedProb(occupiedProb);
-                    }
-                }
-            }
-        }
-    }/* else {
-        for (uint32_t x = 0; x < m_dimX; x++) {
-            for (uint32_t y = 0; y < m_dimY; y++) {
-                for (uint32_t z = 0; z < m_dimZ; z++) {
-                    VoxelPtr & voxel = m_grid[x][y][z];
-                    
-                    if (voxel) {
-                        const int & sigmaX = voxel->sigmaX();
-                        const int & sigmaY = voxel->sigmaY();
-                        const int & sigmaZ = voxel->sigmaZ();
-                        
-                        // p(m(x,z) | occupied)
-                        const double occupiedProb = 1.0;
-                    }
-                }
-            }
-        }
-    }*/
+        publishStatsSummary();
+        m_lastStatsSummary = ros::WallTime::now();
+    }
 }
 
-void VoxelOdometry::initialization()
+void VoxelOdometry::publishStatsSummary()
 {
-    cout << "Initializing " << m_voxelList.size() << endl;
-    
-    vector <ParticleList> particles(m_voxelList.size());
-
-    uint32_t totalParticles = 0;
-    #pragma omp parallel for
-    for (uint32_t i = 0; i < m_voxelList.size(); i++) {
-        VoxelPtr & voxel = m_voxelList.at(i);
-
-        const double & occupiedProb = voxel->occupiedProb();
-                
-        particles[i] = voxel->createParticlesStatic(m_pose2MapTransform);
-        
-        totalParticles += particles[i].size();
+    voxel_odometry::stats_summary summaryMsg;
+    summaryMsg.header.stamp = ros::Time::now();
+    summaryMsg.windowSize = m_rollingStats->windowSize();
+    
+    for (uint32_t i = 0; i < m_rollingStats->numSeries(); i++) {
+        const t_percentiles percentiles = m_rollingStats->percentiles(i);
+        
+        summaryMsg.names.push_back(m_rollingStats->name(i));
+        summaryMsg.numValues.push_back(m_rollingStats->numValues(i));
+        summaryMsg.p50.push_back(percentiles.p50);
+        summaryMsg.p90.push_back(percentiles.p90);
+        summaryMsg.p99.push_back(percentiles.p99);
+        summaryMsg.max.push_back(percentiles.max);
     }
+    
+    m_statsSummaryPub.publish(summaryMsg);
+}
 
-    m_particles.reserve(m_particles.size() + totalParticles);
+/**
+ * Whether an output has to be built for this frame: somebody listens to it and, if its rate
+ * is limited, its period has passed since it was last published.
+ */
+bool VoxelOdometry::outputDue(const Output & output, const bool & listened)
+{
+    if (! listened)
+        return false;
     
-//     totalParticles = 0;
-    for (uint32_t i = 0; i < m_voxelList.size(); i++) {
-        
-        ParticleList & newParticles = particles[i];
-        
-        m_particles.insert(m_particles.end(), newParticles.begin(), newParticles.end());
-        
-//         totalParticles += newParticles.size();
-    }
+    const ros::WallTime now = ros::WallTime::now();
+    if ((m_outputPeriods[output] > 0.0) && ((now - m_lastOutputs[output]).toSec() < m_outputPeriods[output]))
+        return false;
     
-    m_initialized = true;
+    m_lastOutputs[output] = now;
+    return true;
 }
 
-inline void VoxelOdometry::particleToVoxel(const ParticlePtr & particle, 
-                                               int32_t & posX, int32_t & posY, int32_t & posZ)
+// Outputs that need the voxels and particles of the snapshot
+bool VoxelOdometry::hasIntermediateSubscribers() const
 {
-    const double dPosX = (particle->x() - m_minX) / m_cellSizeX;
-    const double dPosY = (particle->y() - m_minY) / m_cellSizeY;
-    const double dPosZ = (particle->z() - m_minZ) / m_cellSizeZ;
-
-    // This check is needed to avoid truncating to 0 the case (-0.***)
-    posX = (dPosX < 0.0)? -1 : dPosX;
-    posY = (dPosY < 0.0)? -1 : dPosY;
-    posZ = (dPosZ < 0.0)? -1 : dPosZ;
+    return hasSubscribers(m_voxelsPub) || hasSubscribers(m_voxelsIdxPub) || hasSubscribers(m_oFlowPub) || 
+           hasSubscribers(m_voxelsCloudPub) || hasSubscribers(m_particlesCloudPub) || 
+           hasSubscribers(m_particlesPub) || hasSubscribers(m_particlesSimplePub) || 
+           hasSubscribers(m_particles0Pub) || hasSubscribers(m_particles1Pub) || hasSubscribers(m_particles2Pub) || 
+           hasSubscribers(m_particles3Pub) || hasSubscribers(m_particlesDPub) || hasSubscribers(m_mainVectorsPub);
 }
 
-void VoxelOdometry::prediction()
+/**
+ * Writes the events still in the buffers of the tracer. Deadline flushes are at most one per second.
+ * @param reason: Just for the log.
+ */
+void VoxelOdometry::flushTrace(const char * reason)
 {
-    // TODO: Put correct values for deltaX, deltaY, deltaZ, deltaVX, deltaVY, deltaVZ in class Particle,
-    // based on the covariance matrix
-    ParticleList newParticles;
-    newParticles.reserve(m_particles.size());
-    BOOST_FOREACH(ParticlePtr & particle, m_particles) {
-        particle->transform(m_deltaTime);
-        
-        int32_t xPos, yPos, zPos;
-        particleToVoxel(particle, xPos, yPos, zPos);
-        
-        if ((xPos >= 0) && (xPos < m_dimX) &&
-            (yPos >= 0) && (yPos < m_dimY) &&
-            (zPos >= 0) && (zPos < m_dimZ)) {                    
-        
-            VoxelPtr & voxel = m_grid[xPos][yPos][zPos];
-            if (voxel) {
-                voxel->addParticle(particle);
-                newParticles.push_back(particle);
-            }
-        }
-    }
+    const std::string fileName = m_tracer->flush();
+    m_lastTraceFlush = ros::WallTime::now();
     
-    if (m_useOFlow) {
-        for (uint32_t x = 0; x < m_dimX; x++) {
-            for (uint32_t y = 0; y < m_dimY; y++) {
-                for (uint32_t z = 0; z < m_dimZ; z++) {
-                    VoxelPtr & voxel = m_grid[x][y][z];
-                    if (voxel)
-                        voxel->joinParticles();
-                }
-            }
-        }
-    }
-    
-    m_particles.swap(newParticles);
-        
+    if (fileName.empty())
+        ROS_ERROR_NAMED(__FILE__, "[%s] The trace could not be written (%s)", __FUNCTION__, reason);
+    else
+        ROS_INFO("[%s] Trace written to %s (%s)", __FUNCTION__, fileName.c_str(), reason);
 }
 
-void VoxelOdometry::measurementBasedUpdate()
+
+// TODO: This part is not meant to be used in the future. I leave it for compatibility, but 
+// it will dissappear.
+tf::Quaternion getQuaternion(const double &vx, const double &vy, const double &vz)
 {
-    for (uint32_t x = 0; x < m_dimX; x++) {
-        for (uint32_t y = 0; y < m_dimY; y++) {
-            for (uint32_t z = 0; z < m_dimZ; z++) {
-                VoxelPtr & voxel = m_grid[x][y][z];
-                
-                if ((voxel) && (! voxel->empty()) && (voxel->occupied())) {
-                    voxel->sortParticles();
-//                     voxel->setMainVectors(m_deltaX, m_deltaY, m_deltaZ);
-                    voxel->updateHistogram();
-                    voxel->reduceParticles(m_maxNumberOfParticles);
-//                     voxel->centerParticles();
-                }
-            }
-        }
+    if (vx == vy == vz == 0.0) {
+        return tf::Quaternion(0.0, 0.0, 0.0, 0.0);
     }
     
-    return;
+    Eigen::Vector3d zeroVector, currVector;
+    zeroVector << 1.0, 0.0, 0.0;
+    currVector << vx, vy, vz;
+    currVector.normalize();
+    Eigen::Quaterniond eigenQuat;
+    eigenQuat.setFromTwoVectors(zeroVector, currVector);
     
-    for (uint32_t x = 0; x < m_dimX; x++) {
-        for (uint32_t y = 0; y < m_dimY; y++) {
-            for (uint32_t z = 0; z < m_dimZ; z++) {
-                VoxelPtr & voxel = m_grid[x][y][z];
-            
-                if ((! voxel->empty()) && (voxel->occupied())) {
-                    voxel->setOccupiedPosteriorProb(m_particlesPerVoxel);
-                    const double Nrc = voxel->occupiedPosteriorProb() * m_particlesPerVoxel;
-                    const double fc = Nrc / voxel->numParticles();
-                    
-                    if (fc > 1.0) {
-                        const double Fn = floor(fc);       // Integer part
-                        const double Ff = fc - Fn;         // Fractional part
-                        
-                        for (uint32_t i = 0; i < voxel->numParticles(); i++) {
-                            
-                            const ParticlePtr & p = voxel->getParticle(i);
-                            
-                            for (uint32_t k = 1; k < Fn; k++)
-                                for (uint32_t n = 0; n < p->age(); n++)
-                                    voxel->makeCopy(p);
-                            
-                            const double r = (double)rand() / (double)RAND_MAX;
-                            if (r < Ff)
-                                voxel->makeCopy(p);
-                        }
-                    } else if (fc < 1.0) {
-                        for (uint32_t i = 0; i < voxel->numParticles(); i++) {
-                            const double r = (double)rand() / (double)RAND_MAX;
-                            if (r > fc)
-                                voxel->removeParticle(i);
-                        }
-                    }
-                }
-            }
-        }
-    }
+    tf::Quaternion quat(eigenQuat.x(), eigenQuat.y(), eigenQuat.z(), eigenQuat.w());
+    
+    return quat;
 }
 
-void VoxelOdometry::joinVoxels()
+void VoxelOdometry::publishVoxels(const FrameSnapshot & snapshot)
 {
-    m_obstacles.clear();
-    VoxelObstaclePtr obst(new VoxelObstacle(m_obstacles.size(), 
-                            m_threshYaw, m_threshPitch, m_threshMagnitude, 
-                            m_minVoxelDensity, m_obstacleSpeedMethod, 
-                            m_yawInterval, m_pitchInterval));
-
-    BOOST_FOREACH(VoxelPtr & voxel, m_voxelList) {
-        
-        obst->addVoxelToObstacle(voxel);
-    }
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
+    
+    // Each topic is built just if somebody listens to it
+    const bool publishMarkers = hasSubscribers(m_voxelsPub);
+    const bool publishIdx = hasSubscribers(m_voxelsIdxPub);
+    
+    if (hasSubscribers(m_voxelsCloudPub)) {
+        sensor_msgs::PointCloud2Ptr cloudMsg(new sensor_msgs::PointCloud2);
+        recordsToCloud(snapshot.voxels, VOXEL_FIELDS, sizeof(VOXEL_FIELDS) / sizeof(t_record_field), *cloudMsg);
+        cloudMsg->header.frame_id = m_mapFrame;
+        cloudMsg->header.stamp = ros::Time(snapshot.stamp);
+        cloudMsg->header.seq = snapshot.id;
         
-    m_obstacles.push_back(obst);
-}
-
-void VoxelOdometry::updateSpeedFromObstacles()
-{
-    BOOST_FOREACH(VoxelObstaclePtr & obstacle, m_obstacles) {
-//         obstacle.updateSpeed(m_deltaX, m_deltaY, m_deltaZ);
-        obstacle->updateSpeedFromParticles();
-        obstacle->updateHistogram(m_maxVelX, m_maxVelY, m_maxVelZ, m_factorSpeed, m_minMagnitude);
+        publishCounted(m_voxelsCloudPub, cloudMsg);
     }
-}
-
-void VoxelOdometry::publishVoxels()
-{
+    
+    if ((! publishMarkers) && (! publishIdx))
+        return;
+    
     visualization_msgs::MarkerArray voxelMarkers;
     visualization_msgs::MarkerArray voxelIdxList;
-    visualization_msgs::MarkerArray voxelIdxListCleaner;
-    
-    voxelIdxListCleaner.markers.clear();
-    for (uint32_t i = 0; i < m_dimX * m_dimY * m_dimZ; i++) {
-        visualization_msgs::Marker voxelIdx;
-        voxelIdx.header.frame_id = m_mapFrame;
-        voxelIdx.header.stamp = ros::Time();
-        voxelIdx.id = i;
-        
-        voxelIdx.ns = "voxels";
-        voxelIdx.type = visualization_msgs::Marker::CUBE;
-        voxelIdx.action = visualization_msgs::Marker::DELETE;
-        
-        voxelIdxListCleaner.markers.push_back(voxelIdx);
-    }
-    m_voxelsPub.publish(voxelIdxListCleaner);
     
     uint32_t idCount = 0;
-    BOOST_FOREACH(const VoxelPtr & voxel, m_voxelList) {
-        visualization_msgs::Marker voxelMarker;
-        voxelMarker.header.frame_id = m_mapFrame;
-        voxelMarker.header.stamp = ros::Time();
-        voxelMarker.id = idCount++;
-        voxelMarker.ns = "voxels";
-        voxelMarker.type = visualization_msgs::Marker::CUBE;
-        voxelMarker.action = visualization_msgs::Marker::ADD;
-
-        voxelMarker.pose.position.x = voxel->centroidX();
-        voxelMarker.pose.position.y = voxel->centroidY();
-        voxelMarker.pose.position.z = voxel->centroidZ();
+    BOOST_FOREACH(const t_voxel_record & voxel, snapshot.voxels) {
+        if (publishMarkers) {
+            visualization_msgs::Marker voxelMarker;
+            voxelMarker.header.frame_id = m_mapFrame;
+            voxelMarker.header.stamp = ros::Time();
+            voxelMarker.id = idCount;
+            voxelMarker.ns = "voxels";
+            voxelMarker.type = visualization_msgs::Marker::CUBE;
+            voxelMarker.action = visualization_msgs::Marker::ADD;
+
+            voxelMarker.pose.position.x = voxel.centroidX;
+            voxelMarker.pose.position.y = voxel.centroidY;
+            voxelMarker.pose.position.z = voxel.centroidZ;
         
-        voxelMarker.pose.orientation.x = 0.0;
-        voxelMarker.pose.orientation.y = 0.0;
-        voxelMarker.pose.orientation.z = 0.0;
-        voxelMarker.pose.orientation.w = 1.0;
-        voxelMarker.scale.x = m_cellSizeX;
-        voxelMarker.scale.y = m_cellSizeY;
-        voxelMarker.scale.z = m_cellSizeZ;
-        voxelMarker.color.r = (double)rand() / RAND_MAX;
-        voxelMarker.color.g = (double)rand() / RAND_MAX;
-        voxelMarker.color.b = (double)rand() / RAND_MAX;
-        voxelMarker.color.a = 0.5;
+            voxelMarker.pose.orientation.x = 0.0;
+            voxelMarker.pose.orientation.y = 0.0;
+            voxelMarker.pose.orientation.z = 0.0;
+            voxelMarker.pose.orientation.w = 1.0;
+            voxelMarker.scale.x = m_cellSizeX;
+            voxelMarker.scale.y = m_cellSizeY;
+            voxelMarker.scale.z = m_cellSizeZ;
+            voxelMarker.color.r = (double)rand() / RAND_MAX;
+            voxelMarker.color.g = (double)rand() / RAND_MAX;
+            voxelMarker.color.b = (double)rand() / RAND_MAX;
+            voxelMarker.color.a = 0.5;
 //         voxelMarker.color.a = voxel.occupiedProb();
         
-        voxelMarkers.markers.push_back(voxelMarker);
-
+            voxelMarkers.markers.push_back(voxelMarker);
+        }
+        idCount++;
+        
+        if (! publishIdx)
+            continue;
+        
         // ********************************************************
         // Publication of the speed text of the obstacle
         // ********************************************************
@@ -1061,9 +1023,9 @@ void VoxelOdometry::publishVoxels()
         voxelIdx.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
         voxelIdx.action = visualization_msgs::Marker::ADD;
         
-        voxelIdx.pose.position.x = voxel->centroidX();
-        voxelIdx.pose.position.y = voxel->centroidY();
-        voxelIdx.pose.position.z = voxel->centroidZ();
+        voxelIdx.pose.position.x = voxel.centroidX;
+        voxelIdx.pose.position.y = voxel.centroidY;
+        voxelIdx.pose.position.z = voxel.centroidZ;
         
         voxelIdx.pose.orientation.x = 0.0;
         voxelIdx.pose.orientation.y = 0.0;
@@ -1076,57 +1038,38 @@ void VoxelOdometry::publishVoxels()
         voxelIdx.color.b = 0.0;
         
         stringstream ss;
-        ss << voxel->x() << ", " << voxel->y() << ", " << voxel->z() << endl;
+        ss << voxel.x << ", " << voxel.y << ", " << voxel.z << endl;
         voxelIdx.text = ss.str();
         
         voxelIdxList.markers.push_back(voxelIdx);
     }
     
-    m_voxelsIdxPub.publish(voxelIdxList);
+    if (publishIdx) {
+        m_voxelIdxMarkers.finish(voxelIdxList);
+        publishCounted(m_voxelsIdxPub, voxelIdxList);
+    }
 
-    m_voxelsPub.publish(voxelMarkers);
+    if (publishMarkers) {
+        m_voxelMarkers.finish(voxelMarkers);
+        publishCounted(m_voxelsPub, voxelMarkers);
+    }
 }
 
-void VoxelOdometry::publishOFlow()
+void VoxelOdometry::publishOFlow(const FrameSnapshot & snapshot)
 {
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
+    
     geometry_msgs::PoseArray oflowVectors;
     
     oflowVectors.header.frame_id = m_mapFrame;
     oflowVectors.header.stamp = ros::Time();
     
-    uint32_t idCount = 0;
-    for (uint32_t x = 0; x < m_dimX; x++) {
-        for (uint32_t y = 0; y < m_dimY; y++) {
-            for (uint32_t z = 0; z < m_dimZ; z++) {
-                VoxelPtr & voxel = m_grid[x][y][z];
-                
-                if (voxel) {
-                
-                    const ParticleList & oflowParticles = voxel->getOFlowParticles();
-                    
-                    BOOST_FOREACH(const ParticlePtr & particle, oflowParticles) {
-                        geometry_msgs::Pose pose;
-                        
-                        pose.position.x = particle->x();
-                        pose.position.y = particle->y();
-                        pose.position.z = particle->z();
-                        
-                        const double & vx = particle->vx();
-                        const double & vy = particle->vy();
-                        const double & vz = particle->vz();
-                        
-                        const tf::Quaternion & quat = particle->getQuaternion();
-                        pose.orientation.w = quat.w();
-                        pose.orientation.x = quat.x();
-                        pose.orientation.y = quat.y();
-                        pose.orientation.z = quat.z();
-                        
-                        oflowVectors.poses.push_back(pose);
-                    }
-                }
-            }
-        }
-    }
+    // Optical flow particles are stored voxel by voxel, in grid order
+    oflowVectors.poses.resize(snapshot.oFlowParticles.size());
+    m_engine->taskRuntime()->parallelFor(0, snapshot.oFlowParticles.size(), 256, 
+                                         boost::bind(&VoxelOdometry::fillParticlePoses, this, 
+                                                     boost::cref(snapshot.oFlowParticles), 
+                                                     boost::ref(oflowVectors.poses), _1, _2));
 //     BOOST_FOREACH(const pcl::PointXYZRGBNormal & point, *m_oFlowCloud) {
 //         geometry_msgs::Pose pose;
 //         
@@ -1149,44 +1092,65 @@ void VoxelOdometry::publishOFlow()
 //         oflowVectors.poses.push_back(pose);
 //     }
     
-    m_oFlowPub.publish(oflowVectors);
+    publishCounted(m_oFlowPub, oflowVectors);
 }
 
 
-void VoxelOdometry::publishParticles()
+/**
+ * Fills poses[begin, end) with the position and direction of the same range of particles.
+ */
+void VoxelOdometry::fillParticlePoses(const std::vector<t_particle_record> & particles, 
+                                      std::vector<geometry_msgs::Pose> & poses, 
+                                      const uint32_t & begin, const uint32_t & end)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        const t_particle_record & particle = particles[i];
+        geometry_msgs::Pose & pose = poses[i];
+        
+        pose.position.x = particle.x;
+        pose.position.y = particle.y;
+        pose.position.z = particle.z;
+        
+        const tf::Quaternion & quat = getQuaternion(particle.vx, particle.vy, particle.vz);
+        pose.orientation.w = quat.w();
+        pose.orientation.x = quat.x();
+        pose.orientation.y = quat.y();
+        pose.orientation.z = quat.z();
+    }
+}
+
+void VoxelOdometry::publishParticles(const FrameSnapshot & snapshot)
 {
-    {
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
+    
+    // Compact alternative to the markers and pose arrays below
+    if (hasSubscribers(m_particlesCloudPub)) {
+        sensor_msgs::PointCloud2Ptr cloudMsg(new sensor_msgs::PointCloud2);
+        recordsToCloud(snapshot.particles, PARTICLE_FIELDS, sizeof(PARTICLE_FIELDS) / sizeof(t_record_field), *cloudMsg);
+        cloudMsg->header.frame_id = m_mapFrame;
+        cloudMsg->header.stamp = ros::Time(snapshot.stamp);
+        cloudMsg->header.seq = snapshot.id;
+        
+        publishCounted(m_particlesCloudPub, cloudMsg);
+    }
+    
+    if (hasSubscribers(m_particlesSimplePub)) {
         geometry_msgs::PoseArray particles;
         
         particles.header.frame_id = m_mapFrame;
         particles.header.stamp = ros::Time();
-            
-        BOOST_FOREACH(const VoxelPtr & voxel, m_voxelList) {
-            BOOST_FOREACH(const ParticlePtr & particle, voxel->getParticles()) {
-                geometry_msgs::Pose pose;
-                
-                pose.position.x = particle->x();
-                pose.position.y = particle->y();
-                pose.position.z = particle->z();
-                
-                const double & vx = particle->vx();
-                const double & vy = particle->vy();
-                const double & vz = particle->vz();
-                
-                const tf::Quaternion & quat = particle->getQuaternion();
-                pose.orientation.w = quat.w();
-                pose.orientation.x = quat.x();
-                pose.orientation.y = quat.y();
-                pose.orientation.z = quat.z();
-                
-                particles.poses.push_back(pose);
-            }
-        }
         
-        m_particlesSimplePub.publish(particles);
+        particles.poses.resize(snapshot.particles.size());
+        m_engine->taskRuntime()->parallelFor(0, snapshot.particles.size(), 256, 
+                                             boost::bind(&VoxelOdometry::fillParticlePoses, this, 
+                                                         boost::cref(snapshot.particles), 
+                                                         boost::ref(particles.poses), _1, _2));
+        
+        publishCounted(m_particlesSimplePub, particles);
     }
     
-    {
+    if (hasSubscribers(m_particles0Pub) || hasSubscribers(m_particles1Pub) || hasSubscribers(m_particles2Pub) || 
+        hasSubscribers(m_particles3Pub) || hasSubscribers(m_particlesDPub)) {
         
         geometry_msgs::PoseArray particles0, particles1, particles2, particles3, particlesD;
         
@@ -1205,274 +1169,225 @@ void VoxelOdometry::publishParticles()
         particlesD.header.frame_id = m_mapFrame;
         particlesD.header.stamp = ros::Time();
         
-        BOOST_FOREACH(const VoxelPtr & voxel, m_voxelList) {
-            BOOST_FOREACH(const ParticlePtr & particle, voxel->getParticles()) {
-                geometry_msgs::Pose pose;
-                
-                int X, Y, Z;
-                
-                particleToVoxel(particle, X, Y, Z);
-                
-                pose.position.x = voxel->centroidX(); // particle->x();
-                pose.position.y = voxel->centroidY(); // particle->y();
-                pose.position.z = voxel->centroidZ(); // particle->z();
-                
-                const double & vx = particle->vx();
-                const double & vy = particle->vy();
-                const double & vz = particle->vz();
-                
-                float magnitude = cv::norm(cv::Vec3f(vx, vy, vz));
-                float maxMagnitude = cv::norm(cv::Vec3f(m_maxVelX, m_maxVelY, m_maxVelZ));
-                
-                pose.position.z += (m_cellSizeZ / 2.0) - (m_cellSizeZ * (magnitude / maxMagnitude));
-                
-                if (vx != 0) {
-                    pose.position.x += (float)rand()/(float)(RAND_MAX/(m_cellSizeX / 20.0f));
-                }
-                if (vy != 0) {
-                    pose.position.y += (float)rand()/(float)(RAND_MAX/(m_cellSizeX / 20.0f));
-                }
-                
-                const tf::Quaternion & quat = particle->getQuaternion();
-                pose.orientation.w = quat.w();
-                pose.orientation.x = quat.x();
-                pose.orientation.y = quat.y();
-                pose.orientation.z = quat.z();
-                
-                switch (particle->age()) {
-                    case 0:
-                        particles0.poses.push_back(pose);
-                        break;
-                    case 1:
-                        particles1.poses.push_back(pose);
-                        break;
-                    case 2:
-                        particles2.poses.push_back(pose);
-                        break;
-                    case 3:
-                        particles3.poses.push_back(pose);
-                        break;
-                    default:
-                        particlesD.poses.push_back(pose);
-                        break;
-                }
+        BOOST_FOREACH(const t_particle_record & particle, snapshot.particles) {
+            const t_voxel_record & voxel = snapshot.voxels[particle.voxelIdx];
+            
+            geometry_msgs::Pose pose;
+            
+            pose.position.x = voxel.centroidX; // particle->x();
+            pose.position.y = voxel.centroidY; // particle->y();
+            pose.position.z = voxel.centroidZ; // particle->z();
+            
+            const double & vx = particle.vx;
+            const double & vy = particle.vy;
+            const double & vz = particle.vz;
+            
+            float magnitude = cv::norm(cv::Vec3f(vx, vy, vz));
+            float maxMagnitude = cv::norm(cv::Vec3f(m_maxVelX, m_maxVelY, m_maxVelZ));
+            
+            pose.position.z += (m_cellSizeZ / 2.0) - (m_cellSizeZ * (magnitude / maxMagnitude));
+            
+            if (vx != 0) {
+                pose.position.x += (float)rand()/(float)(RAND_MAX/(m_cellSizeX / 20.0f));
+            }
+            if (vy != 0) {
+                pose.position.y += (float)rand()/(float)(RAND_MAX/(m_cellSizeX / 20.0f));
+            }
+            
+            const tf::Quaternion & quat = getQuaternion(particle.vx, particle.vy, particle.vz);
+            pose.orientation.w = quat.w();
+            pose.orientation.x = quat.x();
+            pose.orientation.y = quat.y();
+            pose.orientation.z = quat.z();
+            
+            switch (particle.age) {
+                case 0:
+                    particles0.poses.push_back(pose);
+                    break;
+                case 1:
+                    particles1.poses.push_back(pose);
+                    break;
+                case 2:
+                    particles2.poses.push_back(pose);
+                    break;
+                case 3:
+                    particles3.poses.push_back(pose);
+                    break;
+                default:
+                    particlesD.poses.push_back(pose);
+                    break;
             }
         }
         
-        if (particles0.poses.size() != 0) m_particles0Pub.publish(particles0);
-        if (particles1.poses.size() != 0) m_particles1Pub.publish(particles1);
-        if (particles2.poses.size() != 0) m_particles2Pub.publish(particles2);
-        if (particles3.poses.size() != 0) m_particles3Pub.publish(particles3);
-        if (particlesD.poses.size() != 0) m_particlesDPub.publish(particlesD);
+        if ((particles0.poses.size() != 0) && hasSubscribers(m_particles0Pub)) publishCounted(m_particles0Pub, particles0);
+        if ((particles1.poses.size() != 0) && hasSubscribers(m_particles1Pub)) publishCounted(m_particles1Pub, particles1);
+        if ((particles2.poses.size() != 0) && hasSubscribers(m_particles2Pub)) publishCounted(m_particles2Pub, particles2);
+        if ((particles3.poses.size() != 0) && hasSubscribers(m_particles3Pub)) publishCounted(m_particles3Pub, particles3);
+        if ((particlesD.poses.size() != 0) && hasSubscribers(m_particlesDPub)) publishCounted(m_particlesDPub, particlesD);
     }
     
-    visualization_msgs::MarkerArray particlesCleaners;
+    if (! hasSubscribers(m_particlesPub))
+        return;
     
-    for (uint32_t i = 0; i < 1000; i++) {
-        for (uint32_t age = 0; age < MAX_PARTICLE_AGE_REPRESENTATION; age++) {
-            stringstream ss;
-            ss << "age_" << age;
-            
-            visualization_msgs::Marker voxelMarker;
-            voxelMarker.header.frame_id = m_mapFrame;
-            voxelMarker.header.stamp = ros::Time();
-            voxelMarker.id = i;
-            voxelMarker.ns = ss.str();
-            voxelMarker.type = visualization_msgs::Marker::ARROW;
-            voxelMarker.action = visualization_msgs::Marker::DELETE;
-            
-            particlesCleaners.markers.push_back(voxelMarker);
-        }
+    std::string ageNamespaces[MAX_PARTICLE_AGE_REPRESENTATION];
+    for (uint32_t age = 0; age < MAX_PARTICLE_AGE_REPRESENTATION; age++) {
+        stringstream ss;
+        ss << "age_" << age;
+        ageNamespaces[age] = ss.str();
     }
     
-    m_particlesPub.publish(particlesCleaners);
-    
     visualization_msgs::MarkerArray particles;
+    particles.markers.reserve(snapshot.particles.size());
     
     uint32_t idCount = 0;
-    BOOST_FOREACH(const VoxelPtr & voxel, m_voxelList) {
-        BOOST_FOREACH(const ParticlePtr & particle, voxel->getParticles()) {
-            uint32_t age = particle->age();
-            const uint32_t & id = particle->id();
-            if (age >= MAX_PARTICLE_AGE_REPRESENTATION)
-                age = MAX_PARTICLE_AGE_REPRESENTATION - 1;
-            
-            visualization_msgs::Marker particleVector;
-            particleVector.header.frame_id = m_mapFrame;
-            particleVector.header.stamp = ros::Time();
-            particleVector.id = idCount++;
-            stringstream ss;
-            ss << "age_" << age;
-            particleVector.ns = ss.str();
-            particleVector.type = visualization_msgs::Marker::ARROW;
-            particleVector.action = visualization_msgs::Marker::ADD;
-            
-            particleVector.pose.orientation.x = 0.0;
-            particleVector.pose.orientation.y = 0.0;
-            particleVector.pose.orientation.z = 0.0;
-            particleVector.pose.orientation.w = 1.0;
-            particleVector.scale.x = 0.01;
-            particleVector.scale.y = 0.03;
-            particleVector.scale.z = 0.1;
-            particleVector.color.a = 1.0;
+    BOOST_FOREACH(const t_particle_record & particle, snapshot.particles) {
+        const t_voxel_record & voxel = snapshot.voxels[particle.voxelIdx];
+        
+        uint32_t age = particle.age;
+        const uint32_t & id = particle.id;
+        if (age >= MAX_PARTICLE_AGE_REPRESENTATION)
+            age = MAX_PARTICLE_AGE_REPRESENTATION - 1;
+        
+        visualization_msgs::Marker particleVector;
+        particleVector.header.frame_id = m_mapFrame;
+        particleVector.header.stamp = ros::Time();
+        particleVector.id = idCount++;
+        particleVector.ns = ageNamespaces[age];
+        particleVector.type = visualization_msgs::Marker::ARROW;
+        particleVector.action = visualization_msgs::Marker::ADD;
+        
+        particleVector.pose.orientation.x = 0.0;
+        particleVector.pose.orientation.y = 0.0;
+        particleVector.pose.orientation.z = 0.0;
+        particleVector.pose.orientation.w = 1.0;
+        particleVector.scale.x = 0.01;
+        particleVector.scale.y = 0.03;
+        particleVector.scale.z = 0.1;
+        particleVector.color.a = 1.0;
 //                     particleVector.color.r = m_obstacleColors[age][2];
 //                     particleVector.color.g = m_obstacleColors[age][1];
 //                     particleVector.color.b = m_obstacleColors[age][0];
-            particleVector.color.r = m_obstacleColors[id][2];
-            particleVector.color.g = m_obstacleColors[id][1];
-            particleVector.color.b = m_obstacleColors[id][0];
-            
-            //         orientation.lifetime = ros::Duration(5.0);
-            
-            const double & x = voxel->centroidX(); // particle->x();
-            const double & y = voxel->centroidY(); // particle->y();
-            const double & z = voxel->centroidZ(); // particle->z();
-            const double & vx = particle->vx();
-            const double & vy = particle->vy();
-            const double & vz = particle->vz();
-            
-            geometry_msgs::Point origin, dest;
-            origin.x = x;
-            origin.y = y;
-            origin.z = z;
-            
-            dest.x = x + vx * m_deltaTime;
-            dest.y = y + vy * m_deltaTime;
-            dest.z = z + vz * m_deltaTime;
-            
-            particleVector.points.push_back(origin);
-            particleVector.points.push_back(dest);
-            
-            particles.markers.push_back(particleVector);
-        }
+        particleVector.color.r = m_obstacleColors[id][2];
+        particleVector.color.g = m_obstacleColors[id][1];
+        particleVector.color.b = m_obstacleColors[id][0];
+        
+        //         orientation.lifetime = ros::Duration(5.0);
+        
+        const double & x = voxel.centroidX; // particle->x();
+        const double & y = voxel.centroidY; // particle->y();
+        const double & z = voxel.centroidZ; // particle->z();
+        const double & vx = particle.vx;
+        const double & vy = particle.vy;
+        const double & vz = particle.vz;
+        
+        geometry_msgs::Point origin, dest;
+        origin.x = x;
+        origin.y = y;
+        origin.z = z;
+        
+        dest.x = x + vx * snapshot.deltaTime;
+        dest.y = y + vy * snapshot.deltaTime;
+        dest.z = z + vz * snapshot.deltaTime;
+        
+        particleVector.points.push_back(origin);
+        particleVector.points.push_back(dest);
+        
+        particles.markers.push_back(particleVector);
     }
     
-    m_particlesPub.publish(particles);
+    m_particleMarkers.finish(particles);
+    publishCounted(m_particlesPub, particles);
 }
 
-void VoxelOdometry::publishMainVectors()
+void VoxelOdometry::publishMainVectors(const FrameSnapshot & snapshot)
 {
-    visualization_msgs::MarkerArray vectorCleaners;
-    
-    for (uint32_t i = 0; i < MAX_OBSTACLES_VISUALIZATION * 3; i++) {
-        visualization_msgs::Marker voxelMarker;
-        voxelMarker.header.frame_id = m_mapFrame;
-        voxelMarker.header.stamp = ros::Time();
-        voxelMarker.id = i;
-        voxelMarker.ns = "mainVectors";
-        voxelMarker.type = visualization_msgs::Marker::ARROW;
-        voxelMarker.action = visualization_msgs::Marker::DELETE;
-        
-        vectorCleaners.markers.push_back(voxelMarker);
-    }
-    
-    m_mainVectorsPub.publish(vectorCleaners);
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
     
     visualization_msgs::MarkerArray mainVectors;
     
     uint32_t idCount = 0;
-    for (uint32_t x = 0; x < m_dimX; x++) {
-        for (uint32_t y = 0; y < m_dimY; y++) {
-            for (uint32_t z = 0; z < m_dimZ; z++) {
-                const VoxelPtr & voxel = m_grid[x][y][z];
-                
-                if (voxel && (! voxel->empty())) {
-                    
-                    visualization_msgs::Marker mainVector;
-                    mainVector.header.frame_id = m_mapFrame;
-                    mainVector.header.stamp = ros::Time();
-                    mainVector.id = idCount++;
-                    mainVector.ns = "mainVectors";
-                    mainVector.type = visualization_msgs::Marker::ARROW;
-                    mainVector.action = visualization_msgs::Marker::ADD;
-                    
-                    mainVector.pose.orientation.x = 0.0;
-                    mainVector.pose.orientation.y = 0.0;
-                    mainVector.pose.orientation.z = 0.0;
-                    mainVector.pose.orientation.w = 1.0;
-                    mainVector.scale.x = 0.01;
-                    mainVector.scale.y = 0.03;
-                    mainVector.scale.z = 0.1;
-                    
-                    cv::Vec3f color(voxel->vx(), voxel->vy(), voxel->vz());
-                    if (cv::norm(color) != 0.0) {
-                        color = color / cv::norm(color);
-
-                        mainVector.color.r = fabs(color[0]);
-                        mainVector.color.g = fabs(color[1]);
-                        mainVector.color.b = fabs(color[2]);
-                    } else {
-                        mainVector.color.r = (double)rand() / RAND_MAX;
-                        mainVector.color.g = (double)rand() / RAND_MAX;
-                        mainVector.color.b = (double)rand() / RAND_MAX;
-                    }
-                    mainVector.color.a = 1.0;
-                    
-                    mainVector.color.r = 0.0;
-                    mainVector.color.g = 0.0;
-                    mainVector.color.b = 0.0;
-                    
-                    //         orientation.lifetime = ros::Duration(5.0);
-                    
-                    geometry_msgs::Point origin, dest;
-                    origin.x = voxel->centroidX();
-                    origin.y = voxel->centroidY();
-                    origin.z = voxel->centroidZ();
-                    
+    BOOST_FOREACH(const t_voxel_record & voxel, snapshot.voxels) {
+        if (voxel.numParticles != 0) {
+            
+            visualization_msgs::Marker mainVector;
+            mainVector.header.frame_id = m_mapFrame;
+            mainVector.header.stamp = ros::Time();
+            mainVector.id = idCount++;
+            mainVector.ns = "mainVectors";
+            mainVector.type = visualization_msgs::Marker::ARROW;
+            mainVector.action = visualization_msgs::Marker::ADD;
+            
+            mainVector.pose.orientation.x = 0.0;
+            mainVector.pose.orientation.y = 0.0;
+            mainVector.pose.orientation.z = 0.0;
+            mainVector.pose.orientation.w = 1.0;
+            mainVector.scale.x = 0.01;
+            mainVector.scale.y = 0.03;
+            mainVector.scale.z = 0.1;
+            
+            cv::Vec3f color(voxel.vx, voxel.vy, voxel.vz);
+            if (cv::norm(color) != 0.0) {
+                color = color / cv::norm(color);
+
+                mainVector.color.r = fabs(color[0]);
+                mainVector.color.g = fabs(color[1]);
+                mainVector.color.b = fabs(color[2]);
+            } else {
+                mainVector.color.r = (double)rand() / RAND_MAX;
+                mainVector.color.g = (double)rand() / RAND_MAX;
+                mainVector.color.b = (double)rand() / RAND_MAX;
+            }
+            mainVector.color.a = 1.0;
+            
+            mainVector.color.r = 0.0;
+            mainVector.color.g = 0.0;
+            mainVector.color.b = 0.0;
+            
+            //         orientation.lifetime = ros::Duration(5.0);
+            
+            geometry_msgs::Point origin, dest;
+            origin.x = voxel.centroidX;
+            origin.y = voxel.centroidY;
+            origin.z = voxel.centroidZ;
+            
 //                     cout << cv::Vec4f(voxel->vx(), voxel->vy(), voxel->vz(), voxel->magnitude()) << endl;
-                    
+            
 //                     dest.x = voxel->centroidX() + voxel->vx() * m_deltaTime * 5.0;
 //                     dest.y = voxel->centroidY() + voxel->vy() * m_deltaTime * 5.0;
 //                     dest.z = voxel->centroidZ() + voxel->vz() * m_deltaTime * 5.0;
-                    
-                    dest.x = voxel->centroidX() + voxel->vx() * voxel->magnitude();
-                    dest.y = voxel->centroidY() + voxel->vy() * voxel->magnitude();
-                    dest.z = voxel->centroidZ() + voxel->vz() * voxel->magnitude();
-                    
-                    mainVector.points.push_back(origin);
-                    mainVector.points.push_back(dest);
-                    
-                    mainVectors.markers.push_back(mainVector);
-                }
-            }
+            
+            dest.x = voxel.centroidX + voxel.vx * voxel.magnitude;
+            dest.y = voxel.centroidY + voxel.vy * voxel.magnitude;
+            dest.z = voxel.centroidZ + voxel.vz * voxel.magnitude;
+            
+            mainVector.points.push_back(origin);
+            mainVector.points.push_back(dest);
+            
+            mainVectors.markers.push_back(mainVector);
         }
     }
     
-    m_mainVectorsPub.publish(mainVectors);
+    m_mainVectorMarkers.finish(mainVectors);
+    publishCounted(m_mainVectorsPub, mainVectors);
     
 }
 
-void VoxelOdometry::publishObstacles()
+void VoxelOdometry::publishObstacles(const FrameSnapshot & snapshot)
 {
-    visualization_msgs::MarkerArray voxelCleaners;
-    
-    for (uint32_t i = 0; i < MAX_OBSTACLES_VISUALIZATION * 3; i++) {
-        visualization_msgs::Marker voxelMarker;
-        voxelMarker.header.frame_id = m_mapFrame;
-        voxelMarker.header.stamp = ros::Time();
-        voxelMarker.id = i;
-        voxelMarker.ns = "obstacles";
-        voxelMarker.type = visualization_msgs::Marker::CUBE;
-        voxelMarker.action = visualization_msgs::Marker::DELETE;
-        
-        voxelCleaners.markers.push_back(voxelMarker);
-    }
-    
-    m_obstaclesPub.publish(voxelCleaners);
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
     
     visualization_msgs::MarkerArray voxelMarkers;
 
     uint32_t idCount = 0;
     
-    BOOST_FOREACH(const VoxelObstaclePtr & obstacle, m_obstacles) {
-        const VoxelList & voxels = obstacle->voxels();
+    BOOST_FOREACH(const t_obstacle_record & obstacle, snapshot.obstacles) {
         visualization_msgs::Marker::_color_type color;
-        color.r = (obstacle->vx() / m_maxVelX + 1.0) * 0.5f;
-        color.g = (obstacle->vy() / m_maxVelY + 1.0) * 0.5f;
+        color.r = (obstacle.vx / m_maxVelX + 1.0) * 0.5f;
+        color.g = (obstacle.vy / m_maxVelY + 1.0) * 0.5f;
         color.b = 0.0;
         color.a = 0.5; //(0.8 - (0.4 * obstacle->magnitude() / m_maxMagnitude));
         
-        if (obstacle->magnitude() == 0.0) {
+        if (obstacle.magnitude == 0.0) {
             color.r = color.g = color.b = color.a = 0.0;
         }
         
@@ -1480,7 +1395,9 @@ void VoxelOdometry::publishObstacles()
 //             << cv::Vec3f((obstacle->vx() / m_maxVelX + 1.0) * 0.5f, 
 //                         (obstacle->vy() / m_maxVelY + 1.0) * 0.5f, 0.0) << endl;
                         
-        BOOST_FOREACH(const VoxelPtr & voxel, voxels) {
+        for (uint32_t i = obstacle.firstVoxel; i < obstacle.firstVoxel + obstacle.numVoxels; i++) {
+            const t_point_record & voxel = snapshot.obstacleVoxels[i];
+            
             visualization_msgs::Marker voxelMarker;
             voxelMarker.header.frame_id = m_mapFrame;
             voxelMarker.header.stamp = ros::Time();
@@ -1489,9 +1406,9 @@ void VoxelOdometry::publishObstacles()
             voxelMarker.type = visualization_msgs::Marker::CUBE;
             voxelMarker.action = visualization_msgs::Marker::ADD;
             
-            voxelMarker.pose.position.x = voxel->centroidX();
-            voxelMarker.pose.position.y = voxel->centroidY();
-            voxelMarker.pose.position.z = voxel->centroidZ();
+            voxelMarker.pose.position.x = voxel.x;
+            voxelMarker.pose.position.y = voxel.y;
+            voxelMarker.pose.position.z = voxel.z;
             
             voxelMarker.pose.orientation.x = 0.0;
             voxelMarker.pose.orientation.y = 0.0;
@@ -1507,218 +1424,181 @@ void VoxelOdometry::publishObstacles()
         }
     }
     
-    m_obstaclesPub.publish(voxelMarkers);
+    m_obstacleMarkers.finish(voxelMarkers);
+    publishCounted(m_obstaclesPub, voxelMarkers);
 }
 
-void VoxelOdometry::publishObstacleCubes()
+void VoxelOdometry::publishObstacleCubes(const FrameSnapshot & snapshot)
 {
-    visualization_msgs::MarkerArray obstacleCubesCleaners;
-    
-    for (uint32_t i = 0; i < 1000; i++) {
-        visualization_msgs::Marker obstacleCubeMarker;
-        obstacleCubeMarker.header.frame_id = m_mapFrame;
-        obstacleCubeMarker.header.stamp = ros::Time();
-        obstacleCubeMarker.id = i;
-        obstacleCubeMarker.ns = "obstacleCubes";
-        obstacleCubeMarker.type = visualization_msgs::Marker::CUBE;
-        obstacleCubeMarker.action = visualization_msgs::Marker::DELETE;
-        
-        obstacleCubesCleaners.markers.push_back(obstacleCubeMarker);
-    }
-    m_obstacleCubesPub.publish(obstacleCubesCleaners);
-    obstacleCubesCleaners.markers.clear();
-    for (uint32_t i = 0; i < 1000; i++) {
-        visualization_msgs::Marker obstacleCubeMarker;
-        obstacleCubeMarker.header.frame_id = m_mapFrame;
-        obstacleCubeMarker.header.stamp = ros::Time();
-        obstacleCubeMarker.id = i;
-        
-        obstacleCubeMarker.ns = "speedVector";
-        obstacleCubeMarker.type = visualization_msgs::Marker::ARROW;
-        obstacleCubeMarker.action = visualization_msgs::Marker::DELETE;
-        
-        obstacleCubesCleaners.markers.push_back(obstacleCubeMarker);
-    }
-    m_obstacleCubesPub.publish(obstacleCubesCleaners);
-   
-    obstacleCubesCleaners.markers.clear();
-    for (uint32_t i = 0; i < 1000; i++) {
-        visualization_msgs::Marker obstacleCubeMarker;
-        obstacleCubeMarker.header.frame_id = m_mapFrame;
-        obstacleCubeMarker.header.stamp = ros::Time();
-        obstacleCubeMarker.id = i;
-        
-        obstacleCubeMarker.ns = "speedText";
-        obstacleCubeMarker.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-        obstacleCubeMarker.action = visualization_msgs::Marker::DELETE;
-        
-        obstacleCubesCleaners.markers.push_back(obstacleCubeMarker);
-    }
-    m_obstacleCubesPub.publish(obstacleCubesCleaners);
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
     
     visualization_msgs::MarkerArray obstacleCubeMarkers;
     visualization_msgs::MarkerArray obstacleSpeedMarkers;
     visualization_msgs::MarkerArray obstacleSpeedTextMarkers;
     
-    uint32_t idCount = 0;
-    
-    for (uint32_t i = 0; i < m_obstacles.size(); i++) {
-        const VoxelObstaclePtr & obstacle = m_obstacles[i];
-        
-        visualization_msgs::Marker obstacleCubeMarker;
-        obstacleCubeMarker.header.frame_id = m_mapFrame;
-        obstacleCubeMarker.header.stamp = ros::Time();
-        obstacleCubeMarker.id = idCount++;
-        obstacleCubeMarker.ns = "obstacleCubes";
-        obstacleCubeMarker.type = visualization_msgs::Marker::CUBE;
-        obstacleCubeMarker.action = visualization_msgs::Marker::ADD;
-        
-        obstacleCubeMarker.pose.position.x = obstacle->centerX();
-        obstacleCubeMarker.pose.position.y = obstacle->centerY();
-        obstacleCubeMarker.pose.position.z = obstacle->centerZ();
-        
-        obstacleCubeMarker.pose.orientation.x = 0.0;
-        obstacleCubeMarker.pose.orientation.y = 0.0;
-        obstacleCubeMarker.pose.orientation.z = 0.0;
-        obstacleCubeMarker.pose.orientation.w = 1.0;
-        obstacleCubeMarker.scale.x = 2 * max(fabs(obstacle->maxX() - obstacle->centerX()),
-                                             fabs(obstacle->minX() - obstacle->centerX()));
-        obstacleCubeMarker.scale.y = 2 * max(fabs(obstacle->maxY() - obstacle->centerY()),
-                                             fabs(obstacle->minY() - obstacle->centerY()));
-        obstacleCubeMarker.scale.z = 2 * max(fabs(obstacle->maxZ() - obstacle->centerZ()),
-                                             fabs(obstacle->minZ() - obstacle->centerZ()));
-        obstacleCubeMarker.color.r = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][0];
-        obstacleCubeMarker.color.g = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][1];
-        obstacleCubeMarker.color.b = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][2];
-        obstacleCubeMarker.color.a = 0.4;
-        
-        obstacleCubeMarkers.markers.push_back(obstacleCubeMarker);
-        
-        // ********************************************************
-        // Publication of the speed of the obstacle
-        // ********************************************************
-        
-        visualization_msgs::Marker speedVector;
-        speedVector.header.frame_id = m_mapFrame;
-        speedVector.header.stamp = ros::Time();
-        speedVector.id = idCount;
-        speedVector.ns = "speedVector";
-        speedVector.type = visualization_msgs::Marker::ARROW;
-        speedVector.action = visualization_msgs::Marker::ADD;
-        
-        speedVector.pose.orientation.x = 0.0;
-        speedVector.pose.orientation.y = 0.0;
-        speedVector.pose.orientation.z = 0.0;
-        speedVector.pose.orientation.w = 1.0;
-        speedVector.scale.x = 0.01;
-        speedVector.scale.y = 0.03;
-        speedVector.scale.z = 0.1;
-        speedVector.color.a = 1.0;
-        speedVector.color.r = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][0];
-        speedVector.color.g = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][1];
-        speedVector.color.b = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][2];
-        
-        //         orientation.lifetime = ros::Duration(5.0);
-        
-        geometry_msgs::Point origin, dest;
-        origin.x = obstacle->centerX();
-        origin.y = obstacle->centerY();
-        origin.z = obstacle->centerZ();        
-
-        // NOTE: This makes vectors longer than they actually are. 
-        // For a realistic visualization, multiply by m_deltaTime
-//         dest.x = obstacle.centerX() + obstacle.vx();
-//         dest.y = obstacle.minY() + obstacle.vy();
-//         dest.z = obstacle.centerZ() + obstacle.vz();
+    // Each topic is built just if somebody listens to it
+    const bool publishCubes = hasSubscribers(m_obstacleCubesPub);
+    const bool publishSpeed = hasSubscribers(m_obstacleSpeedPub);
+    const bool publishSpeedText = hasSubscribers(m_obstacleSpeedTextPub);
+    
+    for (uint32_t i = 0; i < snapshot.obstacles.size(); i++) {
+        const t_obstacle_record & obstacle = snapshot.obstacles[i];
+        
+        if (publishCubes) {
+            visualization_msgs::Marker obstacleCubeMarker;
+            obstacleCubeMarker.header.frame_id = m_mapFrame;
+            obstacleCubeMarker.header.stamp = ros::Time();
+            obstacleCubeMarker.id = i;
+            obstacleCubeMarker.ns = "obstacleCubes";
+            obstacleCubeMarker.type = visualization_msgs::Marker::CUBE;
+            obstacleCubeMarker.action = visualization_msgs::Marker::ADD;
+            
+            obstacleCubeMarker.pose.position.x = obstacle.centerX;
+            obstacleCubeMarker.pose.position.y = obstacle.centerY;
+            obstacleCubeMarker.pose.position.z = obstacle.centerZ;
+            
+            obstacleCubeMarker.pose.orientation.x = 0.0;
+            obstacleCubeMarker.pose.orientation.y = 0.0;
+            obstacleCubeMarker.pose.orientation.z = 0.0;
+            obstacleCubeMarker.pose.orientation.w = 1.0;
+            obstacleCubeMarker.scale.x = 2 * max(fabs(obstacle.maxX - obstacle.centerX),
+                                                 fabs(obstacle.minX - obstacle.centerX));
+            obstacleCubeMarker.scale.y = 2 * max(fabs(obstacle.maxY - obstacle.centerY),
+                                                 fabs(obstacle.minY - obstacle.centerY));
+            obstacleCubeMarker.scale.z = 2 * max(fabs(obstacle.maxZ - obstacle.centerZ),
+                                                 fabs(obstacle.minZ - obstacle.centerZ));
+            obstacleCubeMarker.color.r = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][0];
+            obstacleCubeMarker.color.g = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][1];
+            obstacleCubeMarker.color.b = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][2];
+            obstacleCubeMarker.color.a = 0.4;
+            
+            obstacleCubeMarkers.markers.push_back(obstacleCubeMarker);
+        }
         
-        dest.x = obstacle->centerX() + obstacle->vx() * obstacle->magnitude() * 5.0;
-        dest.y = obstacle->centerY() + obstacle->vy() * obstacle->magnitude() * 5.0;
-        dest.z = obstacle->centerZ() + obstacle->vz() * obstacle->magnitude() * 5.0;
+        if (publishSpeed) {
+            // ********************************************************
+            // Publication of the speed of the obstacle
+            // ********************************************************
+            
+            visualization_msgs::Marker speedVector;
+            speedVector.header.frame_id = m_mapFrame;
+            speedVector.header.stamp = ros::Time();
+            speedVector.id = i + 1;
+            speedVector.ns = "speedVector";
+            speedVector.type = visualization_msgs::Marker::ARROW;
+            speedVector.action = visualization_msgs::Marker::ADD;
+            
+            speedVector.pose.orientation.x = 0.0;
+            speedVector.pose.orientation.y = 0.0;
+            speedVector.pose.orientation.z = 0.0;
+            speedVector.pose.orientation.w = 1.0;
+            speedVector.scale.x = 0.01;
+            speedVector.scale.y = 0.03;
+            speedVector.scale.z = 0.1;
+            speedVector.color.a = 1.0;
+            speedVector.color.r = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][0];
+            speedVector.color.g = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][1];
+            speedVector.color.b = m_obstacleColors[i % MAX_OBSTACLES_VISUALIZATION][2];
+            
+            //         orientation.lifetime = ros::Duration(5.0);
+            
+            geometry_msgs::Point origin, dest;
+            origin.x = obstacle.centerX;
+            origin.y = obstacle.centerY;
+            origin.z = obstacle.centerZ;        
+
+            // NOTE: This makes vectors longer than they actually are. 
+            // For a realistic visualization, multiply by m_deltaTime
+    //         dest.x = obstacle.centerX() + obstacle.vx();
+    //         dest.y = obstacle.minY() + obstacle.vy();
+    //         dest.z = obstacle.centerZ() + obstacle.vz();
+            
+            dest.x = obstacle.centerX + obstacle.vx * obstacle.magnitude * 5.0;
+            dest.y = obstacle.centerY + obstacle.vy * obstacle.magnitude * 5.0;
+            dest.z = obstacle.centerZ + obstacle.vz * obstacle.magnitude * 5.0;
 
-//         dest.x = obstacle->centerX() + obstacle->vx() / obstacle->numVoxels() * m_deltaTime;
-//         dest.y = obstacle->minY() + obstacle->vy() / obstacle->numVoxels() * m_deltaTime;
-//         dest.z = obstacle->centerZ() + obstacle->vz() / obstacle->numVoxels() * m_deltaTime;
-        
-        speedVector.points.push_back(origin);
-        speedVector.points.push_back(dest);
-        
-        obstacleSpeedMarkers.markers.push_back(speedVector);
-        
-        // ********************************************************
-        // Publication of the speed text of the obstacle
-        // ********************************************************
-        
-        visualization_msgs::Marker speedTextVector;
-        speedTextVector.header.frame_id = m_mapFrame;
-        speedTextVector.header.stamp = ros::Time();
-        speedTextVector.id = idCount;
-        speedTextVector.ns = "speedText";
-        speedTextVector.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-        speedTextVector.action = visualization_msgs::Marker::ADD;
-        
-        speedTextVector.pose.position.x = obstacle->centerX();
-        speedTextVector.pose.position.y = obstacle->centerY();
-        speedTextVector.pose.position.z = obstacle->maxZ() + (m_cellSizeZ / 2.0);
-        
-        speedTextVector.pose.orientation.x = 0.0;
-        speedTextVector.pose.orientation.y = 0.0;
-        speedTextVector.pose.orientation.z = 0.0;
-        speedTextVector.pose.orientation.w = 1.0;
-        speedTextVector.scale.z = 0.25;
-        speedTextVector.color.a = 1.0;
-        speedTextVector.color.r = 0.0;
-        speedTextVector.color.g = 1.0;
-        speedTextVector.color.b = 0.0;
+    //         dest.x = obstacle->centerX() + obstacle->vx() / obstacle->numVoxels() * m_deltaTime;
+    //         dest.y = obstacle->minY() + obstacle->vy() / obstacle->numVoxels() * m_deltaTime;
+    //         dest.z = obstacle->centerZ() + obstacle->vz() / obstacle->numVoxels() * m_deltaTime;
+            
+            speedVector.points.push_back(origin);
+            speedVector.points.push_back(dest);
+            
+            obstacleSpeedMarkers.markers.push_back(speedVector);
+        }
         
-        const double speedInKmH = obstacle->magnitude() * 3.6;
-        stringstream ss;
-        ss << m_currentId << " => " << std::setprecision(3) << speedInKmH << " Km/h" << " - " << obstacle->idx() << endl;//obstacle->winnerNumberOfParticles();
-        speedTextVector.text = ss.str();
-                
-        obstacleSpeedTextMarkers.markers.push_back(speedTextVector);
+        if (publishSpeedText) {
+            // ********************************************************
+            // Publication of the speed text of the obstacle
+            // ********************************************************
+            
+            visualization_msgs::Marker speedTextVector;
+            speedTextVector.header.frame_id = m_mapFrame;
+            speedTextVector.header.stamp = ros::Time();
+            speedTextVector.id = i + 1;
+            speedTextVector.ns = "speedText";
+            speedTextVector.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
+            speedTextVector.action = visualization_msgs::Marker::ADD;
+            
+            speedTextVector.pose.position.x = obstacle.centerX;
+            speedTextVector.pose.position.y = obstacle.centerY;
+            speedTextVector.pose.position.z = obstacle.maxZ + (m_cellSizeZ / 2.0);
+            
+            speedTextVector.pose.orientation.x = 0.0;
+            speedTextVector.pose.orientation.y = 0.0;
+            speedTextVector.pose.orientation.z = 0.0;
+            speedTextVector.pose.orientation.w = 1.0;
+            speedTextVector.scale.z = 0.25;
+            speedTextVector.color.a = 1.0;
+            speedTextVector.color.r = 0.0;
+            speedTextVector.color.g = 1.0;
+            speedTextVector.color.b = 0.0;
+            
+            const double speedInKmH = obstacle.magnitude * 3.6;
+            stringstream ss;
+            ss << snapshot.id << " => " << std::setprecision(3) << speedInKmH << " Km/h" << " - " << obstacle.idx << endl;//obstacle->winnerNumberOfParticles();
+            speedTextVector.text = ss.str();
+                    
+            obstacleSpeedTextMarkers.markers.push_back(speedTextVector);
+        }
     }
     
-    m_obstacleCubesPub.publish(obstacleCubeMarkers);
-    m_obstacleSpeedPub.publish(obstacleSpeedMarkers);
-    m_obstacleSpeedTextPub.publish(obstacleSpeedTextMarkers);
-}
-
-tf::Quaternion getQuaternion(const double &vx, const double &vy, const double &vz)
-{
-    if (vx == vy == vz == 0.0) {
-        return tf::Quaternion(0.0, 0.0, 0.0, 0.0);
+    if (publishCubes) {
+        m_obstacleCubeMarkers.finish(obstacleCubeMarkers);
+        publishCounted(m_obstacleCubesPub, obstacleCubeMarkers);
+    }
+    if (publishSpeed) {
+        m_obstacleSpeedMarkers.finish(obstacleSpeedMarkers);
+        publishCounted(m_obstacleSpeedPub, obstacleSpeedMarkers);
+    }
+    if (publishSpeedText) {
+        m_obstacleSpeedTextMarkers.finish(obstacleSpeedTextMarkers);
+        publishCounted(m_obstacleSpeedTextPub, obstacleSpeedTextMarkers);
     }
-    
-    Eigen::Vector3d zeroVector, currVector;
-    zeroVector << 1.0, 0.0, 0.0;
-    currVector << vx, vy, vz;
-    currVector.normalize();
-    Eigen::Quaterniond eigenQuat;
-    eigenQuat.setFromTwoVectors(zeroVector, currVector);
-    
-    tf::Quaternion quat(eigenQuat.x(), eigenQuat.y(), eigenQuat.z(), eigenQuat.w());
-    
-    return quat;
 }
 
-void VoxelOdometry::publishFakePointCloud()
+void VoxelOdometry::publishFakePointCloud(const FrameSnapshot & snapshot)
 {
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
+    
     
     PointCloudPtr fakePointCloud(new pcl::PointCloud<pcl::PointXYZRGB>);
     geometry_msgs::PoseArray fakeParticles;
     
-    BOOST_FOREACH(const VoxelObstaclePtr & obstacle, m_obstacles) {
+    BOOST_FOREACH(const t_obstacle_record & obstacle, snapshot.obstacles) {
         
 //         if ((obstacle->minZ() - (m_cellSizeZ / 2.0)) == m_minZ) {
-        if (obstacle->numVoxels() > 1) {
+        if (obstacle.numVoxels > 1) {
             const double tColission = 3.0;
             const double deltaTime = 0.3;
             
-            BOOST_FOREACH(const VoxelPtr & voxel, obstacle->voxels()) {
+            for (uint32_t i = obstacle.firstVoxel; i < obstacle.firstVoxel + obstacle.numVoxels; i++) {
+                const t_point_record & voxel = snapshot.obstacleVoxels[i];
+                
                 pcl::PointXYZRGB currPoint;
-                currPoint.x = voxel->centroidX();
-                currPoint.y = voxel->centroidY();
-                currPoint.z = voxel->centroidZ();
+                currPoint.x = voxel.x;
+                currPoint.y = voxel.y;
+                currPoint.z = voxel.z;
                     
                 currPoint.r = 255.0;
                 currPoint.g = 0.0;
@@ -1727,13 +1607,13 @@ void VoxelOdometry::publishFakePointCloud()
                 fakePointCloud->push_back(currPoint);
                 
                 geometry_msgs::Pose currPose;
-                currPose.position.x = voxel->centroidX();
-                currPose.position.y = voxel->centroidY();
-                currPose.position.z = voxel->centroidZ();
+                currPose.position.x = voxel.x;
+                currPose.position.y = voxel.y;
+                currPose.position.z = voxel.z;
                 
-                const double & vx = obstacle->vx();
-                const double & vy = obstacle->vy();
-                const double & vz = obstacle->vz();
+                const double & vx = obstacle.vx;
+                const double & vy = obstacle.vy;
+                const double & vz = obstacle.vz;
                 
                 const tf::Quaternion & quat = getQuaternion(vx, vy, vz);
                 currPose.orientation.w = quat.w();
@@ -1748,9 +1628,9 @@ void VoxelOdometry::publishFakePointCloud()
 //                     double t = 1.0;
 
                     pcl::PointXYZRGB newPoint;
-                    newPoint.x = currPoint.x + obstacle->vx() * t;
-                    newPoint.y = currPoint.y + obstacle->vy() * t;
-                    newPoint.z = currPoint.z + obstacle->vz() * t;
+                    newPoint.x = currPoint.x + obstacle.vx * t;
+                    newPoint.y = currPoint.y + obstacle.vy * t;
+                    newPoint.z = currPoint.z + obstacle.vz * t;
                     newPoint.r = 255.0;
                     newPoint.g = 0.0;
                     newPoint.b = 0.0;
@@ -1758,13 +1638,13 @@ void VoxelOdometry::publishFakePointCloud()
                     fakePointCloud->push_back(newPoint);   
                     
                     geometry_msgs::Pose newPose;
-                    newPose.position.x = currPoint.x + obstacle->vx() * t;
-                    newPose.position.y = currPoint.y + obstacle->vy() * t;
-                    newPose.position.z = currPoint.z + obstacle->vz() * t;
+                    newPose.position.x = currPoint.x + obstacle.vx * t;
+                    newPose.position.y = currPoint.y + obstacle.vy * t;
+                    newPose.position.z = currPoint.z + obstacle.vz * t;
                     
-                    const double & vx = obstacle->vx();
-                    const double & vy = obstacle->vy();
-                    const double & vz = obstacle->vz();
+                    const double & vx = obstacle.vx;
+                    const double & vy = obstacle.vy;
+                    const double & vz = obstacle.vz;
                     
                     const tf::Quaternion & quat = getQuaternion(vx, vy, vz);
                     newPose.orientation.w = quat.w();
@@ -1781,59 +1661,38 @@ void VoxelOdometry::publishFakePointCloud()
     fakeParticles.header.frame_id = m_mapFrame;
     fakeParticles.header.stamp = ros::Time();
     
-    sensor_msgs::PointCloud2 cloudMsg;
-    pcl::toROSMsg (*fakePointCloud, cloudMsg);
-    cloudMsg.header.frame_id = m_mapFrame;
-    cloudMsg.header.stamp = ros::Time::now();
-    cloudMsg.header.seq = m_currentId;
-    
-    m_fakePointCloudPub.publish(cloudMsg);
+    if (hasSubscribers(m_fakePointCloudPub)) {
+        sensor_msgs::PointCloud2Ptr cloudMsg(new sensor_msgs::PointCloud2);
+        pcl::toROSMsg (*fakePointCloud, *cloudMsg);
+        cloudMsg->header.frame_id = m_mapFrame;
+        cloudMsg->header.stamp = ros::Time::now();
+        cloudMsg->header.seq = snapshot.id;
+        
+        publishCounted(m_fakePointCloudPub, cloudMsg);
+    }
     
-    m_fakeParticlesPub.publish(fakeParticles);
+    if (hasSubscribers(m_fakeParticlesPub))
+        publishCounted(m_fakeParticlesPub, fakeParticles);
 }
 
-void VoxelOdometry::publishOdom()
+void VoxelOdometry::publishOdom(const FrameSnapshot & snapshot)
 {
-    if (m_obstacles.size() == 0)
-        return;
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
     
-    const VoxelObstaclePtr & obst = m_obstacles[0];
-    
-    double vx = -obst->vx();
-    double vy = -obst->vy();
-    double vz = -obst->vz();
-
-    tf::Quaternion tmpQuat = getQuaternion(vx, vy, vz);
-    
-//     double angleDiff = atan2(sin(m_currTheta - tmpQuat.getAngle()), cos(m_currTheta - tmpQuat.getAngle()));
-//     if (m_currTheta == std::numeric_limits<double>::infinity())
-//         angleDiff = 0.0;
-    
-//     cout << (m_currTheta / CV_PI * 180.0) << " - " << (tmpQuat.getAngle() / CV_PI * 180.0) << " = " << (angleDiff / CV_PI * 180.0) << endl;
-//     m_currTheta = (m_currTheta + 2.0 * tmpQuat.getAngle()) / 3.0;
-    
-//     if (angleDiff > CV_PI / 4.0)
-//         return;
-    
-    
-    if ((vx < 0.3) && (vy < 0.3))
-        vx=vy=vz=0.0;
-    
-    m_currX += vx * m_deltaTime;
-    m_currY += vy * m_deltaTime;
-    m_currTheta = tmpQuat.getAngle();
+    const t_odometry_state & odometry = snapshot.odometry;
+    if (! odometry.valid)
+        return;
     
-    geometry_msgs::Quaternion odom_quat = tf::createQuaternionMsgFromYaw(m_currTheta);
+    geometry_msgs::Quaternion odom_quat = tf::createQuaternionMsgFromYaw(odometry.theta);
     
-    cout << "PUBLISHING" << endl;
     //first, we'll publish the transform over tf
     geometry_msgs::TransformStamped odom_trans;
-    odom_trans.header.stamp = m_lastPointCloudTime;
+    odom_trans.header.stamp = ros::Time(snapshot.stamp);
     odom_trans.header.frame_id = "odom";
     odom_trans.child_frame_id = m_poseFrame;
     
-    odom_trans.transform.translation.x = m_currX;
-    odom_trans.transform.translation.y = m_currY;
+    odom_trans.transform.translation.x = odometry.x;
+    odom_trans.transform.translation.y = odometry.y;
     odom_trans.transform.translation.z = 0.0;
     odom_trans.transform.rotation = odom_quat;
     
@@ -1841,28 +1700,68 @@ void VoxelOdometry::publishOdom()
 //     m_odomBroadcaster.sendTransform(odom_trans);
     
     //next, we'll publish the odometry message over ROS
-    nav_msgs::Odometry odom;
-    odom.header.stamp = m_lastPointCloudTime;
-    odom.header.frame_id = "odom";
+    nav_msgs::OdometryPtr odom(new nav_msgs::Odometry);
+    odom->header.stamp = ros::Time(snapshot.stamp);
+    odom->header.frame_id = "odom";
     
     //set the position
-    odom.pose.pose.position.x = m_currX;
-    odom.pose.pose.position.y = m_currY;
-    odom.pose.pose.position.z = 0.0;
-    odom.pose.pose.orientation = odom_quat;
+    odom->pose.pose.position.x = odometry.x;
+    odom->pose.pose.position.y = odometry.y;
+    odom->pose.pose.position.z = 0.0;
+    odom->pose.pose.orientation = odom_quat;
     
-    odom.pose.covariance.assign(0.1f);
+    odom->pose.covariance.assign(0.1f);
     
     //set the velocity
-    odom.child_frame_id = m_poseFrame;
-    odom.twist.twist.linear.x = vx;
-    odom.twist.twist.linear.y = vy;
-    odom.twist.twist.angular.z = tmpQuat.getAngle() / m_deltaTime;
+    odom->child_frame_id = m_poseFrame;
+    odom->twist.twist.linear.x = odometry.vx;
+    odom->twist.twist.linear.y = odometry.vy;
+    odom->twist.twist.angular.z = odometry.yawRate;
     
-    odom.twist.covariance.assign(0.1f);
+    odom->twist.covariance.assign(0.1f);
     
     //publish the message
-    m_odomPub.publish(odom);
+    publishCounted(m_odomPub, odom);
+}
+
+/**
+ * One record per obstacle, for the planners (the same obstacles as the cubes, obstacleSpeed 
+ * and obstacleSpeedText markers).
+ */
+void VoxelOdometry::publishObstacleArray(const FrameSnapshot & snapshot)
+{
+    TraceSpan span(m_tracer.get(), __FUNCTION__);
+    
+    voxel_odometry::obstacle_arrayPtr obstacleArray(new voxel_odometry::obstacle_array);
+    obstacleArray->header.frame_id = m_mapFrame;
+    obstacleArray->header.stamp = ros::Time(snapshot.stamp);
+    obstacleArray->header.seq = snapshot.id;
+    
+    obstacleArray->obstacles.resize(snapshot.obstacles.size());
+    for (uint32_t i = 0; i < snapshot.obstacles.size(); i++) {
+        const t_obstacle_record & record = snapshot.obstacles[i];
+        voxel_odometry::obstacle & obstacle = obstacleArray->obstacles[i];
+        
+        obstacle.id = record.idx;
+        obstacle.centerX = record.centerX;
+        obstacle.centerY = record.centerY;
+        obstacle.centerZ = record.centerZ;
+        obstacle.minX = record.minX;
+        obstacle.maxX = record.maxX;
+        obstacle.minY = record.minY;
+        obstacle.maxY = record.maxY;
+        obstacle.minZ = record.minZ;
+        obstacle.maxZ = record.maxZ;
+        // The record keeps the direction and the speed apart
+        obstacle.vx = record.vx * record.magnitude;
+        obstacle.vy = record.vy * record.magnitude;
+        obstacle.vz = record.vz * record.magnitude;
+        obstacle.magnitude = record.magnitude;
+        obstacle.numVoxels = record.numVoxels;
+        obstacle.confidence = record.confidence;
+    }
+    
+    publishCounted(m_obstacleArrayPub, obstacleArray);
 }
 
 
@@ -28,6 +28,7 @@
 #include <message_filters/sync_policies/exact_time.h>
 #include <message_filters/sync_policies/approximate_time.h>
 #include <sensor_msgs/CameraInfo.h>
+#include <geometry_msgs/Pose.h>
 
 #include <image_transport/subscriber_filter.h>
 
@@ -40,8 +41,23 @@
 
 // #include "polargridtracking.h"
 
-#include "voxel.h"
-#include "voxelobstacle.h"
+#include "voxelodometryengine.h"
+#include "engineparams.h"
+#include "sweepdeskew.h"
+#include "framesnapshot.h"
+#include "snapshotpublisher.h"
+#include "markermanager.h"
+#include "voxelframe.h"
+#include "stagequeue.h"
+#include "ingestqueue.h"
+#include "poseprovider.h"
+#include "rollingstats.h"
+#include "tracer.h"
+#include "logging.h"
+
+#include <boost/thread/thread.hpp>
+
+#include <visualization_msgs/MarkerArray.h>
 
 #define DEFAULT_BASE_FRAME "left_cam"
 #define MAX_OBSTACLES_VISUALIZATION 10000
@@ -49,11 +65,20 @@
 #define MAX_PARTICLE_AGE_REPRESENTATION 8
 
 namespace voxel_odometry {
+
+// Visualization outputs, built just if somebody listens to them, at most at publish_rate_<name>.
+// OUTPUT_NAMES has to follow the same order.
+enum Output { OUTPUT_VOXELS = 0, OUTPUT_OFLOW, OUTPUT_PARTICLES, OUTPUT_MAIN_VECTORS, OUTPUT_OBSTACLES,
+              OUTPUT_OBSTACLE_CUBES, OUTPUT_FAKE_POINT_CLOUD, OUTPUT_ODOM, OUTPUT_OBSTACLE_ARRAY, NUM_OUTPUTS };
+const char * const OUTPUT_NAMES[NUM_OUTPUTS] = { "voxels", "oflow", "particles", "main_vectors", "obstacles",
+                                                 "obstacle_cubes", "fake_point_cloud", "odom", "obstacle_array" };
     
 class VoxelOdometry
 {
 public:
-    VoxelOdometry();
+    // Throws std::invalid_argument if a param is wrong
+    VoxelOdometry(ros::NodeHandle nh = ros::NodeHandle("~"));
+    ~VoxelOdometry();
     
     // TODO: Change to PointXYZNormal
     typedef pcl::PointXYZRGBNormal PointNormalType;
@@ -96,96 +121,130 @@ protected:
                             const sensor_msgs::CameraInfoConstPtr& leftCameraInfo, 
                             const sensor_msgs::CameraInfoConstPtr& rightCameraInfo);
     
+    void processPointCloud(const sensor_msgs::PointCloud2::ConstPtr& msgPointCloud);
+    void ingestLoop();
+    
     // Method functions
     void compute(const PointCloudPtr & pointCloud);
-    void reset();
-    void getVoxelGridFromPointCloud(const PointCloudPtr& pointCloud);
-    void getMeasurementModel();
-    void initialization();
-    void particleToVoxel(const ParticlePtr & particle, 
-                         int32_t & posX, int32_t & posY, int32_t & posZ);
-    void prediction();
-    void measurementBasedUpdate();
-    void joinVoxels();
-    void updateSpeedFromObstacles();
-    
-    void updateFromOFlow();
+    void filterFrame(VoxelFrame & frame);
+    void filterLoop();
+    void ingestPointCloud(const sensor_msgs::PointCloud2 & msgPointCloud);
+    void updatePoses(const std_msgs::Header & header);
+    void countPoseStatus(const PoseStatus & status);
     
     // Visualization functions
-    void publishVoxels();
-    void publishParticles();
-    void publishOFlow();
-    void publishMainVectors();
-    void publishObstacles();
-    void publishObstacleCubes();
-    void publishFakePointCloud();
-    void publishOdom();
+    void publishSnapshot(const FrameSnapshot & snapshot);
+    void publishVoxels(const FrameSnapshot & snapshot);
+    void publishParticles(const FrameSnapshot & snapshot);
+    void fillParticlePoses(const std::vector<t_particle_record> & particles, 
+                           std::vector<geometry_msgs::Pose> & poses, 
+                           const uint32_t & begin, const uint32_t & end);
+    void publishOFlow(const FrameSnapshot & snapshot);
+    void publishMainVectors(const FrameSnapshot & snapshot);
+    void publishObstacles(const FrameSnapshot & snapshot);
+    void publishObstacleCubes(const FrameSnapshot & snapshot);
+    void publishFakePointCloud(const FrameSnapshot & snapshot);
+    void publishOdom(const FrameSnapshot & snapshot);
+    void publishObstacleArray(const FrameSnapshot & snapshot);
+    void publishStatsSummary();
+    bool outputDue(const Output & output, const bool & listened);
+    bool hasIntermediateSubscribers() const;
+    static bool hasSubscribers(const ros::Publisher & publisher) { return publisher.getNumSubscribers() != 0; }
+    void flushTrace(const char * reason);
+    
+    // Publishes msg, counting what is published in this frame
+    template <typename MessageType>
+    void publishCounted(const ros::Publisher & publisher, const MessageType & msg) {
+        TraceSpan span(m_tracer.get(), "publish");
+        m_publishedBytes += ros::serialization::serializationLength(msg);
+        m_publishedMarkers += numMarkers(msg);
+        publisher.publish(msg);
+    }
+    // Same, but intra-process subscribers get the pointer without serialization. msg must not be 
+    // modified after this.
+    template <typename MessageType>
+    void publishCounted(const ros::Publisher & publisher, const boost::shared_ptr<MessageType> & msg) {
+        TraceSpan span(m_tracer.get(), "publish");
+        m_publishedBytes += ros::serialization::serializationLength(*msg);
+        m_publishedMarkers += numMarkers(*msg);
+        publisher.publish(msg);
+    }
+    template <typename MessageType>
+    static uint32_t numMarkers(const MessageType &) { return 0; }
+    static uint32_t numMarkers(const visualization_msgs::MarkerArray & msg) { return msg.markers.size(); }
     
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr m_pointCloud;
     pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr m_oFlowCloud;
-    PointCloudPtr m_lastPointCloud;
-    pcl::search::KdTree<PointType> m_kdtreeLastPointCloud;
     
-    double m_deltaYaw, m_deltaPitch, m_speed, m_deltaTime;
+    double m_deltaTime;
     ros::Time m_lastPointCloudTime;
-    double m_deltaX, m_deltaY, m_deltaZ;
     
-    double m_currX, m_currY, m_currTheta;
-    
-    VoxelGrid m_grid;
-    VoxelList m_voxelList;
-    ParticleList m_particles;
+    boost::shared_ptr<VoxelOdometryEngine> m_engine;
+    boost::shared_ptr<SweepDeskew> m_sweepDeskew;
+    string m_deskewTimeField;
     
     ColorVector m_obstacleColors;
     ParticlesColorVector m_particleColors;
     
-    uint32_t m_dimX, m_dimY, m_dimZ;
-    
-    bool m_initialized;
-    
     bool m_publishIntermediateInfo;
     
     tf::StampedTransform m_lastMapOdomTransform;
-    tf::StampedTransform m_pose2MapTransform;
-    tf::StampedTransform m_map2CamTransform;
+    Eigen::Affine3d m_pose2MapTransform;
+    Eigen::Affine3d m_map2CamTransform;
     
     tf::TransformListener m_tfListener;
     
-    VoxelObstacleList m_obstacles;
+    // Poses of the frames, without waiting for tf
+    boost::shared_ptr<PoseProvider> m_poseProvider;
+    uint32_t m_pose2MapPair, m_map2CamPair;
+    string m_map2CamFrame;                      // Camera frame of m_map2CamPair
+    bool m_staticMap2Cam;
+    uint64_t m_posesExtrapolated, m_posesStale;
     
     uint32_t m_currentId;
     
     image_geometry::StereoCameraModel m_stereoCameraModel;
     
     // Parameters
+    // Just the ones the node needs, the rest go to the engine
     float m_cellSizeX, m_cellSizeY, m_cellSizeZ;
-    uint32_t m_maxNumberOfParticles;
-    uint32_t m_threads;
     double m_maxVelX, m_maxVelY, m_maxVelZ;
-    double m_minVelX, m_minVelY, m_minVelZ;
-    double m_maxMagnitude, m_minMagnitude;
-    double m_yawInterval, m_pitchInterval, m_factorSpeed;
-    SpeedMethod m_obstacleSpeedMethod;
-    double m_threshOccupancyProb;
+    double m_maxMagnitude;
     uint32_t m_neighBorX, m_neighBorY, m_neighBorZ;
     
-    double m_particlesPerVoxel;
-    double m_threshYaw, m_threshPitch, m_threshMagnitude;
     uint32_t m_minVoxelsPerObstacle;
-    double m_minVoxelDensity;
     double m_maxCommonVolume;
     double m_minObstacleHeight;
     
-    SpeedMethod m_speedMethod;
+    OdometryMethod m_odometryMethod;
     
     bool m_useOFlow;
     
     bool m_inputFromCameras;
 
-    // Computed parameters
-    float m_minX, m_maxX, m_minY, m_maxY, m_minZ, m_maxZ;
-    float m_voxelSize;
-    
+    bool m_pipelineEnabled;
+    
+    bool m_stageCpuTime;
+    
+    // The logger is shared by the whole process, so just its own startAsync is undone
+    bool m_logAsync;
+    
+    // Just used from the publisher thread
+    boost::shared_ptr<RollingStats> m_rollingStats;
+    uint32_t m_latencySeries, m_inputPointsSeries, m_occupiedVoxelsSeries;
+    uint32_t m_liveParticlesSeries, m_obstaclesSeries, m_publishedBytesSeries;
+    double m_statsSummaryPeriod;
+    ros::WallTime m_lastStatsSummary;
+    double m_outputPeriods[NUM_OUTPUTS];        // Seconds. 0 to publish every frame.
+    ros::WallTime m_lastOutputs[NUM_OUTPUTS];
+    
+    // NULL unless trace_enabled
+    boost::shared_ptr<Tracer> m_tracer;
+    double m_traceDeadline;                     // Seconds. 0 to disable it.
+    ros::WallTime m_lastTraceFlush;
+    uint32_t m_publishedMarkers;
+    uint64_t m_publishedBytes;
+
     string m_mapFrame;
     string m_poseFrame;
     string m_cameraFrame;
@@ -223,6 +282,8 @@ protected:
     ros::Publisher m_particles3Pub;
     ros::Publisher m_particlesDPub;
     ros::Publisher m_particlesSimplePub;
+    ros::Publisher m_particlesCloudPub;
+    ros::Publisher m_voxelsCloudPub;
     ros::Publisher m_oFlowPub;
     ros::Publisher m_mainVectorsPub;
     ros::Publisher m_obstaclesPub;
@@ -230,12 +291,35 @@ protected:
     ros::Publisher m_obstacleSpeedPub;
     ros::Publisher m_obstacleSpeedTextPub;
     ros::Publisher m_timeStatsPub;
+    ros::Publisher m_statsSummaryPub;
     ros::Publisher m_segmentedPointCloudPub;
     ros::Publisher m_debugSegmentPub;
     ros::Publisher m_debugProbPub;
     ros::Publisher m_fakePointCloudPub;
     ros::Publisher m_fakeParticlesPub;
     ros::Publisher m_odomPub;
+    ros::Publisher m_obstacleArrayPub;
+    
+    // Markers published last time in each marker topic
+    MarkerManager m_voxelMarkers, m_voxelIdxMarkers, m_particleMarkers, m_mainVectorMarkers, m_obstacleMarkers;
+    MarkerManager m_obstacleCubeMarkers, m_obstacleSpeedMarkers, m_obstacleSpeedTextMarkers;
+    
+    boost::shared_ptr<SnapshotPublisher> m_snapshotPublisher;
+    
+    // Pipeline: frames go from m_freeFrames to the ingestion stage, then through m_readyFrames
+    // to the filter thread, and back to m_freeFrames
+    std::vector< boost::shared_ptr<VoxelFrame> > m_frames;
+    boost::shared_ptr< StageQueue<VoxelFrame *> > m_freeFrames;
+    boost::shared_ptr< StageQueue<VoxelFrame *> > m_readyFrames;
+    boost::thread m_filterThread;
+    
+    // Clouds waiting to be computed, and the thread computing them
+    boost::shared_ptr<IngestQueue> m_ingestQueue;
+    t_ingest_info m_ingestInfo;
+    boost::thread m_ingestThread;
+    
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 
 }
@@ -0,0 +1,49 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "voxel_odometry.h"
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <stdexcept>
+
+namespace voxel_odometry {
+
+/**
+ * VoxelOdometry loaded into a nodelet manager. Clouds published from the same manager
+ * (e.g. the point cloud transform) are received as a shared pointer, without serialization.
+ */
+class VoxelOdometryNodelet : public nodelet::Nodelet
+{
+public:
+    virtual void onInit() {
+        // A wrong param just leaves this nodelet stopped; the rest of the manager keeps running
+        try {
+            m_voxelOdometry.reset(new VoxelOdometry(getPrivateNodeHandle()));
+        } catch (const std::invalid_argument & e) {
+            NODELET_FATAL("Not started: %s", e.what());
+        }
+    }
+    
+protected:
+    boost::shared_ptr<VoxelOdometry> m_voxelOdometry;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(voxel_odometry::VoxelOdometryNodelet, nodelet::Nodelet)
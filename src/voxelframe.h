@@ -0,0 +1,64 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef VOXELFRAME_H
+#define VOXELFRAME_H
+
+#include "params_structs.h"
+#include "voxel.h"
+#include "framesnapshot.h"
+
+#include <Eigen/Geometry>
+
+namespace voxel_odometry {
+
+/**
+ * Everything that belongs to a single frame: the voxel grid obtained from its point cloud
+ * and the inputs it was computed with. It is produced by the ingestion stage (binning and
+ * ego-motion) and consumed by the filter stage (prediction, update, segmentation...).
+ * The particles are not here, since they are carried from one frame to the next by the filter.
+ */
+struct VoxelFrame
+{
+    uint32_t id;
+    double stamp;                       // Seconds
+    double deltaTime;
+
+    VoxelGrid grid;
+    VoxelList voxels;
+    uint32_t dimX, dimY, dimZ;
+    float minX, maxX, minY, maxY, minZ, maxZ;
+
+    t_ego_motion egoMotion;
+
+    Eigen::Affine3d pose2MapTransform;
+    Eigen::Affine3d map2CamTransform;   // Just with input_from_cameras
+    t_stereo_camera stereoCamera;       // Just with input_from_cameras
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr oFlowCloud;
+
+    // Filled by both stages
+    t_frame_stats timeStats;
+
+    VoxelFrame() : pose2MapTransform(Eigen::Affine3d::Identity()), map2CamTransform(Eigen::Affine3d::Identity()), 
+                   oFlowCloud(new pcl::PointCloud<pcl::PointXYZRGBNormal>) {}
+    
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+}
+
+#endif // VOXELFRAME_H
@@ -16,7 +16,6 @@
 
 
 #include "voxelobstacle.h"
-#include "utilspolargridtracking.h"
 
 #include <boost/foreach.hpp>
 #include <boost/graph/graph_concepts.hpp>
@@ -27,7 +26,7 @@ namespace voxel_odometry {
                                  const double& threshMagnitude, const double & minDensity, const SpeedMethod & speedMethod,
                                  const double & yawInterval, const double & pitchInterval,
                                  VoxelPtr& voxel) :
-                                    m_idx(obstIdx), m_threshMagnitude(threshMagnitude), 
+                                    m_idx(obstIdx), m_confidence(0.0), m_threshMagnitude(threshMagnitude), 
                                     m_threshYaw(threshYaw), m_threshPitch(threshPitch),
                                     m_minDensity(minDensity), m_speedMethod(speedMethod),
                                     m_yawInterval(yawInterval), m_pitchInterval(pitchInterval)
@@ -44,7 +43,7 @@ VoxelObstacle::VoxelObstacle(const uint32_t& obstIdx, const double& threshYaw,
                              const double& threshPitch, const double& threshMagnitude, 
                              const double & minDensity, const SpeedMethod & speedMethod,
                              const double & yawInterval, const double & pitchInterval) :
-                                m_idx(obstIdx), m_threshMagnitude(threshMagnitude), 
+                                m_idx(obstIdx), m_confidence(0.0), m_threshMagnitude(threshMagnitude), 
                                 m_threshYaw(threshYaw), m_threshPitch(threshPitch),
                                 m_minDensity(minDensity), m_speedMethod(speedMethod),
                                 m_yawInterval(yawInterval), m_pitchInterval(pitchInterval)
@@ -256,8 +255,12 @@ void VoxelObstacle::updateHistogram(const float & maxVelX, const float & maxVelY
         uint32_t totalPoints = 0;
         const float & maxSpeed = cv::norm(cv::Vec3f(maxVelX, maxVelY, maxVelZ));
         const float & speed2IdFactor =  maxSpeed * factorSpeed;
+        // For the confidence
+        double squaredMagnitudeSum = 0.0;
+        uint32_t numParticles = 0, numTracked = 0;
         BOOST_FOREACH(VoxelPtr voxel, m_voxels) {
             const ParticleList & particles = voxel->getParticles();
+            numParticles += particles.size();
             BOOST_FOREACH(ParticlePtr particle, particles) {
                 if (particle->age() >= 2) {
                     const float & vx = particle->vx();
@@ -269,6 +272,8 @@ void VoxelObstacle::updateHistogram(const float & maxVelX, const float & maxVelY
                     m_vy += vy * increment;
                     m_vz += vz * increment;
                     totalPoints += increment;
+                    squaredMagnitudeSum += (vx * vx + vy * vy + vz * vz) * increment;
+                    numTracked++;
                 }
             }
         }
@@ -277,10 +282,23 @@ void VoxelObstacle::updateHistogram(const float & maxVelX, const float & maxVelY
             m_vx /= totalPoints;
             m_vy /= totalPoints;
             m_vz /= totalPoints;
+            squaredMagnitudeSum /= totalPoints;
         }
             
         cv::Vec3f speedVector(m_vx, m_vy, m_vz);
         m_magnitude = cv::norm(speedVector);
+        
+        // Fraction of particles old enough to be used, times how tight their velocities are around the 
+        // mean one (1 if all of them agree, 0 if they spread as much as the max speed). It does not 
+        // depend on the speed, so a well observed static obstacle is as confident as a moving one.
+        m_confidence = 0.0;
+        if (numTracked != 0) {
+            const double spread = sqrt(std::max(0.0, squaredMagnitudeSum - m_magnitude * m_magnitude));
+            const double tightness = (maxSpeed > 0.0f)? std::max(0.0, 1.0 - spread / maxSpeed) : 
+                                                        ((spread == 0.0)? 1.0 : 0.0);
+            m_confidence = tightness * numTracked / numParticles;
+        }
+        
         if (m_magnitude != 0.0f) {
             speedVector /= m_magnitude;
             
@@ -299,6 +317,23 @@ void VoxelObstacle::updateHistogram(const float & maxVelX, const float & maxVelY
     
 }
 
+// Mean of the points of its voxels, each voxel weighing the same (its centroid is the center of the cell)
+void VoxelObstacle::updateCentroid()
+{
+    m_centerX = m_centerY = m_centerZ = 0.0;
+    if (m_voxels.empty())
+        return;
+    
+    BOOST_FOREACH(const VoxelPtr & voxel, m_voxels) {
+        m_centerX += voxel->meanX();
+        m_centerY += voxel->meanY();
+        m_centerZ += voxel->meanZ();
+    }
+    m_centerX /= m_voxels.size();
+    m_centerY /= m_voxels.size();
+    m_centerZ /= m_voxels.size();
+}
+
 bool VoxelObstacle::isObstacleConnected(const VoxelObstacle & obstacle)
 {
     return true;
@@ -324,10 +359,7 @@ void VoxelObstacle::joinObstacles(VoxelObstacle& obstacle)
 void VoxelObstacle::update(const double & m_voxelSizeX, const double & m_voxelSizeY, const double & m_voxelSizeZ)
 {
     updateMotionInformation();
-    
-    m_centerX = (m_maxX + m_minX) / 2.0;
-    m_centerY = (m_maxY + m_minY) / 2.0;
-    m_centerZ = (m_maxZ + m_minZ) / 2.0;
+    updateCentroid();
     
     m_sizeX = m_maxX - m_minX + m_voxelSizeX;
     m_sizeY = m_maxY - m_minY + m_voxelSizeY;
@@ -457,7 +489,7 @@ void VoxelObstacle::updateSpeed(const double & egoDeltaX, const double & egoDelt
             break;
         }
         default: {
-            ROS_ERROR("Speed method not known: %d", m_speedMethod);
+            cerr << "Speed method not known: " << m_speedMethod << endl;
             exit(-1);
         }
     }
@@ -500,7 +532,6 @@ void VoxelObstacle::updateSpeedFromParticles()
             m_magnitude = 0.0;
             uint32_t countParticles = 0;
             
-            m_centerX = m_centerY = m_centerZ = 0.0;
             BOOST_FOREACH(const VoxelPtr & voxel, m_voxels) {
                 BOOST_FOREACH(const ParticlePtr & particle, voxel->getParticles()) {
                     m_vx += particle->vx();
@@ -509,13 +540,8 @@ void VoxelObstacle::updateSpeedFromParticles()
                     
                     countParticles++;
                 }
-                m_centerX += voxel->centroidX();
-                m_centerY += voxel->centroidY();
-                m_centerZ += voxel->centroidZ();
             }
-            m_centerX /= m_voxels.size();
-            m_centerY /= m_voxels.size();
-            m_centerZ /= m_voxels.size();
+            updateCentroid();
             
             m_vx /= countParticles;
             m_vy /= countParticles;
@@ -573,7 +599,6 @@ void VoxelObstacle::updateSpeedFromParticles()
             const uint32_t totalYawBins = 2 * M_PI / m_yawInterval;
             CircularHist histogram(boost::extents[totalPitchBins + 1][totalYawBins + 1]);
             
-            m_centerX = m_centerY = m_centerZ = 0.0;
             BOOST_FOREACH(const VoxelPtr & voxel, m_voxels) {
                 BOOST_FOREACH(const ParticlePtr & particle, voxel->getParticles()) {
                     if (particle->age() > 1) {
@@ -587,13 +612,8 @@ void VoxelObstacle::updateSpeedFromParticles()
                         histogram[idxPitch][idxYaw].magnitudeSum += cv::norm(cv::Vec3f(particle->vx(), particle->vy(), particle->vz()));
                     }
                 }
-                m_centerX += voxel->centroidX();
-                m_centerY += voxel->centroidY();
-                m_centerZ += voxel->centroidZ();
             }
-            m_centerX /= m_voxels.size();
-            m_centerY /= m_voxels.size();
-            m_centerZ /= m_voxels.size();
+            updateCentroid();
             
             uint32_t maxIdxPitch = 0;
             uint32_t maxIdxYaw = 0;
@@ -653,7 +673,7 @@ void VoxelObstacle::updateSpeedFromParticles()
             break;
         }
         default: {
-            ROS_ERROR("Speed method not known: %d", m_speedMethod);
+            cerr << "Speed method not known: " << m_speedMethod << endl;
             exit(-1);
         }
     }
@@ -21,7 +21,6 @@
 #include "voxel.h"
 
 #include <opencv2/opencv.hpp>
-#include <image_geometry/stereo_camera_model.h>
 
 namespace voxel_odometry {
 
@@ -62,6 +61,7 @@ public:
     double vz() const { return m_vz; }
     
     double magnitude() const { return m_magnitude; }
+    double confidence() const { return m_confidence; }
     
     VoxelList voxels() const { return m_voxels; }
     
@@ -85,12 +85,14 @@ public:
     friend ostream& operator<<(ostream & stream, const VoxelObstacle & in);
 protected:
     void updateMotionInformation();
+    void updateCentroid();
     void updateWithVoxel(const VoxelPtr & voxel);
     
     VoxelList m_voxels;
     
     uint32_t m_idx;
     double m_magnitude;
+    double m_confidence;
     double m_yaw;
     double m_pitch;
     
@@ -0,0 +1,1029 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "voxelodometryengine.h"
+#include "timeutils.h"
+#include "tracer.h"
+#include "logging.h"
+
+#include <math.h>
+#include <limits>
+#include <iostream>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include <pcl/search/kdtree.h>
+
+#include <opencv2/opencv.hpp>
+
+#include <Eigen/Geometry>
+
+// Voxels per chunk in the initialization (see createStaticParticles)
+#define INITIALIZATION_GRAIN 16
+
+using namespace std;
+
+namespace voxel_odometry {
+
+VoxelOdometryEngine::VoxelOdometryEngine(const t_engine_params & params) : 
+                                            m_params(params), m_inputCloud(new PointCloud)
+{
+    m_tasks.reset(new TaskRuntime(params.threads));
+    
+    m_cellSizeX = params.cellSizeX;
+    m_cellSizeY = params.cellSizeY;
+    m_cellSizeZ = params.cellSizeZ;
+    m_voxelSize = max(max(m_cellSizeX, m_cellSizeY), m_cellSizeZ);
+    
+    m_maxNumberOfParticles = params.maxNumberOfParticles;
+    m_maxVelX = params.maxVelX;
+    m_maxVelY = params.maxVelY;
+    m_maxVelZ = params.maxVelZ;
+    m_minMagnitude = cv::norm(cv::Vec3f(params.minVelX, params.minVelY, params.minVelZ));
+    m_yawInterval = params.yawInterval;
+    m_pitchInterval = params.pitchInterval;
+    m_factorSpeed = params.factorSpeed;
+    m_threshOccupancyProb = params.threshOccupancyProb;
+    m_particlesPerVoxel = params.particlesPerVoxel;
+    m_threshYaw = params.threshYaw;
+    m_threshPitch = params.threshPitch;
+    m_threshMagnitude = params.threshMagnitude;
+    m_minVoxelDensity = params.minVoxelDensity;
+    m_obstacleSpeedMethod = params.obstacleSpeedMethod;
+    m_speedMethod = params.speedMethod;
+    m_odometryMethod = params.odometryMethod;
+    m_compensateEgoMotion = params.compensateEgoMotion;
+    m_useOFlow = params.useOFlow;
+    m_inputFromCameras = params.inputFromCameras;
+    
+    m_registration.reset(new VoxelRegistration(params.registrationMetric, params.registrationMaxIterations, 
+                                               params.registrationMaxDistance, params.registrationMinCorrespondences, 
+                                               params.registrationTranslationEps, params.registrationRotationEps));
+    
+    if ((m_odometryMethod == ODOMETRY_METHOD_BEV) || 
+        ((m_odometryMethod == ODOMETRY_METHOD_REGISTRATION) && params.registrationBevFallback)) {
+        
+        m_bevOdometry.reset(new BevOdometry(params.bevResolution, params.bevAngleBins, params.bevMinResponse));
+    }
+    
+    m_egoMotion.deltaX = m_egoMotion.deltaY = m_egoMotion.deltaYaw = 0.0;
+    m_egoMotion.deltaTime = 0.0;
+    m_egoMotion.valid = false;
+    
+    m_initialized = false;
+    
+    m_currX = m_currY = 0.0;
+    m_odometry.valid = false;
+    
+    m_currTheta = std::numeric_limits<double>::infinity();
+    if (m_odometryMethod != ODOMETRY_METHOD_PARTICLES)
+        m_currTheta = 0.0;
+}
+
+void VoxelOdometryEngine::setTracer(const boost::shared_ptr<Tracer> & tracer)
+{
+    m_tracer = tracer;
+    m_tasks->setTracer(tracer);
+}
+
+/**
+ * Computes a whole frame in the calling thread.
+ * @param points: x, y, z of each point, in the frame of the sensor (input.sensor2PoseTransform).
+ * @param numPoints: Number of points.
+ * @param pointStride: Number of floats between two consecutive points (3 if packed).
+ * @param input: Pose and timing of the frame.
+ * @param result: The result of the frame.
+ * @param intermediateInfo: If true, voxels and particles are also copied into the result.
+ */
+void VoxelOdometryEngine::compute(const float * points, const uint32_t & numPoints, const uint32_t & pointStride,
+                                  const t_frame_input & input, FrameSnapshot & result, 
+                                  const bool & intermediateInfo)
+{
+    const Eigen::Affine3f sensor2Pose = input.sensor2PoseTransform.cast<float>();
+    
+    m_inputCloud->clear();
+    m_inputCloud->reserve(numPoints);
+    for (uint32_t i = 0; i < numPoints; i++) {
+        const float * point = points + i * pointStride;
+        const Eigen::Vector3f position = sensor2Pose * Eigen::Vector3f(point[0], point[1], point[2]);
+        
+        PointType dst;
+        dst.x = position.x();
+        dst.y = position.y();
+        dst.z = position.z();
+        m_inputCloud->push_back(dst);
+    }
+    
+    m_frame.id = input.id;
+    m_frame.stamp = input.stamp;
+    m_frame.deltaTime = input.deltaTime;
+    m_frame.pose2MapTransform = input.pose2MapTransform;
+    m_frame.map2CamTransform = input.map2CamTransform;
+    m_frame.stereoCamera = input.stereoCamera;
+    m_frame.timeStats = t_frame_stats();
+    
+    computeVoxelFrame(m_inputCloud, m_frame);
+    filterFrame(m_frame);
+    
+    result.clear();
+    fillSnapshot(m_frame, result, intermediateInfo);
+    result.timeStats = m_frame.timeStats;
+}
+
+static inline t_particle_record particleRecord(const Particle3d & particle, const uint32_t & voxelIdx)
+{
+    t_particle_record record;
+    record.x = particle.x();
+    record.y = particle.y();
+    record.z = particle.z();
+    record.vx = particle.vx();
+    record.vy = particle.vy();
+    record.vz = particle.vz();
+    record.age = particle.age();
+    record.id = particle.id();
+    record.voxelIdx = voxelIdx;
+    
+    return record;
+}
+
+/**
+ * Ingestion stage: everything that just depends on the current point cloud. 
+ * Depends on the previous frame just through the ego-motion estimation.
+ * @param pointCloud: The input point cloud.
+ * @param frame: The frame to be filled.
+ */
+void VoxelOdometryEngine::computeVoxelFrame(const PointCloudPtr& pointCloud, VoxelFrame & frame)
+{
+    t_stage_time * stages = frame.timeStats.stages;
+    const bool & cpuTime = m_params.stageCpuTime;
+    
+    StageTimer totalTimer(stages[STAGE_TOTAL_COMPUTE], cpuTime);
+    TraceSpan totalSpan(m_tracer.get(), "computeVoxelFrame");
+    
+//     INIT_CLOCK(startExtractDynamicObjects)
+//     extractDynamicObjects(pointCloud);
+//     END_CLOCK(totalExtractDynamicObjects, startExtractDynamicObjects)
+//     ROS_INFO("[%s] %d, extractDynamicObjects: %f seconds", __FUNCTION__, __LINE__, totalExtractDynamicObjects);
+    
+    // Having a point cloud, the voxel grid is computed
+    {
+        StageTimer timer(stages[STAGE_GET_VOXEL_GRID_FROM_POINT_CLOUD], cpuTime);
+        TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_GET_VOXEL_GRID_FROM_POINT_CLOUD]);
+        getVoxelGridFromPointCloud(pointCloud, frame);
+    }
+    frame.timeStats.inputPoints = pointCloud->size();
+    frame.timeStats.occupiedVoxels = frame.voxels.size();
+    
+    if (m_odometryMethod != ODOMETRY_METHOD_PARTICLES) {
+        StageTimer timer(stages[STAGE_REGISTRATION], cpuTime);
+        TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_REGISTRATION]);
+        estimateEgoMotion(frame);
+    }
+    frame.egoMotion = m_egoMotion;
+    
+    if(m_useOFlow) {
+        StageTimer timer(stages[STAGE_UPDATE_FROM_OFLOW], cpuTime);
+        TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_UPDATE_FROM_OFLOW]);
+        updateFromOFlow(frame);
+    }
+}
+
+/**
+ * Filter stage. Depends on the previous frame through the particles, so frames go through
+ * it one at a time and in order.
+ * @param frame: The frame, as left by the ingestion stage.
+ */
+void VoxelOdometryEngine::filterFrame(VoxelFrame & frame)
+{
+    t_stage_time * stages = frame.timeStats.stages;
+    const bool & cpuTime = m_params.stageCpuTime;
+    
+    // Added to the time of computeVoxelFrame
+    StageTimer totalTimer(stages[STAGE_TOTAL_COMPUTE], cpuTime);
+    TraceSpan totalSpan(m_tracer.get(), "filterFrame");
+    
+    {
+        StageTimer timer(stages[STAGE_GET_MEASUREMENT_MODEL], cpuTime);
+        TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_GET_MEASUREMENT_MODEL]);
+        getMeasurementModel(frame);
+    }
+    
+    // TODO:
+    // Improve the way in which flow vectors are computed
+    
+    if (m_initialized) {
+        if (m_compensateEgoMotion) {
+            StageTimer timer(stages[STAGE_EGO_MOTION_COMPENSATION], cpuTime);
+            TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_EGO_MOTION_COMPENSATION]);
+            egoMotionCompensation(frame);
+        }
+        
+        {
+            StageTimer timer(stages[STAGE_PREDICTION], cpuTime);
+            TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_PREDICTION]);
+            prediction(frame);
+        }
+        {
+            StageTimer timer(stages[STAGE_MEASUREMENT_BASED_UPDATE], cpuTime);
+            TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_MEASUREMENT_BASED_UPDATE]);
+            measurementBasedUpdate(frame);
+        }
+        {
+            StageTimer timer(stages[STAGE_SEGMENT], cpuTime);
+            TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_SEGMENT]);
+            joinVoxels(frame);
+        }
+        {
+            StageTimer timer(stages[STAGE_UPDATE_SPEED_FROM_OBSTACLES], cpuTime);
+            TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_UPDATE_SPEED_FROM_OBSTACLES]);
+            updateSpeedFromObstacles();
+        }
+    }
+    {
+        StageTimer timer(stages[STAGE_INITIALIZATION], cpuTime);
+        TraceSpan span(m_tracer.get(), STAGE_NAMES[STAGE_INITIALIZATION]);
+        initialization(frame);
+    }
+    
+    frame.timeStats.liveParticles = m_particles.size();
+    frame.timeStats.obstacles = m_obstacles.size();
+    
+    integrateOdometry(frame);
+}
+
+/**
+ * Copies the result of the current frame into a snapshot
+ * @param snapshot: The snapshot to be filled (already cleared).
+ * @param intermediateInfo: If true, voxels and particles are also copied.
+ */
+void VoxelOdometryEngine::fillSnapshot(const VoxelFrame & frame, FrameSnapshot & snapshot, 
+                                       const bool & intermediateInfo) const
+{
+    snapshot.id = frame.id;
+    snapshot.stamp = frame.stamp;
+    snapshot.deltaTime = frame.deltaTime;
+    snapshot.dimX = frame.dimX;
+    snapshot.dimY = frame.dimY;
+    snapshot.dimZ = frame.dimZ;
+    snapshot.odometry = m_odometry;
+    
+    if (intermediateInfo) {
+        snapshot.voxels.reserve(frame.voxels.size());
+        BOOST_FOREACH(const VoxelPtr & voxel, frame.voxels) {
+            t_voxel_record record;
+            record.centroidX = voxel->centroidX();
+            record.centroidY = voxel->centroidY();
+            record.centroidZ = voxel->centroidZ();
+            record.vx = voxel->vx();
+            record.vy = voxel->vy();
+            record.vz = voxel->vz();
+            record.magnitude = voxel->magnitude();
+            record.x = voxel->x();
+            record.y = voxel->y();
+            record.z = voxel->z();
+            
+            const uint32_t voxelIdx = snapshot.voxels.size();
+            record.firstParticle = snapshot.particles.size();
+            BOOST_FOREACH(const ParticlePtr & particle, voxel->particles()) {
+                snapshot.particles.push_back(particleRecord(*particle, voxelIdx));
+            }
+            record.numParticles = snapshot.particles.size() - record.firstParticle;
+            
+            record.firstOFlowParticle = snapshot.oFlowParticles.size();
+            BOOST_FOREACH(const ParticlePtr & particle, voxel->oFlowParticles()) {
+                snapshot.oFlowParticles.push_back(particleRecord(*particle, voxelIdx));
+            }
+            record.numOFlowParticles = snapshot.oFlowParticles.size() - record.firstOFlowParticle;
+            
+            snapshot.voxels.push_back(record);
+        }
+    }
+    
+    snapshot.obstacles.reserve(m_obstacles.size());
+    BOOST_FOREACH(const VoxelObstaclePtr & obstacle, m_obstacles) {
+        t_obstacle_record record;
+        record.centerX = obstacle->centerX();
+        record.centerY = obstacle->centerY();
+        record.centerZ = obstacle->centerZ();
+        record.minX = obstacle->minX();
+        record.maxX = obstacle->maxX();
+        record.minY = obstacle->minY();
+        record.maxY = obstacle->maxY();
+        record.minZ = obstacle->minZ();
+        record.maxZ = obstacle->maxZ();
+        record.vx = obstacle->vx();
+        record.vy = obstacle->vy();
+        record.vz = obstacle->vz();
+        record.magnitude = obstacle->magnitude();
+        record.confidence = obstacle->confidence();
+        record.idx = obstacle->idx();
+        
+        record.firstVoxel = snapshot.obstacleVoxels.size();
+        BOOST_FOREACH(const VoxelPtr & voxel, obstacle->voxels()) {
+            t_point_record point;
+            point.x = voxel->centroidX();
+            point.y = voxel->centroidY();
+            point.z = voxel->centroidZ();
+            snapshot.obstacleVoxels.push_back(point);
+        }
+        record.numVoxels = snapshot.obstacleVoxels.size() - record.firstVoxel;
+        
+        snapshot.obstacles.push_back(record);
+    }
+}
+
+/**
+ * The grid is emptied
+ */
+void VoxelOdometryEngine::reset(VoxelFrame & frame)
+{
+    for (uint32_t x = 0; x < frame.dimX; x++) {
+        for (uint32_t y = 0; y < frame.dimY; y++) {
+            for (uint32_t z = 0; z < frame.dimZ; z++) {
+                frame.grid[x][y][z]->reset();
+            }
+        }
+    }
+}
+
+void VoxelOdometryEngine::getVoxelGridFromPointCloud(const PointCloudPtr& pointCloud, VoxelFrame & frame)
+{
+    INIT_CLOCK(startCompute)
+    
+    PointType minPoint, maxPoint;
+    
+//     if (m_threads >= 3) {
+//         // This way is twice faster than pcl::getMinMax3D implementation
+//         minPoint = pointCloud->at(0);
+//         maxPoint = pointCloud->at(0);
+//         
+//         #pragma omp parallel num_threads(3) 
+//         {
+//             #pragma omp sections nowait 
+//             {
+//                 #pragma omp section 
+//                 {
+//                     // X
+//                     for (uint32_t i = 0; i < pointCloud->size(); i++) {
+//                         if (minPoint.x > pointCloud->at(i).x) minPoint.x = pointCloud->at(i).x;
+//                         if (maxPoint.x < pointCloud->at(i).x) maxPoint.x = pointCloud->at(i).x;
+//                     }
+//                 }
+//                 #pragma omp section 
+//                 {
+//                     // Y
+//                     for (uint32_t i = 0; i < pointCloud->size(); i++) {
+//                         if (minPoint.y > pointCloud->at(i).y) minPoint.y = pointCloud->at(i).y;
+//                         if (maxPoint.y < pointCloud->at(i).y) maxPoint.y = pointCloud->at(i).y;
+//                     }
+//                 }
+//                 #pragma omp section 
+//                 {
+//                     // Z
+//                     for (uint32_t i = 0; i < pointCloud->size(); i++) {
+//                         if (minPoint.z > pointCloud->at(i).z) minPoint.z = pointCloud->at(i).z;
+//                         if (maxPoint.z < pointCloud->at(i).z) maxPoint.z = pointCloud->at(i).z;
+//                     }
+//                 }
+//             }
+//         }
+//     } else {
+//         pcl::getMinMax3D(*pointCloud, minPoint, maxPoint);
+//     }
+    
+
+    const float halfSizeX = m_cellSizeX / 2.0f;
+    const float halfSizeY = m_cellSizeY / 2.0f;
+    const float halfSizeZ = m_cellSizeZ / 2.0f;
+    
+    frame.minX = floor(minPoint.x / m_cellSizeX) * m_cellSizeX;
+    frame.minY = floor(minPoint.y / m_cellSizeY) * m_cellSizeY;
+    frame.minZ = floor(minPoint.z / m_cellSizeZ) * m_cellSizeZ;
+    
+    frame.maxX = ceil(maxPoint.x / m_cellSizeX) * m_cellSizeX;
+    frame.maxY = ceil(maxPoint.y / m_cellSizeY) * m_cellSizeY;
+    frame.maxZ = ceil(maxPoint.z / m_cellSizeZ) * m_cellSizeZ;
+    
+    frame.minX = -20.0;
+    frame.maxX = 20.0;
+    frame.minY = -20.0;
+    frame.maxY = 20.0;
+    frame.minZ = 0.5;
+    frame.maxZ = 3.5;
+    
+    frame.dimX = (frame.maxX - frame.minX) / m_cellSizeX;
+    frame.dimY = (frame.maxY - frame.minY) / m_cellSizeY; 
+    frame.dimZ = (frame.maxZ - frame.minZ) / m_cellSizeZ;
+    
+    frame.grid.resize(boost::extents[0][0][0]);
+    frame.grid.resize(boost::extents[frame.dimX][frame.dimY][frame.dimZ]);
+    
+    frame.voxels.clear();
+    frame.voxels.reserve(frame.dimX * frame.dimY * frame.dimZ);
+    
+    END_CLOCK(totalCompute, startCompute)
+    
+    RESET_CLOCK(startCompute)
+    
+    // Create the Kd-Tree
+    pcl::search::KdTree<PointType> kdtree;
+    kdtree.setSortedResults(false);
+    kdtree.setEpsilon(std::min(halfSizeX, std::min(halfSizeY, halfSizeZ)));
+    kdtree.setInputCloud (pointCloud);
+    END_CLOCK_2(totalCompute, startCompute)
+
+    RESET_CLOCK(startCompute)
+
+    std::vector<int> pointIdxRadiusSearch;
+    std::vector<float> pointRadiusSquaredDistance;
+
+    double focalX = 0.0, focalY = 0.0;
+    if (m_inputFromCameras) {
+        focalX = frame.stereoCamera.fx;
+        focalY = frame.stereoCamera.fy;
+    }
+
+    PointCloudPtr currPointCloud(new PointCloud);
+
+    VO_LOG_DEBUG("[%s] Bounds x [%f, %f], y [%f, %f], z [%f, %f]", __FUNCTION__, 
+                 frame.minX, frame.maxX, frame.minY, frame.maxY, frame.minZ, frame.maxZ);
+    
+    PointType searchPoint;
+    for (searchPoint.x = frame.minX + halfSizeX; searchPoint.x < frame.maxX; searchPoint.x += m_cellSizeX) {
+        for (searchPoint.y = frame.minY + halfSizeY; searchPoint.y < frame.maxY; searchPoint.y += m_cellSizeY) {
+            for (searchPoint.z = frame.minZ + halfSizeZ; searchPoint.z < frame.maxZ; searchPoint.z += m_cellSizeZ) {
+
+                if ((fabs(searchPoint.x) < 6.0) || (fabs(searchPoint.x) < 6.0) || (fabs(searchPoint.x) < 6.0))
+                    continue;
+                
+                float prob = 1.0;
+                const uint32_t neighbours = kdtree.radiusSearch(searchPoint, m_voxelSize / 2.0, 
+                                                                pointIdxRadiusSearch, pointRadiusSquaredDistance);
+
+                if (neighbours == 0)
+                    continue;
+
+                currPointCloud->push_back(searchPoint);
+                
+                // The mean of the points is needed for the scan to scan registration, since the 
+                // position of the voxel is quantized to the center of the cell
+                double meanX = searchPoint.x, meanY = searchPoint.y, meanZ = searchPoint.z;
+                if (m_odometryMethod != ODOMETRY_METHOD_PARTICLES) {
+                    meanX = meanY = meanZ = 0.0;
+                    for (uint32_t i = 0; i < neighbours; i++) {
+                        const PointType & point = pointCloud->points[pointIdxRadiusSearch[i]];
+                        meanX += point.x;
+                        meanY += point.y;
+                        meanZ += point.z;
+                    }
+                    meanX /= neighbours;
+                    meanY /= neighbours;
+                    meanZ /= neighbours;
+                }
+
+                // Avoids using static obstacles
+//                 if (!m_inputFromCameras && m_lastPointCloud) {
+
+//                     const uint32_t & prevNeighbours = m_kdtreeLastPointCloud.radiusSearch(searchPoint, m_voxelSize / 2.0, 
+//                                                                                     pointIdxRadiusSearch, pointRadiusSquaredDistance);
+
+//                     if (prevNeighbours != 0)
+//                         continue;
+
+//                 }
+
+                if (m_inputFromCameras) {
+
+                    const Eigen::Vector3d point = frame.map2CamTransform * 
+                                                    Eigen::Vector3d(searchPoint.x, searchPoint.y, searchPoint.z);
+                    const float & X = point[0];
+                    const float & Y = point[1];
+                    const float & Z = point[2];
+                    
+                    const float & fX_Z = focalX / Z;
+                    const float & u = X * fX_Z;
+                    const float & u0 = (X - m_cellSizeX) * fX_Z;
+                    const float & u1 = (X + m_cellSizeX) * fX_Z;
+                    const float & sigmaX = (u1 - u0) + 1;//2 * (u1 - u0) + 1;
+                    
+                    const float & fY_Z = focalY / Z;
+                    const float & v = Y * fY_Z;
+                    const float & v0 = (Y - m_cellSizeY) * fY_Z;
+                    const float & v1 = (Y + m_cellSizeY) * fY_Z;
+                    const float & sigmaY = (u1 - u0) + 1; //2 * (v1 - v0) + 1;
+                    
+                    prob = neighbours / sqrt(sigmaX * sigmaY);
+
+                }
+
+                // Just voxels with enough probability are added to the list
+                if (prob > m_threshOccupancyProb) {
+
+                    const float & x = floor((searchPoint.x - frame.minX) / m_cellSizeX);
+                    const float & y = floor((searchPoint.y - frame.minY)  / m_cellSizeY);
+                    const float & z = floor((searchPoint.z - frame.minZ)  / m_cellSizeZ);
+
+                    // FIXME: This is just for debugging
+//                     if (z == 1.0) {
+
+                        const t_stereo_camera * stereoCamera = NULL;
+                        if (m_inputFromCameras)
+                            stereoCamera = &frame.stereoCamera;
+    
+                        VoxelPtr voxelPtr( new Voxel(x, y, z, 
+                                            searchPoint.x, searchPoint.y, searchPoint.z, 
+                                            m_cellSizeX, m_cellSizeY, m_cellSizeZ, 
+                                            m_maxVelX, m_maxVelY, m_maxVelZ, 
+                                            stereoCamera, m_speedMethod,
+                                            m_yawInterval, m_pitchInterval, m_factorSpeed));
+
+                        if (! m_inputFromCameras)
+                            voxelPtr->setOccupiedProb(1.0);
+                        
+                        voxelPtr->setPointsMean(meanX, meanY, meanZ);
+
+                        frame.voxels.push_back(voxelPtr);
+                        frame.grid[x][y][z] = voxelPtr;
+
+//                     }
+                }
+
+            }
+        }
+    }
+    
+    VO_LOG_DEBUG("[%s] %lu occupied voxels", __FUNCTION__, (unsigned long)frame.voxels.size());
+
+//     m_lastPointCloud.reset(new PointCloud);
+//     pcl::copyPointCloud(*currPointCloud, *m_lastPointCloud);
+//     BOOST_FOREACH (VoxelPtr & voxel, m_voxelList) {
+//         m_lastPointCloud->push_back(PointType(voxel->centroidX(), voxel->centroidY(), voxel->centroidZ()));
+//     }
+//     m_kdtreeLastPointCloud.setSortedResults(false);
+//     m_kdtreeLastPointCloud.setEpsilon(std::min(halfSizeX, std::min(halfSizeY, halfSizeZ)));
+//     m_kdtreeLastPointCloud.setInputCloud (m_lastPointCloud);
+    
+    END_CLOCK_2(totalCompute, startCompute)
+}
+
+/**
+ * The motion of the vehicle between the previous and the current frame is obtained by 
+ * registering the voxel centroids of both frames, or by correlating their bird's eye views.
+ */
+void VoxelOdometryEngine::estimateEgoMotion(VoxelFrame & frame)
+{
+    CentroidList centroids;
+    centroids.reserve(frame.voxels.size());
+    BOOST_FOREACH(const VoxelPtr & voxel, frame.voxels) {
+        centroids.push_back(Eigen::Vector3f(voxel->meanX(), voxel->meanY(), voxel->meanZ()));
+    }
+    
+    t_ego_motion egoMotion;
+    bool valid = false;
+    if (m_odometryMethod == ODOMETRY_METHOD_REGISTRATION) {
+        m_registration->setGridGeometry(frame.minX, frame.minY, frame.minZ, 
+                                        m_cellSizeX, m_cellSizeY, m_cellSizeZ,
+                                        frame.dimX, frame.dimY, frame.dimZ);
+        
+        valid = m_registration->align(centroids, m_egoMotion, frame.deltaTime, egoMotion);
+        if (! valid) {
+            VO_LOG_WARN_THROTTLE(1.0, "[%s] Registration failed (%u correspondences after %u iterations)", __FUNCTION__, 
+                                 m_registration->numCorrespondences(), m_registration->iterations());
+        }
+    }
+    
+    // The BEV images are computed in every frame, since consecutive frames are needed
+    if (m_bevOdometry) {
+        m_bevOdometry->setGridGeometry(frame.minX, frame.maxX, frame.minY, frame.maxY);
+        
+        t_ego_motion bevEgoMotion;
+        const bool bevValid = m_bevOdometry->estimate(centroids, frame.deltaTime, bevEgoMotion);
+        if ((! valid) && bevValid) {
+            egoMotion = bevEgoMotion;
+            valid = true;
+        } else if (! valid) {
+            VO_LOG_WARN_THROTTLE(1.0, "[%s] BEV correlation failed (responses %f, %f)", __FUNCTION__, 
+                                 m_bevOdometry->rotationResponse(), m_bevOdometry->translationResponse());
+        }
+    }
+    
+    if (valid) {
+        m_egoMotion = egoMotion;
+    } else {
+        m_egoMotion.valid = false;
+    }
+}
+
+void VoxelOdometryEngine::updateFromOFlow(VoxelFrame & frame)
+{
+    BOOST_FOREACH(pcl::PointXYZRGBNormal & flowVector, *frame.oFlowCloud) {
+
+        
+        if (cv::norm(cv::Vec3f(flowVector.normal_x, flowVector.normal_y, flowVector.normal_z)) > 
+            cv::norm(cv::Vec3f(m_maxVelX, m_maxVelY, m_maxVelZ))) {
+            
+            continue;
+        }
+            
+        ParticlePtr particle(new Particle3d(flowVector.x, flowVector.y, flowVector.z, 
+                                    flowVector.normal_x, flowVector.normal_y, flowVector.normal_z));
+        
+        int32_t xPos, yPos, zPos;
+        particleToVoxel(frame, particle, xPos, yPos, zPos);
+        
+        if ((xPos >= 0) && (xPos < frame.dimX) &&
+            (yPos >= 0) && (yPos < frame.dimY) &&
+            (zPos >= 0) && (zPos < frame.dimZ)) {                    
+            
+            if (frame.grid[xPos][yPos][zPos]->occupied()) {
+                particle->setAge(frame.grid[xPos][yPos][zPos]->oldestParticle() + 2);
+                
+                frame.grid[xPos][yPos][zPos]->addFlowParticle(particle);
+            }
+        }
+    }
+}
+
+void VoxelOdometryEngine::getMeasurementModel(VoxelFrame & frame)
+{
+    if (m_inputFromCameras) {
+        // Each task takes a slab of the grid along x
+        m_tasks->parallelFor(0, frame.dimX, 1, 
+                             boost::bind(&VoxelOdometryEngine::spreadOccupancy, this, boost::ref(frame), _1, _2));
+        m_tasks->parallelFor(0, frame.dimX, 1, 
+                             boost::bind(&VoxelOdometryEngine::computeOccupiedProb, this, boost::ref(frame), _1, _2));
+    }/* else {
+        for (uint32_t x = 0; x < frame.dimX; x++) {
+            for (uint32_t y = 0; y < frame.dimY; y++) {
+                for (uint32_t z = 0; z < frame.dimZ; z++) {
+                    VoxelPtr & voxel = frame.grid[x][y][z];
+                    
+                    if (voxel) {
+                        const int & sigmaX = voxel->sigmaX();
+                        const int & sigmaY = voxel->sigmaY();
+                        const int & sigmaZ = voxel->sigmaZ();
+                        
+                        // p(m(x,z) | occupied)
+                        const double occupiedProb = 1.0;
+                    }
+                }
+            }
+        }
+    }*/
+}
+
+/**
+ * Counts each voxel in [beginX, endX) as an occupied neighbour of the voxels within its sigma.
+ * Neighbours can be in other slabs, hence the counter is incremented atomically.
+ */
+void VoxelOdometryEngine::spreadOccupancy(VoxelFrame & frame, const uint32_t & beginX, const uint32_t & endX)
+{
+    for (uint32_t x = beginX; x < endX; x++) {
+        for (uint32_t y = 0; y < frame.dimY; y++) {
+            for (uint32_t z = 0; z < frame.dimZ; z++) {
+                VoxelPtr & voxel = frame.grid[x][y][z];
+                
+                if (voxel) {
+                    const int & sigmaX = voxel->sigmaX();
+                    const int & sigmaY = voxel->sigmaY();
+                    const int & sigmaZ = voxel->sigmaZ();
+                    
+                    for (uint32_t x1 = max(0, (int)(x - sigmaX)); x1 <= min((int)(frame.dimX - 1), (int)(x + sigmaX)); x1++) {
+                        for (uint32_t y1 = max(0, (int)(y - sigmaY)); y1 <= min((int)(frame.dimY - 1), (int)(y + sigmaY)); y1++) {
+                            for (uint32_t z1 = max(0, (int)(z - sigmaZ)); z1 <= min((int)(frame.dimZ - 1), (int)(z + sigmaZ)); z1++) {
+                                if (frame.grid[x1][y1][z1])
+                                    frame.grid[x1][y1][z1]->incNeighborOcc();
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void VoxelOdometryEngine::computeOccupiedProb(VoxelFrame & frame, const uint32_t & beginX, const uint32_t & endX)
+{
+    for (uint32_t x = beginX; x < endX; x++) {
+        for (uint32_t y = 0; y < frame.dimY; y++) {
+            for (uint32_t z = 0; z < frame.dimZ; z++) {
+                VoxelPtr & voxel = frame.grid[x][y][z];
+
+                if (voxel) {
+                    const int & sigmaX = voxel->sigmaX();
+                    const int & sigmaY = voxel->sigmaY();
+                    const int & sigmaZ = voxel->sigmaZ();
+                
+                    // p(m(x,z) | occupied)
+                    const double occupiedProb = (double)voxel->neighborOcc() / 
+                                ((2.0 * (double)sigmaX + 1.0) + (2.0 * (double)sigmaY + 1.0) + (2.0 * (double)sigmaZ + 1.0));
+                    voxel->setOccupiedProb(occupiedProb);
+                }
+            }
+        }
+    }
+}
+
+void VoxelOdometryEngine::initialization(VoxelFrame & frame)
+{
+    VO_LOG_DEBUG("[%s] %lu voxels", __FUNCTION__, (unsigned long)frame.voxels.size());
+    
+    vector <ParticleList> particles(frame.voxels.size());
+
+    m_tasks->parallelFor(0, frame.voxels.size(), INITIALIZATION_GRAIN, 
+                         boost::bind(&VoxelOdometryEngine::createStaticParticles, this, 
+                                     boost::ref(frame), boost::ref(particles), _1, _2));
+    
+    uint32_t totalParticles = 0;
+    for (uint32_t i = 0; i < frame.voxels.size(); i++)
+        totalParticles += particles[i].size();
+    frame.timeStats.particlesBorn = totalParticles;
+
+    m_particles.reserve(m_particles.size() + totalParticles);
+    
+//     totalParticles = 0;
+    for (uint32_t i = 0; i < frame.voxels.size(); i++) {
+        
+        ParticleList & newParticles = particles[i];
+        
+        m_particles.insert(m_particles.end(), newParticles.begin(), newParticles.end());
+        
+//         totalParticles += newParticles.size();
+    }
+    
+    m_initialized = true;
+}
+
+/**
+ * The random ids of the particles are drawn from a generator per chunk of INITIALIZATION_GRAIN voxels,
+ * seeded with the frame and the chunk, so they do not depend on the number of threads nor on their timing.
+ */
+void VoxelOdometryEngine::createStaticParticles(VoxelFrame & frame, std::vector<ParticleList> & particles, 
+                                                const uint32_t & begin, const uint32_t & end)
+{
+    unsigned int seed = 0;
+    for (uint32_t i = begin; i < end; i++) {
+        // Without workers, the whole loop comes in a single call
+        if ((i == begin) || (i % INITIALIZATION_GRAIN == 0))
+            seed = frame.id * 2654435761u + i / INITIALIZATION_GRAIN;
+        
+        particles[i] = frame.voxels[i]->createParticlesStatic(seed);
+    }
+}
+
+/**
+ * Moves the surviving particles to the current vehicle frame, so static structure keeps
+ * falling in the same voxels and the particles just have to model the motion of the obstacles.
+ */
+void VoxelOdometryEngine::egoMotionCompensation(const VoxelFrame & frame)
+{
+    if (! frame.egoMotion.valid)
+        return;
+    
+    const double cosYaw = cos(frame.egoMotion.deltaYaw);
+    const double sinYaw = sin(frame.egoMotion.deltaYaw);
+    BOOST_FOREACH(ParticlePtr & particle, m_particles) {
+        particle->egoTransform(cosYaw, sinYaw, frame.egoMotion.deltaX, frame.egoMotion.deltaY);
+    }
+}
+
+void VoxelOdometryEngine::prediction(VoxelFrame & frame)
+{
+    // TODO: Put correct values for deltaX, deltaY, deltaZ, deltaVX, deltaVY, deltaVZ in class Particle,
+    // based on the covariance matrix
+    ParticleList newParticles;
+    newParticles.reserve(m_particles.size());
+    BOOST_FOREACH(ParticlePtr & particle, m_particles) {
+        particle->transform(frame.deltaTime);
+        
+        int32_t xPos, yPos, zPos;
+        particleToVoxel(frame, particle, xPos, yPos, zPos);
+        
+        if ((xPos >= 0) && (xPos < frame.dimX) &&
+            (yPos >= 0) && (yPos < frame.dimY) &&
+            (zPos >= 0) && (zPos < frame.dimZ)) {                    
+        
+            VoxelPtr & voxel = frame.grid[xPos][yPos][zPos];
+            if (voxel) {
+                voxel->addParticle(particle);
+                newParticles.push_back(particle);
+            }
+        }
+    }
+    
+    if (m_useOFlow) {
+        for (uint32_t x = 0; x < frame.dimX; x++) {
+            for (uint32_t y = 0; y < frame.dimY; y++) {
+                for (uint32_t z = 0; z < frame.dimZ; z++) {
+                    VoxelPtr & voxel = frame.grid[x][y][z];
+                    if (voxel)
+                        voxel->joinParticles();
+                }
+            }
+        }
+    }
+    
+    frame.timeStats.particlesEvicted = m_particles.size() - newParticles.size();
+    
+    m_particles.swap(newParticles);
+        
+}
+
+void VoxelOdometryEngine::measurementBasedUpdate(VoxelFrame & frame)
+{
+    m_tasks->parallelFor(0, frame.dimX, 1, 
+                         boost::bind(&VoxelOdometryEngine::updateVoxels, this, boost::ref(frame), _1, _2));
+    
+    return;
+    
+    for (uint32_t x = 0; x < frame.dimX; x++) {
+        for (uint32_t y = 0; y < frame.dimY; y++) {
+            for (uint32_t z = 0; z < frame.dimZ; z++) {
+                VoxelPtr & voxel = frame.grid[x][y][z];
+            
+                if ((! voxel->empty()) && (voxel->occupied())) {
+                    voxel->setOccupiedPosteriorProb(m_particlesPerVoxel);
+                    const double Nrc = voxel->occupiedPosteriorProb() * m_particlesPerVoxel;
+                    const double fc = Nrc / voxel->numParticles();
+                    
+                    if (fc > 1.0) {
+                        const double Fn = floor(fc);       // Integer part
+                        const double Ff = fc - Fn;         // Fractional part
+                        
+                        for (uint32_t i = 0; i < voxel->numParticles(); i++) {
+                            
+                            const ParticlePtr & p = voxel->getParticle(i);
+                            
+                            for (uint32_t k = 1; k < Fn; k++)
+                                for (uint32_t n = 0; n < p->age(); n++)
+                                    voxel->makeCopy(p);
+                            
+                            const double r = (double)rand() / (double)RAND_MAX;
+                            if (r < Ff)
+                                voxel->makeCopy(p);
+                        }
+                    } else if (fc < 1.0) {
+                        for (uint32_t i = 0; i < voxel->numParticles(); i++) {
+                            const double r = (double)rand() / (double)RAND_MAX;
+                            if (r > fc)
+                                voxel->removeParticle(i);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Voxels just hold their own particles, so each slab of the grid is updated independently
+void VoxelOdometryEngine::updateVoxels(VoxelFrame & frame, const uint32_t & beginX, const uint32_t & endX)
+{
+    for (uint32_t x = beginX; x < endX; x++) {
+        for (uint32_t y = 0; y < frame.dimY; y++) {
+            for (uint32_t z = 0; z < frame.dimZ; z++) {
+                VoxelPtr & voxel = frame.grid[x][y][z];
+                
+                if ((voxel) && (! voxel->empty()) && (voxel->occupied())) {
+                    voxel->sortParticles();
+//                     voxel->setMainVectors(m_deltaX, m_deltaY, m_deltaZ);
+                    voxel->updateHistogram();
+                    voxel->reduceParticles(m_maxNumberOfParticles);
+//                     voxel->centerParticles();
+                }
+            }
+        }
+    }
+}
+
+void VoxelOdometryEngine::joinVoxels(VoxelFrame & frame)
+{
+    m_obstacles.clear();
+    VoxelObstaclePtr obst(new VoxelObstacle(m_obstacles.size(), 
+                            m_threshYaw, m_threshPitch, m_threshMagnitude, 
+                            m_minVoxelDensity, m_obstacleSpeedMethod, 
+                            m_yawInterval, m_pitchInterval));
+
+    BOOST_FOREACH(VoxelPtr & voxel, frame.voxels) {
+        
+        obst->addVoxelToObstacle(voxel);
+    }
+        
+    m_obstacles.push_back(obst);
+}
+
+void VoxelOdometryEngine::updateSpeedFromObstacles()
+{
+    m_tasks->parallelFor(0, m_obstacles.size(), 1, 
+                         boost::bind(&VoxelOdometryEngine::updateObstacles, this, _1, _2));
+}
+
+void VoxelOdometryEngine::updateObstacles(const uint32_t & begin, const uint32_t & end)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        VoxelObstaclePtr & obstacle = m_obstacles[i];
+//         obstacle.updateSpeed(m_deltaX, m_deltaY, m_deltaZ);
+        obstacle->updateSpeedFromParticles();
+        obstacle->updateHistogram(m_maxVelX, m_maxVelY, m_maxVelZ, m_factorSpeed, m_minMagnitude);
+    }
+}
+
+// Angle of the rotation from the x axis to the given vector
+static double getAngle(const double &vx, const double &vy, const double &vz)
+{
+    if (vx == vy == vz == 0.0) {
+        return 2.0 * acos(0.0);
+    }
+    
+    Eigen::Vector3d zeroVector, currVector;
+    zeroVector << 1.0, 0.0, 0.0;
+    currVector << vx, vy, vz;
+    currVector.normalize();
+    Eigen::Quaterniond eigenQuat;
+    eigenQuat.setFromTwoVectors(zeroVector, currVector);
+    
+    return 2.0 * acos(eigenQuat.w());
+}
+
+/**
+ * The pose of the vehicle is updated with the motion of the current frame
+ */
+void VoxelOdometryEngine::integrateOdometry(const VoxelFrame & frame)
+{
+    m_odometry.valid = false;
+    
+    double vx, vy, vz, yawRate;
+    if (m_odometryMethod != ODOMETRY_METHOD_PARTICLES) {
+        if (! frame.egoMotion.valid)
+            return;
+        
+        // The motion is expressed in the previous vehicle frame
+        const double cosTheta = cos(m_currTheta);
+        const double sinTheta = sin(m_currTheta);
+        m_currX += cosTheta * frame.egoMotion.deltaX - sinTheta * frame.egoMotion.deltaY;
+        m_currY += sinTheta * frame.egoMotion.deltaX + cosTheta * frame.egoMotion.deltaY;
+        m_currTheta = atan2(sin(m_currTheta + frame.egoMotion.deltaYaw), cos(m_currTheta + frame.egoMotion.deltaYaw));
+        
+        vx = frame.egoMotion.deltaX / frame.egoMotion.deltaTime;
+        vy = frame.egoMotion.deltaY / frame.egoMotion.deltaTime;
+        vz = 0.0;
+        yawRate = frame.egoMotion.deltaYaw / frame.egoMotion.deltaTime;
+    } else {
+        if (m_obstacles.size() == 0)
+            return;
+        
+        const VoxelObstaclePtr & obst = m_obstacles[0];
+        
+        vx = -obst->vx();
+        vy = -obst->vy();
+        vz = -obst->vz();
+        
+        const double angle = getAngle(vx, vy, vz);
+    
+//     double angleDiff = atan2(sin(m_currTheta - angle), cos(m_currTheta - angle));
+//     if (m_currTheta == std::numeric_limits<double>::infinity())
+//         angleDiff = 0.0;
+    
+//     cout << (m_currTheta / CV_PI * 180.0) << " - " << (angle / CV_PI * 180.0) << " = " << (angleDiff / CV_PI * 180.0) << endl;
+//     m_currTheta = (m_currTheta + 2.0 * angle) / 3.0;
+    
+//     if (angleDiff > CV_PI / 4.0)
+//         return;
+    
+    
+        if ((vx < 0.3) && (vy < 0.3))
+            vx=vy=vz=0.0;
+        
+        m_currX += vx * frame.deltaTime;
+        m_currY += vy * frame.deltaTime;
+        m_currTheta = angle;
+        
+        yawRate = angle / frame.deltaTime;
+    }
+    
+    m_odometry.x = m_currX;
+    m_odometry.y = m_currY;
+    m_odometry.theta = m_currTheta;
+    m_odometry.vx = vx;
+    m_odometry.vy = vy;
+    m_odometry.vz = vz;
+    m_odometry.yawRate = yawRate;
+    m_odometry.valid = true;
+}
+
+}
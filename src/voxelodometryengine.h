@@ -0,0 +1,198 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef VOXELODOMETRYENGINE_H
+#define VOXELODOMETRYENGINE_H
+
+#include "params_structs.h"
+#include "voxel.h"
+#include "voxelobstacle.h"
+#include "voxelregistration.h"
+#include "bevodometry.h"
+#include "voxelframe.h"
+#include "framesnapshot.h"
+#include "taskruntime.h"
+#include "tracer.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <Eigen/Geometry>
+
+namespace voxel_odometry {
+
+typedef struct {
+    float cellSizeX, cellSizeY, cellSizeZ;
+    uint32_t maxNumberOfParticles;
+    uint32_t threads;
+    double maxVelX, maxVelY, maxVelZ;
+    double minVelX, minVelY, minVelZ;
+    double yawInterval, pitchInterval, factorSpeed;
+    double threshOccupancyProb;
+    double particlesPerVoxel;
+    double threshYaw, threshPitch, threshMagnitude;
+    double minVoxelDensity;
+    SpeedMethod obstacleSpeedMethod;
+    SpeedMethod speedMethod;
+    
+    OdometryMethod odometryMethod;
+    bool compensateEgoMotion;
+    bool useOFlow;
+    bool inputFromCameras;
+    bool stageCpuTime;                  // Also measure the CPU time of each stage
+    
+    // Just with odometry_method_registration
+    RegistrationMetric registrationMetric;
+    uint32_t registrationMaxIterations;
+    uint32_t registrationMinCorrespondences;
+    double registrationMaxDistance;
+    double registrationTranslationEps, registrationRotationEps;
+    bool registrationBevFallback;
+    
+    // Just with odometry_method_bev (or registrationBevFallback)
+    double bevResolution;
+    uint32_t bevAngleBins;
+    double bevMinResponse;
+} t_engine_params;
+
+// Everything but the points needed to compute a frame
+typedef struct {
+    uint32_t id;
+    double stamp;                       // Seconds
+    double deltaTime;                   // Seconds since the previous frame
+    Eigen::Affine3d pose2MapTransform;
+    Eigen::Affine3d sensor2PoseTransform; // Applied to the points while binning them (the grid is in the vehicle frame)
+    Eigen::Affine3d map2CamTransform;   // Just with inputFromCameras
+    t_stereo_camera stereoCamera;       // Just with inputFromCameras
+} t_frame_input;
+
+/**
+ * The method itself, without any dependency on ROS, so it can be run offline.
+ * A frame goes through two stages: computeVoxelFrame (voxel grid and ego-motion, which just 
+ * depend on the current cloud) and filterFrame (particle filter and segmentation, which carry 
+ * the state from one frame to the next). They can be called from different threads, as long
+ * as each stage is called with the frames in order.
+ */
+class VoxelOdometryEngine
+{
+public:
+    typedef pcl::PointXYZRGB PointType;
+    typedef pcl::PointCloud< PointType > PointCloud;
+    typedef PointCloud::Ptr PointCloudPtr;
+    
+    VoxelOdometryEngine(const t_engine_params & params);
+    
+    void compute(const float * points, const uint32_t & numPoints, const uint32_t & pointStride,
+                 const t_frame_input & input, FrameSnapshot & result, 
+                 const bool & intermediateInfo = false);
+    
+    void computeVoxelFrame(const PointCloudPtr & pointCloud, VoxelFrame & frame);
+    void filterFrame(VoxelFrame & frame);
+    void fillSnapshot(const VoxelFrame & frame, FrameSnapshot & snapshot, const bool & intermediateInfo) const;
+    
+    const t_engine_params & params() const { return m_params; }
+    const t_ego_motion & egoMotion() const { return m_egoMotion; }
+    // Shared with whoever else needs parallel loops, so there is a single pool of threads
+    const boost::shared_ptr<TaskRuntime> & taskRuntime() const { return m_tasks; }
+    
+    // Records the stages and the parallel tasks. NULL (the default) to disable it.
+    void setTracer(const boost::shared_ptr<Tracer> & tracer);
+    
+protected:
+    void reset(VoxelFrame & frame);
+    void getVoxelGridFromPointCloud(const PointCloudPtr& pointCloud, VoxelFrame & frame);
+    void estimateEgoMotion(VoxelFrame & frame);
+    void updateFromOFlow(VoxelFrame & frame);
+    void getMeasurementModel(VoxelFrame & frame);
+    void spreadOccupancy(VoxelFrame & frame, const uint32_t & beginX, const uint32_t & endX);
+    void computeOccupiedProb(VoxelFrame & frame, const uint32_t & beginX, const uint32_t & endX);
+    void initialization(VoxelFrame & frame);
+    void createStaticParticles(VoxelFrame & frame, std::vector<ParticleList> & particles, 
+                               const uint32_t & begin, const uint32_t & end);
+    void particleToVoxel(const VoxelFrame & frame, const ParticlePtr & particle, 
+                         int32_t & posX, int32_t & posY, int32_t & posZ);
+    void egoMotionCompensation(const VoxelFrame & frame);
+    void prediction(VoxelFrame & frame);
+    void measurementBasedUpdate(VoxelFrame & frame);
+    void updateVoxels(VoxelFrame & frame, const uint32_t & beginX, const uint32_t & endX);
+    void joinVoxels(VoxelFrame & frame);
+    void updateSpeedFromObstacles();
+    void updateObstacles(const uint32_t & begin, const uint32_t & end);
+    void integrateOdometry(const VoxelFrame & frame);
+    
+    t_engine_params m_params;
+    
+    boost::shared_ptr<TaskRuntime> m_tasks;
+    boost::shared_ptr<Tracer> m_tracer;
+    
+    // Stage of computeVoxelFrame
+    t_ego_motion m_egoMotion;
+    boost::shared_ptr<VoxelRegistration> m_registration;
+    boost::shared_ptr<BevOdometry> m_bevOdometry;
+    
+    // State of filterFrame
+    ParticleList m_particles;
+    VoxelObstacleList m_obstacles;
+    bool m_initialized;
+    double m_currX, m_currY, m_currTheta;
+    t_odometry_state m_odometry;
+    
+    // Just for compute()
+    PointCloudPtr m_inputCloud;
+    VoxelFrame m_frame;
+    
+    // Parameters
+    float m_cellSizeX, m_cellSizeY, m_cellSizeZ;
+    uint32_t m_maxNumberOfParticles;
+    double m_maxVelX, m_maxVelY, m_maxVelZ;
+    double m_minMagnitude;
+    double m_yawInterval, m_pitchInterval, m_factorSpeed;
+    SpeedMethod m_obstacleSpeedMethod;
+    double m_threshOccupancyProb;
+    double m_particlesPerVoxel;
+    double m_threshYaw, m_threshPitch, m_threshMagnitude;
+    double m_minVoxelDensity;
+    SpeedMethod m_speedMethod;
+    OdometryMethod m_odometryMethod;
+    bool m_compensateEgoMotion;
+    bool m_useOFlow;
+    bool m_inputFromCameras;
+    
+    // Computed parameters
+    float m_voxelSize;
+    
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// Inline, since it is called for every particle in the prediction and the update
+inline void VoxelOdometryEngine::particleToVoxel(const VoxelFrame & frame, const ParticlePtr & particle, 
+                                                 int32_t & posX, int32_t & posY, int32_t & posZ)
+{
+    const double dPosX = (particle->x() - frame.minX) / m_cellSizeX;
+    const double dPosY = (particle->y() - frame.minY) / m_cellSizeY;
+    const double dPosZ = (particle->z() - frame.minZ) / m_cellSizeZ;
+
+    // This check is needed to avoid truncating to 0 the case (-0.***)
+    posX = (dPosX < 0.0)? -1 : dPosX;
+    posY = (dPosY < 0.0)? -1 : dPosY;
+    posZ = (dPosZ < 0.0)? -1 : dPosZ;
+}
+
+}
+
+#endif // VOXELODOMETRYENGINE_H
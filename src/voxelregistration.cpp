@@ -0,0 +1,305 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "voxelregistration.h"
+
+#include <math.h>
+#include <limits>
+#include <Eigen/Dense>
+
+namespace voxel_odometry {
+
+VoxelRegistration::VoxelRegistration(const RegistrationMetric & metric, const uint32_t & maxIterations,
+                                     const double & maxCorrespondenceDistance,
+                                     const uint32_t & minCorrespondences,
+                                     const double & translationEpsilon, const double & rotationEpsilon) :
+                                        m_metric(metric), m_maxIterations(maxIterations),
+                                        m_maxCorrespondenceDistance(maxCorrespondenceDistance),
+                                        m_minCorrespondences(minCorrespondences),
+                                        m_translationEpsilon(translationEpsilon),
+                                        m_rotationEpsilon(rotationEpsilon)
+{
+    m_minX = m_minY = m_minZ = 0.0f;
+    m_cellSizeX = m_cellSizeY = m_cellSizeZ = 1.0f;
+    m_dimX = m_dimY = m_dimZ = 0;
+
+    m_iterations = 0;
+    m_numCorrespondences = 0;
+}
+
+void VoxelRegistration::setGridGeometry(const float & minX, const float & minY, const float & minZ,
+                                        const float & cellSizeX, const float & cellSizeY, const float & cellSizeZ,
+                                        const uint32_t & dimX, const uint32_t & dimY, const uint32_t & dimZ)
+{
+    if ((minX == m_minX) && (minY == m_minY) && (minZ == m_minZ) &&
+        (cellSizeX == m_cellSizeX) && (cellSizeY == m_cellSizeY) && (cellSizeZ == m_cellSizeZ) &&
+        (dimX == m_dimX) && (dimY == m_dimY) && (dimZ == m_dimZ)) {
+
+        return;
+    }
+
+    m_minX = minX;
+    m_minY = minY;
+    m_minZ = minZ;
+    m_cellSizeX = cellSizeX;
+    m_cellSizeY = cellSizeY;
+    m_cellSizeZ = cellSizeZ;
+    m_dimX = dimX;
+    m_dimY = dimY;
+    m_dimZ = dimZ;
+
+    // The previous frame is not valid anymore
+    m_lastIndexes.resize(boost::extents[m_dimX][m_dimY][m_dimZ]);
+    std::fill(m_lastIndexes.data(), m_lastIndexes.data() + m_lastIndexes.num_elements(), -1);
+    m_lastCells.clear();
+    m_lastCentroids.clear();
+    m_lastNormals.clear();
+    m_lastValidNormals.clear();
+}
+
+inline bool VoxelRegistration::toGrid(const Eigen::Vector3f & point, int32_t & x, int32_t & y, int32_t & z) const
+{
+    x = floor((point[0] - m_minX) / m_cellSizeX);
+    y = floor((point[1] - m_minY) / m_cellSizeY);
+    z = floor((point[2] - m_minZ) / m_cellSizeZ);
+
+    return (x >= 0) && (x < (int32_t)m_dimX) &&
+           (y >= 0) && (y < (int32_t)m_dimY) &&
+           (z >= 0) && (z < (int32_t)m_dimZ);
+}
+
+void VoxelRegistration::setReference(const CentroidList & centroids)
+{
+    // Just the cells used in the last frame are cleaned, instead of the whole grid
+    int32_t * indexes = m_lastIndexes.data();
+    for (uint32_t i = 0; i < m_lastCells.size(); i++)
+        indexes[m_lastCells[i]] = -1;
+    m_lastCells.clear();
+
+    m_lastCentroids = centroids;
+    m_lastCells.reserve(centroids.size());
+    for (uint32_t i = 0; i < centroids.size(); i++) {
+        int32_t x, y, z;
+        if (toGrid(centroids[i], x, y, z)) {
+            const int32_t cell = (x * m_dimY + y) * m_dimZ + z;
+            indexes[cell] = i;
+            m_lastCells.push_back(cell);
+        }
+    }
+
+    if (m_metric != REGISTRATION_POINT_TO_PLANE)
+        return;
+
+    // Normals in the XY plane, from the centroids in the 3x3x3 neighbourhood
+    m_lastNormals.resize(centroids.size());
+    m_lastValidNormals.assign(centroids.size(), false);
+    for (uint32_t i = 0; i < centroids.size(); i++) {
+        int32_t x, y, z;
+        if (! toGrid(centroids[i], x, y, z))
+            continue;
+
+        Eigen::Vector2d mean = Eigen::Vector2d::Zero();
+        Eigen::Matrix2d cov = Eigen::Matrix2d::Zero();
+        uint32_t numNeighbors = 0;
+        for (int32_t x1 = std::max(0, x - 1); x1 <= std::min((int32_t)m_dimX - 1, x + 1); x1++) {
+            for (int32_t y1 = std::max(0, y - 1); y1 <= std::min((int32_t)m_dimY - 1, y + 1); y1++) {
+                for (int32_t z1 = std::max(0, z - 1); z1 <= std::min((int32_t)m_dimZ - 1, z + 1); z1++) {
+                    const int32_t & idx = m_lastIndexes[x1][y1][z1];
+                    if (idx < 0)
+                        continue;
+
+                    const Eigen::Vector2d point = centroids[idx].head<2>().cast<double>();
+                    mean += point;
+                    cov += point * point.transpose();
+                    numNeighbors++;
+                }
+            }
+        }
+
+        if (numNeighbors < 3)
+            continue;
+
+        mean /= numNeighbors;
+        cov = cov / numNeighbors - mean * mean.transpose();
+
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> solver(cov);
+        // Eigenvalues are sorted in increasing order
+        if (solver.eigenvalues()[1] <= 0.0)
+            continue;
+
+        m_lastNormals[i] = solver.eigenvectors().col(0).cast<float>();
+        m_lastValidNormals[i] = true;
+    }
+}
+
+bool VoxelRegistration::findCorrespondence(const Eigen::Vector3f & point, int32_t & idx) const
+{
+    int32_t x, y, z;
+    toGrid(point, x, y, z);
+
+    const int32_t searchX = ceil(m_maxCorrespondenceDistance / m_cellSizeX);
+    const int32_t searchY = ceil(m_maxCorrespondenceDistance / m_cellSizeY);
+    const int32_t searchZ = ceil(m_maxCorrespondenceDistance / m_cellSizeZ);
+
+    float minDist = m_maxCorrespondenceDistance * m_maxCorrespondenceDistance;
+    idx = -1;
+    for (int32_t x1 = std::max(0, x - searchX); x1 <= std::min((int32_t)m_dimX - 1, x + searchX); x1++) {
+        for (int32_t y1 = std::max(0, y - searchY); y1 <= std::min((int32_t)m_dimY - 1, y + searchY); y1++) {
+            for (int32_t z1 = std::max(0, z - searchZ); z1 <= std::min((int32_t)m_dimZ - 1, z + searchZ); z1++) {
+                const int32_t & candidate = m_lastIndexes[x1][y1][z1];
+                if (candidate < 0)
+                    continue;
+
+                const float dist = (m_lastCentroids[candidate] - point).squaredNorm();
+                if (dist < minDist) {
+                    minDist = dist;
+                    idx = candidate;
+                }
+            }
+        }
+    }
+
+    return idx >= 0;
+}
+
+/**
+ * Aligns the centroids of the current frame to the ones of the previous frame.
+ * @param centroids: Centroids of the occupied voxels in the current frame.
+ * @param initialGuess: Last estimation, scaled to the current deltaTime and used as initial guess.
+ * @param deltaTime: Time elapsed since the previous frame.
+ * @param motion: Motion of the vehicle frame, expressed in the previous frame.
+ * @return true if the registration was possible.
+ */
+bool VoxelRegistration::align(const CentroidList & centroids, const t_ego_motion & initialGuess,
+                              const double & deltaTime, t_ego_motion & motion)
+{
+    motion.deltaX = motion.deltaY = motion.deltaYaw = 0.0;
+    motion.deltaTime = deltaTime;
+    motion.valid = false;
+
+    m_iterations = 0;
+    m_numCorrespondences = 0;
+
+    if (m_lastCentroids.empty() || centroids.empty()) {
+        setReference(centroids);
+        return false;
+    }
+
+    double yaw = 0.0, tx = 0.0, ty = 0.0;
+    if (initialGuess.valid && (initialGuess.deltaTime > 0.0)) {
+        const double scale = deltaTime / initialGuess.deltaTime;
+        yaw = initialGuess.deltaYaw * scale;
+        tx = initialGuess.deltaX * scale;
+        ty = initialGuess.deltaY * scale;
+    }
+
+    bool converged = false;
+    while ((m_iterations < m_maxIterations) && (! converged)) {
+        m_iterations++;
+
+        const float cosYaw = cos(yaw);
+        const float sinYaw = sin(yaw);
+
+        // Point to point
+        Eigen::Vector2d sumSrc = Eigen::Vector2d::Zero();
+        Eigen::Vector2d sumDst = Eigen::Vector2d::Zero();
+        Eigen::Matrix2d sumSrcDst = Eigen::Matrix2d::Zero();
+        // Point to plane
+        Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d b = Eigen::Vector3d::Zero();
+
+        uint32_t numCorrespondences = 0;
+        for (uint32_t i = 0; i < centroids.size(); i++) {
+            const Eigen::Vector3f & point = centroids[i];
+            const Eigen::Vector3f src(cosYaw * point[0] - sinYaw * point[1] + tx,
+                                      sinYaw * point[0] + cosYaw * point[1] + ty,
+                                      point[2]);
+
+            int32_t idx;
+            if (! findCorrespondence(src, idx))
+                continue;
+
+            const Eigen::Vector3f & dst = m_lastCentroids[idx];
+
+            if (m_metric == REGISTRATION_POINT_TO_PLANE) {
+                if (! m_lastValidNormals[idx])
+                    continue;
+
+                const Eigen::Vector2f & normal = m_lastNormals[idx];
+                const double residual = normal.dot((src - dst).head<2>());
+                const Eigen::Vector3d J(normal[0], normal[1], normal[1] * src[0] - normal[0] * src[1]);
+
+                A += J * J.transpose();
+                b += J * residual;
+            } else {
+                const Eigen::Vector2d s = src.head<2>().cast<double>();
+                const Eigen::Vector2d d = dst.head<2>().cast<double>();
+                sumSrc += s;
+                sumDst += d;
+                sumSrcDst += s * d.transpose();
+            }
+
+            numCorrespondences++;
+        }
+
+        m_numCorrespondences = numCorrespondences;
+        if (numCorrespondences < m_minCorrespondences)
+            break;
+
+        double deltaYaw, deltaX, deltaY;
+        if (m_metric == REGISTRATION_POINT_TO_PLANE) {
+            const Eigen::Vector3d x = A.ldlt().solve(-b);
+            deltaX = x[0];
+            deltaY = x[1];
+            deltaYaw = x[2];
+        } else {
+            const Eigen::Vector2d meanSrc = sumSrc / numCorrespondences;
+            const Eigen::Vector2d meanDst = sumDst / numCorrespondences;
+            const Eigen::Matrix2d H = sumSrcDst / numCorrespondences - meanSrc * meanDst.transpose();
+
+            deltaYaw = atan2(H(0, 1) - H(1, 0), H(0, 0) + H(1, 1));
+            deltaX = meanDst[0] - (cos(deltaYaw) * meanSrc[0] - sin(deltaYaw) * meanSrc[1]);
+            deltaY = meanDst[1] - (sin(deltaYaw) * meanSrc[0] + cos(deltaYaw) * meanSrc[1]);
+        }
+
+        // The increment is composed on the left of the current estimation
+        const double newTx = cos(deltaYaw) * tx - sin(deltaYaw) * ty + deltaX;
+        const double newTy = sin(deltaYaw) * tx + cos(deltaYaw) * ty + deltaY;
+        tx = newTx;
+        ty = newTy;
+        yaw = atan2(sin(yaw + deltaYaw), cos(yaw + deltaYaw));
+
+        converged = (fabs(deltaYaw) < m_rotationEpsilon) &&
+                    (sqrt(deltaX * deltaX + deltaY * deltaY) < m_translationEpsilon);
+
+        motion.valid = true;
+    }
+
+    if (m_numCorrespondences < m_minCorrespondences)
+        motion.valid = false;
+
+    if (motion.valid) {
+        motion.deltaX = tx;
+        motion.deltaY = ty;
+        motion.deltaYaw = yaw;
+    }
+
+    setReference(centroids);
+
+    return motion.valid;
+}
+
+}
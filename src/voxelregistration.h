@@ -0,0 +1,86 @@
+/*
+ *  Copyright 2013 Néstor Morales Hernández <nestor@isaatc.ull.es>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef VOXELREGISTRATION_H
+#define VOXELREGISTRATION_H
+
+#include "params_structs.h"
+
+#include <boost/multi_array.hpp>
+
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+namespace voxel_odometry {
+
+typedef std::vector< Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > CentroidList;
+
+/**
+ * Scan to scan registration between the voxel centroids of two consecutive frames.
+ * The motion is estimated in SE(2), since the vehicle moves in the plane. Correspondences
+ * are looked up in the voxel grid of the previous frame, within ceil(maxCorrespondenceDistance / 
+ * cellSize) cells along each axis, instead of using a Kd-tree.
+ */
+class VoxelRegistration
+{
+public:
+    VoxelRegistration(const RegistrationMetric & metric, const uint32_t & maxIterations,
+                      const double & maxCorrespondenceDistance, const uint32_t & minCorrespondences,
+                      const double & translationEpsilon, const double & rotationEpsilon);
+
+    void setGridGeometry(const float & minX, const float & minY, const float & minZ,
+                         const float & cellSizeX, const float & cellSizeY, const float & cellSizeZ,
+                         const uint32_t & dimX, const uint32_t & dimY, const uint32_t & dimZ);
+
+    bool align(const CentroidList & centroids, const t_ego_motion & initialGuess,
+               const double & deltaTime, t_ego_motion & motion);
+
+    uint32_t iterations() const { return m_iterations; }
+    uint32_t numCorrespondences() const { return m_numCorrespondences; }
+
+protected:
+    typedef boost::multi_array<int32_t, 3> IndexGrid;
+
+    void setReference(const CentroidList & centroids);
+    bool findCorrespondence(const Eigen::Vector3f & point, int32_t & idx) const;
+    bool toGrid(const Eigen::Vector3f & point, int32_t & x, int32_t & y, int32_t & z) const;
+
+    RegistrationMetric m_metric;
+    uint32_t m_maxIterations;
+    float m_maxCorrespondenceDistance;
+    uint32_t m_minCorrespondences;
+    double m_translationEpsilon, m_rotationEpsilon;
+
+    float m_minX, m_minY, m_minZ;
+    float m_cellSizeX, m_cellSizeY, m_cellSizeZ;
+    uint32_t m_dimX, m_dimY, m_dimZ;
+
+    // Previous frame: centroids, normals in the XY plane and their position in the grid
+    CentroidList m_lastCentroids;
+    std::vector<Eigen::Vector2f, Eigen::aligned_allocator<Eigen::Vector2f> > m_lastNormals;
+    std::vector<bool> m_lastValidNormals;
+    IndexGrid m_lastIndexes;
+    std::vector<int32_t> m_lastCells;
+
+    uint32_t m_iterations;
+    uint32_t m_numCorrespondences;
+};
+
+}
+
+#endif // VOXELREGISTRATION_H